@@ -316,10 +316,11 @@ function test()
 end
 
 canyon = nil
+terrain = nil
 
 function start()
 	fx.preload()
-	canyon = vcanyon_create(engine, scene)
+	canyon, terrain = vcanyon_create(engine, scene)
 
 	test()
 
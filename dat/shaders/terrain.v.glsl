@@ -5,11 +5,12 @@ precision highp float;
 
 //#define NORMAL_MAPPING
 
-// Attributes
-attribute vec4 position;
-attribute vec4 normal;
-attribute vec2 uv;
+// Attributes - a packed terrainVertex (see src/terrain/vertex.h), as the raw integers
+attribute vec4 position;		// Quantised in xyz; texture_v's half in w
+attribute vec4 normal;			// Octahedral, as two snorm16s in xy
+attribute vec2 uv;				// Halfs
 attribute vec4 color;
+attribute vec3 morph_target;	// Where this vertex lies on the next coarser LOD
 
 // Varying
 varying vec4 frag_position;
@@ -36,6 +37,27 @@ uniform vec4 fog_color;
 uniform vec4 sun_color;
 uniform vec4 viewspace_up;
 uniform vec4 directional_light_direction;
+uniform float morph;			// 0 for this block's own LOD, 1 for the next coarser
+uniform vec4 vertex_origin;		// The block's terrainVertexFrame
+uniform vec4 vertex_scale;
+uniform vec4 vertex_uv_origin;	// uv in xy, texture_v in z
+
+// A half from its bits, which a float holds exactly (GLSL ES 1.00 has no bit operations)
+float half_toFloat( float h ) {
+	float s = h < 32768.0 ? 1.0 : -1.0;
+	h = mod( h, 32768.0 );
+	float e = floor( h / 1024.0 );
+	float m = h - e * 1024.0;
+	return s * ( e == 0.0 ? m * exp2( -24.0 ) : ( 1.0 + m / 1024.0 ) * exp2( e - 15.0 ));
+}
+
+vec3 octNormal_decode( vec2 e ) {
+	vec2 n = max( e / 32767.0, -1.0 );
+	float z = 1.0 - abs( n.x ) - abs( n.y );
+	if ( z < 0.0 )
+		n = ( 1.0 - abs( n.yx )) * vec2( n.x < 0.0 ? -1.0 : 1.0, n.y < 0.0 ? -1.0 : 1.0 );
+	return normalize( vec3( n, z ));
+}
 
 float sun_fog( vec4 local_sun_dir, vec4 view_direction ) {
 	return clamp( dot( local_sun_dir, view_direction ), 0.0, 1.0 );
@@ -51,15 +73,19 @@ float sun( vec4 sunDir, vec4 fragPosition ) {
 }
 
 void main() {
-	gl_Position = projection * modelview * position;
+	vec3 local = vertex_origin.xyz + position.xyz * vertex_scale.xyz;
+	vec4 morphed = vec4( mix( local, morph_target, morph ), 1.0 );
+	gl_Position = projection * modelview * morphed;
 	screenCoord = (gl_Position.xy / gl_Position.w) * 0.5 + vec2(0.5, 0.5);
-	frag_position = modelview * position;
-	vec4 n = vec4( normal.xyz, 0.0 );
+	frag_position = modelview * morphed;
+	vec4 n = vec4( octNormal_decode( normal.xy ), 0.0 );
 	cameraSpace_frag_normal = modelview * n;
 	frag_normal = n;
-	texcoord = vec2(uv.x, normal.w);
-	cliff_texcoord = vec2( normal.w, uv.y );
-	cliff_texcoord_b = uv.xy;
+	float texture_v = half_toFloat( position.w ) + vertex_uv_origin.z;
+	vec2 texture_uv = vec2( half_toFloat( uv.x ), half_toFloat( uv.y )) + vertex_uv_origin.xy;
+	texcoord = vec2( texture_uv.x, texture_v );
+	cliff_texcoord = vec2( texture_v, texture_uv.y );
+	cliff_texcoord_b = texture_uv;
 
 	vert_color = vec4( color.xyz, 1.0 );
 	
@@ -77,7 +103,7 @@ void main() {
 	float distant_fog_far		= 700.0;
 	float distant_fog_distance	= 100.0; // distant_fog_far - distant_fog_near
 
-	float height_factor = clamp( ( fog_height - (position.y + fog_height_offset) ) / fog_height, 0.0, 1.0 );
+	float height_factor = clamp( ( fog_height - (morphed.y + fog_height_offset) ) / fog_height, 0.0, 1.0 );
 	//float height_factor = 0.0;
 	float distance = sqrt( frag_position.z * frag_position.z + frag_position.x * frag_position.x );
 	float near_fog = min(( distance - fog_near ) / fog_distance, fog_max ) * height_factor;
@@ -0,0 +1,2 @@
+(shader (vertex "dat/shaders/terrain_depth.v.glsl")
+				(fragment "dat/shaders/depth_pass.f.glsl"))
@@ -0,0 +1,21 @@
+//#version 110
+
+#ifdef GL_ES
+precision highp float;
+#endif
+
+// Depth pass for terrain, whose vertices are packed; see terrain.v.glsl
+// Attributes
+attribute vec4 position;		// Quantised in xyz
+attribute vec3 morph_target;	// Where this vertex lies on the next coarser LOD
+
+uniform mat4 projection;
+uniform mat4 modelview;
+uniform float morph;
+uniform vec4 vertex_origin;
+uniform vec4 vertex_scale;
+
+void main() {
+	vec3 local = vertex_origin.xyz + position.xyz * vertex_scale.xyz;
+	gl_Position = projection * modelview * vec4( mix( local, morph_target, morph ), 1.0 );
+}
@@ -107,6 +107,11 @@ actorSystem* actorSystemCreate() {
 	return a;
 }
 
+void actorSystemDelete( actorSystem* system ) {
+	vAssert( system->count == 0 );
+	mem_free( system );
+}
+
 bool msgPending( ActorRef a ) {
 	bool b = false;
 	actorLock( a ); {
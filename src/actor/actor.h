@@ -11,6 +11,8 @@ struct actorSystem_s {
 };
 
 actorSystem* actorSystemCreate();
+// Every actor must have been stopped, and no task still queued to run the system
+void actorSystemDelete( actorSystem* system );
 
 // Send a message to an Actor
 void tell( ActorRef a, Msg m );
@@ -0,0 +1,24 @@
+// bench.c
+#include "common.h"
+#include "bench.h"
+//---------------------
+#include <time.h>
+
+#if UNIT_TEST
+
+double bench_seconds() {
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return (double)t.tv_sec + (double)t.tv_nsec * 0.000000001;
+}
+
+void bench_report( const char* name, long long operations, double seconds ) {
+	printf( "[ %sBench%s ]\t%s: %lld ops in %.3fs (%.0f ops/s)\n", TERM_GREEN, TERM_WHITE, name, operations, seconds, (double)operations / seconds );
+}
+
+int bench_compareDoubles( const void* a, const void* b ) {
+	const double da = *(const double*)a, db = *(const double*)b;
+	return da < db ? -1 : ( da > db ? 1 : 0 );
+}
+
+#endif // UNIT_TEST
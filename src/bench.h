@@ -0,0 +1,13 @@
+// bench.h
+#pragma once
+
+#if UNIT_TEST
+// Wall-clock time in seconds, at a resolution suitable for timing benchmark loops
+double bench_seconds();
+
+// Print a benchmark result as operations per second
+void bench_report( const char* name, long long operations, double seconds );
+
+// qsort comparator, for taking percentiles of timings
+int bench_compareDoubles( const void* a, const void* b );
+#endif // UNIT_TEST
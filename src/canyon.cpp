@@ -2,6 +2,8 @@
 #include "common.h"
 #include "canyon.h"
 //-----------------------
+#include "bench.h"
+#include "test.h"
 #include "vtime.h"
 #include "base/window_buffer.h"
 #include "maths/geometry.h"
@@ -9,6 +11,7 @@
 #include "maths/vector.h"
 #include "render/debugdraw.h"
 #include "render/render.h"
+#include "system/thread.h"
 #include "terrain/cache.h"
 
 // *** New Terrain Canyon
@@ -45,6 +48,7 @@ vector terrain_newCanyonPoint( vector current, vector previous );
 
 void canyon_seedRandom( long int seed ) { deterministic_seedRandSeq( seed, &canyon_random_seed ); }
 void canyon_staticInit() { canyon_seedRandom( initial_seed ); }
+long int canyon_seed() { return initial_seed; }
 
 // Returns a point from the buffer that corresponds to absolute stream position STREAM_INDEX
 static inline vector canyon_point( window_buffer* buffer, size_t stream_index ) {
@@ -52,11 +56,6 @@ static inline vector canyon_point( window_buffer* buffer, size_t stream_index )
 	return canyonBuffer_point( buffer, mapped_index );
 }
 
-static inline vector cached_point_normal( window_buffer* buffer, size_t stream_index ) {
-	size_t mapped_index = windowBuffer_mappedPosition( buffer, stream_index );
-	return canyonBuffer_normal( buffer, mapped_index );
-}
-
 vector segmentNormal( vector from, vector to ) {
 	vector segment = vector_sub( to, from );
 	return normalized(Vector( -segment.coord.z, 0.f, segment.coord.x, 0.f ));
@@ -108,6 +107,73 @@ void canyonBuffer_seekForward( canyon* c, size_t seek_position ) {
 	canyonBuffer_generatePoints( c, from, to );
 }
 
+// *** Snapshots
+
+const float max_perpendicular_u = 100.f;
+
+canyonSnapshot* canyonSnapshot_create( window_buffer* b ) {
+	canyonSnapshot* s = (canyonSnapshot*)mem_alloc( sizeof( canyonSnapshot ));
+	s->refCount.store( 1, std::memory_order_relaxed );
+	s->head = b->head;
+	s->stream_position = b->stream_position;
+	memcpy( (void*)s->points, b->elements, sizeof( s->points ));
+	for ( size_t i = 0; i < MaxCanyonPoints; ++i ) {
+		const vector p = s->points[windowBuffer_mappedPosition( b, b->stream_position + i )].point;
+		s->x[i] = p.coord.x;
+		s->z[i] = p.coord.z;
+	}
+	for ( size_t i = 0; i < MaxCanyonPoints; ++i ) {
+		const size_t next = windowBuffer_index( b, i + 1 );
+		canyonSegment* segment = &s->segments[i];
+		segment->start = s->points[i].point;
+		segment->end = s->points[next].point;
+		vector a = vector_scaled( s->points[i].normal, max_perpendicular_u );
+		Add( &segment->target_start, &segment->start, &a );
+		vector b = vector_scaled( s->points[next].normal, max_perpendicular_u );
+		Add( &segment->target_end, &segment->end, &b );
+	}
+	return s;
+}
+
+void canyonSnapshot_release( canyonSnapshot* s ) {
+	const int previous = s->refCount.fetch_sub( 1, std::memory_order_acq_rel );
+	vAssert( previous > 0 );
+	if ( previous == 1 )
+		cache_retire( s );
+}
+
+// Fails once the last ref has gone, so a retired snapshot is never revived
+bool canyonSnapshot_tryTakeRef( canyonSnapshot* s ) {
+	int refs = s->refCount.load( std::memory_order_relaxed );
+	while ( refs > 0 )
+		if ( s->refCount.compare_exchange_weak( refs, refs + 1, std::memory_order_acq_rel ))
+			return true;
+	return false;
+}
+
+canyonSnapshot* canyon_snapshot( canyon* c ) {
+	while ( true ) {
+		const unsigned epoch = cacheEpoch_pin();
+		canyonSnapshot* s = c->snapshot.load( std::memory_order_acquire );
+		const bool taken = canyonSnapshot_tryTakeRef( s );
+		cacheEpoch_unpin( epoch );
+		// The canyon only drops its ref after publishing a newer snapshot, so a retry finds that one
+		if ( taken )
+			return s;
+	}
+}
+
+// Main thread; called whenever the window has moved
+void canyon_publishSnapshot( canyon* c ) {
+	window_buffer* b = c->canyon_streaming_buffer;
+	canyonSnapshot* old = c->snapshot.load( std::memory_order_relaxed );
+	if ( old && old->head == b->head && old->stream_position == b->stream_position )
+		return;
+	c->snapshot.store( canyonSnapshot_create( b ), std::memory_order_release );
+	if ( old )
+		canyonSnapshot_release( old );
+}
+
 // Seek the canyon window_buffer so that its stream_position is now SEEK_POSITION - can seek forwards or backwards
 void canyonBuffer_seek( canyon* c, size_t seek_position ) {
 	window_buffer* b = c->canyon_streaming_buffer;
@@ -116,6 +182,7 @@ void canyonBuffer_seek( canyon* c, size_t seek_position ) {
 		canyon_generateInitialPoints( c );
 	}
 	canyonBuffer_seekForward( c, seek_position );
+	canyon_publishSnapshot( c );
 }
 
 
@@ -127,80 +194,103 @@ float canyon_v( int segment_index, float segment_prog ) {
 	return ( segment_prog + (float)segment_index ) * CanyonSegmentLength;
 }
 
-// Estimate the closest z point, based on an even distribution of Zs
-int canyon_estimatePointForZ( window_buffer* buffer, float z ) {
-	float min_z = canyonBuffer_point( buffer, buffer->head ).coord.z;
-	float max_z = canyonBuffer_point( buffer, buffer->tail ).coord.z;
-	return (int)( fclamp(( z - min_z ) / ( max_z - min_z ), 0.f, 1.f ) * (float)buffer->window_size ) + buffer->stream_position;
+/* Canyon points always advance in Z, so the snapshot keeps their Xs and Zs in stream order and the closest
+   point is found by searching on Z: find where the query's Z falls, then widen out either side only while a
+   point's Z alone is closer than the best found. Segments are at least CanyonSegmentLength * sin(PI/4) apart
+   in Z, so that is a handful of points however long the window */
+
+// Stream-order slot of the first point at or beyond Z in [LO, HI], or HI + 1; binary search between bounds
+int canyonSnapshot_searchZ( const canyonSnapshot* s, float z, int lo, int hi ) {
+	int count = hi - lo + 1;
+	while ( count > 0 ) {
+		const int step = count / 2;
+		if ( s->z[lo + step] < z ) {
+			lo += step + 1;
+			count -= step + 1;
+		}
+		else
+			count = step;
+	}
+	return lo;
 }
 
-int canyon_findStartZ( canyon* c, int default_start, float z, float closest_d, int closest_i ) {
-	// Then walk backwards until the earliest possible Z
-	float earliest_z = z - sqrt( closest_d );
-	int start = closest_i;
-	float current_z = canyon_point( c->canyon_streaming_buffer, start ).coord.z;
-	// TODO - just binary search this?
-	while ( current_z > earliest_z && start > default_start ) {
-		int min_delta = (int)fmax( 1.f, ( current_z - earliest_z ) / CanyonSegmentLength );
-		start = max( start - min_delta, default_start );
-		vAssert( start >= default_start );
-		current_z = canyon_point( c->canyon_streaming_buffer, start ).coord.z;
+// As above, galloping out from slot HINT so nearby queries cost log of the distance moved
+int canyonSnapshot_searchZFrom( const canyonSnapshot* s, float z, int lo, int hi, int hint ) {
+	if ( s->z[hint] < z ) {
+		int step = 1;
+		while ( hint + step <= hi && s->z[hint + step] < z )
+			step *= 2;
+		return canyonSnapshot_searchZ( s, z, hint + step / 2 + 1, min( hint + step, hi ));
 	}
-	return start;
+	int step = 1;
+	while ( hint - step >= lo && s->z[hint - step] >= z )
+		step *= 2;
+	return canyonSnapshot_searchZ( s, z, max( hint - step, lo ), hint - step / 2 );
 }
 
-// Convert world-space X and Z coords into canyon space U and V
-int canyon_findClosestPoint( canyon* c, float x, float z ) {
-	vector point = Vector( x, 0.f, z, 1.f );
-	int closest_i = 0;	// Closest point - in absolute stream position
-	float closest_d = FLT_MAX;
-	// We need to find the closest segment
-	int default_start = c->canyon_streaming_buffer->stream_position + 1;
-	int default_end = c->canyon_streaming_buffer->stream_position + c->canyon_streaming_buffer->window_size;
+int canyonSnapshot_closestPoint( const canyonSnapshot* s, float x, float z, int hint ) {
+	// The first and last points are left out, so the segments either side of the result both exist
+	const int lo = 1, hi = MaxCanyonPoints - 2;
+	const int slot = hint - (int)s->stream_position;
+	const int found = ( slot >= lo && slot <= hi ) ? canyonSnapshot_searchZFrom( s, z, lo, hi, slot ) : canyonSnapshot_searchZ( s, z, lo, hi );
 
-	// Estimate the closest z point, based on an even distribution of Zs
-	// initialize the closest distance from that
-	closest_i = max( c->canyon_streaming_buffer->stream_position + 1, canyon_estimatePointForZ( c->canyon_streaming_buffer, z ));
-	vector closest_point = canyon_point( c->canyon_streaming_buffer, closest_i );
-	vector displacement = vector_sub( point, closest_point );
-	closest_d = vector_lengthSq( &displacement );
-
-	// Then walk backwards until the earliest possible Z
-	int start = canyon_findStartZ( c, default_start, z, closest_d, closest_i );
-	int end = default_end;
-
-	// Iterate from there
-	for ( size_t i = (size_t)start; i + 1 < (size_t)end; ++i ) {
-		vector test_point = canyon_point( c->canyon_streaming_buffer, i );
-		
-		// We know that Z values are always increasing as we force canyon segments in the forward arc
-		// If the distance from Z-component alone is greater than closest, we can break out of the loop
-		// as all later points must be at least that far away
-		// * Use fabsf on one argument to preserve the sign of the square
-		if ( fabsf(test_point.coord.z - point.coord.z) * (test_point.coord.z - point.coord.z) > closest_d ) {
-			//printf( "Finishing canyon point test at index %d, skipping %d, total %d.\n", (int)i, (int)(end - i), (int)(end - start));
+	int closest = -1;
+	float closest_d = FLT_MAX;
+	for ( int i = found - 1; i >= lo; --i ) {
+		const float dz = z - s->z[i];
+		if ( dz * dz > closest_d )
 			break;
+		const float dx = x - s->x[i];
+		const float d = dx * dx + dz * dz;
+		if ( d <= closest_d ) { // Walking backwards, so ties go to the earlier point
+			closest_d = d;
+			closest = i;
 		}
-
-		// TODO - do we skip everything behind or have we already done that?
-		vector displacement = vector_sub( point, test_point );
-		float d = vector_lengthSq( &displacement );
+	}
+	for ( int i = found; i <= hi; ++i ) {
+		const float dz = s->z[i] - z;
+		if ( dz * dz > closest_d )
+			break;
+		const float dx = x - s->x[i];
+		const float d = dx * dx + dz * dz;
 		if ( d < closest_d ) {
 			closest_d = d;
-			closest_i = i;
+			closest = i;
 		}
 	}
-	return closest_i;
+	return closest + (int)s->stream_position;
 }
 
-void canyonSpaceFromWorld( canyon* c, float x, float z, float* u, float* v ) {
-	int closest_i = canyon_findClosestPoint( c, x, z );
+void canyonSnapshot_closestPoints( const canyonSnapshot* s, const float* x, const float* z, int* closest, int n ) {
+	int hint = -1;
+	for ( int i = 0; i < n; ++i )
+		hint = closest[i] = canyonSnapshot_closestPoint( s, x[i], z[i], hint );
+}
+
+// Closest canyon point to world-space X and Z, as an absolute stream position
+int canyon_findClosestPoint( canyon* c, float x, float z ) {
+	const unsigned epoch = cacheEpoch_pin();
+	const canyonSnapshot* s = c->snapshot.load( std::memory_order_acquire );
+	const int closest = canyonSnapshot_closestPoint( s, x, z, c->closest_hint.load( std::memory_order_relaxed ));
+	cacheEpoch_unpin( epoch );
+	c->closest_hint.store( closest, std::memory_order_relaxed );
+	return closest;
+}
+
+const canyonSegment* canyonSnapshot_segment( const canyonSnapshot* s, int stream_index ) {
+	return &s->segments[( (size_t)stream_index - s->stream_position + s->head ) % MaxCanyonPoints];
+}
+
+// Canyon space from world space, given the closest canyon point
+static void canyonSnapshot_canyonSpaceFrom( const canyonSnapshot* s, int closest_i, float x, float z, float* u, float* v ) {
 	vector point = Vector( x, 0.f, z, 1.f );
 
 	// find closest points on the two segments using that point
 	vector closest_a, closest_b;
-	float seg_pos_a = segment_closestPoint( canyon_point( c->canyon_streaming_buffer, closest_i ), canyon_point( c->canyon_streaming_buffer, closest_i+1 ), point, &closest_a );
-	float seg_pos_b = segment_closestPoint( canyon_point( c->canyon_streaming_buffer, closest_i-1 ), canyon_point( c->canyon_streaming_buffer, closest_i ), point, &closest_b );
+	const canyonSegment* a = canyonSnapshot_segment( s, closest_i );
+	const canyonSegment* b = canyonSnapshot_segment( s, closest_i - 1 );
+	float seg_pos_a = segment_closestPoint( a->start, a->end, point, &closest_a );
+	float seg_pos_b = segment_closestPoint( b->start, b->end, point, &closest_b );
 	// use the closest
 	float length_a = vector_lengthI( vector_sub( point, closest_a ));
 	float length_b = vector_lengthI( vector_sub( point, closest_b ));
@@ -209,57 +299,64 @@ void canyonSpaceFromWorld( canyon* c, float x, float z, float* u, float* v ) {
 	*v = ( length_a < length_b ) ? canyon_v( closest_i, seg_pos_a ) : canyon_v( closest_i - 1, seg_pos_b );
 }
 
+void canyonSpaceFromWorld( canyon* c, float x, float z, float* u, float* v ) {
+	const unsigned epoch = cacheEpoch_pin();
+	const canyonSnapshot* s = c->snapshot.load( std::memory_order_acquire );
+	int closest_i = canyonSnapshot_closestPoint( s, x, z, c->closest_hint.load( std::memory_order_relaxed ));
+	c->closest_hint.store( closest_i, std::memory_order_relaxed );
+	canyonSnapshot_canyonSpaceFrom( s, closest_i, x, z, u, v );
+	cacheEpoch_unpin( epoch );
+}
+
+void canyonSpaceFromWorldBatch( canyon* c, const float* x, const float* z, float* u, float* v, int n ) {
+	if ( n <= 0 )
+		return;
+	int* closest = (int*)mem_alloc( sizeof( int ) * n );
+	const unsigned epoch = cacheEpoch_pin();
+	const canyonSnapshot* s = c->snapshot.load( std::memory_order_acquire );
+	canyonSnapshot_closestPoints( s, x, z, closest, n );
+	for ( int i = 0; i < n; ++i )
+		canyonSnapshot_canyonSpaceFrom( s, closest[i], x[i], z[i], &u[i], &v[i] );
+	cacheEpoch_unpin( epoch );
+	c->closest_hint.store( closest[n - 1], std::memory_order_relaxed );
+	mem_free( closest );
+}
+
 int terrainCanyon_segmentAtDistance( float v ) {
 	return (float)floorf(v / CanyonSegmentLength);
 }
 
 // Convert canyon-space U and V coords into world space X and Z
-void terrain_worldSpaceFromCanyon( canyon* c, float u, float v, float* x, float* z ) {
-	vmutex_lock( &terrainMutex ); {
+void canyonSnapshot_worldSpaceFromCanyon( const canyonSnapshot* s, float u, float v, float* x, float* z ) {
 	int i = max(0, terrainCanyon_segmentAtDistance( v ));
 	float segment_position = ( v - (float)i * CanyonSegmentLength ) / CanyonSegmentLength; 
 	
 	// For this segment
-	vector canyon_next = canyon_point( c->canyon_streaming_buffer, i + 1 );
-	// TODO - pull down points and normals together for i -> i+1
-	vector canyon_previous = canyon_point( c->canyon_streaming_buffer, i );
-	vector canyon_position = vector_lerp( &canyon_previous, &canyon_next, segment_position );
+	const canyonSegment* segment = canyonSnapshot_segment( s, i );
+	vector canyon_position = vector_lerp( &segment->start, &segment->end, segment_position );
 
 	/* We use a warped grid system, where near the canyon the U-axis lines run perpendicular to the canyon
 	   but further away (more than max_perpendicular_u) they run parallel to the X axis.
 	   This is to prevent overlapping artifacts in the terrain generation.
 	   We actually lerp the perpendicular U-axis lines to blend from the previous and next segements
 	   to prevent overlapping.  */
-
-	// Begin and end vectors for tweening the normal
-	vector normal_begin = cached_point_normal( c->canyon_streaming_buffer, i + 0); // Incremented again because point normals trail behind now
-	vector normal_end = cached_point_normal( c->canyon_streaming_buffer, i + 1 );
-
-	const float max_perpendicular_u = 100.f;
-	// TODO - Try pointer versions?
-	//vector target_begin = vector_add( canyon_previous, vector_scaled( normal_begin, max_perpendicular_u ));
-	//vector target_end = vector_add( canyon_next, vector_scaled( normal_end, max_perpendicular_u ));
-	vector target_begin, target_end;
-	vector a = vector_scaled( normal_begin, max_perpendicular_u );
-   	Add( &target_begin, &canyon_previous, &a );
-	vector b = vector_scaled( normal_end, max_perpendicular_u );
-	Add( &target_end, &canyon_next, &b );
-	vector target = vector_lerp( &target_begin, &target_end, segment_position );
+	vector target = vector_lerp( &segment->target_start, &segment->target_end, segment_position );
 	vector sampled_normal = normalized( vector_sub( target, canyon_position ));
-	
-
-
-
 
 	// What am I doing here? Ah - it's because after so far out (max_perp) we switch back to U-as-X axis)
 	float perpendicular_u = fclamp( u, -max_perpendicular_u, max_perpendicular_u );
 	vector u_offset = vector_scaled( sampled_normal, perpendicular_u );
-	//vector flat_u_offset = Vector( perpendicular_u - u, 0.f, 0.f, 0.f );
 	u_offset.coord.x += perpendicular_u - u;
 	vector position = vector_add( canyon_position, u_offset);
 	*x = position.coord.x;
 	*z = position.coord.z; 
-	} vmutex_unlock( &terrainMutex );
+}
+
+// Workers call this while the main thread may be moving the window, so sample the current snapshot
+void terrain_worldSpaceFromCanyon( canyon* c, float u, float v, float* x, float* z ) {
+	const unsigned epoch = cacheEpoch_pin();
+	canyonSnapshot_worldSpaceFromCanyon( c->snapshot.load( std::memory_order_acquire ), u, v, x, z );
+	cacheEpoch_unpin( epoch );
 }
 
 vector terrain_newCanyonPoint( vector current, vector previous ) {
@@ -324,9 +421,11 @@ canyonData* canyon_sample( canyon* c, int index ) {
 
 canyon* canyon_create( scene* s, const char* file ) {
 	canyon* c = (canyon*)mem_alloc( sizeof( canyon ));
-	memset( c, 0, sizeof( canyon ));
+	memset( (void*)c, 0, sizeof( canyon ));
 	c->_scene = s;
-	canyonZone_load( c, file );
+	// No zone file for headless use (tests and benchmarks), as zones pull in textures
+	if ( file )
+		canyonZone_load( c, file );
 	c->canyon_streaming_buffer = window_bufferCreate( sizeof( canyonData ), MaxCanyonPoints );
 	c->cache = terrainCache_create();
 	canyon_generateInitialPoints( c );
@@ -334,6 +433,16 @@ canyon* canyon_create( scene* s, const char* file ) {
 	return c;
 }
 
+void canyon_delete( canyon* c ) {
+	vAssert( c->zone_count == 0 );
+	// Released first, so the cache's last epoch advances free it too
+	canyonSnapshot_release( c->snapshot.load( std::memory_order_relaxed ));
+	terrainCache_delete( c->cache );
+	mem_free( c->canyon_streaming_buffer->elements );
+	mem_free( c->canyon_streaming_buffer );
+	mem_free( c );
+}
+
 void canyon_test() {
 	canyon* c = canyon_create( NULL, "dat/script/lisp/canyon_zones.s");
 	canyon_seekForWorldPosition(c, Vector( 0.f, 0.f, 0.f, 1.f ));
@@ -386,3 +495,285 @@ void canyon_debugPrint( canyon* c ) {
 		printf( "%d : %.2f, %.2f\n", i, v.coord.x, v.coord.z );
 	}
 }
+
+#if UNIT_TEST
+// Estimate the closest z point, based on an even distribution of Zs
+int canyon_estimatePointForZ( window_buffer* buffer, float z ) {
+	float min_z = canyonBuffer_point( buffer, buffer->head ).coord.z;
+	float max_z = canyonBuffer_point( buffer, buffer->tail ).coord.z;
+	return (int)( fclamp(( z - min_z ) / ( max_z - min_z ), 0.f, 1.f ) * (float)buffer->window_size ) + buffer->stream_position;
+}
+
+int canyon_findStartZ( canyon* c, int default_start, float z, float closest_d, int closest_i ) {
+	// Then walk backwards until the earliest possible Z
+	float earliest_z = z - sqrt( closest_d );
+	int start = closest_i;
+	float current_z = canyon_point( c->canyon_streaming_buffer, start ).coord.z;
+	// TODO - just binary search this?
+	while ( current_z > earliest_z && start > default_start ) {
+		int min_delta = (int)fmax( 1.f, ( current_z - earliest_z ) / CanyonSegmentLength );
+		start = max( start - min_delta, default_start );
+		vAssert( start >= default_start );
+		current_z = canyon_point( c->canyon_streaming_buffer, start ).coord.z;
+	}
+	return start;
+}
+
+// The previous lookup: estimate a start from Z, walk back, then scan forward
+int canyon_findClosestPointScan( canyon* c, float x, float z ) {
+	vector point = Vector( x, 0.f, z, 1.f );
+	int closest_i = 0;	// Closest point - in absolute stream position
+	float closest_d = FLT_MAX;
+	// We need to find the closest segment
+	int default_start = c->canyon_streaming_buffer->stream_position + 1;
+	int default_end = c->canyon_streaming_buffer->stream_position + c->canyon_streaming_buffer->window_size;
+
+	// Estimate the closest z point, based on an even distribution of Zs
+	// initialize the closest distance from that
+	closest_i = max( c->canyon_streaming_buffer->stream_position + 1, canyon_estimatePointForZ( c->canyon_streaming_buffer, z ));
+	vector closest_point = canyon_point( c->canyon_streaming_buffer, closest_i );
+	vector displacement = vector_sub( point, closest_point );
+	closest_d = vector_lengthSq( &displacement );
+
+	// Then walk backwards until the earliest possible Z
+	int start = canyon_findStartZ( c, default_start, z, closest_d, closest_i );
+	int end = default_end;
+
+	// Iterate from there
+	for ( size_t i = (size_t)start; i + 1 < (size_t)end; ++i ) {
+		vector test_point = canyon_point( c->canyon_streaming_buffer, i );
+		
+		// We know that Z values are always increasing as we force canyon segments in the forward arc
+		// If the distance from Z-component alone is greater than closest, we can break out of the loop
+		// as all later points must be at least that far away
+		// * Use fabsf on one argument to preserve the sign of the square
+		if ( fabsf(test_point.coord.z - point.coord.z) * (test_point.coord.z - point.coord.z) > closest_d ) {
+			//printf( "Finishing canyon point test at index %d, skipping %d, total %d.\n", (int)i, (int)(end - i), (int)(end - start));
+			break;
+		}
+
+		// TODO - do we skip everything behind or have we already done that?
+		vector displacement = vector_sub( point, test_point );
+		float d = vector_lengthSq( &displacement );
+		if ( d < closest_d ) {
+			closest_d = d;
+			closest_i = i;
+		}
+	}
+	return closest_i;
+}
+
+void test_canyonSnapshot() {
+	printf( "--- Beginning Unit Test: Canyon Snapshot ---\n" );
+	canyon* c = canyon_create( NULL, NULL );
+	canyonSnapshot* s = canyon_snapshot( c );
+	const float u = 35.f, v = 1234.5f;
+	float x, z, liveX, liveZ;
+	canyonSnapshot_worldSpaceFromCanyon( s, u, v, &x, &z );
+	terrain_worldSpaceFromCanyon( c, u, v, &liveX, &liveZ );
+	test( x == liveX && z == liveZ, "Snapshot samples match the live canyon", "Snapshot samples differ from the live canyon" );
+
+	// Move the window on; the held snapshot is untouched, and the new one still agrees where they overlap
+	canyonBuffer_seek( c, 10 );
+	float heldX, heldZ;
+	canyonSnapshot_worldSpaceFromCanyon( s, u, v, &heldX, &heldZ );
+	terrain_worldSpaceFromCanyon( c, u, v, &liveX, &liveZ );
+	test( c->snapshot.load() != s && heldX == x && heldZ == z && liveX == x && liveZ == z,
+			"Held snapshot survives the window moving", "Held snapshot changed when the window moved" );
+	test( s->refCount.load() == 1, "Superseded snapshot only held by its reader", "Superseded snapshot refs wrong" );
+	canyonSnapshot_release( s );
+	canyon_delete( c );
+}
+
+int canyon_findClosestPointBrute( const canyonSnapshot* s, float x, float z ) {
+	int closest = -1;
+	float closest_d = FLT_MAX;
+	for ( int i = 1; i <= MaxCanyonPoints - 2; ++i ) {
+		const float dx = x - s->x[i], dz = z - s->z[i];
+		const float d = dx * dx + dz * dz;
+		if ( d < closest_d ) {
+			closest_d = d;
+			closest = i;
+		}
+	}
+	return closest + (int)s->stream_position;
+}
+
+#define kClosestQueries 20000
+
+// Queries along the canyon, across it and well away from it, in order along the canyon
+void canyon_closestQueries( canyon* c, float* x, float* z, int n ) {
+	const float vStart = ( c->canyon_streaming_buffer->stream_position + 1 ) * CanyonSegmentLength;
+	const float vLength = ( MaxCanyonPoints - 3 ) * CanyonSegmentLength;
+	for ( int i = 0; i < n; ++i ) {
+		const float u = (float)(( i * 7919 ) % 1601 ) - 800.f;
+		const float v = vStart + vLength * (float)i / (float)n;
+		terrain_worldSpaceFromCanyon( c, u, v, &x[i], &z[i] );
+	}
+}
+
+void test_canyonClosestPoint() {
+	printf( "--- Beginning Unit Test: Canyon Closest Point ---\n" );
+	canyon* c = canyon_create( NULL, NULL );
+	canyonBuffer_seek( c, 7 ); // So the window doesn't start at the buffer's first slot
+	float* x = (float*)mem_alloc( sizeof( float ) * kClosestQueries );
+	float* z = (float*)mem_alloc( sizeof( float ) * kClosestQueries );
+	int* batch = (int*)mem_alloc( sizeof( int ) * kClosestQueries );
+	canyon_closestQueries( c, x, z, kClosestQueries );
+	// Some beyond either end of the window, too
+	x[0] = 300.f; z[0] = -5000.f;
+	x[1] = -2000.f; z[1] = 1e5f;
+
+	canyonSnapshot* s = canyon_snapshot( c );
+	canyonSnapshot_closestPoints( s, x, z, batch, kClosestQueries );
+	bool cold = true, warm = true, batched = true;
+	int hint = -1;
+	for ( int i = 0; i < kClosestQueries; ++i ) {
+		const int expected = canyon_findClosestPointBrute( s, x[i], z[i] );
+		cold = cold && canyonSnapshot_closestPoint( s, x[i], z[i], -1 ) == expected;
+		// Hints from anywhere in the window must still give the right answer, just more slowly
+		warm = warm && canyonSnapshot_closestPoint( s, x[i], z[i], hint ) == expected;
+		batched = batched && batch[i] == expected;
+		hint = expected + ( i % 5 ) * 13 - 20;
+	}
+	test( cold, "Closest point search matches brute force", "Closest point search differs from brute force" );
+	test( warm, "Warm-started closest point search matches brute force", "Warm-started closest point search differs from brute force" );
+	test( batched, "Batched closest point search matches brute force", "Batched closest point search differs from brute force" );
+	canyonSnapshot_release( s );
+	mem_free( x );
+	mem_free( z );
+	mem_free( batch );
+	canyon_delete( c );
+}
+
+#define kBenchClosestPasses 50
+
+void bench_canyonClosestPoint() {
+	canyon* c = canyon_create( NULL, NULL );
+	canyonBuffer_seek( c, 7 );
+	float* x = (float*)mem_alloc( sizeof( float ) * kClosestQueries );
+	float* z = (float*)mem_alloc( sizeof( float ) * kClosestQueries );
+	int* closest = (int*)mem_alloc( sizeof( int ) * kClosestQueries );
+	canyon_closestQueries( c, x, z, kClosestQueries );
+	canyonSnapshot* s = canyon_snapshot( c );
+	const long long queries = (long long)kClosestQueries * kBenchClosestPasses;
+	long long check = 0;
+
+	double start = bench_seconds();
+	for ( int pass = 0; pass < kBenchClosestPasses; ++pass )
+		for ( int i = 0; i < kClosestQueries; ++i )
+			check += canyon_findClosestPointBrute( s, x[i], z[i] );
+	bench_report( "canyon closest point (brute force)", queries, bench_seconds() - start );
+
+	start = bench_seconds();
+	for ( int pass = 0; pass < kBenchClosestPasses; ++pass )
+		for ( int i = 0; i < kClosestQueries; ++i )
+			check -= canyon_findClosestPointScan( c, x[i], z[i] );
+	bench_report( "canyon closest point (previous scan)", queries, bench_seconds() - start );
+
+	start = bench_seconds();
+	for ( int pass = 0; pass < kBenchClosestPasses; ++pass )
+		for ( int i = 0; i < kClosestQueries; ++i )
+			check += canyonSnapshot_closestPoint( s, x[i], z[i], -1 );
+	bench_report( "canyon closest point (Z search)", queries, bench_seconds() - start );
+
+	start = bench_seconds();
+	for ( int pass = 0; pass < kBenchClosestPasses; ++pass ) {
+		canyonSnapshot_closestPoints( s, x, z, closest, kClosestQueries );
+		check -= closest[pass];
+	}
+	bench_report( "canyon closest point (Z search, batched along the canyon)", queries, bench_seconds() - start );
+	printf( "(checksum %lld)\n", check );
+
+	canyonSnapshot_release( s );
+	mem_free( x );
+	mem_free( z );
+	mem_free( closest );
+	canyon_delete( c );
+}
+
+#define kBenchCanyonWorkers 4
+#define kBenchCanyonSamples 2000000
+#define kBenchCanyonSeeks 20
+#define kBenchCanyonSeekInterval 100 // Microseconds; far more often than once a frame, to stress readers
+
+std::atomic<int> benchCanyonFinished( 0 );
+vmutex benchCanyonMutex = kMutexInitialiser;
+
+typedef struct benchCanyonArgs_s {
+	canyon* c;
+	int first;
+	int count;
+	vmutex* serialise;
+	float checksum;
+} benchCanyonArgs;
+
+// Sample points stay well inside the window wherever the writer has seeked it to. With SERIALISE, each sample
+// reads the live canyon holding it, as every sample once held terrainMutex
+void* benchCanyonThread( void* data ) {
+	benchCanyonArgs* args = (benchCanyonArgs*)data;
+	float sum = 0.f;
+	for ( int i = args->first; i < args->first + args->count; ++i ) {
+		float x, z;
+		const float u = (float)(( i * 37 ) % 400 ) - 200.f;
+		const float v = 1000.f + (float)(( (unsigned)i * 7919u ) % 2600u );
+		if ( args->serialise ) {
+			vmutex_lock( args->serialise );
+			canyonSnapshot_worldSpaceFromCanyon( args->c->snapshot.load( std::memory_order_acquire ), u, v, &x, &z );
+			vmutex_unlock( args->serialise );
+		}
+		else
+			terrain_worldSpaceFromCanyon( args->c, u, v, &x, &z );
+		sum += x + z;
+	}
+	args->checksum = sum;
+	benchCanyonFinished.fetch_add( 1 );
+	return NULL;
+}
+
+// Canyon-to-world conversions per second from WORKERS threads; if SEEKING, the main thread keeps moving the
+// window meanwhile, as it does while the ship flies. With SERIALISE, samples and seeks all hold it
+void bench_canyonSamplingRun( int workers, bool seeking, vmutex* serialise ) {
+	canyon* c = canyon_create( NULL, NULL );
+	benchCanyonArgs args[kBenchCanyonWorkers];
+	vthread threads[kBenchCanyonWorkers];
+	benchCanyonFinished.store( 0 );
+	int seeks = 0;
+	const double start = bench_seconds();
+	for ( int i = 0; i < workers; ++i ) {
+		args[i].c = c;
+		args[i].count = kBenchCanyonSamples / workers;
+		args[i].first = i * args[i].count;
+		args[i].serialise = serialise;
+		threads[i] = vthread_create( benchCanyonThread, &args[i] );
+	}
+	while ( seeking && benchCanyonFinished.load() < workers ) {
+		if ( serialise )
+			vmutex_lock( serialise );
+		canyonBuffer_seek( c, ++seeks % kBenchCanyonSeeks );
+		if ( serialise )
+			vmutex_unlock( serialise );
+		cacheEpoch_advance(); // As the terrain cache tick does each frame
+		usleep( kBenchCanyonSeekInterval );
+	}
+	for ( int i = 0; i < workers; ++i )
+		vthread_join( threads[i] );
+	const double seconds = bench_seconds() - start;
+
+	char name[128];
+	snprintf( name, sizeof( name ), "canyon to world space (%d workers, %s, %s)", workers, seeking ? "window seeking" : "window still",
+			serialise ? "global mutex, before" : "snapshots" );
+	bench_report( name, kBenchCanyonSamples, seconds );
+	if ( seeking )
+		printf( "%d window seeks meanwhile\n", seeks );
+	canyon_delete( c );
+}
+
+void bench_canyonSampling() {
+	for ( int workers = 1; workers <= kBenchCanyonWorkers; workers *= 4 )
+		for ( int seeking = 0; seeking < 2; ++seeking ) {
+			bench_canyonSamplingRun( workers, seeking, &benchCanyonMutex );
+			bench_canyonSamplingRun( workers, seeking, NULL );
+		}
+}
+#endif // UNIT_TEST
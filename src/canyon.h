@@ -2,6 +2,7 @@
 #pragma once
 #include "canyon_zone.h"
 #include "maths/vector.h"
+#include <atomic>
 
 // The maximum canyon points loaded in the buffer at one time
 #define MaxCanyonPoints 96
@@ -17,6 +18,9 @@ struct canyon_s {
 	vector		zone_sample_point;
 	scene*		_scene;
 	window_buffer* canyon_streaming_buffer;
+	// Immutable copy of the streaming buffer for workers, republished whenever the main thread moves it
+	std::atomic<canyonSnapshot*> snapshot;
+	std::atomic<int> closest_hint;	// Last closest point found, to start the next search from
 	terrainCache* cache;
 };
 
@@ -25,21 +29,63 @@ struct canyonData_s {
 	vector normal;
 };
 
+// Everything needed to map canyon space onto the segment from one canyon point to the next
+struct canyonSegment_s {
+	vector start;
+	vector end;
+	vector target_start;	// START and END pushed out along their normals, where U stops following the canyon
+	vector target_end;
+};
+
+/* A snapshot of the canyon window, with its segments precomputed. Snapshots are never modified once
+   published, so workers sample them without locks. They are refcounted; when the last ref goes they are
+   retired through the terrain cache epochs, so a reader that has merely pinned an epoch is safe too */
+struct canyonSnapshot_s {
+	std::atomic<int> refCount;
+	size_t head;			// As in the window_buffer it was taken from
+	size_t stream_position;
+	canyonData points[MaxCanyonPoints];
+	canyonSegment segments[MaxCanyonPoints]; // From each point to the next in the stream, in the same slots
+	float x[MaxCanyonPoints];	// Point Xs and Zs in stream order, from stream_position; Zs always increase
+	float z[MaxCanyonPoints];
+};
+
 extern const float canyon_base_radius;
 extern const float canyon_width;
 extern const float canyon_height;
 
 // Canyon functions
 canyon* canyon_create( scene* s, const char* file );
+// Free a headless canyon (one created without zones), and its terrain cache; nothing may still be sampling it
+void canyon_delete( canyon* c );
 void canyon_tick( void* canyon_data, float dt, engine* eng );
 void canyon_generateInitialPoints( canyon* c );
 void canyon_staticInit();
+
+// The seed the canyon is generated from; reseeding before canyon_create gives a reproducible canyon
+long int canyon_seed();
+void canyon_seedRandom( long int seed );
 void canyon_seekForWorldPosition( canyon* c, vector position );
 // Convert world-space X and Z coords into canyon space U and V
 void canyonSpaceFromWorld( canyon* c, float x, float z, float* u, float* v );
+// The same for N points under one snapshot; best for nearby points, as each search starts from the last result
+void canyonSpaceFromWorldBatch( canyon* c, const float* x, const float* z, float* u, float* v, int n );
 // Convert canyon-space U and V coords into world space X and Z
 void terrain_worldSpaceFromCanyon( canyon* c, float u, float v, float* x, float* z );
 
+// Take a ref to the current snapshot of the canyon window, for a run of lock-free samples
+canyonSnapshot* canyon_snapshot( canyon* c );
+void canyonSnapshot_release( canyonSnapshot* s );
+// terrain_worldSpaceFromCanyon() on a snapshot
+void canyonSnapshot_worldSpaceFromCanyon( const canyonSnapshot* s, float u, float v, float* x, float* z );
+
+// Closest canyon point to world-space X and Z, as an absolute stream position; O(log n) in the window size.
+// HINT, if in the window, should be a recent result for a nearby query, to speed the search
+int canyonSnapshot_closestPoint( const canyonSnapshot* s, float x, float z, int hint );
+// The closest points for N queries, each search starting from the last result; best for nearby queries
+void canyonSnapshot_closestPoints( const canyonSnapshot* s, const float* x, const float* z, int* closest, int n );
+int canyon_findClosestPoint( canyon* c, float x, float z );
+
 void canyonBuffer_generatePoints( canyon* c, size_t from, size_t to );
 void canyonBuffer_seek( canyon* c, size_t seek_position );
 
@@ -47,3 +93,10 @@ void canyonBuffer_seek( canyon* c, size_t seek_position );
 void terrain_debugDraw( canyon* c, window* w );
 
 void canyon_test();
+
+#if UNIT_TEST
+void test_canyonSnapshot();
+void test_canyonClosestPoint();
+void bench_canyonSampling();
+void bench_canyonClosestPoint();
+#endif // UNIT_TEST
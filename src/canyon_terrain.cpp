@@ -8,6 +8,7 @@
 #include "canyon_zone.h"
 #include "collision.h"
 #include "future.h"
+#include "scene.h"
 #include "terrain_collision.h"
 #include "terrain_generate.h"
 #include "terrain_render.h"
@@ -20,12 +21,11 @@
 #include "render/texture.h"
 #include "terrain/cache.h"
 #include "terrain/buildCacheTask.h"
+#include "terrain/heightGrid.h"
+#include "terrain/prefetch.h"
 
-#define LowestLod 2
 
 // *** Forward Declarations
-canyonTerrainBlock* newBlock( canyonTerrain* t, absolute u, absolute v, engine* e );
-void				deleteBlock( canyonTerrainBlock* b );
 void				canyonTerrain_calculateBounds( canyon* c, int bounds[2][2], canyonTerrain* t, vector* sample_point );
 void				canyonTerrainBlock_calculateExtents( canyonTerrainBlock* b, canyonTerrain* t, absolute u, absolute v );
 int					canyonTerrain_lodLevelForBlock( canyon* c, canyonTerrain* t, absolute u, absolute v );
@@ -37,10 +37,14 @@ IMPLEMENT_POOL(canyonTerrainBlock)
 
 pool_canyonTerrainBlock* static_block_pool = NULL;
 
-void canyonTerrain_staticInit() {
+void canyonTerrain_initPools() {
 	static_block_pool = pool_canyonTerrainBlock_create( PoolMaxBlocks );
+	canyonTerrain_renderInitPools();
+}
 
-	canyonTerrain_renderInit();
+void canyonTerrain_staticInit() {
+	canyonTerrain_initPools();
+	canyonTerrain_renderLoadTextures();
 }
 
 // ***
@@ -66,10 +70,6 @@ void canyonTerrain_updateBlocks( canyon* c, canyonTerrain* t, engine* e ) {
 	vmutex_lock( &t->mutex ); {
 		canyonTerrain_calculateBounds( c, bounds, t, &t->sample_point );
 
-		const int vTrim = ((float)bounds[0][1] - 0.5f) * ((2 * t->v_radius) / (float)t->v_block_count);
-		//printf( "Trimming up to %d.\n", vTrim );
-		terrainCache_trim( c->cache, vTrim );
-
 		if (t->firstUpdate || !boundsEqual( bounds, t->bounds )) {
 			boundsIntersection( intersection, bounds, t->bounds );
 			canyonTerrainBlock** newBlocks = (canyonTerrainBlock**)stackArray( canyonTerrainBlock*, t->total_block_count );
@@ -139,7 +139,7 @@ void canyonTerrainBlock_tick( void* arg, float dt, engine* e ) {
 	(void)dt;(void)e;
 	canyonTerrainBlock* b = (canyonTerrainBlock*)arg;
 	terrainRenderable* r = b->renderable;
-	if (( r->vertex_VBO_alt && *r->vertex_VBO_alt ) && ( r->element_VBO_alt && *r->element_VBO_alt )) {
+	if (( r->vertex_VBO_alt && *r->vertex_VBO_alt ) && ( r->element_VBO_alt && *r->element_VBO_alt ) && ( r->morph_VBO_alt && *r->morph_VBO_alt )) {
 			if (!b->ready->complete)
 				future_complete_( b->ready );
 	}
@@ -155,6 +155,7 @@ canyonTerrainBlock* newBlock( canyonTerrain* t, absolute u, absolute v, engine*
 	b->_canyon = t->_canyon;
 	b->u = u;
 	b->v = v;
+	terrainLatency_stamp( b, kBlockRequested );
 	b->renderable = terrainRenderable_create( b );
 	canyonTerrainBlock_calculateExtents( b, b->terrain, u, v );
 	//printf( "Generating new block 0x" xPTRf " at lod %d.\n", (uintptr_t)b, b->lod_level );
@@ -168,38 +169,52 @@ void deleteBlock( canyonTerrainBlock* b ) {
 	vAssert( b );
 	stopTick( b->_engine, b, canyonTerrainBlock_tick );
 	terrainBlock_removeCollision( b );
+	if ( b->heights )
+		terrainHeightGrid_release( b->heights );
 	stopActor( b->actor );
 	terrainRenderable_delete( b->renderable );
 	pool_canyonTerrainBlock_free( static_block_pool, b );
 }
 
-void canyonTerrain_blockContaining( canyon* c, int coord[2], canyonTerrain* t, vector* point ) {
-	float u, v;
-	canyonSpaceFromWorld( c, point->coord.x, point->coord.z, &u, &v );
+void canyonTerrain_blockAt( canyonTerrain* t, float u, float v, int coord[2] ) {
 	const float block_width = (2 * t->u_radius) / (float)t->u_block_count;
 	const float block_height = (2 * t->v_radius) / (float)t->v_block_count;
 	coord[0] = fround( u / block_width, 1.f );
 	coord[1] = fround( v / block_height, 1.f );
 }
 
-int canyonTerrain_lodLevelForBlock( canyon* c, canyonTerrain* t, absolute u, absolute v ) {
-	int block[2];
-	canyonTerrain_blockContaining( c, block, t, &t->sample_point );
+void canyonTerrain_blockContaining( canyon* c, int coord[2], canyonTerrain* t, vector* point ) {
+	float u, v;
+	canyonSpaceFromWorld( c, point->coord.x, point->coord.z, &u, &v );
+	canyonTerrain_blockAt( t, u, v, coord );
+}
+
+int canyonTerrain_lodLevelAround( canyonTerrain* t, const int center[2], absolute u, absolute v ) {
 	vAssert( t->lod_interval_u > 0 && t->lod_interval_v > 0 );
 #if 1
-	return min( LowestLod, ( abs( u.coord - block[0] ) / t->lod_interval_u ) + ( abs( v.coord - block[1]) / t->lod_interval_v ));
+	return min( LowestLod, ( abs( u.coord - center[0] ) / t->lod_interval_u ) + ( abs( v.coord - center[1]) / t->lod_interval_v ));
 #else
 	(void)u;(void)v;
 	return 2;
 #endif
 }
 
-void canyonTerrainBlock_calculateSamplesForLoD( canyon* c, canyonTerrainBlock* b, canyonTerrain* t, absolute u, absolute v ) {
-	b->lod_level = canyonTerrain_lodLevelForBlock( c, t, u, v );
-	// Set samples based on U offset, We add one so that we always get a centre point
-	int ratio = max( 1, 2 * b->lod_level );
-	b->u_samples = t->uSamplesPerBlock / ratio + 1;
-	b->v_samples = t->vSamplesPerBlock / ratio + 1;
+int canyonTerrain_lodLevelForBlock( canyon* c, canyonTerrain* t, absolute u, absolute v ) {
+	int block[2];
+	canyonTerrain_blockContaining( c, block, t, &t->sample_point );
+	return canyonTerrain_lodLevelAround( t, block, u, v );
+}
+
+// Samples along one axis of a block at LOD; we add one so that we always get a centre point
+int canyonTerrain_lodSamples( int samples, int lod ) { return samples / max( 1, 2 * lod ) + 1; }
+
+void canyonTerrainBlock_setLayout( canyonTerrainBlock* b, canyonTerrain* t, absolute u, absolute v, int lod ) {
+	b->uMin = u.coord * t->uSamplesPerBlock - (t->uSamplesPerBlock / 2);
+	b->vMin = v.coord * t->vSamplesPerBlock - (t->vSamplesPerBlock / 2);
+	b->lod_level = lod;
+	// Set samples based on U offset
+	b->u_samples = canyonTerrain_lodSamples( t->uSamplesPerBlock, lod );
+	b->v_samples = canyonTerrain_lodSamples( t->vSamplesPerBlock, lod );
 }
 
 void canyonTerrainBlock_calculateExtents( canyonTerrainBlock* b, canyonTerrain* t, absolute u, absolute v ) {
@@ -209,10 +224,7 @@ void canyonTerrainBlock_calculateExtents( canyonTerrainBlock* b, canyonTerrain*
 	b->v_min = ((float)v.coord - 0.5f) * vf;
 	b->u_max = b->u_min + uf;
 	b->v_max = b->v_min + vf;
-	b->uMin = u.coord * t->uSamplesPerBlock - (t->uSamplesPerBlock / 2);
-	b->vMin = v.coord * t->vSamplesPerBlock - (t->vSamplesPerBlock / 2);
-	
-	canyonTerrainBlock_calculateSamplesForLoD( b->_canyon, b, t, u, v );
+	canyonTerrainBlock_setLayout( b, t, u, v, canyonTerrain_lodLevelForBlock( b->_canyon, t, u, v ));
 }
 
 // Calculate the block bounds for the terrain, at a given sample point
@@ -221,6 +233,10 @@ void canyonTerrain_calculateBounds( canyon* c, int bounds[2][2], canyonTerrain*
 	   The center block [0] is from -half_block_width to half_block_width */
 	int block[2];
 	canyonTerrain_blockContaining( c, block, t, sample_point );
+	canyonTerrain_boundsAround( t, block, bounds );
+}
+
+void canyonTerrain_boundsAround( canyonTerrain* t, const int block[2], int bounds[2][2] ) {
 	int rx = ( t->u_block_count - 1 ) / 2;
 	int ry = ( t->v_block_count - 1 ) / 2;
 	bounds[0][0] = block[0] - rx;
@@ -277,14 +293,28 @@ canyonTerrain* canyonTerrain_create( canyon* c, int u_blocks, int v_blocks, int
 	t->system = actorSystemCreate();
 	vmutex_init( &t->mutex );
 
+	t->prefetch = terrainPrefetch_create();
 	canyonTerrain_initVertexBuffers( t );
-	if ( CANYON_TERRAIN_INDEXED ) canyonTerrain_initElementBuffers( t );
+	if ( CANYON_TERRAIN_INDEXED ) canyonTerrain_initLodElements( t );
 	canyonTerrain_createBlocks( c, t );
 
 	t->trans = transform_create();
 	return t;
 }
 
+void canyonTerrain_delete( canyonTerrain* t ) {
+	for ( int i = 0; i < t->total_block_count; ++i )
+		if ( t->blocks[i] )
+			deleteBlock( t->blocks[i] );
+	mem_free( t->blocks );
+	canyonTerrain_deleteVertexBuffers( t );
+	if ( CANYON_TERRAIN_INDEXED ) canyonTerrain_deleteLodElements( t );
+	terrainPrefetch_delete( t->prefetch );
+	actorSystemDelete( t->system );
+	transform_delete( t->trans );
+	mem_free( t );
+}
+
 int lodRatio( canyonTerrainBlock* b ) { return b->u_samples / ( b->terrain->uSamplesPerBlock / 4 ); }
 int lodStride( canyonTerrainBlock* b ) { return 4 / lodRatio(b); }
 
@@ -299,6 +329,21 @@ void canyonTerrain_tick( void* data, float dt, engine* eng ) {
 
 	terrainCache_tick( t->_canyon->cache, dt, t->sample_point );
 	canyonTerrain_updateBlocks( t->_canyon, t, eng );
+
+	canyonSpaceFromWorld( t->_canyon, t->sample_point.coord.x, t->sample_point.coord.z, &t->sample_uv[0], &t->sample_uv[1] );
+	terrainPrefetch_tick( t->prefetch, t, t->sample_uv[0], t->sample_uv[1], dt );
+
+	// Block streaming latency overlay; the text summary goes to the console as it's switched on
+	static bool latencyShown = false;
+	const bool showLatency = ( theScene->debug_flags & kSceneDebugTerrainLatency ) != 0;
+	if ( showLatency ) {
+		terrainLatencySummary s;
+		terrainLatency_summarise( &s );
+		if ( !latencyShown )
+			terrainLatency_print( stdout, &s );
+		terrainLatency_drawOverlay( &s, 100.f, 360.f, 480.f, 180.f );
+	}
+	latencyShown = showLatency;
 }
 
 //// External utilities
@@ -309,3 +354,16 @@ void terrain_positionsFromUV( canyonTerrain* t, int u_index, int v_index, float*
 	*u = (float)u_index * uPerBlock / (float)(t->uSamplesPerBlock);
 	*v = (float)v_index * vPerBlock / (float)(t->vSamplesPerBlock);
 }
+
+#if UNIT_TEST
+canyonTerrain* testTerrain_create() {
+	canyon* c = canyon_create( NULL, NULL );
+	return canyonTerrain_create( c, 9, 17, 64, 48, 640.f, 960.f );
+}
+
+void testTerrain_delete( canyonTerrain* t ) {
+	canyon* c = t->_canyon;
+	canyonTerrain_delete( t );
+	canyon_delete( c );
+}
+#endif // UNIT_TEST
@@ -4,6 +4,8 @@
 #include "actor/actor.h"
 #include "render/render.h"
 #include "system/thread.h"
+#include "terrain/latency.h"
+#include "terrain/vertex.h"
 
 #define PoolMaxBlocks 768
 
@@ -12,6 +14,8 @@
 #define kMaxTerrainBlockWidth 80
 #define kMaxTerrainBlockElements (kMaxTerrainBlockWidth * kMaxTerrainBlockWidth * 6)
 
+#define LowestLod 2
+
 typedef struct absolute_s {
 	int coord;
 } absolute;
@@ -35,6 +39,7 @@ struct canyonTerrainBlock_s {
 
 	// *** Collision
 	body*			collision;
+	terrainHeightGrid*	heights;	// Final vertex positions, shared with collision
 
 	canyonTerrain* terrain;
 	canyon* _canyon;
@@ -44,16 +49,22 @@ struct canyonTerrainBlock_s {
 	terrainRenderable* renderable;
 	engine* _engine;
 	future* ready;
+
+	long long lifecycle[kBlockStageCount];	// When it reached each stage; see terrain/latency.h
 };
 
 struct terrainRenderable_s {
 	canyonTerrainBlock* block;
 
 	shader** terrainShader;
+	shader** depthShader;
 	int element_count;
 	int element_count_render; // The one currently used to render with; for smooth LoD switching
 	unsigned short* element_buffer;
-	vertex* vertex_buffer;
+	terrainVertex* packed_vertices;	// The block's vertices as its VBO holds them; see terrain/vertex.h
+	float* morph_targets;	// 3 floats per vertex; see terrain/morph.h
+	terrainVertexFrame packed_frame;		// Decodes vertex_VBO
+	terrainVertexFrame packed_frame_alt;	// Decodes packed_vertices, and so vertex_VBO_alt
 
 	aabb	bb;
 
@@ -62,8 +73,20 @@ struct terrainRenderable_s {
 	GLuint*			element_VBO;
 	GLuint*			vertex_VBO_alt;
 	GLuint*			element_VBO_alt;
+	GLuint*			morph_VBO;
+	GLuint*			morph_VBO_alt;
 } ;
 
+// Triangle-grid element buffer for one LOD; the grid only depends on the sample counts, so one is shared by
+// every block at that LOD (and uploaded once)
+typedef struct terrainElements_s {
+	int u_samples;
+	int v_samples;
+	int count;
+	unsigned short* elements;
+	GLuint* VBO;
+} terrainElements;
+
 struct canyonTerrain_s {
 	transform* trans;
 	actorSystem* system;
@@ -83,12 +106,13 @@ struct canyonTerrain_s {
 	
 	int				bounds[2][2];
 	vector			sample_point;
+	float			sample_uv[2];	// SAMPLE_POINT in canyon space; blocks geomorph by their distance from it
 
 	canyon*				_canyon;
-	vertex**			vertex_buffers;
+	terrainVertex**		vertex_buffers;
 	int					vertex_buffer_count;
-	unsigned short**	element_buffers;
-	int					element_buffer_count;
+	terrainElements		lod_elements[LowestLod + 1];
+	terrainPrefetch*	prefetch;
 
 	bool firstUpdate;
 	vmutex mutex;
@@ -99,14 +123,27 @@ extern texture* terrain_texture_cliff;
 
 // *** Functions 
 void canyonTerrain_staticInit();
+// Just the block pools, loading no textures; for headless use (benchmarks)
+void canyonTerrain_initPools();
 
 canyonTerrain* canyonTerrain_create( canyon* c, int u_blocks, int v_blocks, int u_samples, int v_samples, float u_radius, float v_radius );
+// Free T and its blocks, but not its canyon; no block may still be generating, nor any of its requests waiting
+void canyonTerrain_delete( canyonTerrain* t );
 void canyonTerrain_setLodIntervals( canyonTerrain* t, int u, int v );
+int canyonTerrain_lodSamples( int samples, int lod );
+// Set the sample grid of B as the block at (U,V) and LOD
+void canyonTerrainBlock_setLayout( canyonTerrainBlock* b, canyonTerrain* t, absolute u, absolute v, int lod );
+// Block coordinates of canyon-space (U,V), and the terrain's block bounds when centred on BLOCK
+void canyonTerrain_blockAt( canyonTerrain* t, float u, float v, int coord[2] );
+void canyonTerrain_boundsAround( canyonTerrain* t, const int block[2], int bounds[2][2] );
+// LOD level of the block at (U,V) when the terrain is centred on CENTER
+int canyonTerrain_lodLevelAround( canyonTerrain* t, const int center[2], absolute u, absolute v );
 void canyonTerrain_render( void* data, scene* s );
 void canyonTerrain_tick( void* data, float dt, engine* eng );
 
 float canyonTerrain_sample( canyon* c, float u, float v );
 float canyonTerrain_sampleUV( float u, float v );
+void canyonTerrain_sampleUVBatch( const float* u, const float* v, float* out, int n );
 
 int lodRatio( canyonTerrainBlock* b );
 int lodStride( canyonTerrainBlock* b );
@@ -114,7 +151,16 @@ int canyonTerrainBlock_renderIndexFromUV( canyonTerrainBlock* b, int u, int v );
 
 // To move to terrain_generate
 void canyonTerrainBlock_generateVerts( canyon* c, canyonTerrainBlock* b, vector* verts );
-void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts, vector* normals );
+void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts, vector* normals, vertex* vertices );
 void terrain_positionsFromUV( canyonTerrain* t, int u_index, int v_index, float* u, float* v );
 
 void terrain_setBlock( canyonTerrain* t, absolute u, absolute v, canyonTerrainBlock* b );
+// Create a block at (U,V), at the LOD the terrain wants there and ticked by E; and destroy one
+canyonTerrainBlock* newBlock( canyonTerrain* t, absolute u, absolute v, engine* e );
+void deleteBlock( canyonTerrainBlock* b );
+
+#if UNIT_TEST
+// The terrain the terrain tests and benches share the shape of, over a headless canyon; and freeing both again
+canyonTerrain* testTerrain_create();
+void testTerrain_delete( canyonTerrain* t );
+#endif // UNIT_TEST
@@ -2,8 +2,10 @@
 #include "common.h"
 #include "canyon_zone.h"
 //-------------------------
+#include "bench.h"
 #include "canyon.h"
 #include "scene.h"
+#include "test.h"
 #include "maths/maths.h"
 #include "mem/allocator.h"
 #include "render/texture.h"
@@ -82,25 +84,93 @@ vector canyonZone_edgeColorAtV( canyon* c, float v ) {
 	return canyonZone_edgeColor( c, canyon_zone( v ));
 }
 
-texture* canyonZone_buildTexture( canyonZone a, canyonZone b ) {
-	uint8_t* bitmap = (uint8_t*)mem_alloc( sizeof( uint8_t ) * kZoneTextureWidth * kZoneTextureHeight * kZoneTextureStride );
+#define kZoneTextureRowBytes ( kZoneTextureWidth * kZoneTextureStride )
+
+// End colours of each row: zone A's at the left, B's at the right, each blended from terrain to cliff
+static void zoneTexture_rowEnds( const vector wanted[4], vector ends[kZoneTextureHeight][2] ) {
 	for ( int y = 0; y < kZoneTextureHeight; ++y ) {
-		for ( int x = 0; x < kZoneTextureWidth; ++x ) {
-			int index = ( x + y * kZoneTextureWidth ) * kZoneTextureStride;
-			float zone = (float)x / (float)kZoneTextureWidth;
-			float cliff = (float)y / (float)kZoneTextureHeight;
-			vector terrain_color = vector_lerp( &a.terrain_color, &b.terrain_color, zone );
-			vector cliff_color = vector_lerp( &a.cliff_color, &b.cliff_color, zone );
-			//vector edge_color = vector_lerp( &a.edge_color, &b.edge_color, zone );
-			vector color = vector_lerp( &terrain_color, &cliff_color, cliff );
-			bitmap[index + 0] = (uint8_t)( color.coord.x * 255.f );
-			bitmap[index + 1] = (uint8_t)( color.coord.y * 255.f );
-			bitmap[index + 2] = (uint8_t)( color.coord.z * 255.f );
-			bitmap[index + 3] = 1.f;
-		}
+		float cliff = (float)y / (float)kZoneTextureHeight;
+		ends[y][0] = vector_lerp( &wanted[0], &wanted[1], cliff );
+		ends[y][1] = vector_lerp( &wanted[2], &wanted[3], cliff );
+	}
+}
+
+static void zoneTexture_fillRow( const vector ends[2], uint8_t* row ) {
+	for ( int x = 0; x < kZoneTextureWidth; ++x ) {
+		float zone = (float)x / (float)kZoneTextureWidth;
+		vector color = vector_lerp( &ends[0], &ends[1], zone );
+		uint8_t* texel = &row[x * kZoneTextureStride];
+		texel[0] = (uint8_t)( color.coord.x * 255.f );
+		texel[1] = (uint8_t)( color.coord.y * 255.f );
+		texel[2] = (uint8_t)( color.coord.z * 255.f );
+		texel[3] = 1.f;
 	}
-	texture* t = texture_loadFromMem( kZoneTextureWidth, kZoneTextureHeight, kZoneTextureStride, bitmap );
-	return t;
+}
+
+static void zoneTexture_wantedFor( const canyonZone* a, const canyonZone* b, vector wanted[4] ) {
+	wanted[0] = a->terrain_color;
+	wanted[1] = a->cliff_color;
+	wanted[2] = b->terrain_color;
+	wanted[3] = b->cliff_color;
+}
+
+void canyonZone_fillTexture( const canyonZone* a, const canyonZone* b, uint8_t* bitmap ) {
+	vector wanted[4];
+	vector ends[kZoneTextureHeight][2];
+	zoneTexture_wantedFor( a, b, wanted );
+	zoneTexture_rowEnds( wanted, ends );
+	for ( int y = 0; y < kZoneTextureHeight; ++y )
+		zoneTexture_fillRow( ends[y], &bitmap[y * kZoneTextureRowBytes] );
+}
+
+zoneTexture* zoneTexture_create( texture* tex ) {
+	zoneTexture* z = (zoneTexture*)mem_alloc( sizeof( zoneTexture ));
+	memset( z, 0, sizeof( zoneTexture ));
+	z->tex = tex;
+	z->bitmap = (uint8_t*)mem_alloc( sizeof( uint8_t ) * kZoneTextureHeight * kZoneTextureRowBytes );
+	vmutex_init( &z->mutex );
+	return z;
+}
+
+void zoneTexture_delete( zoneTexture* z ) {
+	mem_free( z->bitmap );
+	mem_free( z );
+}
+
+int zoneTexture_build( zoneTexture* z ) {
+	int changed = 0;
+	vmutex_lock( &z->mutex ); {
+		if ( z->built_generation != z->wanted_generation ) {
+			const bool first = z->built_generation == 0;
+			vector ends[kZoneTextureHeight][2];
+			zoneTexture_rowEnds( z->wanted, ends );
+			int firstRow = kZoneTextureHeight, lastRow = -1;
+			for ( int y = 0; y < kZoneTextureHeight; ++y ) {
+				if ( !first && memcmp( ends[y], z->row_ends[y], sizeof( ends[y] )) == 0 )
+					continue;
+				zoneTexture_fillRow( ends[y], &z->bitmap[y * kZoneTextureRowBytes] );
+				memcpy( z->row_ends[y], ends[y], sizeof( ends[y] ));
+				firstRow = min( firstRow, y );
+				lastRow = y;
+				++changed;
+			}
+			// The upload is copied, so the bitmap is free for the next build as soon as these return
+			if ( z->tex && first )
+				texture_requestMem( &z->tex->gl_tex, kZoneTextureWidth, kZoneTextureHeight, kZoneTextureStride, z->bitmap, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE );
+			else if ( z->tex && changed > 0 )
+				texture_requestRows( &z->tex->gl_tex, kZoneTextureWidth, firstRow, lastRow + 1 - firstRow, kZoneTextureStride, &z->bitmap[firstRow * kZoneTextureRowBytes] );
+			z->built_generation = z->wanted_generation;
+			z->rows_changed = changed;
+		}
+	} vmutex_unlock( &z->mutex );
+	return changed;
+}
+
+void zoneTexture_want( zoneTexture* z, const canyonZone* a, const canyonZone* b ) {
+	vmutex_lock( &z->mutex ); {
+		zoneTexture_wantedFor( a, b, z->wanted );
+		++z->wanted_generation;
+	} vmutex_unlock( &z->mutex );
 }
 
 void canyonZone_skyFogBlend( canyonZone* a, canyonZone* b, float blend, vector* sky_color, vector* fog_color, vector* sun_color ) {
@@ -143,3 +213,76 @@ canyonZone* canyonZone_create() {
 	memset( z, 0, sizeof( canyonZone ));
 	return z;
 }
+
+#if UNIT_TEST
+#define kBenchZoneTextureBuilds 2000
+
+static canyonZone testZone( float terrain, float cliff ) {
+	canyonZone z;
+	memset( &z, 0, sizeof( z ));
+	z.terrain_color = Vector( terrain, 0.5f, 1.f - terrain, 1.f );
+	z.cliff_color = Vector( cliff, 1.f - cliff, 0.25f, 1.f );
+	return z;
+}
+
+void test_zoneTexture() {
+	printf( "--- Beginning Unit Test: Zone Texture ---\n" );
+	// A sequence of zone pairs as the canyon advances; each step changes one side, sometimes only its cliff colour
+	const canyonZone zones[] = { testZone( 0.1f, 0.9f ), testZone( 0.6f, 0.3f ), testZone( 0.1f, 0.4f ), testZone( 0.8f, 0.8f ) };
+	const int pairs[][2] = { { 0, 1 }, { 2, 1 }, { 2, 3 }, { 0, 3 }, { 0, 3 }, { 0, 1 } };
+	zoneTexture* z = zoneTexture_create( NULL );
+	uint8_t* full = (uint8_t*)mem_alloc( sizeof( uint8_t ) * kZoneTextureHeight * kZoneTextureRowBytes );
+	bool matches = true, built = true;
+	for ( unsigned i = 0; i < sizeof( pairs ) / sizeof( pairs[0] ); ++i ) {
+		const canyonZone* a = &zones[pairs[i][0]];
+		const canyonZone* b = &zones[pairs[i][1]];
+		zoneTexture_want( z, a, b );
+		zoneTexture_build( z );
+		built = built && z->built_generation == z->wanted_generation;
+		canyonZone_fillTexture( a, b, full );
+		matches = matches && memcmp( full, z->bitmap, kZoneTextureHeight * kZoneTextureRowBytes ) == 0;
+	}
+	test( built, "Zone texture brought up to date by one build", "Zone texture not up to date after its build" );
+	test( matches, "Incremental zone texture matches a full rebuild", "Incremental zone texture differs from a full rebuild" );
+
+	// Only the rows whose end colours changed are rebuilt
+	zoneTexture_want( z, &zones[0], &zones[1] );
+	zoneTexture_build( z );
+	test( z->rows_changed == 0, "Unchanged zone pair rebuilds no rows", "Unchanged zone pair rebuilt rows" );
+	canyonZone cliffOnly = zones[1];
+	cliffOnly.cliff_color = Vector( 0.f, 0.f, 0.f, 1.f );
+	zoneTexture_want( z, &zones[0], &cliffOnly );
+	zoneTexture_build( z );
+	test( z->rows_changed == kZoneTextureHeight - 1, "Cliff colour change keeps the pure terrain row", "Cliff colour change rebuilt the wrong rows" );
+	canyonZone_fillTexture( &zones[0], &cliffOnly, full );
+	test( memcmp( full, z->bitmap, kZoneTextureHeight * kZoneTextureRowBytes ) == 0,
+			"Partial zone texture rebuild matches a full rebuild", "Partial zone texture rebuild differs from a full rebuild" );
+	mem_free( full );
+	zoneTexture_delete( z );
+}
+
+// The cost of building the texture for a new zone pair: filling every row, against only the rows that changed
+void bench_zoneTexture() {
+	const canyonZone a = testZone( 0.1f, 0.9f ), b = testZone( 0.6f, 0.3f );
+	uint8_t* bitmap = (uint8_t*)mem_alloc( sizeof( uint8_t ) * kZoneTextureHeight * kZoneTextureRowBytes );
+	double start = bench_seconds();
+	for ( int i = 0; i < kBenchZoneTextureBuilds; ++i )
+		canyonZone_fillTexture( i % 2 ? &a : &b, i % 2 ? &b : &a, bitmap );
+	const double fullSeconds = bench_seconds() - start;
+	bench_report( "zone texture full build", kBenchZoneTextureBuilds, fullSeconds );
+
+	// Alternating A/B and B/A changes every row, so this is the worst case for a rebuild
+	zoneTexture* z = zoneTexture_create( NULL );
+	start = bench_seconds();
+	for ( int i = 0; i < kBenchZoneTextureBuilds; ++i ) {
+		zoneTexture_want( z, i % 2 ? &a : &b, i % 2 ? &b : &a );
+		zoneTexture_build( z );
+	}
+	const double buildSeconds = bench_seconds() - start;
+	bench_report( "zone texture changed-row build", kBenchZoneTextureBuilds, buildSeconds );
+	printf( "Zone texture: %.3fms per full build, %.3fms per changed-row build (%d of %d rows)\n",
+			fullSeconds * 1000.0 / kBenchZoneTextureBuilds, buildSeconds * 1000.0 / kBenchZoneTextureBuilds, z->rows_changed, kZoneTextureHeight );
+	zoneTexture_delete( z );
+	mem_free( bitmap );
+}
+#endif // UNIT_TEST
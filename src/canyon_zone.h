@@ -1,6 +1,7 @@
 // Canyon_zone.h
 #pragma once
 #include "maths/vector.h"
+#include "system/thread.h"
 
 #define kZoneLength 2000.f
 #define kNumZones	16
@@ -22,6 +23,21 @@ struct canyonZone_s {
 	texture*	texture_cliff;
 };
 
+/* Zone colour lookup texture: X blends from zone A's colours to zone B's, Y from terrain to cliff colour.
+   Handed to the render thread through the texture upload path. Each row is a blend between its two end colours,
+   so a rebuild only fills, and uploads, the rows whose ends changed. The terrain shader blends the zones' ground
+   and cliff textures instead and never samples this, so nothing builds one at runtime */
+struct zoneTexture_s {
+	texture*	tex;		// NULL when headless; nothing is uploaded
+	uint8_t*	bitmap;
+	vector		row_ends[kZoneTextureHeight][2];	// As last built
+	vector		wanted[4];	// Terrain and cliff colours of A, then of B
+	int			wanted_generation;
+	int			built_generation;
+	int			rows_changed;	// By the last build that had anything to do
+	vmutex		mutex;
+};
+
 extern vector zone_sample_point;
 
 int canyon_zone( float v );
@@ -42,7 +58,22 @@ vector canyonZone_terrainColorAtV( canyon* c, float v );
 vector canyonZone_cliffColorAtV( canyon* c, float v );
 vector canyonZone_edgeColorAtV( canyon* c, float v );
 
+// *** Texture
+zoneTexture* zoneTexture_create( texture* tex );
+void zoneTexture_delete( zoneTexture* z );
+// Set zones A and B as the ones Z should next be built for
+void zoneTexture_want( zoneTexture* z, const canyonZone* a, const canyonZone* b );
+// Bring Z up to date with the zones last wanted; returns how many rows changed
+int zoneTexture_build( zoneTexture* z );
+// Fill a whole bitmap for zones A and B, as a full rebuild
+void canyonZone_fillTexture( const canyonZone* a, const canyonZone* b, uint8_t* bitmap );
+
 canyonZone* canyonZone_create();
 void canyonZone_load( canyon* c, const char* filename );
 void canyonZone_tick( canyon* c, float dt );
 void canyonZone_skyFogBlend( canyonZone* a, canyonZone* b, float blend, vector* sky_color, vector* fog_color, vector* sun_color );
+
+#if UNIT_TEST
+void test_zoneTexture();
+void bench_zoneTexture();
+#endif // UNIT_TEST
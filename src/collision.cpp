@@ -10,8 +10,10 @@
 #include "base/ringqueue.h"
 #include "maths/geometry.h"
 #include "render/debugdraw.h"
+#include "terrain/heightGrid.h"
 #include "collection/vec.h"
-#include "collision/quadtree.h"
+#include "collision/broadphase.h"
+#include "collision/narrowphase.h"
 
 #define kDeadBodyQueueSize 128
 #define kNewBodyQueueSize 128
@@ -27,6 +29,14 @@ int event_count;
 body* bodies[kMaxCollidingBodies];
 int body_count;
 
+broadphase* collision_broadphase = NULL;
+int collision_broadphase_type = COLLISION_BROADPHASE;
+int collision_narrowphase_helpers = kNarrowphaseHelpers;
+collisionEvent* collision_hits = NULL;	// The narrowphase's output; grown to the most pairs seen
+int collision_hits_capacity = 0;
+collisionStats collision_tickStats;		// Written by the tick
+collisionStats collision_processedStats;	// What the tick wrote, as of the last results processed
+
 RingQ<body>* collision_dead_body_queue = NULL;
 ringQueue* collision_new_body_queue = NULL;
 
@@ -39,9 +49,7 @@ bool collisionFunc_HeightfieldSphere( shape* height_shape, shape* sphere_shape,
 void shape_delete( shape* s );
 
 static inline vector heightField_vertex( heightField* h, int x, int z ) { 
-	int index = x + z * h->x_samples;
-	//vAssert( index >= 0 && index < h->vert_count );
-	return h->verts[index];
+	return terrainHeightGrid_position( h->grid, x, z );
 }
 
 void body_delete( body* b ) {
@@ -71,6 +79,7 @@ void collision_addBody( body* b ) {
 void collision_addNewBody( body* b ) {
 	vAssert( body_count < kMaxCollidingBodies );
 	bodies[body_count++] = b;
+	broadphase_add( collision_broadphase, b );
 }
 
 void collision_addNewBodies() {
@@ -94,6 +103,8 @@ void collision_removeBody( body* b ) {
 void collision_removeDeadBody( body* b ) {
 	array_remove( (void**)bodies, &body_count, b );
 	vAssert( b );
+	if ( b->broadphase_proxy >= 0 )
+		broadphase_remove( collision_broadphase, b );
 	vAssert( b->_shape );
 	shape_delete( b->_shape );
 	body_delete( b );
@@ -118,34 +129,58 @@ void collision_runCallbacks() {
 	}
 }
 
-void collision_generateEvents() {
-	// for every body, check every other body
-	// TODO - keep separate lists for layers; iterate those instead
-#if 0
+void collision_setBroadphase( int type ) {
+	collision_broadphase_type = type;
+}
+
+// Switch broadphase if asked to, refiling every body in the new one
+static void collision_updateBroadphaseType() {
+	if ( broadphase_type( collision_broadphase ) == collision_broadphase_type )
+		return;
+	broadphase_delete( collision_broadphase );
+	collision_broadphase = broadphase_create( collision_broadphase_type );
 	for ( int i = 0; i < body_count; ++i )
-		for ( int j = i + 1; j < body_count; j++ ) {
-			vAssert( bodies[i] )
-			vAssert( bodies[j] )
-			if ( !bodies[i]->disabled && !bodies[j]->disabled && body_colliding( bodies[i], bodies[j] ))
-				collision_event( bodies[i], bodies[j] );
-		}
-#else 
-	float radius = 10000.f;
-	aabb2d bb;
-	bb.x_max = radius;
-	bb.x_min = -radius;
-	bb.z_max = radius;
-	bb.z_min = -radius;
-	QuadTree<body*> tree(bb);
-	for ( int i = 0; i < body_count; ++i ) {
-		tree += bodies[i];
-	}
-//	tree.print(0);
-	auto collisions = potentialCollisions(&tree);
-	for (auto c : collisions.underlying) {
-			collision_event( c.a, c.b );
+		broadphase_add( collision_broadphase, bodies[i] );
+}
+
+void collision_setNarrowphaseHelpers( int helpers ) {
+	collision_narrowphase_helpers = helpers;
+}
+
+// The broadphase only pairs bodies in layers that interact; whether these two do is still checked body by body
+void collision_generateEvents() {
+	collision_updateBroadphaseType();
+	const collisionEvent* pairs;
+	const int pair_count = broadphase_update( collision_broadphase, &pairs );
+	const broadphaseStats* bpStats = broadphase_stats( collision_broadphase );
+	collisionStats* stats = &collision_tickStats;
+	memset( stats, 0, sizeof( collisionStats ));
+	stats->bodies = bpStats->bodies;
+	stats->layer_pairs = bpStats->layer_pairs;
+	stats->bounds_tests = bpStats->bounds_tests;
+	stats->pairs_culled = bpStats->pairs_culled;
+	if ( pair_count > collision_hits_capacity ) {
+		if ( collision_hits )
+			mem_free( collision_hits );
+		collision_hits_capacity = max( pair_count, collision_hits_capacity * 2 );
+		collision_hits = (collisionEvent*)mem_alloc( sizeof( collisionEvent ) * collision_hits_capacity );
 	}
-#endif
+	narrowphaseStats narrow;
+	const int hits = narrowphase_run( pairs, pair_count, collision_hits, collision_narrowphase_helpers, worker_addImmediateTask, &narrow );
+	for ( int i = 0; i < hits; ++i )
+		collision_event( collision_hits[i].a, collision_hits[i].b );
+	stats->pairs_tested = narrow.pairs_tested;
+	stats->pairs_culled += narrow.pairs_culled;
+	stats->events = event_count;
+}
+
+void collision_stats( collisionStats* stats ) {
+	*stats = collision_processedStats;
+}
+
+void collision_printStats( FILE* out, const collisionStats* stats ) {
+	fprintf( out, "Collision: %d bodies, %d interacting layer pairs, %d bounds tests, %d pairs tested, %lld culled by layer, %d events\n",
+			stats->bodies, stats->layer_pairs, stats->bounds_tests, stats->pairs_tested, stats->pairs_culled, stats->events );
 }
 
 void collisionMesh_drawWireframe( collisionMesh* m, matrix trans, vector color ) {
@@ -231,6 +266,7 @@ void collision_processResults( int frame_counter, float dt ) {
 	}
 
 	collision_runCallbacks();
+	collision_processedStats = collision_tickStats;
 
 	// Memory Write Barrier?
 
@@ -525,9 +561,7 @@ bool shape_colliding( shape* a, shape* b, matrix matrix_a, matrix matrix_b ) {
 bool body_colliding( body* a, body* b ) {
 	//vAssert( a->trans );
 	//vAssert( b->trans );
-	bool test_collision =	( a->collide_with & b->layers ) |
-	   						( a->layers & b->collide_with );
-	return test_collision && shape_colliding( a->_shape, b->_shape, a->trans->world, b->trans->world );
+	return body_layersCollide( a, b ) && shape_colliding( a->_shape, b->_shape, a->trans->world, b->trans->world );
 }
 
 bool body_collided( body* b ) {
@@ -673,26 +707,11 @@ void enlargeAABB( aabb2d* aabb, vector v ) {
 	aabb->z_min = fminf( aabb->z_min, v.coord.z );
 }
 
+// The grid has its bounds already
 void heightField_calculateAABB( heightField* h ) {
-	h->aabb.x_max = -FLT_MAX;
-	h->aabb.x_min = FLT_MAX;
-	h->aabb.z_max = -FLT_MAX;
-	h->aabb.z_min = FLT_MAX;
-	h->maxHeight = -FLT_MAX;
-	// Only need o do outer edges - the max must be one of them
-	for ( int j = 0; j < h->z_samples; j++ ) {
-		enlargeAABB( &h->aabb, heightField_vertex( h, 0, j ));
-		enlargeAABB( &h->aabb, heightField_vertex( h, h->x_samples - 1, j ));
-	}
-	for ( int i = 0; i < h->x_samples; i++ ) {
-		enlargeAABB( &h->aabb, heightField_vertex( h, i, 0 ));
-		enlargeAABB( &h->aabb, heightField_vertex( h, i, h->z_samples - 1 ));
-	}
-	for ( int i = 0; i < h->x_samples; i++ ) {
-		for ( int j = 0; j < h->z_samples; j++ ) {
-			h->maxHeight = fmaxf( h->maxHeight, heightField_vertex( h, i, j ).coord.y);
-		}
-	}
+	const aabb& bounds = h->grid->bounds;
+	h->aabb = Aabb2d( bounds.min.coord.x, bounds.max.coord.x, bounds.min.coord.z, bounds.max.coord.z );
+	h->maxHeight = bounds.max.coord.y;
 }
 
 bool AABBcontains( aabb2d aabb, float x, float z ) {
@@ -712,7 +731,395 @@ bool heightField_contains( heightField* h, vector v ) {
 	return true;
 }
 
+static inline const float* heightField_position( heightField* h, int x, int z ) {
+	return h->grid->positions[x + z * h->x_samples];
+}
+
+// Twice the signed area of A, B, P in x-z; positive with P to the left of A->B
+static inline float cross2d( const float* a, const float* b, float x, float z ) {
+	return ( b[0] - a[0] ) * ( z - a[2] ) - ( b[2] - a[2] ) * ( x - a[0] );
+}
+
+// The height at (X,Z) on the plane of triangle A, B, C
+static inline float triangle_heightAt( const float* a, const float* b, const float* c, float x, float z ) {
+	const float area = cross2d( a, b, c[0], c[2] );
+	const float wb = cross2d( c, a, x, z ) / area;
+	const float wc = cross2d( a, b, x, z ) / area;
+	return a[1] + ( b[1] - a[1] ) * wb + ( c[1] - a[1] ) * wc;
+}
+
+// Orientation and the first-guess mapping, from the grid
+static void heightField_calculateCells( heightField* h ) {
+	const int xCells = h->x_samples - 1, zCells = h->z_samples - 1;
+	const float* origin = heightField_position( h, 0, 0 );
+	const float* xEnd = heightField_position( h, xCells, 0 );
+	const float* zEnd = heightField_position( h, 0, zCells );
+	h->orientation = cross2d( origin, xEnd, zEnd[0], zEnd[2] ) >= 0.f ? 1.f : -1.f;
+
+	const float ux = ( xEnd[0] - origin[0] ) / (float)xCells, uz = ( xEnd[2] - origin[2] ) / (float)xCells;
+	const float vx = ( zEnd[0] - origin[0] ) / (float)zCells, vz = ( zEnd[2] - origin[2] ) / (float)zCells;
+	const float det = ux * vz - vx * uz;
+	h->guess_origin[0] = origin[0];
+	h->guess_origin[1] = origin[2];
+	h->guess_inverse[0] = vz / det;
+	h->guess_inverse[1] = -vx / det;
+	h->guess_inverse[2] = -uz / det;
+	h->guess_inverse[3] = ux / det;
+
+	h->folded = false;
+	for ( int j = 0; j < zCells && !h->folded; ++j )
+		for ( int i = 0; i < xCells && !h->folded; ++i ) {
+			const float* a = heightField_position( h, i, j );
+			const float* b = heightField_position( h, i + 1, j );
+			const float* c = heightField_position( h, i, j + 1 );
+			const float* d = heightField_position( h, i + 1, j + 1 );
+			h->folded = h->orientation * cross2d( a, b, c[0], c[2] ) < 0.f || h->orientation * cross2d( d, c, b[0], b[2] ) < 0.f;
+		}
+	if ( !h->folded )
+		return;
+	const int leaves_u = h->grid->level_u[0], leaves_v = h->grid->level_v[0];
+	h->leaf_bounds = (aabb2d*)mem_alloc( sizeof( aabb2d ) * leaves_u * leaves_v );
+	for ( int lv = 0; lv < leaves_v; ++lv )
+		for ( int lu = 0; lu < leaves_u; ++lu ) {
+			aabb2d* bb = &h->leaf_bounds[lu + lv * leaves_u];
+			*bb = Aabb2d( FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX );
+			for ( int j = lv * kHeightGridLeafCells; j <= min( ( lv + 1 ) * kHeightGridLeafCells, zCells ); ++j )
+				for ( int i = lu * kHeightGridLeafCells; i <= min( ( lu + 1 ) * kHeightGridLeafCells, xCells ); ++i ) {
+					const float* p = heightField_position( h, i, j );
+					bb->x_min = fminf( bb->x_min, p[0] );
+					bb->x_max = fmaxf( bb->x_max, p[0] );
+					bb->z_min = fminf( bb->z_min, p[2] );
+					bb->z_max = fmaxf( bb->z_max, p[2] );
+				}
+		}
+}
+
+/* Find the cell under (X,Z): guess it from the mean cell axes, then walk across whichever edge the point is
+   outside of until it's inside; canyon warping is gentle enough that this is a step or two. If the point is
+   off the field, stops at a border cell near it and returns false */
+static bool heightField_cell( heightField* h, float x, float z, int* x_out, int* z_out ) {
+	const int xCells = h->x_samples - 1, zCells = h->z_samples - 1;
+	const float dx = x - h->guess_origin[0], dz = z - h->guess_origin[1];
+	int i = (int)floorf( fclamp( h->guess_inverse[0] * dx + h->guess_inverse[1] * dz, 0.f, (float)( xCells - 1 )));
+	int j = (int)floorf( fclamp( h->guess_inverse[2] * dx + h->guess_inverse[3] * dz, 0.f, (float)( zCells - 1 )));
+	const float o = h->orientation;
+	for ( int step = 0; step < xCells + zCells; ++step ) {
+		const float* a = heightField_position( h, i, j );
+		const float* b = heightField_position( h, i + 1, j );
+		const float* c = heightField_position( h, i, j + 1 );
+		const float* d = heightField_position( h, i + 1, j + 1 );
+		// Edges in winding order, each with the step to the cell beyond it; take the first leading somewhere
+		const bool outside[4] = { o * cross2d( a, b, x, z ) < 0.f, o * cross2d( b, d, x, z ) < 0.f,
+									o * cross2d( d, c, x, z ) < 0.f, o * cross2d( c, a, x, z ) < 0.f };
+		const bool canStep[4] = { j > 0, i < xCells - 1, j < zCells - 1, i > 0 };
+		const int stepX[4] = { 0, 1, 0, -1 };
+		const int stepZ[4] = { -1, 0, 1, 0 };
+		int edge = 0;
+		while ( edge < 4 && !( outside[edge] && canStep[edge] ))
+			++edge;
+		if ( edge == 4 ) {
+			*x_out = i;
+			*z_out = j;
+			return !( outside[0] || outside[1] || outside[2] || outside[3] );
+		}
+		i += stepX[edge];
+		j += stepZ[edge];
+	}
+	*x_out = i;
+	*z_out = j;
+	return false;
+}
+
+// The surface height at (X,Z) within cell (I,J); triangulated along b-c, as terrainElements_fill does
+static float heightField_cellHeight( heightField* h, int i, int j, float x, float z ) {
+	const float* a = heightField_position( h, i, j );
+	const float* b = heightField_position( h, i + 1, j );
+	const float* c = heightField_position( h, i, j + 1 );
+	if ( h->orientation * cross2d( b, c, x, z ) >= 0.f )
+		return triangle_heightAt( a, b, c, x, z );
+	const float* d = heightField_position( h, i + 1, j + 1 );
+	return triangle_heightAt( d, c, b, x, z );
+}
+
+static inline heightRange heightField_cellRange( heightField* h, int i, int j ) {
+	return terrainHeightGrid_range( h->grid, 0, i / kHeightGridLeafCells, j / kHeightGridLeafCells );
+}
+
+static inline void sub3( float* out, const float* a, const float* b ) {
+	out[0] = a[0] - b[0];
+	out[1] = a[1] - b[1];
+	out[2] = a[2] - b[2];
+}
+
+static inline float dot3( const float* a, const float* b ) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+// Squared distance from P to the closest point of triangle A, B, C (Ericson, Real-Time Collision Detection 5.1.5)
+static float triangle_distanceSq( const float* p, const float* a, const float* b, const float* c ) {
+	float ab[3], ac[3], ap[3], bp[3], cp[3];
+	sub3( ab, b, a );
+	sub3( ac, c, a );
+	sub3( ap, p, a );
+	float closest[3];
+	const float d1 = dot3( ab, ap ), d2 = dot3( ac, ap );
+	sub3( bp, p, b );
+	const float d3 = dot3( ab, bp ), d4 = dot3( ac, bp );
+	sub3( cp, p, c );
+	const float d5 = dot3( ab, cp ), d6 = dot3( ac, cp );
+	const float va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+	if ( d1 <= 0.f && d2 <= 0.f )
+		return dot3( ap, ap );
+	if ( d3 >= 0.f && d4 <= d3 )
+		return dot3( bp, bp );
+	if ( d6 >= 0.f && d5 <= d6 )
+		return dot3( cp, cp );
+	if ( vc <= 0.f && d1 >= 0.f && d3 <= 0.f ) {
+		const float t = d1 / ( d1 - d3 );
+		for ( int k = 0; k < 3; ++k ) closest[k] = a[k] + ab[k] * t;
+	} else if ( vb <= 0.f && d2 >= 0.f && d6 <= 0.f ) {
+		const float t = d2 / ( d2 - d6 );
+		for ( int k = 0; k < 3; ++k ) closest[k] = a[k] + ac[k] * t;
+	} else if ( va <= 0.f && ( d4 - d3 ) >= 0.f && ( d5 - d6 ) >= 0.f ) {
+		const float t = ( d4 - d3 ) / (( d4 - d3 ) + ( d5 - d6 ));
+		for ( int k = 0; k < 3; ++k ) closest[k] = b[k] + ( c[k] - b[k] ) * t;
+	} else {
+		const float denom = 1.f / ( va + vb + vc );
+		const float v = vb * denom, w = vc * denom;
+		for ( int k = 0; k < 3; ++k ) closest[k] = a[k] + ab[k] * v + ac[k] * w;
+	}
+	float offset[3];
+	sub3( offset, p, closest );
+	return dot3( offset, offset );
+}
+
+// Where ORIGIN + DIR * t crosses triangle A, B, C, for t in [0, *T]; shortens *T to it (Moller-Trumbore)
+static bool triangle_raycast( const float* origin, const float* dir, const float* a, const float* b, const float* c, float* t ) {
+	float ab[3], ac[3], ao[3], p[3], q[3];
+	sub3( ab, b, a );
+	sub3( ac, c, a );
+	p[0] = dir[1] * ac[2] - dir[2] * ac[1];
+	p[1] = dir[2] * ac[0] - dir[0] * ac[2];
+	p[2] = dir[0] * ac[1] - dir[1] * ac[0];
+	const float det = dot3( ab, p );
+	if ( det == 0.f )
+		return false;
+	const float inv = 1.f / det;
+	sub3( ao, origin, a );
+	const float u = dot3( ao, p ) * inv;
+	if ( u < 0.f || u > 1.f )
+		return false;
+	q[0] = ao[1] * ab[2] - ao[2] * ab[1];
+	q[1] = ao[2] * ab[0] - ao[0] * ab[2];
+	q[2] = ao[0] * ab[1] - ao[1] * ab[0];
+	const float v = dot3( dir, q ) * inv;
+	if ( v < 0.f || u + v > 1.f )
+		return false;
+	const float hit = dot3( ac, q ) * inv;
+	if ( hit < 0.f || hit > *t )
+		return false;
+	*t = hit;
+	return true;
+}
+
+// Test both triangles of cell (I,J), shortening *T to the nearest hit
+static bool heightField_cellRaycast( heightField* h, int i, int j, const float* origin, const float* dir, float* t ) {
+	const float* a = heightField_position( h, i, j );
+	const float* b = heightField_position( h, i + 1, j );
+	const float* c = heightField_position( h, i, j + 1 );
+	const float* d = heightField_position( h, i + 1, j + 1 );
+	const bool near = triangle_raycast( origin, dir, a, b, c, t );
+	const bool far = triangle_raycast( origin, dir, d, c, b, t );
+	return near || far;
+}
+
+static bool heightField_cellTouchesSphere( heightField* h, int i, int j, const float* centre, float radius_sq ) {
+	const float* a = heightField_position( h, i, j );
+	const float* b = heightField_position( h, i + 1, j );
+	const float* c = heightField_position( h, i, j + 1 );
+	const float* d = heightField_position( h, i + 1, j + 1 );
+	return triangle_distanceSq( centre, a, b, c ) <= radius_sq || triangle_distanceSq( centre, d, c, b ) <= radius_sq;
+}
+
 bool heightField_collides( heightField* h, vector point ) {
+	if ( !heightField_contains( h, point ))
+		return false;
+	int i, j;
+	if ( !heightField_cell( h, point.coord.x, point.coord.z, &i, &j ))
+		return false;
+	return point.coord.y <= heightField_cellHeight( h, i, j, point.coord.x, point.coord.z );
+}
+
+bool heightField_height( heightField* h, float x, float z, float* y ) {
+	int i, j;
+	if ( !AABBcontains( h->aabb, x, z ) || !heightField_cell( h, x, z, &i, &j ))
+		return false;
+	*y = heightField_cellHeight( h, i, j, x, z );
+	return true;
+}
+
+bool heightField_sphereCollides( heightField* h, vector centre, float radius ) {
+	const aabb2d& bb = h->aabb;
+	const float x = centre.coord.x, y = centre.coord.y, z = centre.coord.z;
+	if ( x < bb.x_min - radius || x > bb.x_max + radius || z < bb.z_min - radius || z > bb.z_max + radius || y - radius > h->maxHeight )
+		return false;
+	int i, j;
+	const bool over = heightField_cell( h, x, z, &i, &j );
+	if ( over && y <= heightField_cellHeight( h, i, j, x, z ))
+		return true;
+	if ( radius <= 0.f )
+		return false;
+
+	// The cells under the corners of its bounding square bound those it reaches, give or take a cell of warp
+	int iMin = i, iMax = i, jMin = j, jMax = j;
+	for ( int corner = 0; corner < 4; ++corner ) {
+		int ci, cj;
+		heightField_cell( h, x + ( corner & 1 ? radius : -radius ), z + ( corner & 2 ? radius : -radius ), &ci, &cj );
+		iMin = min( iMin, ci );
+		iMax = max( iMax, ci );
+		jMin = min( jMin, cj );
+		jMax = max( jMax, cj );
+	}
+	const float radius_sq = radius * radius;
+	const float c[3] = { x, y, z };
+	for ( int jj = max( 0, jMin - 1 ); jj <= min( h->z_samples - 2, jMax + 1 ); ++jj )
+		for ( int ii = max( 0, iMin - 1 ); ii <= min( h->x_samples - 2, iMax + 1 ); ++ii ) {
+			if ( y - radius > heightField_cellRange( h, ii, jj ).max )
+				continue;
+			if ( heightField_cellTouchesSphere( h, ii, jj, c, radius_sq ))
+				return true;
+		}
+	return false;
+}
+
+// Where the ray next crosses into the field through its border, no earlier than MIN_T, and which cell it's then in
+static bool heightField_rayEntry( heightField* h, const float* origin, const float* dir, float min_t, float max_t, float* t_entry, int* x_out, int* z_out ) {
+	const int xCells = h->x_samples - 1, zCells = h->z_samples - 1;
+	bool found = false;
+	// Each border edge with the cell inside it: along the z == 0 and z == zCells rows, then the x == 0 and x == xCells columns
+	for ( int side = 0; side < 4; ++side ) {
+		const int count = side < 2 ? xCells : zCells;
+		for ( int k = 0; k < count; ++k ) {
+			const float* e0, *e1;
+			int i, j;
+			// Which side of the edge as given the field is on, as terrainElements_fill winds the border cells
+			const float inward = ( side == 0 || side == 3 ) ? h->orientation : -h->orientation;
+			if ( side < 2 ) {
+				j = side == 0 ? 0 : zCells;
+				e0 = heightField_position( h, k, j );
+				e1 = heightField_position( h, k + 1, j );
+				i = k;
+				j = side == 0 ? 0 : zCells - 1;
+			} else {
+				i = side == 2 ? 0 : xCells;
+				e0 = heightField_position( h, i, k );
+				e1 = heightField_position( h, i, k + 1 );
+				i = side == 2 ? 0 : xCells - 1;
+				j = k;
+			}
+			// Solve origin + dir * t == e0 + ( e1 - e0 ) * s in x-z
+			const float ex = e1[0] - e0[0], ez = e1[2] - e0[2];
+			const float denom = dir[0] * ez - dir[2] * ex;
+			if ( inward * denom >= 0.f ) // Parallel, or leaving
+				continue;
+			const float ox = e0[0] - origin[0], oz = e0[2] - origin[2];
+			const float t = ( ox * ez - oz * ex ) / denom;
+			const float s = ( ox * dir[2] - oz * dir[0] ) / denom;
+			if ( s < 0.f || s > 1.f || t < min_t || t > max_t || ( found && t >= *t_entry ))
+				continue;
+			found = true;
+			*t_entry = t;
+			*x_out = i;
+			*z_out = j;
+		}
+	}
+	return found;
+}
+
+/* A 2D DDA across the grid: step from cell to cell through whichever edge the ray leaves by, so cells are
+   visited in order along it and the first hit is the nearest. The warped grid means the exit edge comes from
+   clipping against the cell's edges rather than stepping fixed increments, but on a regular grid it's the same
+   walk. Cells the ray passes wholly above the height range of are skipped without testing their triangles, and
+   a ray already climbing above the whole field stops. Leaving through the border needn't be the end, as warping
+   can leave the border concave */
+bool heightField_raycast( heightField* h, vector origin_v, vector dir_v, float max_t, float* hit_t ) {
+	const float origin[3] = { origin_v.coord.x, origin_v.coord.y, origin_v.coord.z };
+	const float dir[3] = { dir_v.coord.x, dir_v.coord.y, dir_v.coord.z };
+	const terrainHeightGrid* g = h->grid;
+	const heightRange root = terrainHeightGrid_range( g, g->levels - 1, 0, 0 );
+	if ( fminf( origin[1], origin[1] + dir[1] * max_t ) > root.max )
+		return false;
+
+	float t = max_t;
+	if ( h->folded ) {
+		// No one cell under each point to walk between, so try every cell in the leaves the ray's bounds overlap
+		const float end[3] = { origin[0] + dir[0] * max_t, origin[1] + dir[1] * max_t, origin[2] + dir[2] * max_t };
+		const aabb2d ray_bounds = Aabb2d( fminf( origin[0], end[0] ), fmaxf( origin[0], end[0] ), fminf( origin[2], end[2] ), fmaxf( origin[2], end[2] ));
+		const float y_min = fminf( origin[1], end[1] );
+		const int leaves_u = g->level_u[0], leaves_v = g->level_v[0];
+		bool hit = false;
+		for ( int lv = 0; lv < leaves_v; ++lv )
+			for ( int lu = 0; lu < leaves_u; ++lu ) {
+				const aabb2d& bb = h->leaf_bounds[lu + lv * leaves_u];
+				if ( y_min > terrainHeightGrid_range( g, 0, lu, lv ).max || bb.x_max < ray_bounds.x_min || bb.x_min > ray_bounds.x_max ||
+						bb.z_max < ray_bounds.z_min || bb.z_min > ray_bounds.z_max )
+					continue;
+				for ( int j = lv * kHeightGridLeafCells; j < min( ( lv + 1 ) * kHeightGridLeafCells, h->z_samples - 1 ); ++j )
+					for ( int i = lu * kHeightGridLeafCells; i < min( ( lu + 1 ) * kHeightGridLeafCells, h->x_samples - 1 ); ++i )
+						hit = heightField_cellRaycast( h, i, j, origin, dir, &t ) || hit;
+			}
+		if ( hit )
+			*hit_t = t;
+		return hit;
+	}
+
+	int i, j;
+	float t_in = 0.f;
+	if ( !heightField_cell( h, origin[0], origin[2], &i, &j ) &&
+			!heightField_rayEntry( h, origin, dir, 0.f, max_t, &t_in, &i, &j ))
+		return false;
+
+	const float o = h->orientation;
+	const int xCells = h->x_samples - 1, zCells = h->z_samples - 1;
+	for ( int step = 0; step < 4 * ( xCells + zCells ); ++step ) {
+		const float* a = heightField_position( h, i, j );
+		const float* b = heightField_position( h, i + 1, j );
+		const float* c = heightField_position( h, i, j + 1 );
+		const float* d = heightField_position( h, i + 1, j + 1 );
+		// Leave by the outward-facing edge the ray crosses first
+		const float* edges[4][2] = { { a, b }, { b, d }, { d, c }, { c, a } };
+		const int stepX[4] = { 0, 1, 0, -1 };
+		const int stepZ[4] = { -1, 0, 1, 0 };
+		float t_out = max_t;
+		int exit = -1;
+		for ( int e = 0; e < 4; ++e ) {
+			const float* e0 = edges[e][0], *e1 = edges[e][1];
+			const float slope = o * (( e1[0] - e0[0] ) * dir[2] - ( e1[2] - e0[2] ) * dir[0] );
+			if ( slope >= 0.f )
+				continue;
+			const float crossing = -o * cross2d( e0, e1, origin[0], origin[2] ) / slope;
+			if ( crossing < t_out ) {
+				t_out = crossing;
+				exit = e;
+			}
+		}
+
+		const float y_in = origin[1] + dir[1] * t_in, y_out = origin[1] + dir[1] * t_out;
+		if ( fminf( y_in, y_out ) <= heightField_cellRange( h, i, j ).max && heightField_cellRaycast( h, i, j, origin, dir, &t )) {
+			*hit_t = t;
+			return true;
+		}
+		if ( exit < 0 || ( dir[1] >= 0.f && y_out > root.max ))
+			return false;
+		i += stepX[exit];
+		j += stepZ[exit];
+		t_in = t_out;
+		if (( i < 0 || j < 0 || i >= xCells || j >= zCells ) && !heightField_rayEntry( h, origin, dir, t_out, max_t, &t_in, &i, &j ))
+			return false;
+	}
+	return false;
+}
+
+#if UNIT_TEST
+bool heightField_collidesBrute( heightField* h, vector point ) {
 	//vector_printf( "Testing heightfield against point: ", &point );
 	// Check every possible polygon?
 	for ( int i = 0; i < h->x_samples - 1; i++ ) {
@@ -723,22 +1130,12 @@ bool heightField_collides( heightField* h, vector point ) {
 			vector c = heightField_vertex( h, i, j+1 );
 			vector d = heightField_vertex( h, i+1, j+1 );
 
-			// Temp AABB check to weed out triangles for debugging
+			// AABB check to weed out triangles; the grid is warped, so take all four corners
 			aabb2d aabb;
-			/*
 			aabb.x_max = fmaxf( a.coord.x, fmaxf( b.coord.x, fmaxf( c.coord.x, d.coord.x )));
 			aabb.x_min = fminf( a.coord.x, fminf( b.coord.x, fminf( c.coord.x, d.coord.x )));
 			aabb.z_max = fmaxf( a.coord.z, fmaxf( b.coord.z, fmaxf( c.coord.z, d.coord.z )));
 			aabb.z_min = fminf( a.coord.z, fminf( b.coord.z, fminf( c.coord.z, d.coord.z )));
-			*/
-			// We know that +ve i correlates with +ve x, and same for j and z
-			//aabb.x_max = fmaxf( a.coord.x, fmaxf( b.coord.x, fmaxf( c.coord.x, d.coord.x )));
-			//aabb.x_min = fminf( a.coord.x, fminf( b.coord.x, fminf( c.coord.x, d.coord.x )));
-			aabb.x_max = fmaxf( a.coord.x, c.coord.x );
-			aabb.x_min = fminf( b.coord.x, d.coord.x );
-			aabb.z_max = fmaxf( c.coord.z, d.coord.z );
-			aabb.z_min = fminf( a.coord.z, b.coord.z );
-			//printf( "aabb: %.2f -> %.2f, %.2f -> %.2f\n", aabb.x_min, aabb.x_max, aabb.z_min, aabb.z_max );
 			if ( !AABBcontains( aabb, point.coord.x, point.coord.z ))
 				 continue;
 
@@ -757,11 +1154,33 @@ bool heightField_collides( heightField* h, vector point ) {
 	return false;
 }
 
+bool heightField_sphereCollidesBrute( heightField* h, vector centre, float radius ) {
+	if ( heightField_collidesBrute( h, centre ))
+		return true;
+	const float c[3] = { centre.coord.x, centre.coord.y, centre.coord.z };
+	for ( int i = 0; i < h->x_samples - 1; i++ )
+		for ( int j = 0; j < h->z_samples - 1; j++ )
+			if ( heightField_cellTouchesSphere( h, i, j, c, radius * radius ))
+				return true;
+	return false;
+}
+
+bool heightField_raycastBrute( heightField* h, vector origin_v, vector dir_v, float max_t, float* hit_t ) {
+	const float origin[3] = { origin_v.coord.x, origin_v.coord.y, origin_v.coord.z };
+	const float dir[3] = { dir_v.coord.x, dir_v.coord.y, dir_v.coord.z };
+	float t = max_t;
+	bool hit = false;
+	for ( int i = 0; i < h->x_samples - 1; i++ )
+		for ( int j = 0; j < h->z_samples - 1; j++ )
+			hit = heightField_cellRaycast( h, i, j, origin, dir, &t ) || hit;
+	if ( hit )
+		*hit_t = t;
+	return hit;
+}
+#endif // UNIT_TEST
+
 // Do a collision test between a sphere and a heightfield
 bool collisionFunc_SphereHeightfield( shape* sphere_shape, shape* height_shape, matrix matrix_sphere, matrix matrix_heightfield ) {
-	// For now, assuming that the sphere is actually a point
-	// TODO - take into account the radius
-
 	// Translate the sphere into heightfield space
 	/*
 	matrix sphere_to_height;
@@ -770,14 +1189,9 @@ bool collisionFunc_SphereHeightfield( shape* sphere_shape, shape* height_shape,
 	matrix_mul( sphere_to_height, inv_b, matrix_sphere );
 	vector sphere_position = matrix_vecMul( sphere_to_height, &sphere_shape->origin );
 	*/
-	(void)sphere_shape;
 	(void)matrix_heightfield;
 	vector sphere_position = *matrix_getTranslation( matrix_sphere );
-
-	// Check that the sphere is actually over the heightfield
-	bool collides = heightField_contains( height_shape->height_field, sphere_position );
-	collides = collides && heightField_collides( height_shape->height_field, sphere_position );
-	return collides;
+	return heightField_sphereCollides( height_shape->height_field, sphere_position, sphere_shape->radius );
 }
 
 bool collisionFunc_HeightfieldSphere( shape* height_shape, shape* sphere_shape, matrix matrix_heightfield, matrix matrix_sphere ) {
@@ -791,29 +1205,33 @@ shape* shape_heightField_create( heightField* h ) {
 	return s;
 }
 
-heightField* heightField_create( float width, float length, int x_samples, int z_samples) {
+heightField* heightField_create( float width, float length, terrainHeightGrid* grid ) {
 	heightField* h = (heightField*)mem_alloc( sizeof( heightField ));
 	memset( h, 0, sizeof( heightField ));
 	h->width = width;
 	h->length = length;
-	h->x_samples = x_samples;
-	h->z_samples = z_samples;
-	h->vert_count = x_samples * z_samples;
-	h->verts = (vector*)mem_alloc( sizeof( h->verts[0] ) * h->vert_count );
+	h->x_samples = grid->u_samples;
+	h->z_samples = grid->v_samples;
+	h->grid = grid;
+	terrainHeightGrid_take( grid );
+	heightField_calculateAABB( h );
+	heightField_calculateCells( h );
 	return h;
 }
 
 void heightField_delete( heightField* h ) {
 	vAssert( h );
-	vAssert( h->verts );
-	mem_free( h->verts );
+	vAssert( h->grid );
+	terrainHeightGrid_release( h->grid );
+	if ( h->leaf_bounds )
+		mem_free( h->leaf_bounds );
 	mem_free( h );
 }
 
 void shape_delete( shape* s ) {
 	if ( s->type == shapeHeightField ) {
 		vAssert( s->height_field );
-		mem_free( s->height_field );
+		heightField_delete( s->height_field );
 	}
 	mem_free( s );
 }
@@ -829,19 +1247,20 @@ aabb2d sphereAabb2d( shape* sphere, transform* t ) {
 
 #if UNIT_TEST
 void test_heightField() {
-	heightField* h = heightField_create( 10.f, 8.f, 2, 2 );
-	(void)h;
-	h->verts[0].coord.y = 2.f; // Near corner
-	h->verts[1].coord.y = 1.f;
-	h->verts[2].coord.y = 0.f;
-	h->verts[3].coord.y = -2.f; // Far corner
+	const vector verts[4] = { Vector( -5.f, 2.f, -4.f, 1.f ),	// Near corner
+								Vector( 5.f, 1.f, -4.f, 1.f ),
+								Vector( -5.f, 0.f, 4.f, 1.f ),
+								Vector( 5.f, -2.f, 4.f, 1.f ) };	// Far corner
+	terrainHeightGrid* grid = terrainHeightGrid_create( verts, 2, 2, 2 );
+	heightField* h = heightField_create( 10.f, 8.f, grid );
+	terrainHeightGrid_release( grid );
 
 	{
 		float y;
 		y = heightField_sample( h, -5.f, -4.f );
-		test( ( y == h->verts[0].coord.y ), "heightField Sample near corner success", "heightField Sample near corner failure" );
+		test( ( y == verts[0].coord.y ), "heightField Sample near corner success", "heightField Sample near corner failure" );
 		y = heightField_sample( h, 4.99999f, 3.99999f );
-		test( ( f_eq( y, h->verts[3].coord.y ) ), "heightField Sample far corner success", "heightField Sample far corner failure" );
+		test( ( f_eq( y, verts[3].coord.y ) ), "heightField Sample far corner success", "heightField Sample far corner failure" );
 	}
 
 	{
@@ -879,11 +1298,13 @@ body* body_create( shape* s, transform* t ) {
 	b->_shape = s;
 	b->trans = t;
 	b->disabled = false;
+	b->broadphase_proxy = -1;
 	return b;
 }
 
 void collision_init() {
 	body_count = 0;
+	collision_broadphase = broadphase_create( collision_broadphase_type );
 	collision_clearEvents();
 	collision_initCollisionFuncs();
 	//collision_dead_body_queue = ringQueue_create( kDeadBodyQueueSize );
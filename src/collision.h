@@ -14,6 +14,7 @@
 #define kCollisionLayerEnemy	2
 #define kCollisionLayerBullet	4
 #define kCollisionLayerTerrain	8
+#define kCollisionLayers		8	// One per bit of collision_layers_t
 
 enum shapeType {
 	shapeInvalid,
@@ -37,10 +38,15 @@ typedef struct heightField_s {
 	int z_samples;		// How many verts long the field is
 	float width;		// How wide (in game units) - X - the field is
 	float length;		// How long (in game units) - Z - the field is
-	vector *verts;
-	int vert_count;
+	terrainHeightGrid* grid;	// Shared, not copied; the heightField holds a ref
 	aabb2d	aabb;
 	float	maxHeight;
+	// For finding cells directly, since the grid is regular in canyon space but warped in x-z
+	float	orientation;		// +1 if cells wind anticlockwise in x-z going u then v, else -1
+	float	guess_origin[2];	// x-z of sample (0,0)
+	float	guess_inverse[4];	// Inverse of the mean cell axes; a first guess at the cell under a point
+	bool	folded;				// Some cells wind backwards, where a tight bend folds the grid over itself in x-z
+	aabb2d*	leaf_bounds;		// If folded, the x-z bounds of each of the grid's level 0 leaves
 } heightField;
 
 typedef struct shape_s {
@@ -68,6 +74,7 @@ struct body_s {
 	collisionCallback callback;
 	void* callback_data;
 	bool disabled;
+	int broadphase_proxy;	// Owned by the broadphase; -1 when not in one
 };
 
 typedef struct collisionEvent_s {
@@ -77,6 +84,16 @@ typedef struct collisionEvent_s {
 
 typedef bool (*collideFunc)( shape* a, shape* b, matrix matrix_a, matrix matrix_b );
 
+// What the last tick did; read it after collision_processResults
+typedef struct collisionStats_s {
+	int bodies;
+	int layer_pairs;		// Pairs of occupied layers that interact, so were searched
+	int bounds_tests;		// By the broadphase
+	int pairs_tested;		// By the narrowphase
+	long long pairs_culled;	// By layer: those in layers that don't interact, then candidates that don't collide with each other's layers
+	int events;
+} collisionStats;
+
 // Initialize the collision system
 void collision_init();
 
@@ -84,6 +101,14 @@ void collision_init();
 void collision_addBody( body* b );
 void collision_removeBody( body* b );
 
+// Which broadphase finds candidate pairs (see collision/broadphase.h); takes effect from the next tick
+void collision_setBroadphase( int type );
+// How many worker tasks may help test the pairs (see collision/narrowphase.h); 0 tests them all on the collision thread
+void collision_setNarrowphaseHelpers( int helpers );
+
+void collision_stats( collisionStats* stats );
+void collision_printStats( FILE* out, const collisionStats* stats );
+
 // Check for any collisions this frame
 void collision_tick( int frame_counter, float dt );
 // Tick but on worker thread
@@ -99,17 +124,38 @@ bool body_collidedBody( body* a, body* b );
 
 // Test if these bodies collided (only used by collision code)
 bool body_colliding( body* a, body* b );
+bool shape_colliding( shape* a, shape* b, matrix matrix_a, matrix matrix_b );
+
+// Does either body collide with the other's layers
+static inline bool body_layersCollide( const body* a, const body* b ) {
+	return (( a->collide_with & b->layers ) | ( a->layers & b->collide_with )) != 0;
+}
 
 body* body_create( shape* s, transform* t );
 shape* sphere_create( float radius );
 shape* mesh_createFromRenderMesh( mesh* render_mesh );
 void heightField_delete( heightField* h );
-heightField* heightField_create( float width, float length, int x_samples, int z_samples);
+heightField* heightField_create( float width, float length, terrainHeightGrid* grid );
 shape* shape_heightField_create( heightField* h );
 void heightField_calculateAABB( heightField* h );
 
+// The surface height under (X,Z) into Y, if the field covers it
+bool heightField_height( heightField* h, float x, float z, float* y );
+// Is POINT on or under the field's surface; finds the cell under it directly
+bool heightField_collides( heightField* h, vector point );
+// Does the sphere at CENTRE touch or sit under the field's surface
+bool heightField_sphereCollides( heightField* h, vector centre, float radius );
+// The first hit along ORIGIN + DIR * t, for t in [0, MAX_T]; walks the cells the ray crosses in order
+bool heightField_raycast( heightField* h, vector origin, vector dir, float max_t, float* hit_t );
+
 aabb2d sphereAabb2d( shape* sphere, transform* t );
 
 // Unit tests
 void test_collision();
+#if UNIT_TEST
+// Testing every cell, for checking the above against
+bool heightField_collidesBrute( heightField* h, vector point );
+bool heightField_sphereCollidesBrute( heightField* h, vector centre, float radius );
+bool heightField_raycastBrute( heightField* h, vector origin, vector dir, float max_t, float* hit_t );
+#endif // UNIT_TEST
 
@@ -0,0 +1,912 @@
+// broadphase.c
+#include "common.h"
+#include "broadphase.h"
+//---------------------
+#include "test.h"
+#include "transform.h"
+#include "vtime.h"
+#include "collision/quadtree.h"
+#include "maths/geometry.h"
+#include "mem/allocator.h"
+#if UNIT_TEST
+#include "bench.h"
+#endif // UNIT_TEST
+
+typedef struct broadphaseProxy_s {
+	body* b;
+	aabb2d bb;
+	int bucket;		// Grid: the bucket it's filed in, or -1 if it's too big to file
+} broadphaseProxy;
+
+typedef struct gridBucket_s {
+	int* proxies;
+	int count;
+	int capacity;
+} gridBucket;
+
+// Sweep: a proxy and its bounds along the axis, kept together so sorting and sweeping stay in one array
+typedef struct sweepKey_s {
+	float start;
+	float end;
+	int proxy;
+} sweepKey;
+
+// QuadTree: a pair of entries, kept this update if stamped with the current stamp
+typedef struct pairSeen_s {
+	long long key;
+	int stamp;
+} pairSeen;
+
+// A body, and where it's filed in each of its layers
+typedef struct broadphaseEntry_s {
+	body* b;
+	collision_layers_t filed;		// The layers it's filed under, to spot it changing layer
+	int proxies[kCollisionLayers];	// Its proxy in each of those
+} broadphaseEntry;
+
+// The bodies in one collision layer
+typedef struct broadphaseLayer_s {
+	broadphaseProxy* proxies;
+	int count;
+	int capacity;
+
+	// Sweep
+	sweepKey* order;	// Sorted by start
+	int order_capacity;
+
+	// Grid
+	gridBucket* buckets;	// Allocated when the layer first gets a body
+	float reach;	// The furthest any filed body's bounds reach from its centre
+	int* large;		// The proxies too big to file, in index order
+	int large_count;
+	int large_capacity;
+} broadphaseLayer;
+
+struct broadphase_s {
+	int type;
+	broadphaseEntry* entries;
+	int count;
+	int capacity;
+	broadphaseLayer layers[kCollisionLayers];
+	collision_layers_t interacts[kCollisionLayers];	// Per layer, the layers it can collide with
+	collisionEvent* pairs;
+	int pair_count;
+	int pair_capacity;
+	broadphaseStats stats;
+
+	// Sweep
+	int axis;		// 0 for x, 1 for z; shared by every layer, so two layers' orders can be merged
+
+	// Grid
+	int* visited;	// Per bucket, the last visit stamp, so each bucket is searched once per query
+	int stamp;		// Also the quadtree's, for SEEN
+
+	// QuadTree
+	pairSeen* seen;	// Open-addressed set of the pairs kept this update, so one sharing several leaves is kept once
+	int seen_capacity;
+};
+
+aabb2d body_bounds( body* b ) {
+	shape* s = b->_shape;
+	switch ( s->type ) {
+		case shapeSphere:
+			return sphereAabb2d( s, b->trans );
+		case shapeHeightField:
+			return s->height_field->aabb;
+		case shapeInvalid:
+		case shapeMesh:
+			// TODO - bounds for meshes
+			NYI;
+			break;
+	}
+	return Aabb2d( -20.f, -5.f, -20.f, -5.f );
+}
+
+// *** Storage
+
+// Grow an array of ELEMENT-byte items to hold at least COUNT
+static void* broadphase_grow( void* items, int* capacity, int count, size_t element ) {
+	if ( count <= *capacity )
+		return items;
+	const int grown = max( count, max( 16, *capacity * 2 ));
+	void* bigger = mem_alloc( element * grown );
+	if ( items ) {
+		memcpy( bigger, items, element * *capacity );
+		mem_free( items );
+	}
+	*capacity = grown;
+	return bigger;
+}
+
+static inline broadphaseEntry* broadphase_entry( broadphase* bp, const broadphaseProxy* proxy ) {
+	return &bp->entries[proxy->b->broadphase_proxy];
+}
+
+/* A body in several layers can meet another in more than one interacting pair of layers; the pair is only kept
+   from the first of those, in the order update searches them - I, then J from I up. (Within the one pair of
+   layers, two bodies both in both would meet twice, once each way round; broadphase_addPair keeps one of those) */
+static bool broadphase_firstLayerPair( const broadphase* bp, collision_layers_t a, collision_layers_t b, int i, int j ) {
+	for ( int ii = 0; ii <= i; ++ii )
+		for ( int jj = ii; jj < ( ii == i ? j : kCollisionLayers ); ++jj )
+			if (( bp->interacts[ii] & ( 1 << jj )) &&
+					((( a >> ii ) & ( b >> jj ) & 1 ) || (( a >> jj ) & ( b >> ii ) & 1 )))
+				return false;
+	return true;
+}
+
+// Pair P, in layer I, with Q, in layer J
+static void broadphase_addPair( broadphase* bp, const broadphaseProxy* p, const broadphaseProxy* q, int i, int j ) {
+	if ( p->b == q->b )
+		return; // A body in both layers, meeting itself
+	const collision_layers_t a = broadphase_entry( bp, p )->filed, b = broadphase_entry( bp, q )->filed;
+	if (( a & ( a - 1 )) | ( b & ( b - 1 ))) {
+		if ( !broadphase_firstLayerPair( bp, a, b, min( i, j ), max( i, j )))
+			return;
+		// Kept the way round that has the body with the lower entry in the lower layer
+		const body* lower = i < j ? p->b : q->b;
+		const body* higher = i < j ? q->b : p->b;
+		if ( i != j && ( a & ( 1 << j )) && ( b & ( 1 << i )) && lower->broadphase_proxy > higher->broadphase_proxy )
+			return;
+	}
+	bp->pairs = (collisionEvent*)broadphase_grow( bp->pairs, &bp->pair_capacity, bp->pair_count + 1, sizeof( collisionEvent ));
+	collisionEvent* pair = &bp->pairs[bp->pair_count++];
+	pair->a = p->b;
+	pair->b = q->b;
+}
+
+static inline bool broadphase_overlap( broadphase* bp, const broadphaseProxy* p, const broadphaseProxy* q ) {
+	++bp->stats.bounds_tests;
+	return overlap( p->bb, q->bb ) && !p->b->disabled && !q->b->disabled; // Bounds first; they're already to hand
+}
+
+// *** Grid
+
+static inline int grid_cellCoord( float f ) { return (int)floorf( f * ( 1.f / kBroadphaseGridCell )); }
+
+static inline int grid_bucket( int x, int z ) {
+	return (int)(( (unsigned)x * 73856093u ) ^ ( (unsigned)z * 19349663u )) & ( kBroadphaseGridBuckets - 1 );
+}
+
+static bool grid_large( const aabb2d& bb ) {
+	return bb.x_max - bb.x_min > kBroadphaseGridCell || bb.z_max - bb.z_min > kBroadphaseGridCell;
+}
+
+static int grid_bucketFor( const aabb2d& bb ) {
+	if ( grid_large( bb ))
+		return -1;
+	return grid_bucket( grid_cellCoord(( bb.x_min + bb.x_max ) * 0.5f ), grid_cellCoord(( bb.z_min + bb.z_max ) * 0.5f ));
+}
+
+static void grid_file( broadphaseLayer* layer, int proxy ) {
+	const int i = layer->proxies[proxy].bucket;
+	if ( i < 0 )
+		return;
+	gridBucket* bucket = &layer->buckets[i];
+	bucket->proxies = (int*)broadphase_grow( bucket->proxies, &bucket->capacity, bucket->count + 1, sizeof( int ));
+	bucket->proxies[bucket->count++] = proxy;
+}
+
+static void grid_unfile( broadphaseLayer* layer, int proxy ) {
+	const int i = layer->proxies[proxy].bucket;
+	if ( i < 0 )
+		return;
+	gridBucket* bucket = &layer->buckets[i];
+	for ( int k = 0; k < bucket->count; ++k )
+		if ( bucket->proxies[k] == proxy ) {
+			bucket->proxies[k] = bucket->proxies[--bucket->count];
+			return;
+		}
+	vAssert( false );
+}
+
+// Refile only those that moved cell, and note the big ones and how far the filed ones reach
+static void grid_refresh( broadphaseLayer* layer ) {
+	layer->reach = 0.f;
+	layer->large_count = 0;
+	for ( int p = 0; p < layer->count; ++p ) {
+		broadphaseProxy* proxy = &layer->proxies[p];
+		proxy->bb = body_bounds( proxy->b );
+		const int bucket = grid_bucketFor( proxy->bb );
+		if ( bucket != proxy->bucket ) {
+			grid_unfile( layer, p );
+			proxy->bucket = bucket;
+			grid_file( layer, p );
+		}
+		if ( bucket >= 0 )
+			layer->reach = fmaxf( layer->reach, fmaxf( proxy->bb.x_max - proxy->bb.x_min, proxy->bb.z_max - proxy->bb.z_min ) * 0.5f );
+		else {
+			layer->large = (int*)broadphase_grow( layer->large, &layer->large_capacity, layer->large_count + 1, sizeof( int ));
+			layer->large[layer->large_count++] = p;
+		}
+	}
+}
+
+/* Pair proxy P of layer I with layer J's filed proxies that could overlap it: a filed body overlapping P has its
+   centre within J's reach of P's bounds, so those are the only cells to look in. Within one layer, only those
+   after P if P is filed too, so each pair of filed proxies is found once */
+static void grid_pairWithCells( broadphase* bp, int i, int p, int j ) {
+	const broadphaseLayer* other = &bp->layers[j];
+	const broadphaseProxy* proxy = &bp->layers[i].proxies[p];
+	const bool after = i == j && proxy->bucket >= 0;
+	const aabb2d& bb = proxy->bb;
+	const int x0 = grid_cellCoord( bb.x_min - other->reach ), z0 = grid_cellCoord( bb.z_min - other->reach );
+	const int x1 = grid_cellCoord( bb.x_max + other->reach ), z1 = grid_cellCoord( bb.z_max + other->reach );
+	++bp->stamp;
+	for ( int z = z0; z <= z1; ++z )
+		for ( int x = x0; x <= x1; ++x ) {
+			const int k = grid_bucket( x, z );
+			if ( bp->visited[k] == bp->stamp )
+				continue;
+			bp->visited[k] = bp->stamp;
+			const gridBucket* bucket = &other->buckets[k];
+			for ( int n = 0; n < bucket->count; ++n ) {
+				const int q = bucket->proxies[n];
+				if (( !after || q > p ) && broadphase_overlap( bp, proxy, &other->proxies[q] ))
+					broadphase_addPair( bp, proxy, &other->proxies[q], i, j );
+			}
+		}
+}
+
+// Pair big proxy P of layer I with layer J's big ones; only those after it, within one layer
+static void grid_pairLarge( broadphase* bp, int i, int p, int j ) {
+	const broadphaseLayer* other = &bp->layers[j];
+	const broadphaseProxy* proxy = &bp->layers[i].proxies[p];
+	for ( int n = 0; n < other->large_count; ++n ) {
+		const int q = other->large[n];
+		if (( i != j || q > p ) && broadphase_overlap( bp, proxy, &other->proxies[q] ))
+			broadphase_addPair( bp, proxy, &other->proxies[q], i, j );
+	}
+}
+
+static void grid_pairWithin( broadphase* bp, int i ) {
+	const broadphaseLayer* layer = &bp->layers[i];
+	for ( int p = 0; p < layer->count; ++p ) {
+		if ( layer->proxies[p].b->disabled )
+			continue;
+		grid_pairWithCells( bp, i, p, i );
+		if ( layer->proxies[p].bucket < 0 )
+			grid_pairLarge( bp, i, p, i );
+	}
+}
+
+// Every proxy of the smaller layer looks in the other's grid; the other's big ones, which aren't filed, look back
+static void grid_pairBetween( broadphase* bp, int i, int j ) {
+	const int small = bp->layers[i].count <= bp->layers[j].count ? i : j;
+	const int big = small == i ? j : i;
+	const broadphaseLayer* layer = &bp->layers[small];
+	for ( int p = 0; p < layer->count; ++p ) {
+		if ( layer->proxies[p].b->disabled )
+			continue;
+		grid_pairWithCells( bp, small, p, big );
+		if ( layer->proxies[p].bucket < 0 )
+			grid_pairLarge( bp, small, p, big );
+	}
+	const broadphaseLayer* other = &bp->layers[big];
+	for ( int n = 0; n < other->large_count; ++n )
+		if ( !other->proxies[other->large[n]].b->disabled )
+			grid_pairWithCells( bp, big, other->large[n], small );
+}
+
+// *** Sweep and prune
+
+static inline float sweep_min( const broadphase* bp, const aabb2d& bb ) { return bp->axis == 0 ? bb.x_min : bb.z_min; }
+static inline float sweep_max( const broadphase* bp, const aabb2d& bb ) { return bp->axis == 0 ? bb.x_max : bb.z_max; }
+
+/* Sweep along whichever axis the centres of the bodies in LAYERS vary most; changing axis means a full re-sort,
+   so it takes a clear winner */
+static int sweep_chooseAxis( const broadphase* bp, collision_layers_t layers ) {
+	double sum[2] = { 0.0, 0.0 }, sumSq[2] = { 0.0, 0.0 };
+	int count = 0;
+	for ( int l = 0; l < kCollisionLayers; ++l ) {
+		if ( !( layers & ( 1 << l )))
+			continue;
+		const broadphaseLayer* layer = &bp->layers[l];
+		for ( int p = 0; p < layer->count; ++p ) {
+			const aabb2d& bb = layer->proxies[p].bb;
+			const double centre[2] = { ( bb.x_min + bb.x_max ) * 0.5, ( bb.z_min + bb.z_max ) * 0.5 };
+			for ( int a = 0; a < 2; ++a ) {
+				sum[a] += centre[a];
+				sumSq[a] += centre[a] * centre[a];
+			}
+		}
+		count += layer->count;
+	}
+	if ( count < 2 )
+		return bp->axis;
+	const double variance[2] = { sumSq[0] - sum[0] * sum[0] / count, sumSq[1] - sum[1] * sum[1] / count };
+	const int other = 1 - bp->axis;
+	return variance[other] > variance[bp->axis] * 2.0 ? other : bp->axis;
+}
+
+static void sweep_sort( const broadphase* bp, broadphaseLayer* layer ) {
+	sweepKey* order = layer->order;
+	for ( int i = 0; i < layer->count; ++i ) {
+		const aabb2d& bb = layer->proxies[order[i].proxy].bb;
+		order[i].start = sweep_min( bp, bb );
+		order[i].end = sweep_max( bp, bb );
+	}
+	for ( int i = 1; i < layer->count; ++i ) {
+		const sweepKey key = order[i];
+		int j = i;
+		for ( ; j > 0 && order[j - 1].start > key.start; --j )
+			order[j] = order[j - 1];
+		order[j] = key;
+	}
+}
+
+// Refresh the bounds of the bodies in LAYERS, then sort each of those along the axis
+static void sweep_refresh( broadphase* bp, collision_layers_t layers ) {
+	for ( int l = 0; l < kCollisionLayers; ++l )
+		if ( layers & ( 1 << l )) {
+			broadphaseLayer* layer = &bp->layers[l];
+			for ( int p = 0; p < layer->count; ++p )
+				layer->proxies[p].bb = body_bounds( layer->proxies[p].b );
+		}
+	const int axis = sweep_chooseAxis( bp, layers );
+	if ( axis != bp->axis ) {
+		// Sorted along the other axis is no better than random along this one; start from index order
+		bp->axis = axis;
+		for ( int l = 0; l < kCollisionLayers; ++l )
+			for ( int p = 0; p < bp->layers[l].count; ++p )
+				bp->layers[l].order[p].proxy = p;
+	}
+	for ( int l = 0; l < kCollisionLayers; ++l )
+		if ( layers & ( 1 << l ))
+			sweep_sort( bp, &bp->layers[l] );
+}
+
+static void sweep_pairWithin( broadphase* bp, int l ) {
+	const broadphaseLayer* layer = &bp->layers[l];
+	const sweepKey* order = layer->order;
+	for ( int i = 0; i < layer->count; ++i ) {
+		const float end = order[i].end;
+		if ( i + 1 == layer->count || order[i + 1].start > end )
+			continue;
+		const broadphaseProxy* proxy = &layer->proxies[order[i].proxy];
+		if ( proxy->b->disabled )
+			continue;
+		for ( int j = i + 1; j < layer->count && order[j].start <= end; ++j )
+			if ( broadphase_overlap( bp, proxy, &layer->proxies[order[j].proxy] ))
+				broadphase_addPair( bp, proxy, &layer->proxies[order[j].proxy], l, l );
+	}
+}
+
+// Pair each proxy of layer I with those of layer J that start within it; from STRICTLY after its start, or from it
+static void sweep_pairStarting( broadphase* bp, int i, int j, bool strictly ) {
+	const broadphaseLayer* layer = &bp->layers[i];
+	const broadphaseLayer* other = &bp->layers[j];
+	const sweepKey* order = other->order;
+	int first = 0;
+	for ( int n = 0; n < layer->count; ++n ) {
+		const float start = layer->order[n].start;
+		while ( first < other->count && ( strictly ? order[first].start <= start : order[first].start < start ))
+			++first;
+		const float end = layer->order[n].end;
+		if ( first == other->count || order[first].start > end )
+			continue;
+		const broadphaseProxy* proxy = &layer->proxies[layer->order[n].proxy];
+		if ( proxy->b->disabled )
+			continue;
+		for ( int m = first; m < other->count && order[m].start <= end; ++m )
+			if ( broadphase_overlap( bp, proxy, &other->proxies[order[m].proxy] ))
+				broadphase_addPair( bp, proxy, &other->proxies[order[m].proxy], i, j );
+	}
+}
+
+// Two layers sorted along the same axis merge: each pair is found from whichever body starts first, ties going to I
+static void sweep_pairBetween( broadphase* bp, int i, int j ) {
+	sweep_pairStarting( bp, i, j, false );
+	sweep_pairStarting( bp, j, i, true );
+}
+
+// *** QuadTree
+
+// Whether A and B were already kept this update; if not, they are now
+static bool quadTree_seen( broadphase* bp, const body* a, const body* b ) {
+	const long long lo = min( a->broadphase_proxy, b->broadphase_proxy ), hi = max( a->broadphase_proxy, b->broadphase_proxy );
+	const long long key = ( lo << 32 ) | hi;
+	const int mask = bp->seen_capacity - 1;
+	for ( int i = (int)(( (unsigned)lo * 73856093u ) ^ ( (unsigned)hi * 19349663u )) & mask; ; i = ( i + 1 ) & mask ) {
+		pairSeen* slot = &bp->seen[i];
+		if ( slot->stamp != bp->stamp ) {
+			slot->key = key;
+			slot->stamp = bp->stamp;
+			return false;
+		}
+		if ( slot->key == key )
+			return true;
+	}
+}
+
+// One tree of every body in an interacting layer, its pairs then filtered by layer and deduplicated
+static void quadTree_update( broadphase* bp, collision_layers_t layers ) {
+	QuadTree<body*> tree( Aabb2d( -10000.f, 10000.f, -10000.f, 10000.f ));
+	for ( int e = 0; e < bp->count; ++e )
+		if ( bp->entries[e].filed & layers )
+			tree += bp->entries[e].b;
+	auto pairs = potentialCollisions( &tree );
+	// At most half full, so probes stay short
+	int capacity = 16;
+	while ( capacity < 2 * pairs.size() )
+		capacity *= 2;
+	if ( capacity > bp->seen_capacity ) {
+		if ( bp->seen )
+			mem_free( bp->seen );
+		bp->seen = (pairSeen*)mem_alloc( sizeof( pairSeen ) * capacity );
+		memset( bp->seen, 0, sizeof( pairSeen ) * capacity );
+		bp->seen_capacity = capacity;
+	}
+	++bp->stamp;
+	for ( auto pair : pairs.underlying ) {
+		const collision_layers_t a = bp->entries[pair.a->broadphase_proxy].filed;
+		const collision_layers_t b = bp->entries[pair.b->broadphase_proxy].filed;
+		collision_layers_t partners = 0;
+		for ( int l = 0; l < kCollisionLayers; ++l )
+			if ( a & ( 1 << l ))
+				partners |= bp->interacts[l];
+		++bp->stats.bounds_tests;
+		if (( partners & b ) && !quadTree_seen( bp, pair.a, pair.b )) {
+			bp->pairs = (collisionEvent*)broadphase_grow( bp->pairs, &bp->pair_capacity, bp->pair_count + 1, sizeof( collisionEvent ));
+			bp->pairs[bp->pair_count++] = pair;
+		}
+	}
+}
+
+// *** Layers
+
+static void layer_add( broadphase* bp, int l, body* b ) {
+	broadphaseLayer* layer = &bp->layers[l];
+	layer->proxies = (broadphaseProxy*)broadphase_grow( layer->proxies, &layer->capacity, layer->count + 1, sizeof( broadphaseProxy ));
+	if ( bp->type == BroadphaseSweep )
+		layer->order = (sweepKey*)broadphase_grow( layer->order, &layer->order_capacity, layer->count + 1, sizeof( sweepKey ));
+	const int p = layer->count++;
+	broadphaseProxy* proxy = &layer->proxies[p];
+	proxy->b = b;
+	proxy->bb = body_bounds( b );
+	proxy->bucket = -1;
+	bp->entries[b->broadphase_proxy].proxies[l] = p;
+	if ( bp->type == BroadphaseSweep )
+		layer->order[p].proxy = p; // Sorted into place on the next update
+	else if ( bp->type == BroadphaseGrid ) {
+		if ( !layer->buckets ) {
+			layer->buckets = (gridBucket*)mem_alloc( sizeof( gridBucket ) * kBroadphaseGridBuckets );
+			memset( layer->buckets, 0, sizeof( gridBucket ) * kBroadphaseGridBuckets );
+		}
+		proxy->bucket = grid_bucketFor( proxy->bb );
+		grid_file( layer, p );
+	}
+}
+
+// Swap the layer's last proxy into the removed one's place, fixing up whatever refers to it by index
+static void layer_remove( broadphase* bp, int l, body* b ) {
+	broadphaseLayer* layer = &bp->layers[l];
+	broadphaseEntry* entry = &bp->entries[b->broadphase_proxy];
+	const int p = entry->proxies[l];
+	const int last = layer->count - 1;
+	vAssert( p >= 0 && p <= last && layer->proxies[p].b == b );
+	if ( bp->type == BroadphaseGrid ) {
+		grid_unfile( layer, p );
+		if ( p != last )
+			grid_unfile( layer, last );
+	} else if ( bp->type == BroadphaseSweep ) {
+		int k = 0;
+		for ( int i = 0; i < layer->count; ++i )
+			if ( layer->order[i].proxy != p ) {
+				layer->order[k] = layer->order[i];
+				if ( layer->order[k].proxy == last )
+					layer->order[k].proxy = p;
+				++k;
+			}
+	}
+	if ( p != last ) {
+		layer->proxies[p] = layer->proxies[last];
+		broadphase_entry( bp, &layer->proxies[p] )->proxies[l] = p;
+	}
+	--layer->count;
+	if ( bp->type == BroadphaseGrid && p != last )
+		grid_file( layer, p );
+	entry->proxies[l] = -1;
+}
+
+// Move an entry's body between layers to match LAYERS
+static void broadphase_refile( broadphase* bp, broadphaseEntry* entry, collision_layers_t layers ) {
+	for ( int l = 0; l < kCollisionLayers; ++l ) {
+		const collision_layers_t bit = (collision_layers_t)( 1 << l );
+		if (( entry->filed & bit ) && !( layers & bit ))
+			layer_remove( bp, l, entry->b );
+		else if ( !( entry->filed & bit ) && ( layers & bit ))
+			layer_add( bp, l, entry->b );
+	}
+	entry->filed = layers;
+}
+
+/* Layer I interacts with J if any body in I collides with J, or any in J with I; INTERACTS comes in holding just
+   the first half, each layer's bodies' collide_with. That's per layer, so finer filtering - that an enemy's bullet
+   doesn't hit enemies - is still left to the narrowphase. Returns the layers that interact with any */
+static collision_layers_t broadphase_resolveInteractions( broadphase* bp, collision_layers_t occupied ) {
+	for ( int i = 0; i < kCollisionLayers; ++i )
+		for ( int j = 0; j < kCollisionLayers; ++j )
+			if ( bp->interacts[i] & ( 1 << j ))
+				bp->interacts[j] |= (collision_layers_t)( 1 << i );
+	collision_layers_t interacting = 0;
+	for ( int l = 0; l < kCollisionLayers; ++l ) {
+		bp->interacts[l] = ( occupied & ( 1 << l )) ? bp->interacts[l] & occupied : 0;
+		if ( bp->interacts[l] )
+			interacting |= (collision_layers_t)( 1 << l );
+	}
+	return interacting;
+}
+
+// ***
+
+broadphase* broadphase_create( int type ) {
+	vAssert( type == BroadphaseQuadTree || type == BroadphaseSweep || type == BroadphaseGrid );
+	broadphase* bp = (broadphase*)mem_alloc( sizeof( broadphase ));
+	memset( bp, 0, sizeof( broadphase ));
+	bp->type = type;
+	if ( type == BroadphaseGrid ) {
+		bp->visited = (int*)mem_alloc( sizeof( int ) * kBroadphaseGridBuckets );
+		memset( bp->visited, 0, sizeof( int ) * kBroadphaseGridBuckets );
+	}
+	return bp;
+}
+
+void broadphase_delete( broadphase* bp ) {
+	for ( int l = 0; l < kCollisionLayers; ++l ) {
+		broadphaseLayer* layer = &bp->layers[l];
+		if ( layer->buckets ) {
+			for ( int i = 0; i < kBroadphaseGridBuckets; ++i )
+				if ( layer->buckets[i].proxies )
+					mem_free( layer->buckets[i].proxies );
+			mem_free( layer->buckets );
+		}
+		if ( layer->proxies )
+			mem_free( layer->proxies );
+		if ( layer->order )
+			mem_free( layer->order );
+		if ( layer->large )
+			mem_free( layer->large );
+	}
+	if ( bp->visited )
+		mem_free( bp->visited );
+	if ( bp->seen )
+		mem_free( bp->seen );
+	if ( bp->entries )
+		mem_free( bp->entries );
+	if ( bp->pairs )
+		mem_free( bp->pairs );
+	mem_free( bp );
+}
+
+int broadphase_type( broadphase* bp ) { return bp->type; }
+
+void broadphase_add( broadphase* bp, body* b ) {
+	bp->entries = (broadphaseEntry*)broadphase_grow( bp->entries, &bp->capacity, bp->count + 1, sizeof( broadphaseEntry ));
+	const int e = bp->count++;
+	broadphaseEntry* entry = &bp->entries[e];
+	entry->b = b;
+	entry->filed = 0;
+	for ( int l = 0; l < kCollisionLayers; ++l )
+		entry->proxies[l] = -1;
+	b->broadphase_proxy = e;
+	broadphase_refile( bp, entry, b->layers );
+}
+
+void broadphase_remove( broadphase* bp, body* b ) {
+	const int e = b->broadphase_proxy;
+	const int last = bp->count - 1;
+	vAssert( e >= 0 && e <= last && bp->entries[e].b == b );
+	broadphase_refile( bp, &bp->entries[e], 0 );
+	if ( e != last ) {
+		bp->entries[e] = bp->entries[last];
+		bp->entries[e].b->broadphase_proxy = e;
+	}
+	--bp->count;
+	b->broadphase_proxy = -1;
+}
+
+int broadphase_update( broadphase* bp, const collisionEvent** pairs ) {
+	bp->pair_count = 0;
+	memset( &bp->stats, 0, sizeof( bp->stats ));
+	bp->stats.bodies = bp->count;
+	collision_layers_t occupied = 0;
+	memset( bp->interacts, 0, sizeof( bp->interacts ));
+	for ( int e = 0; e < bp->count; ++e ) {
+		broadphaseEntry* entry = &bp->entries[e];
+		const collision_layers_t layers = entry->b->layers; // Read once; gameplay may set it meanwhile
+		if ( layers != entry->filed )
+			broadphase_refile( bp, entry, layers );
+		for ( int l = 0; l < kCollisionLayers; ++l )
+			if ( layers & ( 1 << l ))
+				bp->interacts[l] |= entry->b->collide_with;
+		occupied |= layers;
+	}
+	const collision_layers_t interacting = broadphase_resolveInteractions( bp, occupied );
+
+	if ( bp->type == BroadphaseSweep )
+		sweep_refresh( bp, interacting );
+	else if ( bp->type == BroadphaseGrid )
+		for ( int l = 0; l < kCollisionLayers; ++l )
+			if ( interacting & ( 1 << l ))
+				grid_refresh( &bp->layers[l] );
+
+	if ( bp->type == BroadphaseQuadTree )
+		quadTree_update( bp, interacting );
+	for ( int i = 0; i < kCollisionLayers; ++i )
+		for ( int j = i; j < kCollisionLayers; ++j ) {
+			const long long ni = bp->layers[i].count, nj = bp->layers[j].count;
+			if ( !( bp->interacts[i] & ( 1 << j ))) {
+				bp->stats.pairs_culled += i == j ? ni * ( ni - 1 ) / 2 : ni * nj;
+				continue;
+			}
+			++bp->stats.layer_pairs;
+			if ( bp->type == BroadphaseSweep ) {
+				if ( i == j )
+					sweep_pairWithin( bp, i );
+				else
+					sweep_pairBetween( bp, i, j );
+			} else if ( bp->type == BroadphaseGrid ) {
+				if ( i == j )
+					grid_pairWithin( bp, i );
+				else
+					grid_pairBetween( bp, i, j );
+			}
+		}
+	bp->stats.pairs = bp->pair_count;
+	*pairs = bp->pairs;
+	return bp->pair_count;
+}
+
+const broadphaseStats* broadphase_stats( broadphase* bp ) { return &bp->stats; }
+
+#if UNIT_TEST
+/* Spheres with their own transforms, in the layouts we bench: spread along a stretch of canyon, or in tight knots
+   like a dogfight or a burst of bullets. Either all in one layer that collides with itself, or layered as in a
+   fight: mostly bullets, both sides', some enemies and a few players, and some that are both enemy and bullet */
+typedef struct broadphaseScene_s {
+	body* bodies;
+	shape* spheres;
+	transform* transforms;
+	vector* velocities;
+	int count;
+	randSeq r;
+} broadphaseScene;
+
+static const float kBroadphaseSceneWidth = 1200.f;
+static const float kBroadphaseSceneLength = 4000.f;
+#define kBroadphaseClusters 8
+
+static void broadphaseScene_setLayers( body* b, int i, bool layered ) {
+	const int kind = i % 20;
+	if ( !layered ) {
+		b->layers = kCollisionLayerEnemy;
+		b->collide_with = kCollisionLayerEnemy;
+	} else if ( kind == 0 ) {
+		b->layers = kCollisionLayerPlayer;
+		b->collide_with = kCollisionLayerEnemy | kCollisionLayerTerrain;
+	} else if ( kind < 6 ) {
+		b->layers = kCollisionLayerEnemy;
+		b->collide_with = kCollisionLayerPlayer;
+	} else if ( kind < 13 ) {
+		b->layers = kCollisionLayerBullet;
+		b->collide_with = kCollisionLayerEnemy | kCollisionLayerTerrain;
+	} else if ( kind < 19 ) {
+		b->layers = kCollisionLayerBullet;
+		b->collide_with = kCollisionLayerPlayer | kCollisionLayerTerrain;
+	} else {
+		b->layers = kCollisionLayerEnemy | kCollisionLayerBullet;
+		b->collide_with = kCollisionLayerPlayer;
+	}
+}
+
+static void broadphaseScene_create( broadphaseScene* s, int count, bool clustered, bool layered, long int seed ) {
+	s->count = count;
+	s->bodies = (body*)mem_alloc( sizeof( body ) * count );
+	s->spheres = (shape*)mem_alloc( sizeof( shape ) * count );
+	s->transforms = (transform*)mem_alloc( sizeof( transform ) * count );
+	s->velocities = (vector*)mem_alloc( sizeof( vector ) * count );
+	memset( s->bodies, 0, sizeof( body ) * count );
+	deterministic_seedRandSeq( seed, &s->r );
+	vector clusters[kBroadphaseClusters];
+	for ( int c = 0; c < kBroadphaseClusters; ++c )
+		clusters[c] = Vector( deterministic_frand( &s->r, -0.5f, 0.5f ) * kBroadphaseSceneWidth, 0.f,
+								deterministic_frand( &s->r, 0.f, kBroadphaseSceneLength ), 1.f );
+	for ( int i = 0; i < count; ++i ) {
+		vector position;
+		if ( clustered ) {
+			const vector& c = clusters[i % kBroadphaseClusters];
+			position = Vector( c.coord.x + deterministic_frand( &s->r, -40.f, 40.f ), 0.f, c.coord.z + deterministic_frand( &s->r, -40.f, 40.f ), 1.f );
+		} else
+			position = Vector( deterministic_frand( &s->r, -0.5f, 0.5f ) * kBroadphaseSceneWidth, 0.f, deterministic_frand( &s->r, 0.f, kBroadphaseSceneLength ), 1.f );
+		transform* t = &s->transforms[i];
+		matrix_setIdentity( t->world );
+		matrix_setTranslation( t->world, &position );
+		s->spheres[i].type = shapeSphere;
+		s->spheres[i].radius = deterministic_frand( &s->r, 0.5f, 6.f );
+		s->spheres[i].origin = Vector( 0.f, 0.f, 0.f, 1.f );
+		s->bodies[i]._shape = &s->spheres[i];
+		s->bodies[i].trans = t;
+		s->bodies[i].broadphase_proxy = -1;
+		broadphaseScene_setLayers( &s->bodies[i], i, layered );
+		s->velocities[i] = Vector( deterministic_frand( &s->r, -2.f, 2.f ), 0.f, deterministic_frand( &s->r, -2.f, 2.f ), 0.f );
+	}
+}
+
+static void broadphaseScene_delete( broadphaseScene* s ) {
+	mem_free( s->bodies );
+	mem_free( s->spheres );
+	mem_free( s->transforms );
+	mem_free( s->velocities );
+}
+
+static void broadphaseScene_step( broadphaseScene* s ) {
+	for ( int i = 0; i < s->count; ++i ) {
+		vector position = vector_add( *matrix_getTranslation( s->transforms[i].world ), s->velocities[i] );
+		matrix_setTranslation( s->transforms[i].world, &position );
+	}
+}
+
+// A pair as its two body indices in the scene, lower first, for comparing pair sets
+static long long broadphaseScene_key( const broadphaseScene* s, body* a, body* b ) {
+	long long i = a - s->bodies, j = b - s->bodies;
+	return i < j ? i * s->count + j : j * s->count + i;
+}
+
+static int compareKeys( const void* a, const void* b ) {
+	const long long x = *(const long long*)a, y = *(const long long*)b;
+	return ( x > y ) - ( x < y );
+}
+
+// The broadphase's pairs as sorted keys; returns how many, or -1 if any came up twice
+static int broadphaseTest_keys( const broadphaseScene* s, const collisionEvent* pairs, int count, long long* keys ) {
+	for ( int i = 0; i < count; ++i )
+		keys[i] = broadphaseScene_key( s, pairs[i].a, pairs[i].b );
+	qsort( keys, count, sizeof( long long ), compareKeys );
+	for ( int i = 1; i < count; ++i )
+		if ( keys[i] == keys[i - 1] )
+			return -1;
+	return count;
+}
+
+// Layers LA and LB interact if a body in LA collides with LB while there's a body in LB, or the other way round
+static void broadphaseTest_interactions( const broadphaseScene* s, const bool* present, collision_layers_t* interacts ) {
+	collision_layers_t occupied = 0;
+	memset( interacts, 0, sizeof( collision_layers_t ) * kCollisionLayers );
+	for ( int i = 0; i < s->count; ++i )
+		if ( present[i] )
+			occupied |= s->bodies[i].layers;
+	for ( int i = 0; i < s->count; ++i )
+		for ( int la = 0; la < kCollisionLayers; ++la )
+			for ( int lb = 0; lb < kCollisionLayers; ++lb )
+				if ( present[i] && ( s->bodies[i].layers & ( 1 << la )) && ( s->bodies[i].collide_with & occupied & ( 1 << lb ))) {
+					interacts[la] |= (collision_layers_t)( 1 << lb );
+					interacts[lb] |= (collision_layers_t)( 1 << la );
+				}
+}
+
+static int broadphaseTest_bruteKeys( const broadphaseScene* s, const bool* present, long long* keys ) {
+	collision_layers_t interacts[kCollisionLayers];
+	broadphaseTest_interactions( s, present, interacts );
+	int count = 0;
+	for ( int i = 0; i < s->count; ++i )
+		for ( int j = i + 1; j < s->count; ++j ) {
+			body* a = &s->bodies[i], *b = &s->bodies[j];
+			bool layersInteract = false;
+			for ( int l = 0; l < kCollisionLayers; ++l )
+				layersInteract = layersInteract || (( a->layers & ( 1 << l )) && ( interacts[l] & b->layers ));
+			if ( present[i] && present[j] && !a->disabled && !b->disabled && layersInteract && overlap( body_bounds( a ), body_bounds( b )))
+				keys[count++] = broadphaseScene_key( s, a, b );
+		}
+	return count;
+}
+
+#define kBroadphaseTestBodies 300
+#define kBroadphaseTestFrames 40
+
+void test_broadphase() {
+	printf( "--- Beginning Unit Test: Collision Broadphase ---\n" );
+	const int types[3] = { BroadphaseSweep, BroadphaseGrid, BroadphaseQuadTree };
+	const char* names[3] = { "Sweep and prune", "Loose grid", "Quadtree" };
+	long long* expected = (long long*)mem_alloc( sizeof( long long ) * kBroadphaseTestBodies * kBroadphaseTestBodies / 2 );
+	long long* found = (long long*)mem_alloc( sizeof( long long ) * kBroadphaseTestBodies * kBroadphaseTestBodies / 2 );
+	for ( int t = 0; t < 3; ++t ) {
+		bool matched = true;
+		int pairTotal = 0;
+		long long culledTotal = 0;
+		// Uniform in one layer, then clustered and uniform in layers
+		for ( int scene = 0; scene < 3; ++scene ) {
+			const bool layered = scene > 0;
+			broadphaseScene s;
+			broadphaseScene_create( &s, kBroadphaseTestBodies, scene == 1, layered, 0xb90ad + scene );
+			// Big bodies, as terrain blocks would be, to take the grid's big-body path; one terrain, one not
+			heightField fields[2];
+			shape fieldShapes[2];
+			memset( fields, 0, sizeof( fields ));
+			memset( fieldShapes, 0, sizeof( fieldShapes ));
+			fields[0].aabb = Aabb2d( -100.f, 100.f, 200.f, 400.f );
+			fields[1].aabb = Aabb2d( 50.f, 150.f, 300.f, 500.f );
+			for ( int i = 0; i < 2; ++i ) {
+				fieldShapes[i].type = shapeHeightField;
+				fieldShapes[i].height_field = &fields[i];
+				s.bodies[i]._shape = &fieldShapes[i];
+			}
+			if ( layered ) {
+				s.bodies[0].layers = kCollisionLayerTerrain;
+				s.bodies[0].collide_with = 0;
+			}
+
+			broadphase* bp = broadphase_create( types[t] );
+			bool present[kBroadphaseTestBodies];
+			for ( int i = 0; i < kBroadphaseTestBodies; ++i ) {
+				present[i] = true;
+				broadphase_add( bp, &s.bodies[i] );
+			}
+			for ( int frame = 0; frame < kBroadphaseTestFrames; ++frame ) {
+				// Churn: bodies leave, come back, get disabled and change layer
+				const int i = 1 + ( frame * 37 ) % ( kBroadphaseTestBodies - 1 );
+				if ( present[i] )
+					broadphase_remove( bp, &s.bodies[i] );
+				else
+					broadphase_add( bp, &s.bodies[i] );
+				present[i] = !present[i];
+				s.bodies[( frame * 53 ) % kBroadphaseTestBodies].disabled = frame % 3 == 0;
+				if ( layered )
+					s.bodies[2 + ( frame * 29 ) % ( kBroadphaseTestBodies - 2 )].layers ^= kCollisionLayerEnemy;
+
+				const collisionEvent* pairs;
+				const int count = broadphase_update( bp, &pairs );
+				const int expectedCount = broadphaseTest_bruteKeys( &s, present, expected );
+				qsort( expected, expectedCount, sizeof( long long ), compareKeys );
+				matched = matched && broadphaseTest_keys( &s, pairs, count, found ) == expectedCount &&
+							memcmp( found, expected, sizeof( long long ) * expectedCount ) == 0;
+				pairTotal += count;
+				culledTotal += broadphase_stats( bp )->pairs_culled;
+				broadphaseScene_step( &s );
+			}
+			broadphase_delete( bp );
+			broadphaseScene_delete( &s );
+		}
+		printf( "%s: %d pairs, %lld culled by layer, over %d frames\n", names[t], pairTotal, culledTotal, 3 * kBroadphaseTestFrames );
+		test( matched && pairTotal > 0, "Broadphase finds exactly the overlapping pairs in interacting layers", "Broadphase pairs differ from brute force" );
+		test( culledTotal > 0, "Broadphase culls pairs by layer", "Broadphase culled nothing by layer" );
+	}
+	mem_free( expected );
+	mem_free( found );
+}
+
+#define kBroadphaseBenchFrames 200
+
+// Everything in one layer, as before we kept per-layer lists, then the same bodies layered as in a fight
+void bench_broadphase() {
+	const int types[3] = { BroadphaseQuadTree, BroadphaseSweep, BroadphaseGrid };
+	const char* typeNames[3] = { "quadtree", "sweep", "grid" };
+	const int counts[3] = { 100, 500, 1000 };
+	for ( int layered = 0; layered < 2; ++layered )
+		for ( int clustered = 0; clustered < 2; ++clustered )
+			for ( int c = 0; c < 3; ++c )
+				for ( int t = 0; t < 3; ++t ) {
+					broadphaseScene s;
+					broadphaseScene_create( &s, counts[c], clustered, layered, 0xbe4c );
+					broadphase* bp = broadphase_create( types[t] );
+					for ( int i = 0; i < s.count; ++i )
+						broadphase_add( bp, &s.bodies[i] );
+					const collisionEvent* pairs;
+					long long pairTotal = 0, culledTotal = 0;
+					double seconds = 0.0;
+					for ( int frame = 0; frame < kBroadphaseBenchFrames; ++frame ) {
+						broadphaseScene_step( &s );
+						const double start = bench_seconds();
+						pairTotal += broadphase_update( bp, &pairs );
+						seconds += bench_seconds() - start;
+						culledTotal += broadphase_stats( bp )->pairs_culled;
+					}
+					char name[160];
+					snprintf( name, sizeof( name ), "broadphase %s, %d bodies %s %s (%lld pairs, %lld culled by layer /frame), frames",
+							typeNames[t], s.count, clustered ? "clustered" : "uniform", layered ? "layered" : "one layer",
+							pairTotal / kBroadphaseBenchFrames, culledTotal / kBroadphaseBenchFrames );
+					bench_report( name, kBroadphaseBenchFrames, seconds );
+					broadphase_delete( bp );
+					broadphaseScene_delete( &s );
+				}
+}
+#endif // UNIT_TEST
@@ -0,0 +1,59 @@
+// broadphase.h
+#pragma once
+#include "collision.h"
+
+/* Broadphases: find the pairs of bodies whose x-z bounds overlap, for the narrowphase to test. The sweep and
+   the grid persist between ticks, so a tick only pays for what moved:
+   - BroadphaseSweep keeps its bodies sorted along one axis by their bounds' minimum. Bodies move a little per
+     tick, so the list stays almost sorted and an insertion sort puts it right; a sweep along it then pairs each
+     body only with those that start before it ends. The axis is whichever the bodies are most spread along.
+   - BroadphaseGrid is a loose uniform grid, hashed so it needn't cover the world. Each body is filed in the
+     cell under its centre and only refiled when it moves into another; a body looks for others in the cells
+     within the largest filed body's half-size of its bounds, usually just its own. Bodies bigger than a cell
+     (terrain blocks) aren't filed, but look for the small ones the same way, and test each other directly.
+   - BroadphaseQuadTree is the tree we used to rebuild from scratch every tick, kept for comparison
+   Bodies are kept in one list per collision layer, each with its own structure. Which layers can collide with
+   which is worked out each tick from the bodies' collide_with, and only those pairs of layers are searched - so
+   bullets are never paired with bullets, nor terrain blocks with each other. A layer nothing collides with isn't
+   even refreshed. A body in no layer is never paired */
+#define BroadphaseQuadTree 0
+#define BroadphaseSweep 1
+#define BroadphaseGrid 2
+#ifndef COLLISION_BROADPHASE
+#define COLLISION_BROADPHASE BroadphaseSweep
+#endif
+
+#define kBroadphaseGridCell 32.f	// World units; bodies larger than this take the big-body path
+#define kBroadphaseGridBuckets 4096	// Power of two
+
+typedef struct broadphase_s broadphase;
+
+// What the last update did
+typedef struct broadphaseStats_s {
+	int bodies;
+	int layer_pairs;		// Pairs of occupied layers that interact, so were searched
+	int bounds_tests;
+	int pairs;
+	long long pairs_culled;	// Body pairs never looked at, as their layers don't interact
+} broadphaseStats;
+
+broadphase* broadphase_create( int type );
+void broadphase_delete( broadphase* bp );
+int broadphase_type( broadphase* bp );
+
+void broadphase_add( broadphase* bp, body* b );
+void broadphase_remove( broadphase* bp, body* b );
+
+/* Refile bodies that changed layer, refresh the bounds of those in interacting layers, then find the pairs of
+   enabled bodies in interacting layers whose bounds overlap. The pairs stay owned by the broadphase, valid until
+   its next update; returns how many */
+int broadphase_update( broadphase* bp, const collisionEvent** pairs );
+const broadphaseStats* broadphase_stats( broadphase* bp );
+
+// The x-z bounds the broadphase uses for B
+aabb2d body_bounds( body* b );
+
+#if UNIT_TEST
+void test_broadphase();
+void bench_broadphase();
+#endif // UNIT_TEST
@@ -0,0 +1,334 @@
+// narrowphase.c
+#include "common.h"
+#include "narrowphase.h"
+//---------------------
+#include "test.h"
+#include "transform.h"
+#include "worker.h"
+#include "mem/allocator.h"
+#include "system/thread.h"
+#include <atomic>
+#if UNIT_TEST
+#include "bench.h"
+#include "terrain/heightGrid.h"
+#endif // UNIT_TEST
+
+typedef struct narrowphaseChunk_s {
+	int hits;
+	int tested;
+	int culled;
+	bool helped;
+} narrowphaseChunk;
+
+// One run's work, shared with its helpers; whoever lets go of it last frees it, as helpers can start late
+typedef struct narrowphaseJob_s {
+	const collisionEvent* pairs;
+	int count;
+	collisionEvent* events;
+	int chunk_count;
+	narrowphaseChunk* chunks;	// Allocated along with the job
+	std::atomic<int> next;		// The next chunk to claim
+	std::atomic<int> done;
+	std::atomic<int> refs;
+} narrowphaseJob;
+
+// Test pairs FIRST up to LAST, writing the hits to OUT in order; returns how many
+static int narrowphase_testPairs( const collisionEvent* pairs, int first, int last, collisionEvent* out, int* tested, int* culled ) {
+	int hits = 0;
+	for ( int i = first; i < last; ++i ) {
+		body* a = pairs[i].a, *b = pairs[i].b;
+		if ( !body_layersCollide( a, b )) {
+			++*culled;
+			continue;
+		}
+		++*tested;
+		if ( shape_colliding( a->_shape, b->_shape, a->trans->world, b->trans->world ))
+			out[hits++] = pairs[i];
+	}
+	return hits;
+}
+
+// Claim and test chunks until there are none left
+static void narrowphase_work( narrowphaseJob* job, bool helper ) {
+	for ( int c = job->next.fetch_add( 1 ); c < job->chunk_count; c = job->next.fetch_add( 1 )) {
+		narrowphaseChunk* chunk = &job->chunks[c];
+		const int first = c * kNarrowphaseChunk;
+		chunk->tested = 0;
+		chunk->culled = 0;
+		chunk->hits = narrowphase_testPairs( job->pairs, first, min( first + kNarrowphaseChunk, job->count ),
+												&job->events[first], &chunk->tested, &chunk->culled );
+		chunk->helped = helper;
+		job->done.fetch_add( 1, std::memory_order_release );
+	}
+}
+
+static void narrowphase_release( narrowphaseJob* job ) {
+	if ( job->refs.fetch_sub( 1 ) == 1 )
+		mem_free( job );
+}
+
+static void* narrowphase_helpTask( void* args ) {
+	narrowphaseJob* job = (narrowphaseJob*)args;
+	narrowphase_work( job, true );
+	narrowphase_release( job );
+	return NULL;
+}
+
+int narrowphase_run( const collisionEvent* pairs, int count, collisionEvent* events, int helpers, narrowphaseDispatch dispatch, narrowphaseStats* stats ) {
+	memset( stats, 0, sizeof( narrowphaseStats ));
+	if ( helpers <= 0 || !dispatch || count < kNarrowphaseMinParallelPairs )
+		return narrowphase_testPairs( pairs, 0, count, events, &stats->pairs_tested, &stats->pairs_culled );
+
+	const int chunk_count = ( count + kNarrowphaseChunk - 1 ) / kNarrowphaseChunk;
+	narrowphaseJob* job = (narrowphaseJob*)mem_alloc( sizeof( narrowphaseJob ) + sizeof( narrowphaseChunk ) * chunk_count );
+	job->pairs = pairs;
+	job->count = count;
+	job->events = events;
+	job->chunk_count = chunk_count;
+	job->chunks = (narrowphaseChunk*)( job + 1 );
+	helpers = min( helpers, chunk_count - 1 );
+	job->next.store( 0 );
+	job->done.store( 0 );
+	job->refs.store( 1 + helpers );
+	for ( int i = 0; i < helpers; ++i )
+		dispatch( task( narrowphase_helpTask, job ));
+	narrowphase_work( job, false );
+	while ( job->done.load( std::memory_order_acquire ) < chunk_count )
+		vthread_yield();
+
+	// Each chunk's hits start at its first pair; close up the gaps, in chunk order
+	int hits = 0;
+	for ( int c = 0; c < chunk_count; ++c ) {
+		const narrowphaseChunk* chunk = &job->chunks[c];
+		memmove( &events[hits], &events[c * kNarrowphaseChunk], sizeof( collisionEvent ) * chunk->hits );
+		hits += chunk->hits;
+		stats->pairs_tested += chunk->tested;
+		stats->pairs_culled += chunk->culled;
+		stats->helper_chunks += chunk->helped;
+	}
+	stats->chunks = chunk_count;
+	narrowphase_release( job );
+	return hits;
+}
+
+#if UNIT_TEST
+/* Spheres scattered over and around a rolling heightfield, paired each with the field and with the next sphere,
+   as the broadphase would hand them over in a fight low over the terrain. Some only collide with the player, so
+   their pairs with the field are culled by layer */
+#define kNarrowphaseFieldSamples 33
+#define kNarrowphaseFieldSpacing 4.f
+
+typedef struct narrowphaseScene_s {
+	body* bodies;		// The field, then the spheres
+	shape* shapes;
+	transform* transforms;
+	heightField* field;
+	collisionEvent* pairs;
+	int count;
+	int pair_count;
+} narrowphaseScene;
+
+static void narrowphaseScene_create( narrowphaseScene* s, int spheres, long int seed ) {
+	vector verts[kNarrowphaseFieldSamples * kNarrowphaseFieldSamples];
+	for ( int v = 0; v < kNarrowphaseFieldSamples; ++v )
+		for ( int u = 0; u < kNarrowphaseFieldSamples; ++u ) {
+			const float x = (float)u * kNarrowphaseFieldSpacing, z = (float)v * kNarrowphaseFieldSpacing;
+			verts[u + v * kNarrowphaseFieldSamples] = Vector( x, 6.f * sinf( x * 0.07f ) * cosf( z * 0.05f ), z, 1.f );
+		}
+	terrainHeightGrid* grid = terrainHeightGrid_create( verts, kNarrowphaseFieldSamples, kNarrowphaseFieldSamples, kNarrowphaseFieldSamples );
+	const float size = (float)( kNarrowphaseFieldSamples - 1 ) * kNarrowphaseFieldSpacing;
+	s->field = heightField_create( size, size, grid );
+	terrainHeightGrid_release( grid );
+
+	s->count = spheres + 1;
+	s->bodies = (body*)mem_alloc( sizeof( body ) * s->count );
+	s->shapes = (shape*)mem_alloc( sizeof( shape ) * s->count );
+	s->transforms = (transform*)mem_alloc( sizeof( transform ) * s->count );
+	memset( s->bodies, 0, sizeof( body ) * s->count );
+	memset( s->shapes, 0, sizeof( shape ) * s->count );
+	randSeq r;
+	deterministic_seedRandSeq( seed, &r );
+	for ( int i = 0; i < s->count; ++i ) {
+		body* b = &s->bodies[i];
+		b->_shape = &s->shapes[i];
+		b->trans = &s->transforms[i];
+		b->broadphase_proxy = -1;
+		matrix_setIdentity( b->trans->world );
+		if ( i == 0 ) {
+			s->shapes[i].type = shapeHeightField;
+			s->shapes[i].height_field = s->field;
+			b->layers = kCollisionLayerTerrain;
+			continue;
+		}
+		const vector position = Vector( deterministic_frand( &r, -10.f, size + 10.f ), deterministic_frand( &r, -8.f, 14.f ),
+										deterministic_frand( &r, -10.f, size + 10.f ), 1.f );
+		matrix_setTranslation( b->trans->world, &position );
+		s->shapes[i].type = shapeSphere;
+		s->shapes[i].radius = deterministic_frand( &r, 0.5f, 4.f );
+		s->shapes[i].origin = Vector( 0.f, 0.f, 0.f, 1.f );
+		b->layers = kCollisionLayerBullet;
+		b->collide_with = i % 7 == 0 ? kCollisionLayerPlayer : kCollisionLayerBullet | kCollisionLayerTerrain;
+	}
+
+	// Each sphere with the field, either way round, and with the next sphere
+	s->pairs = (collisionEvent*)mem_alloc( sizeof( collisionEvent ) * 2 * spheres );
+	s->pair_count = 0;
+	for ( int i = 1; i < s->count; ++i ) {
+		collisionEvent* pair = &s->pairs[s->pair_count++];
+		pair->a = i % 2 ? &s->bodies[i] : &s->bodies[0];
+		pair->b = i % 2 ? &s->bodies[0] : &s->bodies[i];
+		if ( i + 1 < s->count ) {
+			pair = &s->pairs[s->pair_count++];
+			pair->a = &s->bodies[i];
+			pair->b = &s->bodies[i + 1];
+		}
+	}
+}
+
+static void narrowphaseScene_delete( narrowphaseScene* s ) {
+	heightField_delete( s->field );
+	mem_free( s->bodies );
+	mem_free( s->shapes );
+	mem_free( s->transforms );
+	mem_free( s->pairs );
+}
+
+/* A small standing pool of helpers for the test and bench, so runs don't pay for starting threads: each helper
+   waits for a task in its slot. Stopping lets any posted task run, then joins them */
+typedef struct narrowphaseTestHelper_s {
+	vthread thread;
+	worker_task task;
+	std::atomic<bool> posted;
+	std::atomic<bool> quit;
+} narrowphaseTestHelper;
+
+static narrowphaseTestHelper narrowphaseTest_helpers[kNarrowphaseHelpers];
+static int narrowphaseTest_next = 0;
+
+static void* narrowphaseTest_helperThread( void* args ) {
+	narrowphaseTestHelper* h = (narrowphaseTestHelper*)args;
+	while ( true ) {
+		if ( h->posted.load( std::memory_order_acquire )) {
+			const worker_task t = h->task;
+			h->posted.store( false, std::memory_order_release );
+			t.func( t.args );
+		}
+		else if ( h->quit.load() )
+			break;
+		else
+			vthread_yield();
+	}
+	return NULL;
+}
+
+static void narrowphaseTest_startHelpers() {
+	narrowphaseTest_next = 0;
+	for ( int i = 0; i < kNarrowphaseHelpers; ++i ) {
+		narrowphaseTestHelper* h = &narrowphaseTest_helpers[i];
+		h->posted.store( false );
+		h->quit.store( false );
+		h->thread = vthread_create( narrowphaseTest_helperThread, h );
+	}
+}
+
+static void narrowphaseTest_stopHelpers() {
+	for ( int i = 0; i < kNarrowphaseHelpers; ++i )
+		narrowphaseTest_helpers[i].quit.store( true );
+	for ( int i = 0; i < kNarrowphaseHelpers; ++i )
+		vthread_join( narrowphaseTest_helpers[i].thread );
+}
+
+static void narrowphaseTest_dispatch( worker_task t ) {
+	narrowphaseTestHelper* h = &narrowphaseTest_helpers[narrowphaseTest_next++ % kNarrowphaseHelpers];
+	while ( h->posted.load( std::memory_order_acquire ))
+		vthread_yield();
+	h->task = t;
+	h->posted.store( true, std::memory_order_release );
+	vthread_yield(); // Let the helper pick it up, even with fewer cores than threads
+}
+
+// Helpers that only start once the run has finished without them, as when every worker is busy
+#define kNarrowphaseTestDeferred 8
+static worker_task narrowphaseTest_deferred[kNarrowphaseTestDeferred];
+static int narrowphaseTest_deferredCount = 0;
+
+static void narrowphaseTest_defer( worker_task t ) {
+	vAssert( narrowphaseTest_deferredCount < kNarrowphaseTestDeferred );
+	narrowphaseTest_deferred[narrowphaseTest_deferredCount++] = t;
+}
+
+#define kNarrowphaseTestSpheres 3000
+#define kNarrowphaseTestRuns 20
+
+void test_narrowphase() {
+	printf( "--- Beginning Unit Test: Collision Narrowphase ---\n" );
+	narrowphaseScene s;
+	narrowphaseScene_create( &s, kNarrowphaseTestSpheres, 0x9a77 );
+	collisionEvent* expected = (collisionEvent*)mem_alloc( sizeof( collisionEvent ) * s.pair_count );
+	collisionEvent* events = (collisionEvent*)mem_alloc( sizeof( collisionEvent ) * s.pair_count );
+
+	// The order testing every pair in turn gives
+	int expectedCount = 0;
+	for ( int i = 0; i < s.pair_count; ++i )
+		if ( body_colliding( s.pairs[i].a, s.pairs[i].b ))
+			expected[expectedCount++] = s.pairs[i];
+
+	narrowphaseStats stats;
+	int count = narrowphase_run( s.pairs, s.pair_count, events, 0, NULL, &stats );
+	test( count == expectedCount && memcmp( events, expected, sizeof( collisionEvent ) * count ) == 0 &&
+			stats.pairs_tested + stats.pairs_culled == s.pair_count && stats.pairs_culled > 0,
+			"Narrowphase on one thread matches testing pairs in turn", "Narrowphase on one thread differs from testing pairs in turn" );
+
+	bool identical = true;
+	int helperChunks = 0;
+	narrowphaseTest_startHelpers();
+	for ( int run = 0; run < kNarrowphaseTestRuns; ++run ) {
+		memset( events, 0, sizeof( collisionEvent ) * s.pair_count );
+		count = narrowphase_run( s.pairs, s.pair_count, events, kNarrowphaseHelpers, narrowphaseTest_dispatch, &stats );
+		identical = identical && count == expectedCount && memcmp( events, expected, sizeof( collisionEvent ) * count ) == 0 &&
+						stats.pairs_tested + stats.pairs_culled == s.pair_count;
+		helperChunks += stats.helper_chunks;
+	}
+	narrowphaseTest_stopHelpers();
+	printf( "%d pairs, %d events; helpers took %d of %d chunks over %d runs\n", s.pair_count, expectedCount, helperChunks,
+			stats.chunks * kNarrowphaseTestRuns, kNarrowphaseTestRuns );
+	test( identical, "Narrowphase across threads gives events in the same order every run", "Narrowphase across threads changed the events or their order" );
+
+	narrowphaseTest_deferredCount = 0;
+	count = narrowphase_run( s.pairs, s.pair_count, events, kNarrowphaseHelpers, narrowphaseTest_defer, &stats );
+	const bool alone = count == expectedCount && memcmp( events, expected, sizeof( collisionEvent ) * count ) == 0 && stats.helper_chunks == 0;
+	for ( int i = 0; i < narrowphaseTest_deferredCount; ++i )
+		narrowphaseTest_deferred[i].func( narrowphaseTest_deferred[i].args ); // Find nothing left, and let the job go
+	test( alone && narrowphaseTest_deferredCount == kNarrowphaseHelpers, "Narrowphase finishes alone when helpers start late",
+			"Narrowphase with late helpers went wrong" );
+
+	mem_free( expected );
+	mem_free( events );
+	narrowphaseScene_delete( &s );
+}
+
+#define kNarrowphaseBenchFrames 100
+
+// Pairs per second with the collision thread alone, then with each more helper
+void bench_narrowphase() {
+	narrowphaseScene s;
+	narrowphaseScene_create( &s, 4 * kNarrowphaseTestSpheres, 0xbe9a );
+	collisionEvent* events = (collisionEvent*)mem_alloc( sizeof( collisionEvent ) * s.pair_count );
+	narrowphaseTest_startHelpers();
+	for ( int helpers = 0; helpers <= kNarrowphaseHelpers; ++helpers ) {
+		narrowphaseTest_next = 0;
+		narrowphaseStats stats;
+		int hits = 0;
+		const double start = bench_seconds();
+		for ( int frame = 0; frame < kNarrowphaseBenchFrames; ++frame )
+			hits += narrowphase_run( s.pairs, s.pair_count, events, helpers, narrowphaseTest_dispatch, &stats );
+		const double seconds = bench_seconds() - start;
+		char name[96];
+		snprintf( name, sizeof( name ), "narrowphase pairs (%d threads, %d events/frame)", helpers + 1, hits / kNarrowphaseBenchFrames );
+		bench_report( name, (long long)s.pair_count * kNarrowphaseBenchFrames, seconds );
+	}
+	narrowphaseTest_stopHelpers();
+	mem_free( events );
+	narrowphaseScene_delete( &s );
+}
+#endif // UNIT_TEST
@@ -0,0 +1,33 @@
+// narrowphase.h
+#pragma once
+#include "collision.h"
+
+/* The narrowphase: the broadphase's candidate pairs, tested with the collide funcs. Pairs are independent, so with
+   enough of them they're split into chunks of kNarrowphaseChunk and shared with helper tasks on the worker pool:
+   the helpers and the calling thread claim chunks in turn, each chunk writes its hits to its own stretch of the
+   event buffer, and once every chunk is done the stretches are closed up in chunk order. So the events come out
+   in just the order testing the pairs one by one would give, whichever thread took which chunk, and replays stay
+   valid. The caller works through chunks too, so it finishes even if every worker is busy; helpers that start
+   after the work is gone just drop out */
+#define kNarrowphaseChunk 32
+#define kNarrowphaseMinParallelPairs 256	// Fewer than this aren't worth waking the workers for
+#define kNarrowphaseHelpers 3				// The worker pool, less the worker running the collision tick
+
+// How helper tasks get to the workers
+typedef void (*narrowphaseDispatch)( worker_task t );
+
+typedef struct narrowphaseStats_s {
+	int pairs_tested;
+	int pairs_culled;	// Neither body collides with the other's layers
+	int chunks;
+	int helper_chunks;	// Of those, how many the helpers took
+} narrowphaseStats;
+
+/* Test COUNT PAIRS, writing those that collide to EVENTS, which must have room for COUNT, in pair order; returns
+   how many. Up to HELPERS tasks go to DISPATCH if there are enough pairs to share */
+int narrowphase_run( const collisionEvent* pairs, int count, collisionEvent* events, int helpers, narrowphaseDispatch dispatch, narrowphaseStats* stats );
+
+#if UNIT_TEST
+void test_narrowphase();
+void bench_narrowphase();
+#endif // UNIT_TEST
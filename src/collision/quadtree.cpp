@@ -15,7 +15,7 @@ collisionEvent collide( body* a, body* b ) {
 }
 
 Vec<collisionEvent> genEvents(const Vec<body*>& bodies) {
-	// for every body, check every other body
+	// for every body, check every other body; the narrowphase is left to the caller
 	auto collisions = Vec<collisionEvent>();
 	int count = bodies.size();
 	// NOTE: Cast down to C-Array for performance (Probably a C++ safe way of doing this, but cant get it to work right now)
@@ -23,7 +23,8 @@ Vec<collisionEvent> genEvents(const Vec<body*>& bodies) {
 	for ( int i = 0; i < count; ++i )
 		for ( int j = i + 1; j < count; j++ ) {
 			vAssert( bodiesArray[i] && bodiesArray[j] )
-			if ( !bodiesArray[i]->disabled && !bodiesArray[j]->disabled && body_colliding( bodiesArray[i], bodiesArray[j] ))
+			if ( !bodiesArray[i]->disabled && !bodiesArray[j]->disabled &&
+					overlap( Bounded<body*>::bb2d( bodiesArray[i] ), Bounded<body*>::bb2d( bodiesArray[j] )))
 				collisions += collide( bodiesArray[i], bodiesArray[j] );
 		}
 	return collisions;
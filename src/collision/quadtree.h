@@ -3,6 +3,7 @@
 
 #include "collection/vec.h"
 #include "collision.h"
+#include "collision/broadphase.h"
 #include <stdio.h>
 
 template<typename T> struct Bounded {
@@ -10,35 +11,7 @@ template<typename T> struct Bounded {
 };
 
 template<> struct Bounded<body*> {
-	static aabb2d bb2d(body* const& b) {
-		// TODO - calculate (naive?) aabb2d for bodies
-		// needs to be per-shape (do only spheres for now? What kind of shapes in use?)
-		// heightfields?
-		(void)b;
-		shape* s = b->_shape;
-		switch (s->type) {
-			case shapeInvalid: {
-				NYI;
-				aabb2d bb = Aabb2d( -20.f, -5.f, -20.f, -5.f );
-				return bb;
-			}
-			case shapeSphere: {
-				return sphereAabb2d(s, b->trans);
-			}
-			case shapeMesh: {
-				NYI;
-				aabb2d bb = Aabb2d( -20.f, -5.f, -20.f, -5.f );
-				return bb;
-			}
-			case shapeHeightField: {
-				return s->height_field->aabb;
-			}
-			default:
-				vAssert(0);
-		}
-		aabb2d bb = Aabb2d( -20.f, -5.f, -20.f, -5.f );
-		return bb;
-	}
+	static aabb2d bb2d(body* const& b) { return body_bounds(b); }
 };
 
 struct QuadTreeBase {
@@ -131,4 +104,5 @@ struct QuadTree : public QuadTreeBase {
 };
 
 // TODO - separate collision quadtree from generic quadtree
+// Pairs of enabled bodies whose bounds overlap, leaf by leaf; a pair sharing several leaves comes up in each
 Vec<collisionEvent> potentialCollisions(const QuadTree<body*>* q);
@@ -9,6 +9,8 @@ struct cacheBlock_s;
 struct camera_s;
 struct canyon_s;
 struct canyonData_s;
+struct canyonSegment_s;
+struct canyonSnapshot_s;
 struct canyonTerrain_s;
 struct canyonTerrainBlock_s;
 struct canyonZone_s;
@@ -33,6 +35,11 @@ struct quaternion_s;
 struct scene_s;
 struct shader_s;
 struct terrainCache_s;
+struct terrainDiskGrid_s;
+struct terrainHeightGrid_s;
+struct terrainPrefetch_s;
+struct terrainVertex_s;
+struct terrainVertexFrame_s;
 struct terrainRenderable_s;
 struct texture_s;
 struct transform_s;
@@ -43,6 +50,7 @@ struct window_s;
 struct window_buffer_s;
 struct worker_task_s;
 struct xwindow_s;
+struct zoneTexture_s;
 union vector_u;
 #endif
 
@@ -53,6 +61,8 @@ typedef struct cacheBlock_s cacheBlock;
 typedef struct camera_s camera;
 typedef struct canyon_s canyon;
 typedef struct canyonData_s canyonData;
+typedef struct canyonSegment_s canyonSegment;
+typedef struct canyonSnapshot_s canyonSnapshot;
 typedef struct canyonTerrain_s canyonTerrain;
 typedef struct canyonTerrainBlock_s canyonTerrainBlock;
 typedef struct canyonZone_s canyonZone;
@@ -78,6 +88,11 @@ typedef struct scene_s scene;
 typedef struct shader_s shader;
 typedef struct texture_s texture;
 typedef struct terrainCache_s terrainCache;
+typedef struct terrainDiskGrid_s terrainDiskGrid;
+typedef struct terrainHeightGrid_s terrainHeightGrid;
+typedef struct terrainPrefetch_s terrainPrefetch;
+typedef struct terrainVertex_s terrainVertex;
+typedef struct terrainVertexFrame_s terrainVertexFrame;
 typedef struct terrainRenderable_s terrainRenderable;
 typedef struct transform_s transform;
 typedef struct triple_s triple;
@@ -87,6 +102,7 @@ typedef struct window_s window;
 typedef struct window_buffer_s window_buffer;
 typedef struct worker_task_s worker_task;
 typedef struct xwindow_s xwindow;
+typedef struct zoneTexture_s zoneTexture;
 
 typedef union vector_u vector;
 typedef union vector_u color;
@@ -6,6 +6,7 @@
 #include "worker.h"
 #include "base/pair.h"
 #include "mem/allocator.h"
+#include "mem/scratch.h"
 
 vmutex futuresMutex = kMutexInitialiser;
 
@@ -42,13 +43,34 @@ future* future_onComplete( future* f, handlerfunc hf, void* args ) {
 	return f;
 }
 
+// The first handler and its list cell are held inline, so only those added after it were allocated
+void future_freeHandlersUNSAFE( future* f ) {
+	handlerlist* hl = f->on_complete;
+	while ( hl && hl != &f->hl ) {
+		handlerlist* tail = hl->tail;
+		mem_free( hl->head );
+		mem_free( hl );
+		hl = tail;
+	}
+	f->on_complete = NULL;
+}
+
 void future_delete( future* f ) {
 	vmutex_lock( &futuresMutex ); {
-		handlerlist_delete( f->on_complete );
+		future_freeHandlersUNSAFE( f );
+		arrayRemove( &futures, &futureCount, f );
 		mem_free( f );
 	} vmutex_unlock( &futuresMutex );
 }
 
+bool future_done( future* f ) {
+	bool done = false;
+	vmutex_lock( &futuresMutex ); {
+		done = f->complete && !f->execute;
+	} vmutex_unlock( &futuresMutex );
+	return done;
+}
+
 future* future_create() {
 	future* f = (future*)mem_alloc( sizeof( future ));
 	f->complete = false;
@@ -66,6 +88,7 @@ future* future_create() {
 }
 
 future* future_complete( future* f, const void* data ) {
+	vAssert( !scratch_contains( data )); // Handlers may run after the task's scratch is reset
 	vmutex_lock( &futuresMutex ); {
 		vAssert( !f->complete );
 		f->value = data;
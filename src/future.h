@@ -36,8 +36,12 @@ future* future_onComplete( future* f, handlerfunc h, void* args );
 
 future* future_create();
 
+// Free F; no-one may still be waiting on it
 void future_delete( future* f );
 
+// F has completed and its handlers have run, so it can be deleted once no-one else holds it
+bool future_done( future* f );
+
 void future_completeWith( future* f, future* other );
 
 future* futures_sequence( futurelist* fs );
@@ -28,6 +28,9 @@
 #include "script/lisp.h"
 #include "system/file.h"
 #include "system/string.h"
+#include "terrain/cache.h"
+#include "terrain/prefetch.h"
+#include "terrain/query.h"
 #include "ui/panel.h"
 
 #define DEBUG_SANITY_CHECK_POINTERS
@@ -950,6 +953,7 @@ int LUA_body_setCollidableLayers( lua_State* l ) {
 	return 0;
 }
 
+// Returns the canyon, and the terrain over it for the terrain queries
 int LUA_createCanyon(lua_State* l) {
 	engine* e = (engine*)lua_toptr( l, 1 );
 	scene* s = (scene*)lua_toptr( l, 2 );
@@ -969,6 +973,88 @@ int LUA_createCanyon(lua_State* l) {
 	startTick( e, (void*)t, canyonTerrain_tick );
 	engine_addRender( e, (void*)t, canyonTerrain_render );
 	lua_pushptr( l, c );
+	lua_pushptr( l, t );
+	return 2;
+}
+
+// Set the byte budget for the canyon's terrain cache, in megabytes
+int LUA_canyon_setCacheBudget( lua_State* l ) {
+	canyon* c = (canyon*)lua_toptr( l, 1 );
+	float megabytes = lua_tonumber( l, 2 );
+	terrainCache_setBudget( c->cache, (long long)( megabytes * MEGABYTES ));
+	return 0;
+}
+
+// Keep generated terrain in the given directory, to load rather than regenerate it next run
+int LUA_canyon_setDiskCache( lua_State* l ) {
+	canyon* c = (canyon*)lua_toptr( l, 1 );
+	const char* dir = lua_tostring( l, 2 );
+	terrainCache_setDiskCache( c->cache, dir );
+	return 0;
+}
+
+// Seconds ahead of the ship to prefetch the canyon's terrain; zero disables prefetching
+int LUA_terrain_setPrefetchLookahead( lua_State* l ) {
+	canyonTerrain* t = (canyonTerrain*)lua_toptr( l, 1 );
+	float seconds = lua_tonumber( l, 2 );
+	terrainPrefetch_setLookahead( t->prefetch, seconds );
+	return 0;
+}
+
+// Surface heights under many points at once: takes a flat table { x1, z1, x2, z2, ... }, returns { y1, y2, ... }
+int LUA_terrain_queryHeights( lua_State* l ) {
+	canyonTerrain* t = (canyonTerrain*)lua_toptr( l, 1 );
+	luaAssert( l, lua_istable( l, 2 ));
+	const int n = (int)lua_objlen( l, 2 ) / 2;
+	vector* points = (vector*)mem_alloc( sizeof( vector ) * max( n, 1 ));
+	float* heights = (float*)mem_alloc( sizeof( float ) * max( n, 1 ));
+	for ( int i = 0; i < n; ++i ) {
+		lua_rawgeti( l, 2, 2 * i + 1 );
+		lua_rawgeti( l, 2, 2 * i + 2 );
+		points[i] = Vector( lua_tonumber( l, -2 ), 0.f, lua_tonumber( l, -1 ), 1.f );
+		lua_pop( l, 2 );
+	}
+	terrain_queryHeights( t, points, n, heights );
+	lua_createtable( l, n, 0 );
+	for ( int i = 0; i < n; ++i ) {
+		lua_pushnumber( l, heights[i] );
+		lua_rawseti( l, -2, i + 1 );
+	}
+	mem_free( points );
+	mem_free( heights );
+	return 1;
+}
+
+// Many raycasts against the loaded terrain at once: takes a flat table { ox, oy, oz, dx, dy, dz, length, ... },
+// returns a table with each ray's distance along its DIR to the hit, or false if it missed
+int LUA_terrain_raycastBatch( lua_State* l ) {
+	canyonTerrain* t = (canyonTerrain*)lua_toptr( l, 1 );
+	luaAssert( l, lua_istable( l, 2 ));
+	const int n = (int)lua_objlen( l, 2 ) / 7;
+	terrainRay* rays = (terrainRay*)mem_alloc( sizeof( terrainRay ) * max( n, 1 ));
+	terrainHit* hits = (terrainHit*)mem_alloc( sizeof( terrainHit ) * max( n, 1 ));
+	for ( int i = 0; i < n; ++i ) {
+		float f[7];
+		for ( int k = 0; k < 7; ++k ) {
+			lua_rawgeti( l, 2, 7 * i + k + 1 );
+			f[k] = lua_tonumber( l, -1 );
+			lua_pop( l, 1 );
+		}
+		rays[i].origin = Vector( f[0], f[1], f[2], 1.f );
+		rays[i].dir = Vector( f[3], f[4], f[5], 0.f );
+		rays[i].length = f[6];
+	}
+	terrain_raycastBatch( t, rays, n, hits );
+	lua_createtable( l, n, 0 );
+	for ( int i = 0; i < n; ++i ) {
+		if ( hits[i].hit )
+			lua_pushnumber( l, hits[i].t );
+		else
+			lua_pushboolean( l, false );
+		lua_rawseti( l, -2, i + 1 );
+	}
+	mem_free( rays );
+	mem_free( hits );
 	return 1;
 }
 
@@ -1273,6 +1359,11 @@ void luaLibrary_import( lua_State* l ) {
 
 	// *** Terrain
 	lua_registerFunction( l, LUA_createCanyon, "vcanyon_create" );
+	lua_registerFunction( l, LUA_canyon_setCacheBudget, "vcanyon_setCacheBudget" );
+	lua_registerFunction( l, LUA_canyon_setDiskCache, "vcanyon_setDiskCache" );
+	lua_registerFunction( l, LUA_terrain_setPrefetchLookahead, "vterrain_setPrefetchLookahead" );
+	lua_registerFunction( l, LUA_terrain_queryHeights, "vterrain_queryHeights" );
+	lua_registerFunction( l, LUA_terrain_raycastBatch, "vterrain_raycastBatch" );
 
 	// *** Physic
 	lua_registerFunction( l, LUA_createphysic, "vcreatePhysic" );
@@ -8,17 +8,33 @@
 #ifndef ANDROID
 
 #include "common.h"
+#include "canyon.h"
 #include "collision.h"
 #include "engine.h"
 #include "input.h"
 #include "maths/maths.h"
 #include "particle.h"
 #include "mem/allocator.h"
+#include "mem/scratch.h"
+#include "noise.h"
 #include "render/modelinstance.h"
 #include "system/file.h"
 #include "system/hash.h"
 #include "system/string.h"
 #include "script/sexpr.h"
+#include "collision/broadphase.h"
+#include "collision/narrowphase.h"
+#include "terrain.h"
+#include "terrain_collision.h"
+#include "terrain_render.h"
+#include "terrain/benchGenerate.h"
+#include "terrain/cache.h"
+#include "terrain/heightGrid.h"
+#include "terrain/latency.h"
+#include "terrain/morph.h"
+#include "terrain/prefetch.h"
+#include "terrain/query.h"
+#include "terrain/vertex.h"
 
 void test_lisp();
 
@@ -28,6 +44,7 @@ void test_lisp();
 void runTests() {
 	// Memory Tests
 	test_allocator();
+	test_scratch();
 
 	test_hash();
 
@@ -37,6 +54,8 @@ void runTests() {
 
 	test_maths();
 
+	test_noise();
+
 	test_property();
 
 	test_string();
@@ -44,6 +63,50 @@ void runTests() {
 	test_input();
 
 	//test_collision();
+	test_broadphase();
+	test_narrowphase();
+
+	test_canyonSnapshot();
+	test_canyonClosestPoint();
+	test_zoneTexture();
+
+	test_terrainCache();
+	test_terrainHeightGrid();
+	test_terrainMorph();
+	test_terrainLatency();
+	test_terrainCollision();
+	test_terrainQuery();
+
+	test_terrainSampleBatch();
+
+	test_terrainVertex();
+	test_terrainElements();
+	test_terrainPrefetch();
+}
+
+// Benchmarks only touch CPU-side systems, so they run headless (no engine, window or GL context)
+void runBenchmarks() {
+	// Without engine_init, the terrain benches that build blocks need the block pools set up here
+	canyon_staticInit();
+	canyonTerrain_initPools();
+
+	bench_canyonSampling();
+	bench_canyonClosestPoint();
+	bench_zoneTexture();
+	bench_terrainCacheRefs();
+	bench_terrainGridLookup();
+	bench_terrainCacheScaling();
+	bench_terrainCacheSoak();
+	bench_terrainDiskCache();
+	bench_terrainLodRefine();
+	bench_terrainSampleBatch();
+	bench_noise();
+	bench_terrainVertex();
+	bench_terrainElements();
+	bench_terrainCollision();
+	bench_terrainQuery();
+	bench_broadphase();
+	bench_narrowphase();
 }
 #endif // UNIT_TEST
 
@@ -55,6 +118,17 @@ int main(int argc, char** argv) {
 	test_allocator();
 	init(argc, argv);
 
+#if UNIT_TEST
+	if ( argc > 1 && strcmp( argv[1], "-bench" ) == 0 ) {
+		runBenchmarks();
+		return 0;
+	}
+	if ( argc > 1 && strcmp( argv[1], "-bench-terrain" ) == 0 ) {
+		bench_terrainGenerate( argc > 2 ? atoi( argv[2] ) : 64, argc > 3 ? argv[3] : NULL );
+		return 0;
+	}
+#endif
+
 	// *** Initialise Engine
 	engine* e = engine_create();
 	engine_init( e, argc, argv );
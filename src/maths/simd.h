@@ -0,0 +1,71 @@
+// simd.h
+#pragma once
+
+/* Portable 4-wide float maths, built on GCC vector extensions so the same code compiles to SSE on x86 and
+   NEON on ARM. Comparisons yield an int mask per lane (all ones or zero) for use with vf4_select */
+
+typedef float vfloat4 __attribute__(( vector_size( 16 )));
+typedef int vint4 __attribute__(( vector_size( 16 )));
+typedef unsigned int vuint4 __attribute__(( vector_size( 16 )));
+
+static inline vfloat4 vf4( float f ) {
+	const vfloat4 v = { f, f, f, f };
+	return v;
+}
+
+static inline vfloat4 vf4_load( const float* p ) {
+	vfloat4 v;
+	memcpy( &v, p, sizeof( v ));
+	return v;
+}
+
+static inline void vf4_store( float* p, vfloat4 v ) {
+	memcpy( p, &v, sizeof( v ));
+}
+
+// Lanes of A where MASK is set, else lanes of B
+static inline vfloat4 vf4_select( vint4 mask, vfloat4 a, vfloat4 b ) {
+	return (vfloat4)(( (vint4)a & mask ) | ( (vint4)b & ~mask ));
+}
+
+static inline vuint4 vu4_select( vint4 mask, vuint4 a, vuint4 b ) {
+	return ( a & (vuint4)mask ) | ( b & ~(vuint4)mask );
+}
+
+static inline vfloat4 vf4_min( vfloat4 a, vfloat4 b ) { return vf4_select( a < b, a, b ); }
+static inline vfloat4 vf4_max( vfloat4 a, vfloat4 b ) { return vf4_select( a > b, a, b ); }
+static inline vfloat4 vf4_clamp( vfloat4 a, vfloat4 bottom, vfloat4 top ) { return vf4_min( vf4_max( a, bottom ), top ); }
+
+static inline vfloat4 vf4_abs( vfloat4 a ) {
+	const vint4 m = { 0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff };
+	return (vfloat4)( (vint4)a & m );
+}
+
+// Truncates toward zero, as a cast does
+static inline vint4 vf4_toInt( vfloat4 f ) {
+	const vint4 i = { (int)f[0], (int)f[1], (int)f[2], (int)f[3] };
+	return i;
+}
+
+static inline vfloat4 vi4_toFloat( vint4 i ) {
+	const vfloat4 f = { (float)i[0], (float)i[1], (float)i[2], (float)i[3] };
+	return f;
+}
+
+static inline vfloat4 vf4_trunc( vfloat4 f ) { return vi4_toFloat( vf4_toInt( f )); }
+
+static inline vfloat4 vf4_floor( vfloat4 f ) {
+	const vfloat4 t = vf4_trunc( f );
+	return vf4_select( t > f, t - vf4( 1.f ), t );
+}
+
+// sin and cos for |x| <= PI/2 (Taylor series; error below 1e-5 over that range)
+static inline vfloat4 vf4_sin( vfloat4 x ) {
+	const vfloat4 x2 = x * x;
+	return x * ( 1.f + x2 * ( -1.f/6.f + x2 * ( 1.f/120.f + x2 * ( -1.f/5040.f + x2 * ( 1.f/362880.f )))));
+}
+
+static inline vfloat4 vf4_cos( vfloat4 x ) {
+	const vfloat4 x2 = x * x;
+	return 1.f + x2 * ( -1.f/2.f + x2 * ( 1.f/24.f + x2 * ( -1.f/720.f + x2 * ( 1.f/40320.f + x2 * ( -1.f/3628800.f )))));
+}
@@ -2,6 +2,7 @@
 #include "common.h"
 #include "allocator.h"
 //---------------------
+#include "scratch.h"
 #include "test.h"
 #include "system/thread.h"
 #include <assert.h>
@@ -57,6 +58,7 @@ void* mem_alloc( size_t bytes ) {
 // Default deallocate from the static heap
 // Passes straight through to heap_deallocate()
 void mem_free( void* ptr ) {
+	vAssert( !scratch_contains( ptr )); // Scratch memory is released by scratch_reset
 	heap_deallocate( static_heap, ptr );
 }
 
@@ -184,6 +186,7 @@ void* heap_allocate_aligned( heapAllocator* heap, size_t toAllocate, size_t alig
 #ifdef MEM_DEBUG_VERBOSE
 	printf( "HeapAllocator request for " dPTRf " bytes, " dPTRf " byte aligned.\n", toAllocate, alignment );
 #endif
+	++heap->allocation_count;
 	bitpool* bit_pool = heap_findBitpool( heap, toAllocate );
 	if ( bit_pool ) {
 		void* data = bitpool_allocate( bit_pool, toAllocate );
@@ -36,6 +36,7 @@ struct heapAllocator_s {
 	size_t total_allocated;	// in bytes, currently allocated
 	size_t total_free;		// in bytes, currently free
 	size_t allocations;
+	size_t allocation_count;	// lifetime total, including bitpools, for measuring allocation rates
 	block* first;					// doubly-linked list of blocks
 	block* free;					// doubly-linked list of free blocks
 	// Bitpools
@@ -73,6 +74,8 @@ typedef struct empty_s {
 	block* prevFree;
 } empty;
 
+extern heapAllocator* static_heap;
+
 // Default allocate from the static heap
 // Passes straight through to heap_allocate()
 #ifdef TRACK_ALLOCATIONS
@@ -0,0 +1,90 @@
+// scratch.c
+#include "common.h"
+#include "scratch.h"
+//---------------------
+#include "test.h"
+#include "mem/allocator.h"
+#include <atomic>
+
+#define kScratchAlignment 16
+
+typedef struct scratchArena_s {
+	void* memory;
+	uint8_t* base;		// MEMORY, aligned
+	size_t size;
+	size_t used;
+	size_t high_water;
+} scratchArena;
+
+static __thread scratchArena* thread_scratch = NULL;
+std::atomic<size_t> scratch_high_water( 0 );
+
+void scratch_threadInit( size_t size ) {
+	vAssert( !thread_scratch );
+	scratchArena* a = (scratchArena*)mem_alloc( sizeof( scratchArena ));
+	a->memory = mem_alloc( size + kScratchAlignment );
+	a->base = (uint8_t*)a->memory + kScratchAlignment - ((uintptr_t)a->memory % kScratchAlignment );
+	a->size = size;
+	a->used = 0;
+	a->high_water = 0;
+	thread_scratch = a;
+}
+
+bool scratch_hasArena() { return thread_scratch != NULL; }
+
+void* scratch_alloc( size_t size ) {
+	scratchArena* a = thread_scratch;
+	vAssert( a ); // Only threads given an arena (the workers) may take scratch memory
+	const size_t aligned = ( size + kScratchAlignment - 1 ) & ~(size_t)( kScratchAlignment - 1 );
+	vAssert( a->used + aligned <= a->size );
+	void* mem = a->base + a->used;
+	a->used += aligned;
+	if ( a->used > a->high_water ) {
+		a->high_water = a->used;
+		size_t highest = scratch_high_water.load( std::memory_order_relaxed );
+		while ( a->used > highest && !scratch_high_water.compare_exchange_weak( highest, a->used, std::memory_order_relaxed ))
+			;
+	}
+	return mem;
+}
+
+void scratch_reset() {
+	scratchArena* a = thread_scratch;
+	if ( !a )
+		return;
+#ifdef DEBUG
+	// Anything that kept a pointer past its task now reads garbage, rather than stale data that looks right
+	memset( a->base, 0xcd, a->used );
+#endif // DEBUG
+	a->used = 0;
+}
+
+bool scratch_contains( const void* ptr ) {
+	const scratchArena* a = thread_scratch;
+	return a && (const uint8_t*)ptr >= a->base && (const uint8_t*)ptr < a->base + a->size;
+}
+
+size_t scratch_highWater() { return scratch_high_water.load(); }
+
+#if UNIT_TEST
+void test_scratch() {
+	// Swap in an arena of our own, so the test doesn't disturb this thread's
+	scratchArena* const saved = thread_scratch;
+	thread_scratch = NULL;
+	scratch_threadInit( 4 * KILOBYTES );
+	float* a = scratchArray( float, 3 );
+	float* b = scratchArray( float, 5 );
+	test( ((uintptr_t)a % kScratchAlignment ) == 0 && ((uintptr_t)b % kScratchAlignment ) == 0,
+			"Scratch allocations are aligned", "Scratch allocation misaligned" );
+	test( (uint8_t*)b - (uint8_t*)a == 16, "Scratch allocations are packed", "Scratch allocations not packed" );
+	test( scratch_contains( a ) && scratch_contains( b ) && !scratch_contains( &saved ),
+			"Scratch arena knows its own allocations", "Scratch arena didn't recognise its allocations" );
+	test( thread_scratch->high_water == 48 && scratch_highWater() >= 48, "Scratch high-water mark tracked", "Scratch high-water mark not tracked" );
+	scratch_reset();
+	test( scratchArray( float, 3 ) == a && thread_scratch->high_water == 48,
+			"Scratch reset reuses the arena", "Scratch reset didn't reuse the arena" );
+	mem_free( thread_scratch->memory );
+	mem_free( thread_scratch );
+	thread_scratch = saved;
+}
+#endif // UNIT_TEST
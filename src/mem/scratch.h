@@ -0,0 +1,31 @@
+// scratch.h
+#pragma once
+
+/* Per-thread scratch arenas: a bump allocator for temporaries that only live as long as the task using them.
+   Workers reset their arena after every task, so nothing taken from one may outlive its task; queueing it as
+   task arguments, completing a future with it or passing it to mem_free all assert */
+
+#define kScratchArenaSize (512*KILOBYTES)
+
+// Give this thread an arena of SIZE bytes
+void scratch_threadInit( size_t size );
+
+// Whether this thread has been given an arena
+bool scratch_hasArena();
+
+// SIZE bytes, 16-byte aligned, from this thread's arena; asserts if the arena is full
+void* scratch_alloc( size_t size );
+#define scratchArray( type, count ) (type*)scratch_alloc( sizeof( type ) * (count) )
+
+// Release everything taken from this thread's arena, if it has one
+void scratch_reset();
+
+// Whether PTR was taken from this thread's arena
+bool scratch_contains( const void* ptr );
+
+// The most any arena has held at once, in bytes
+size_t scratch_highWater();
+
+#if UNIT_TEST
+void test_scratch();
+#endif // UNIT_TEST
@@ -1,7 +1,37 @@
 // noise.h
+#pragma once
+#include "maths/simd.h"
+
+// *** Noise backends
+// NoiseTexture samples a 64x64 tiling texture of sin-hashed octaves, built at startup
+// NoiseHash evaluates fBm of value noise from an integer hash; it never tiles, calls no libm functions,
+// and its lattice values are bit-identical on every machine
+#define NoiseTexture 0
+#define NoiseHash 1
+#ifndef NOISE_BACKEND
+#define NOISE_BACKEND NoiseTexture
+#endif
 
 void noise_staticInit();
 
 float noise( float f );
 float noise2D( float u, float v );
+
+// The terrain noise, from whichever backend is built in; roughly 0 to 1
 float perlin( float u, float v );
+// perlin() for four points at once
+vfloat4 perlin4( vfloat4 u, vfloat4 v );
+
+// The backends, always built so they can be compared
+float perlin_texture( float u, float v );
+vfloat4 perlin_texture4( vfloat4 u, vfloat4 v );
+float noise_fbm( float u, float v );
+vfloat4 noise_fbm4( vfloat4 u, vfloat4 v );
+
+// Hash of an integer lattice point, as a value from 0 to 1
+float noise_hash2D( int u, int v );
+
+#if UNIT_TEST
+void test_noise();
+void bench_noise();
+#endif // UNIT_TEST
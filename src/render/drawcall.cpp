@@ -25,6 +25,9 @@ drawCall::drawCall( shader* vshader, int count, GLushort* elements, vertex* vert
 	element_buffer_offset = 0;
 	vertex_VBO	= resources.vertex_buffer;
 	element_VBO	= resources.element_buffer;
+	morph_VBO	= 0;
+	morph		= 0.f;
+	packed_vertices = false;
 	depth_mask = GL_TRUE;
 	elements_mode = GL_TRIANGLES;
 
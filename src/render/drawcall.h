@@ -23,6 +23,13 @@ struct drawCall {
 
 	GLuint		vertex_VBO;
 	GLuint		element_VBO;
+	GLuint		morph_VBO;		// Optional per-vertex morph targets, 3 floats each, blended in by MORPH
+	float		morph;
+	// Terrain VBOs hold packed terrainVertex, decoded with these; see terrain/vertex.h
+	bool		packed_vertices;
+	vector		vertex_origin;
+	vector		vertex_scale;
+	vector		vertex_uv_origin;	// The uv origin in xy, the canyon texture coordinate's in z
 	uint16_t	element_count;
 	uint16_t	element_buffer_offset;
 
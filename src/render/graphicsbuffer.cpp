@@ -89,7 +89,22 @@ GLuint* render_requestBuffer( GLenum target, const void* data, GLsizei size ) {
 	return b->ptr;
 }
 
-void render_freeBuffer( void* buffer ) { if ( buffer ) mem_free( buffer ); }
+// A request still waiting would write to the freed handle, so it's dropped
+void render_freeBuffer( void* buffer ) {
+	if ( !buffer )
+		return;
+	vmutex_lock( &buffer_mutex );
+	{
+		for ( int i = 0; i < buffer_request_count; ) {
+			if ( buffer_requests[i].ptr == buffer )
+				buffer_requests[i] = buffer_requests[--buffer_request_count];
+			else
+				++i;
+		}
+	}
+	vmutex_unlock( &buffer_mutex );
+	mem_free( buffer );
+}
 
 // Load any waiting buffer requests
 void render_bufferTick() {
@@ -115,6 +130,14 @@ void render_bufferTick() {
 	vmutex_unlock( &buffer_mutex );
 }
 
+void render_bufferDiscardRequests() {
+	vmutex_lock( &buffer_mutex );
+	{
+		buffer_request_count = 0;
+		buffer_copy_request_count = 0;
+	}
+	vmutex_unlock( &buffer_mutex );
+}
 
 /*
 graphicsBuffer* graphicsBuffer_createStatic() {
@@ -21,3 +21,6 @@ void render_bufferCopy( GLenum target, GLuint buffer, const void* data, GLsizei
 
 // Tick the buffer system (to load buffers asynchronously). Should only be called from the render thread!
 void render_bufferTick();
+
+// Drop any waiting requests, leaving their buffers invalid. For headless use, where nothing ticks the buffer system
+void render_bufferDiscardRequests();
@@ -23,6 +23,7 @@
 #include "system/file.h"
 #include "system/hash.h"
 #include "system/string.h"
+#include "terrain/vertex.h"
 // temp
 #include "engine.h"
 
@@ -400,6 +401,28 @@ void render_bindVertexAttributes() {
 	}
 }
 
+/* Terrain blocks' packed terrainVertex (see terrain/vertex.h). Everything but the color goes in unnormalised, so
+   the shader sees the exact stored integers, and decodes them with the draw's frame: texture_v's half rides in
+   position.w, the octahedral normal is the raw snorm pair in normal.xy, and the uvs are halfs' bits */
+void render_bindTerrainVertexAttributes() {
+	if ( *resources.attributes.position >= 0 ) {
+		glVertexAttribPointer( *resources.attributes.position, /*xyz + texture_v*/ 4, GL_UNSIGNED_SHORT, /*Normalized?*/GL_FALSE, sizeof( terrainVertex ), (void*)offsetof( terrainVertex, position ));
+		glEnableVertexAttribArray( *resources.attributes.position );
+	}
+	if ( *resources.attributes.normal >= 0 ) {
+		glVertexAttribPointer( *resources.attributes.normal, /*octahedral*/ 2, GL_SHORT, /*Normalized?*/GL_FALSE, sizeof( terrainVertex ), (void*)offsetof( terrainVertex, normal ));
+		glEnableVertexAttribArray( *resources.attributes.normal );
+	}
+	if ( *resources.attributes.uv >= 0 ) {
+		glVertexAttribPointer( *resources.attributes.uv, /*2 halfs*/ 2, GL_UNSIGNED_SHORT, /*Normalized?*/GL_FALSE, sizeof( terrainVertex ), (void*)offsetof( terrainVertex, uv ));
+		glEnableVertexAttribArray( *resources.attributes.uv );
+	}
+	if ( *resources.attributes.color >= 0 ) {
+		glVertexAttribPointer( *resources.attributes.color, /*4 unsigned bytes*/ 4, GL_UNSIGNED_BYTE, /*Normalized?*/GL_TRUE, sizeof( terrainVertex ), (void*)offsetof( terrainVertex, color ));
+		glEnableVertexAttribArray( *resources.attributes.color );
+	}
+}
+
 void render_useBuffers( GLuint vertexBuffer, GLuint elementBuffer ) {
 	render_current_VBO = vertexBuffer;
 	glBindBuffer( GL_ARRAY_BUFFER, vertexBuffer );
@@ -411,6 +434,17 @@ void render_drawCall_draw( drawCall* draw ) {
 	vAssert( draw->element_count > 0 );
 	if ( draw->vertex_VBO != render_current_VBO )
 		render_useBuffers( draw->vertex_VBO, draw->element_VBO );
+	// Every time, as the same VBO may last have been bound for another shader's attributes
+	if ( draw->packed_vertices )
+		render_bindTerrainVertexAttributes();
+	// Morph targets come from their own buffer, bound just for this draw; without one MORPH is 0 and they're unused
+	const bool morphing = draw->morph_VBO && *resources.attributes.morph_target >= 0;
+	if ( morphing ) {
+		glBindBuffer( GL_ARRAY_BUFFER, draw->morph_VBO );
+		glVertexAttribPointer( *resources.attributes.morph_target, /*vec3*/ 3, GL_FLOAT, /*Normalized?*/GL_FALSE, 0, (void*)0 );
+		glEnableVertexAttribArray( *resources.attributes.morph_target );
+		glBindBuffer( GL_ARRAY_BUFFER, draw->vertex_VBO );
+	}
 	
 	// If required, copy our data to the GPU
 	if ( draw->vertex_VBO == resources.vertex_buffer ) {
@@ -434,6 +468,8 @@ void render_drawCall_draw( drawCall* draw ) {
 		*/
 	}
 	glDrawElements( draw->elements_mode, draw->element_count, GL_UNSIGNED_SHORT, (void*)(uintptr_t)draw->element_buffer_offset );
+	if ( morphing )
+		glDisableVertexAttribArray( *resources.attributes.morph_target );
 }
 
 int compareTexture( const void* a_, const void* b_ ) {
@@ -531,6 +567,12 @@ void render_drawShaderBatch( window* w, int count, const drawCall* calls ) {
 					Uniform( *resources.uniforms.ssao_tex, ssaoBuffer->texture );
 				}
 				Uniform( *resources.uniforms.modelview, sorted[i].modelview );
+				Uniform( *resources.uniforms.morph, sorted[i].morph );
+				if ( sorted[i].packed_vertices ) {
+					Uniform( *resources.uniforms.vertex_origin, &sorted[i].vertex_origin );
+					Uniform( *resources.uniforms.vertex_scale, &sorted[i].vertex_scale );
+					Uniform( *resources.uniforms.vertex_uv_origin, &sorted[i].vertex_uv_origin );
+				}
 				render_drawCall_draw( &sorted[i] );
 			}
 		}
@@ -90,6 +90,7 @@ struct vertex_s {
 	uint32_t	color;		// 4 x 8bit = 32bit
 	// TODO - Should these be smaller than 32bit floats in these vectors? UVs/Colors at least? (And normals?)
 	// What's the smallest feasible size? 10x 32bit?
+	// (Terrain has a 20 byte packed equivalent; see terrain/vertex.h)
 };
 
 struct window_s {
@@ -56,12 +56,17 @@ namespace Shader {
 
 	void Uniform( GLuint uniform, vector v ) { Uniform( uniform, &v ); }
 
+	void Uniform( GLuint uniform, float f ) {
+		if ( uniform != kShaderConstantNoLocation ) glUniform1f( uniform, f );
+	}
+
 	void loadShaders() {
 		shaderLoad( "dat/shaders/default.s", true );
 		shaderLoad( "dat/shaders/depth.s", true );
 		shaderLoad( "dat/shaders/refl_normal.s", true );
 		shaderLoad( "dat/shaders/reflective.s", true );
 		shaderLoad( "dat/shaders/terrain.s", true );
+		shaderLoad( "dat/shaders/terrain_depth.s", true );
 		shaderLoad( "dat/shaders/gaussian.s", true );
 		shaderLoad( "dat/shaders/gaussian_vert.s", true );
 		shaderLoad( "dat/shaders/ui.s", true );
@@ -257,6 +262,7 @@ void shader_activate( shader* s ) {
 map* shaderMap = NULL;
 
 shader** shaderGet( const char* shaderName ) {
+	if ( !shaderMap ) return nullptr; // None loaded yet, or headless
 	void* s = map_find(shaderMap, mhash(shaderName));
 	if (s) return (shader**)s;
 	else return nullptr;
@@ -78,4 +78,5 @@ namespace Shader {
 	void Uniform( GLuint uniform, GLuint texture );
 	void Uniform( GLuint uniform, vector* v );
 	void Uniform( GLuint uniform, vector v );
+	void Uniform( GLuint uniform, float f );
 }
@@ -31,13 +31,18 @@
 	f( sun_color ) \
 	f( viewspace_up ) \
 	f( directional_light_direction ) \
-	f( screen_size )
+	f( screen_size ) \
+	f( morph ) \
+	f( vertex_origin ) \
+	f( vertex_scale ) \
+	f( vertex_uv_origin )
 
 #define VERTEX_ATTRIBS( f ) \
 	f( position ) \
 	f( normal ) \
 	f( uv ) \
-	f( color )
+	f( color ) \
+	f( morph_target )
 
 struct ShaderUniforms { SHADER_UNIFORMS( DECLARE_AS_GLINT_P ) };
 struct VertexAttribs { VERTEX_ATTRIBS( DECLARE_AS_GLINT_P ) };
@@ -20,7 +20,6 @@
 
 // *** Forward Declarations
 uint8_t* read_tga( const char* file, int* w, int* h );
-void texture_requestMem( GLuint* tex, int w, int h, int stride, uint8_t* bitmap, GLuint wrap_s, GLuint wrap_t );
 
 // Globals
 texture* static_texture_default = NULL;
@@ -36,6 +35,7 @@ typedef struct textureRequest_s {
 	int			width;
 	int			height;
 	int			stride;
+	int			first_row;	// For row requests
 	textureProperties properties;
 	future*		_future;
 } textureRequest;
@@ -62,6 +62,12 @@ void texture_tick() {
 					// Need to clear up where we free this - we won't always want to do it but we might
 					texture_free( r.bitmap );
 					break;
+				case kTextureMemRowsRequest:
+					// Requests are handled in order, so the texture's full load has already happened
+					vAssert( r.bitmap && *r.tex != kInvalidGLTexture );
+					texture_loadBitmapRows( *r.tex, r.width, r.first_row, r.height, r.stride, r.bitmap );
+					texture_free( r.bitmap );
+					break;
 			}
 			//vAssert( r._future );
 			//future_complete( r._future, r.filename );
@@ -123,6 +129,25 @@ void texture_requestMem( GLuint* tex, int w, int h, int stride, uint8_t* bitmap,
 	vmutex_unlock( &texture_mutex );
 }
 
+void texture_requestRows( GLuint* tex, int w, int first, int count, int stride, uint8_t* bitmap ) {
+	vmutex_lock( &texture_mutex );
+	{
+		vAssert( texture_request_count < kMaxTextureRequests );
+		textureRequest* request = textureRequest_new();
+
+		request->tex = tex;
+		request->type = kTextureMemRowsRequest;
+		size_t bitmap_size = sizeof( uint8_t ) * w * count * stride;
+		request->bitmap = texture_allocate( bitmap_size );
+		memcpy( request->bitmap, bitmap, bitmap_size );
+		request->width = w;
+		request->height = count;
+		request->first_row = first;
+		request->stride = stride;
+	}
+	vmutex_unlock( &texture_mutex );
+}
+
 void texture_queueWorkerTextureLoad( GLuint* tex, const char* filename, textureProperties* properties ) {
 	// TODO - tuple
 	const void** args = (const void**)mem_alloc( sizeof( void* ) * 3 );
@@ -215,6 +240,13 @@ texture* texture_loadFromMem( int w, int h, int stride, uint8_t* bitmap ) {
 	return t;
 }
 
+texture* texture_createEmpty() {
+	texture* t = texture_nextEmpty();
+	t->gl_tex = kInvalidGLTexture;
+	t->filename = NULL;
+	return t;
+}
+
 void texture_delete( texture* t ) {
 	(void)t;
 	// Do nothing right now?
@@ -357,6 +389,16 @@ GLuint texture_loadBitmap( int w, int h, int stride, uint8_t* bitmap, GLuint wra
 	return tex;
 }
 
+void texture_loadBitmapRows( GLuint tex, int w, int first, int count, int stride, uint8_t* bitmap ) {
+	vAssert( bitmap );
+	vAssert( stride == 4 ); // Only support RGBA8 right now
+	glBindTexture( GL_TEXTURE_2D, tex );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, (GLint)first, (GLsizei)w, (GLsizei)count, GL_RGBA, GL_UNSIGNED_BYTE, bitmap );
+#ifdef RENDER_USE_MIPMAPPING
+	glGenerateMipmap( GL_TEXTURE_2D );
+#endif // RENDER_USE_MIPMAPPING
+}
+
 uint8_t* texture_allocate( size_t size ) {
 	uint8_t* mem = (uint8_t*)heap_allocate( texture_heap, size, NULL );
 	//printf( "TEXTURE: Allocating " dPTRf " bytes as 0x" xPTRf "\n", size, (uintptr_t)mem );
@@ -13,6 +13,7 @@ extern texture* static_texture_reflective;
 void texture_staticInit();
 
 GLuint texture_loadBitmap( int w, int h, int stride, uint8_t* bitmap, GLuint wrap_s, GLuint wrap_t );
+void texture_loadBitmapRows( GLuint tex, int w, int first, int count, int stride, uint8_t* bitmap );
 GLuint texture_loadTGA(const char* filename);
 
 	// TGA format
@@ -52,7 +53,8 @@ typedef struct tga_header_s {
 
 enum textureRequestType {
 	kTextureFileRequest,
-	kTextureMemRequest
+	kTextureMemRequest,
+	kTextureMemRowsRequest
 };
 
 struct texture_s {
@@ -71,6 +73,12 @@ void texture_requestFile( GLuint* tex, const char* filename, textureProperties*
 texture* texture_load( const char* filename );
 texture* texture_loadWithProperties( const char* filename, textureProperties* properties );
 texture* texture_loadFromMem( int w, int h, int stride, uint8_t* bitmap );
+// A texture with nothing loaded yet, for texture_requestMem to fill later
+texture* texture_createEmpty();
+// Queue BITMAP for upload to TEX by the render thread; BITMAP is copied, so may be freed once this returns
+void texture_requestMem( GLuint* tex, int w, int h, int stride, uint8_t* bitmap, GLuint wrap_s, GLuint wrap_t );
+// As texture_requestMem, replacing only rows FIRST to FIRST+COUNT of a texture already requested; BITMAP holds just those rows
+void texture_requestRows( GLuint* tex, int w, int first, int count, int stride, uint8_t* bitmap );
 void texture_delete( texture* t );
 
 // For offline skybox rendering, or anything else that needs source images
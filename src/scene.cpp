@@ -4,6 +4,7 @@
 #include "scene.h"
 //-----------------------
 #include "camera.h"
+#include "collision.h"
 #include "font.h"
 #include "input.h"
 #include "light.h"
@@ -41,6 +42,8 @@ static const size_t lightArraySize = sizeof( light* ) * MAX_LIGHTS;
 keybind scene_debug_transforms_toggle;
 keybind scene_debug_lights_toggle;
 keybind render_bloom_filter_toggle;
+keybind scene_debug_terrain_latency_toggle;
+keybind scene_debug_collision_stats;
 
 void scene_initStatic( ) {
 	scene_debug_transforms_toggle = input_registerKeybind( );
@@ -51,6 +54,12 @@ void scene_initStatic( ) {
 	
 	render_bloom_filter_toggle = input_registerKeybind( );
 	input_setDefaultKeyBind( render_bloom_filter_toggle, KEY_B );
+
+	scene_debug_terrain_latency_toggle = input_registerKeybind( );
+	input_setDefaultKeyBind( scene_debug_terrain_latency_toggle, KEY_Y );
+
+	scene_debug_collision_stats = input_registerKeybind( );
+	input_setDefaultKeyBind( scene_debug_collision_stats, KEY_K );
 }
 
 // Add an existing modelInstance to the scene
@@ -289,6 +298,13 @@ void scene_input( scene* s, input* in ) {
 		s->debug_flags ^= kSceneDebugTransforms;
 	if ( input_keybindPressed( in, scene_debug_lights_toggle ))
 		s->debug_flags ^= kSceneLightsTransforms;
+	if ( input_keybindPressed( in, scene_debug_terrain_latency_toggle ))
+		s->debug_flags ^= kSceneDebugTerrainLatency;
+	if ( input_keybindPressed( in, scene_debug_collision_stats )) {
+		collisionStats stats;
+		collision_stats( &stats );
+		collision_printStats( stdout, &stats );
+	}
 	if ( input_keybindPressed( in, render_bloom_filter_toggle ))
 		render_bloom_enabled = !render_bloom_enabled;
 }
@@ -19,6 +19,7 @@
 
 #define kSceneDebugTransforms	0x00000001
 #define kSceneLightsTransforms	0x00000002
+#define kSceneDebugTerrainLatency	0x00000004
 
 // *** Scene ***
 struct scene_s {
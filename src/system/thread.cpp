@@ -4,6 +4,7 @@
 #include "thread.h"
 //-------------------------
 #include <sched.h> // for sched_yield
+#include <time.h>
 
 //#define DEBUG_THREAD_CONDITIONS
 
@@ -30,6 +31,10 @@ vthread vthread_create( vthreadfunc func, void* args ) {
 	return t;
 }
 
+void vthread_join( vthread t ) {
+	pthread_join( t, NULL );
+}
+
 void vthread_yield() {
 	sched_yield();
 }
@@ -53,6 +58,53 @@ void vmutex_init( vmutex* mutex ) {
 	pthread_mutex_init ( mutex, NULL);
 }
 
+// *** Instrumented Mutices
+
+unsigned long long vlock_nanoseconds() {
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return (unsigned long long)t.tv_sec * 1000000000ull + (unsigned long long)t.tv_nsec;
+}
+
+void vmutex_lockStats( vmutex* mutex, vlockStats* stats ) {
+	const unsigned long long requested = vlock_nanoseconds();
+	vmutex_lock( mutex );
+	const unsigned long long acquired = vlock_nanoseconds();
+	const unsigned long long wait = acquired - requested;
+	++stats->acquisitions;
+	stats->wait_ns += wait;
+	stats->max_wait_ns = ( wait > stats->max_wait_ns ) ? wait : stats->max_wait_ns;
+	stats->acquired_at = acquired;
+}
+
+void vmutex_unlockStats( vmutex* mutex, vlockStats* stats ) {
+	stats->hold_ns += vlock_nanoseconds() - stats->acquired_at;
+	vmutex_unlock( mutex );
+}
+
+void vlockStats_reset( vlockStats* stats ) {
+	memset( stats, 0, sizeof( vlockStats ));
+}
+
+void vlockStats_accumulate( vlockStats* total, const vlockStats* stats ) {
+	total->acquisitions += stats->acquisitions;
+	total->wait_ns += stats->wait_ns;
+	total->hold_ns += stats->hold_ns;
+	total->max_wait_ns = ( stats->max_wait_ns > total->max_wait_ns ) ? stats->max_wait_ns : total->max_wait_ns;
+}
+
+void vlockStats_print( const char* name, const vlockStats* stats ) {
+	const double acquisitions = stats->acquisitions > 0 ? (double)stats->acquisitions : 1.0;
+	printf( "Lock %s: %llu acquisitions, avg wait %.0fns (max %lluns), avg hold %.0fns, total wait %.2fms, total hold %.2fms\n",
+			name,
+			stats->acquisitions,
+			(double)stats->wait_ns / acquisitions,
+			stats->max_wait_ns,
+			(double)stats->hold_ns / acquisitions,
+			(double)stats->wait_ns * 0.000001,
+			(double)stats->hold_ns * 0.000001 );
+}
+
 // *** Conditions
 
 void vthread_signalCondition( int i ) {
@@ -27,6 +27,8 @@ typedef void* (*vthreadfunc)( void* );
 
 // Kick off a thread
 vthread vthread_create( vthreadfunc func, void* args );
+// Wait for a thread to finish
+void vthread_join( vthread t );
 
 // Stop running this thread and add it to the ready-queue, allowing another thread to begin
 // executing
@@ -44,6 +46,23 @@ void vmutex_unlock( vmutex* mutex );
 // Init a non-static mutex
 void vmutex_init( vmutex* mutex );
 
+// Instrumented locking, recording how long callers waited for and then held the mutex
+// The stats are only written while holding the mutex, so need no synchronisation of their own
+typedef struct vlockStats_s {
+	unsigned long long acquisitions;
+	unsigned long long wait_ns;
+	unsigned long long hold_ns;
+	unsigned long long max_wait_ns;
+	unsigned long long acquired_at;
+} vlockStats;
+
+void vmutex_lockStats( vmutex* mutex, vlockStats* stats );
+void vmutex_unlockStats( vmutex* mutex, vlockStats* stats );
+
+void vlockStats_reset( vlockStats* stats );
+void vlockStats_accumulate( vlockStats* total, const vlockStats* stats );
+void vlockStats_print( const char* name, const vlockStats* stats );
+
 //
 // *** Conditions
 //
@@ -2,9 +2,12 @@
 #include "common.h"
 #include "terrain.h"
 //-----------------------
+#include "bench.h"
 #include "canyon.h"
 #include "noise.h"
 #include "canyon_terrain.h"
+#include "test.h"
+#include "mem/allocator.h"
 
 float terrain_mountainFunc( float x ) {
 	return cosf( x - 0.5 * sinf( 2 * x ));
@@ -71,3 +74,129 @@ float canyonTerrain_sampleUV( float u, float v ) {
 	const float canyon = terrain_canyonHeight( u, v );
 	return detail - curvestep(cliff * 2.f, 50.f) - canyon;
 }
+
+// *** Batched sampling
+// 4-wide versions of the functions above, used by canyonTerrain_sampleUVBatch
+
+vfloat4 terrain_detailHeight4( vfloat4 u, vfloat4 v ) {
+	const float amplitude = 16.f;
+	return amplitude * perlin4( u, v ) +
+			amplitude * 1.5f * perlin4( u * 0.7f, v * 0.7f ) +
+				amplitude * 2.5f * perlin4( u * 0.13f, v * 0.13f );
+}
+
+// fmodf, which truncates toward zero, then corrected so it is exact as fmodf is
+vfloat4 vf4_fmod( vfloat4 in, float step ) {
+	vfloat4 r = in - vf4_trunc( in / step ) * step;
+	const vint4 negative = in < 0.f;
+	r = vf4_select( ~negative & ( r < 0.f ), r + step, r );
+	r = vf4_select( ~negative & ( r >= step ), r - step, r );
+	r = vf4_select( negative & ( r > 0.f ), r - step, r );
+	r = vf4_select( negative & ( r <= -step ), r + step, r );
+	return r;
+}
+
+vfloat4 curvestep4( vfloat4 in, float step ) {
+	const vfloat4 m = vf4_fmod( in, step ) / step - 0.5f;
+	// m is in (-1.5, 0.5), so the angle stays within the range vf4_sin and vf4_cos are accurate over
+	const vfloat4 angle = m * (float)( PI * 0.25 );
+	const vfloat4 delta = vf4_sin( angle ) / vf4_cos( angle );
+	return ( vf4_floor( in / step ) + delta ) * step;
+}
+
+vfloat4 terrain_canyonHeight4( vfloat4 u ) {
+	u = vf4_max( vf4_abs( u ) - canyon_base_radius, vf4( 0.f )) * vf4_select( u > 0.f, vf4( 1.f ), vf4( -1.f ));
+
+	const float incline_scale = 0.0004f;
+	const float flat_radius = 20.f;
+	const vfloat4 offset = vf4_max( vf4( 0.f ), vf4_abs( u ) - canyon_base_radius ) - flat_radius;
+	const vfloat4 incline = offset * offset * incline_scale;
+
+	const vfloat4 x = u / canyon_width;
+	const vfloat4 mask = vf4_cos( vf4_clamp( x, vf4( -PI/2.f ), vf4( PI/2.f )));
+	const vfloat4 x2 = x * x;
+	return ( 1.f - vf4_clamp( x2 * x2, vf4( 0.f ), vf4( 1.f ))) * mask * canyon_height - incline;
+}
+
+vfloat4 canyonTerrain_sampleUV4( vfloat4 u, vfloat4 v ) {
+	const vfloat4 detail = terrain_detailHeight4( u, v ) * 0.5f;
+	const float scale = 0.435f;
+	const vfloat4 cliff = terrain_detailHeight4( u * scale, v * scale );
+	const vfloat4 canyon = terrain_canyonHeight4( u );
+	return detail - curvestep4( cliff * 2.f, 50.f ) - canyon;
+}
+
+void canyonTerrain_sampleUVBatch( const float* u, const float* v, float* out, int n ) {
+	int i = 0;
+	for ( ; i + 4 <= n; i += 4 )
+		vf4_store( out + i, canyonTerrain_sampleUV4( vf4_load( u + i ), vf4_load( v + i )));
+	// Pad the tail rather than falling back to the scalar path, so every sample takes the same path
+	if ( i < n ) {
+		float uTail[4] = { 0.f, 0.f, 0.f, 0.f };
+		float vTail[4] = { 0.f, 0.f, 0.f, 0.f };
+		float outTail[4];
+		memcpy( uTail, u + i, ( n - i ) * sizeof( float ));
+		memcpy( vTail, v + i, ( n - i ) * sizeof( float ));
+		vf4_store( outTail, canyonTerrain_sampleUV4( vf4_load( uTail ), vf4_load( vTail )));
+		memcpy( out + i, outTail, ( n - i ) * sizeof( float ));
+	}
+}
+
+#if UNIT_TEST
+#define kTestSamples 4099 // Not a multiple of four, to cover the padded tail
+#define kBenchSamples 65536
+#define kBenchPasses 16
+
+// Points across and along the canyon, from the floor out past the walls
+void terrain_testPoints( float* u, float* v, int n ) {
+	for ( int i = 0; i < n; ++i ) {
+		u[i] = -600.f + (float)(( i * 7919 ) % 1201 ) + 0.37f * (float)( i % 3 );
+		v[i] = -1000.f + 13.71f * (float)i;
+	}
+}
+
+void test_terrainSampleBatch() {
+	printf( "--- Beginning Unit Test: Terrain Batch Sampling ---\n" );
+	noise_staticInit();
+	float* u = (float*)mem_alloc( sizeof( float ) * kTestSamples );
+	float* v = (float*)mem_alloc( sizeof( float ) * kTestSamples );
+	float* batch = (float*)mem_alloc( sizeof( float ) * kTestSamples );
+	terrain_testPoints( u, v, kTestSamples );
+	canyonTerrain_sampleUVBatch( u, v, batch, kTestSamples );
+
+	// The batch path approximates sin, cos and tan, so heights differ from the scalar path by a tiny amount
+	const float tolerance = 0.01f;
+	float worst = 0.f;
+	for ( int i = 0; i < kTestSamples; ++i )
+		worst = fmaxf( worst, fabsf( batch[i] - canyonTerrain_sampleUV( u[i], v[i] )));
+	printf( "Batch sampling max error vs scalar: %g\n", worst );
+	test( worst < tolerance, "Batch sampling matches scalar sampling", "Batch sampling differs from scalar sampling" );
+
+	mem_free( u );
+	mem_free( v );
+	mem_free( batch );
+}
+
+void bench_terrainSampleBatch() {
+	noise_staticInit();
+	float* u = (float*)mem_alloc( sizeof( float ) * kBenchSamples );
+	float* v = (float*)mem_alloc( sizeof( float ) * kBenchSamples );
+	float* out = (float*)mem_alloc( sizeof( float ) * kBenchSamples );
+	terrain_testPoints( u, v, kBenchSamples );
+
+	double start = bench_seconds();
+	for ( int pass = 0; pass < kBenchPasses; ++pass )
+		for ( int i = 0; i < kBenchSamples; ++i )
+			out[i] = canyonTerrain_sampleUV( u[i], v[i] );
+	bench_report( "terrain samples (scalar)", kBenchSamples * kBenchPasses, bench_seconds() - start );
+
+	start = bench_seconds();
+	for ( int pass = 0; pass < kBenchPasses; ++pass )
+		canyonTerrain_sampleUVBatch( u, v, out, kBenchSamples );
+	bench_report( "terrain samples (batch, 4-wide)", kBenchSamples * kBenchPasses, bench_seconds() - start );
+
+	mem_free( u );
+	mem_free( v );
+	mem_free( out );
+}
+#endif // UNIT_TEST
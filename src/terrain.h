@@ -1,3 +1,12 @@
 // terrain.h
+#pragma once
 
 float canyonTerrain_sampleUV( float u, float v );
+
+// Sample N points at once; matches canyonTerrain_sampleUV to within a small tolerance
+void canyonTerrain_sampleUVBatch( const float* u, const float* v, float* out, int n );
+
+#if UNIT_TEST
+void test_terrainSampleBatch();
+void bench_terrainSampleBatch();
+#endif // UNIT_TEST
@@ -0,0 +1,141 @@
+// benchGenerate.c
+#include "src/common.h"
+#include "src/terrain/benchGenerate.h"
+//---------------------
+#include "bench.h"
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "engine.h"
+#include "future.h"
+#include "noise.h"
+#include "terrain_generate.h"
+#include "base/pair.h"
+#include "mem/allocator.h"
+#include "mem/scratch.h"
+#include "render/graphicsbuffer.h"
+#include "terrain/buildCacheTask.h"
+#include "terrain/cache.h"
+#include "terrain/latency.h"
+
+#if UNIT_TEST
+#define kBenchTerrainSeed 0x5eed
+
+typedef struct lodResult_s {
+	int lod;
+	int u_samples;
+	int v_samples;
+	int blocks;
+	double seconds;
+	double p50;
+	double p99;
+	double allocations;	// Per block
+	double stages[kTerrainStageCount];	// Seconds, summed over all blocks
+	terrainLatencySummary latency;		// Over the last kTerrainLatencyRecords blocks
+} lodResult;
+
+// Generate BLOCKS blocks at LOD, a row at a time down a fresh canyon just beyond the terrain's bounds
+static lodResult benchLod( engine* e, int lod, int blocks ) {
+	canyon_seedRandom( kBenchTerrainSeed );
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	double* latencies = (double*)mem_alloc( sizeof( double ) * blocks );
+	size_t allocations = 0;
+	terrainStages_reset();
+	terrainLatency_reset();
+
+	lodResult r;
+	memset( &r, 0, sizeof( r ));
+	r.lod = lod;
+	r.blocks = blocks;
+	r.u_samples = canyonTerrain_lodSamples( t->uSamplesPerBlock, lod );
+	r.v_samples = canyonTerrain_lodSamples( t->vSamplesPerBlock, lod );
+
+	for ( int i = 0; i < blocks; ++i ) {
+		const absolute u = { i % t->u_block_count - t->u_block_count / 2 };
+		const absolute v = { t->bounds[1][1] + 1 + i / t->u_block_count };
+		const float vPosition = (float)v.coord * 2.f * t->v_radius / (float)t->v_block_count;
+		canyonBuffer_seek( c, max( 0, (int)( vPosition / CanyonSegmentLength ) - TrailingCanyonSegments ));
+		canyonTerrainBlock* b = newBlock( t, u, v, e );
+		canyonTerrainBlock_setLayout( b, t, u, v, lod );
+
+		const size_t allocationsBefore = static_heap->allocation_count;
+		const double start = bench_seconds();
+		terrainBlock_generateNow( b );
+		latencies[i] = bench_seconds() - start;
+		allocations += static_heap->allocation_count - allocationsBefore;
+
+		// Hand the block over as the render thread would once its buffers were up. It's outside the terrain's
+		// bounds, so setBlock deletes it
+		render_bufferDiscardRequests();
+		future_complete_( b->ready );
+		futures_tick( 0.f );
+		terrainCache_tick( c->cache, 0.f, Vector( 0.f, 0.f, vPosition, 1.f ));
+	}
+
+	for ( int i = 0; i < blocks; ++i )
+		r.seconds += latencies[i];
+	qsort( latencies, blocks, sizeof( double ), bench_compareDoubles );
+	r.p50 = latencies[blocks / 2];
+	r.p99 = latencies[blocks * 99 / 100];
+	r.allocations = (double)allocations / (double)blocks;
+	for ( int s = 0; s < kTerrainStageCount; ++s )
+		r.stages[s] = terrainStage_seconds( s );
+	terrainLatency_summarise( &r.latency );
+	mem_free( latencies );
+	testTerrain_delete( t );
+	return r;
+}
+
+static void writeJson( FILE* out, int blocks, size_t scratchHighWater, const lodResult* results, int count ) {
+	fprintf( out, "{\n\t\"benchmark\": \"terrain_generate\",\n\t\"seed\": %d,\n\t\"blocks_per_lod\": %d,\n", kBenchTerrainSeed, blocks );
+	fprintf( out, "\t\"scratch_high_water_bytes\": %zu,\n\t\"lods\": [\n", scratchHighWater );
+	for ( int i = 0; i < count; ++i ) {
+		const lodResult* r = &results[i];
+		fprintf( out, "\t\t{\n" );
+		fprintf( out, "\t\t\t\"lod\": %d,\n", r->lod );
+		fprintf( out, "\t\t\t\"samples\": [ %d, %d ],\n", r->u_samples, r->v_samples );
+		fprintf( out, "\t\t\t\"blocks\": %d,\n", r->blocks );
+		fprintf( out, "\t\t\t\"blocks_per_second\": %.1f,\n", (double)r->blocks / r->seconds );
+		fprintf( out, "\t\t\t\"latency_ms\": { \"p50\": %.3f, \"p99\": %.3f },\n", r->p50 * 1000.0, r->p99 * 1000.0 );
+		fprintf( out, "\t\t\t\"allocations_per_block\": %.1f,\n", r->allocations );
+		fprintf( out, "\t\t\t\"stage_ms_per_block\": {" );
+		for ( int s = 0; s < kTerrainStageCount; ++s )
+			fprintf( out, "%s \"%s\": %.3f", s > 0 ? "," : "", terrainStageNames[s], r->stages[s] * 1000.0 / (double)r->blocks );
+		fprintf( out, " },\n" );
+		fprintf( out, "\t\t\t\"lifecycle_ms\": {" );
+		for ( int s = kBlockRequested + 1; s < kBlockStageCount; ++s ) {
+			const latencyPercentiles* p = &r->latency.stages[s];
+			fprintf( out, "%s \"%s\": { \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f }", s > kBlockRequested + 1 ? "," : "",
+					terrainBlockStageNames[s], p->p50 * 1000.0, p->p95 * 1000.0, p->p99 * 1000.0 );
+		}
+		fprintf( out, " }\n\t\t}%s\n", i + 1 < count ? "," : "" );
+	}
+	fprintf( out, "\t]\n}\n" );
+}
+
+void bench_terrainGenerate( int blocks, const char* path ) {
+	vAssert( blocks > 0 );
+	noise_staticInit();
+	canyon_staticInit();
+	canyonTerrain_initPools();
+	scratch_threadInit( kScratchArenaSize );
+	engine* e = engine_create();
+
+	lodResult results[LowestLod + 1];
+	for ( int lod = 0; lod <= LowestLod; ++lod ) {
+		results[lod] = benchLod( e, lod, blocks );
+		char name[64];
+		snprintf( name, sizeof( name ), "terrain generate (lod %d blocks)", lod );
+		bench_report( name, blocks, results[lod].seconds );
+		terrainLatency_print( stdout, &results[lod].latency );
+	}
+
+	FILE* out = path ? fopen( path, "w" ) : stdout;
+	vAssert( out );
+	writeJson( out, blocks, scratch_highWater(), results, LowestLod + 1 );
+	if ( path ) {
+		fclose( out );
+		printf( "Wrote terrain generation benchmark to %s\n", path );
+	}
+}
+#endif // UNIT_TEST
@@ -0,0 +1,11 @@
+// benchGenerate.h
+#pragma once
+
+/* Headless terrain generation benchmark (make bench-terrain). Builds BLOCKS terrain blocks at each LOD along a
+   canyon from a fixed seed, through the same cache and generation tasks the workers run, with no GL context.
+   Writes blocks/s, per-stage timings, allocations per block, latency percentiles and per-lifecycle-stage
+   percentiles (see terrain/latency.h) as JSON to PATH, or to stdout if PATH is NULL */
+
+#if UNIT_TEST
+void bench_terrainGenerate( int blocks, const char* path );
+#endif // UNIT_TEST
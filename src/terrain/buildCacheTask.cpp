@@ -11,6 +11,7 @@
 #include "actor/actor.h"
 #include "base/pair.h"
 #include "mem/allocator.h"
+#include "mem/scratch.h"
 #include "system/thread.h"
 
 void* buildCacheBlockTask(void* args) {
@@ -25,8 +26,11 @@ void* buildCacheBlockTask(void* args) {
 	bool rebuild = cache && cache->lod > b->lod_level;
 	if (rebuild)
 		cacheBlockFree( cache ); // Release the cache we don't want
-	if (!cache || rebuild)
+	if (!cache || rebuild) {
+		const long long stage = terrainStage_begin();
 		cache = terrainCacheBuildAndAdd( c, b->terrain, uMin, vMin, b->lod_level );
+		terrainStage_end( kTerrainStageCacheBuild, stage );
+	}
 
 	future_complete( f, cache ); // TODO - Should this be tryComplete? hit a segfault here
 	cacheBlockFree( cache );
@@ -46,7 +50,7 @@ future* requestCache( canyonTerrainBlock* b, int u, int v ) {
 		void* vv = (void*)(uintptr_t)v;
 		worker_addTask( task( buildCacheBlockTask, Quad(b, f, uu, vv)));
 	}
-	future_onComplete( f, takeCacheRef, NULL );
+	future_onComplete( f, cacheReady, NULL );
 	return f;
 }
 
@@ -57,7 +61,8 @@ void releaseAllCaches( cacheBlocklist* caches ) {
 
 /* At this point all the terrain caches should be filled,
    so we can just use them safely */
-void generateVerts( canyonTerrainBlock* b, vertPositions* vertSources, cacheBlocklist* caches ) {
+void terrainBlock_samplePositions( canyonTerrainBlock* b, vertPositions* vertSources, cacheBlocklist* caches ) {
+	const long long stage = terrainStage_begin();
 	vector* verts = vertSources->positions;
 	const int max = vertCount( b );
 	for ( int v = -1; v < b->v_samples+1; ++v )
@@ -73,16 +78,35 @@ void generateVerts( canyonTerrainBlock* b, vertPositions* vertSources, cacheBloc
 		}
 
 	releaseAllCaches( caches );
-	worker_addTask( task( canyonTerrain_workerGenerateBlock, Pair( vertSources, b )));
+	terrainStage_end( kTerrainStageCacheSample, stage );
 }
 
+// Positions are generated straight into the block in the same task, as they're scratch
 void* worker_generateVerts( void* args ) {
-	cacheBlocklist* caches = cachesForBlock( (canyonTerrainBlock*)_1(args) );
-	generateVerts( (canyonTerrainBlock*)_1(args), (vertPositions*)_2(args), caches );
-	mem_free(args);
+	canyonTerrainBlock* b = (canyonTerrainBlock*)args;
+	terrainLatency_stamp( b, kBlockCacheReady );
+	vertPositions* vertSources = vertPositions_create( b );
+	terrainBlock_samplePositions( b, vertSources, cachesForBlock( b ));
+	canyonTerrainBlock_generate( vertSources, b );
 	return NULL;
 }
 
+void terrainBlock_generateNow( canyonTerrainBlock* b ) {
+	canyon* c = b->_canyon;
+	int cacheMinU = 0, cacheMinV = 0, cacheMaxU = 0, cacheMaxV = 0;
+	getCacheExtents( b, cacheMinU, cacheMinV, cacheMaxU, cacheMaxV );
+	for ( int u = cacheMinU; u <= cacheMaxU; u += CacheBlockSize )
+		for ( int v = cacheMinV; v <= cacheMaxV; v += CacheBlockSize ) {
+			future* f = NULL;
+			if ( cacheBlockFuture( c->cache, u, v, b->lod_level, &f ))
+				buildCacheBlockTask( Quad( b, f, (void*)(uintptr_t)u, (void*)(uintptr_t)v ));
+			future_onComplete( f, cacheReady, NULL );
+		}
+
+	worker_generateVerts( b );
+	scratch_reset();
+}
+
 futurelist* generateAllCaches( canyonTerrainBlock* b ) {
 	int cacheMinU = 0, cacheMinV = 0, cacheMaxU = 0, cacheMaxV = 0;
 	getCacheExtents(b, cacheMinU, cacheMinV, cacheMaxU, cacheMaxV );
@@ -104,7 +128,7 @@ void* buildCacheTask( void* args ) {
 	return NULL;
 }
 
-/* Builds a vertPositions to be passed to a child worker to actually construct the terrain.
+/* Makes sure every cache block the terrain block needs is built, completing the future once they are.
    This should normally just pull from cache - if blocks aren't there, build them */
 future* buildCache(canyonTerrainBlock* b) {
 	future* f = future_create();
@@ -113,15 +137,8 @@ future* buildCache(canyonTerrainBlock* b) {
 }
 
 void generatePositions( canyonTerrainBlock* b) {
-	vertPositions* vertSources = (vertPositions*)mem_alloc( sizeof( vertPositions )); // TODO - don't do a full mem_alloc here
-	vertSources->uMin = -1;
-	vertSources->vMin = -1;
-	vertSources->uCount = b->u_samples + 2;
-	vertSources->vCount = b->v_samples + 2;
-	vertSources->positions = (vector*)mem_alloc( sizeof( vector ) * vertCount( b ));
-
 	future* f = buildCache( b );
-	future_onComplete( f, runTask, taskAlloc( worker_generateVerts, Pair( b, vertSources )));
+	future_onComplete( f, runTask, taskAlloc( worker_generateVerts, b ));
 }
 
 void* generateVertices_( void* args ) {
@@ -1,5 +1,19 @@
 // buildCacheTask.h
 #pragma once
+#include "terrain/cache.h"
 
 // *** Worker Task ***
 Msg generateVertices( canyonTerrainBlock* b );
+
+// Build the cache block at (U,V) if missing or too coarse for the block, then complete the future with it
+void* buildCacheBlockTask( void* args );
+
+// Fill VERTSOURCES for B from CACHES, which must all be ready, releasing them
+void terrainBlock_samplePositions( canyonTerrainBlock* b, vertPositions* vertSources, cacheBlocklist* caches );
+
+// Worker task generating the block ARGS, once its cache blocks are all built
+void* worker_generateVerts( void* args );
+
+/* As generatePositions, but running each worker task in turn on this thread: build any missing cache blocks,
+   then sample the block's positions from them and generate it. Needs a scratch arena on this thread */
+void terrainBlock_generateNow( canyonTerrainBlock* b );
@@ -2,274 +2,793 @@
 #include "src/common.h"
 #include "src/terrain/cache.h"
 //---------------------
+#include "bench.h"
 #include "canyon.h"
 #include "canyon_terrain.h"
 #include "future.h"
+#include "noise.h"
 #include "terrain_generate.h"
+#include "test.h"
 #include "worker.h"
 #include "base/pair.h"
 #include "mem/allocator.h"
+#include "mem/scratch.h"
 #include "system/thread.h"
+#include "terrain/diskCache.h"
+#include <sys/stat.h>
+#if UNIT_TEST
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#endif // UNIT_TEST
 
 DEF_LIST(cacheGrid);
 IMPLEMENT_LIST(cacheBlock);
 IMPLEMENT_LIST(cacheGrid);
 
+#define kGridLockStripes 16
+#define kGridTableInitialCapacity 64
+#define kGridKeyEmpty 0x8000000080000000ull // Grid indices are int / GridCapacity, so never INT_MIN
+#define kGridKeyTombstone 0x8000000080000001ull
+#define kTerrainCacheDefaultBudget (32*MEGABYTES)
+#define kCacheEvictMinAge 60 // Frames; anything requested more recently may still be waited on
+
+/* Grids are found through an open-addressed hash table keyed by the packed grid coordinate, so lookups
+   stay constant time however many grids are resident. Slots are only written under gridListMutex, and
+   a key is published after its grid, so readers can probe without a lock. Removed grids leave a
+   tombstone, which is never reused; the table is rebuilt instead once tombstones build up. */
+typedef struct gridSlot_s {
+	std::atomic<uint64_t> key;
+	std::atomic<cacheGrid*> grid;
+} gridSlot;
+
+typedef struct gridTable_s {
+	int capacity; // Always a power of two
+	int count;
+	int used; // Live grids plus tombstones
+	gridSlot* slots;
+} gridTable;
+
+/* Locking is split so that workers building different parts of the canyon don't serialise:
+   gridListMutex guards only inserts into the grid table, and the contents of each grid (blocks, futures and
+   needed lods) are guarded by one of a set of striped locks keyed by the grid coordinate.
+   Lock order is grid stripe -> grid list -> block retirement */
 struct terrainCache_s {
-	cacheGridlist* grids;	
+	std::atomic<gridTable*> grids;
 	cacheBlocklist* blocks;	
-	cacheBlocklist* toDelete;
+	vmutex gridListMutex;
+	vmutex gridMutices[kGridLockStripes];
+	vlockStats gridListStats;
+	vlockStats gridStats[kGridLockStripes];
+	// Eviction
+	std::atomic<int> frame;
+	std::atomic<long long> residentBytes; // Blocks held by grids
+	long long budgetBytes;
+	std::atomic<int> evictions;
+	std::atomic<int> regenerations;
+	int gridsRemoved;
+	std::atomic<int> refinements; // Blocks built at a finer LOD from the samples of a coarser build
+	// Disk cache; off unless a directory is set
+	char* diskDir;
+	std::atomic<int> diskHits;
+	std::atomic<int> diskMisses;
+	// Prefetching
+	std::atomic<int> prefetches;	// Blocks built ahead of need
+	std::atomic<int> prefetchHits;	// Prefetched blocks later requested
+	std::atomic<int> prefetchWasted;	// Prefetched blocks evicted without being requested
 };
 
-vmutex terrainMutex = kMutexInitialiser;
-vmutex blockMutex = kMutexInitialiser;
+// *** Block reclamation
+/* Refcounts are atomic, so a block can be taken or released from any worker without a lock. When the last
+   ref is dropped the block is retired rather than freed, as a reader may have loaded its pointer but not yet
+   taken a ref. Lock-free readers pin the current epoch while they do so; terrainCache_tick only frees the
+   blocks retired in an epoch once every reader pinned in that epoch has gone, then advances the epoch. */
+#define kCacheEpochs 3
+std::atomic<unsigned> cacheEpoch( 0 );
+std::atomic<int> cacheEpochReaders[kCacheEpochs];
+cacheBlocklist* retiredBlocks[kCacheEpochs]; // Also holds grid tables replaced by a resize; anything mem_alloc'd
+vmutex retireMutex = kMutexInitialiser;
+
+unsigned cacheEpoch_pin() {
+	while ( true ) {
+		const unsigned e = cacheEpoch.load();
+		cacheEpochReaders[e % kCacheEpochs].fetch_add( 1 );
+		if ( cacheEpoch.load() == e )
+			return e;
+		cacheEpochReaders[e % kCacheEpochs].fetch_sub( 1 );
+	}
+}
+
+void cacheEpoch_unpin( unsigned e ) {
+	cacheEpochReaders[e % kCacheEpochs].fetch_sub( 1, std::memory_order_release );
+}
+
+void cache_retire( void* data ) {
+	vmutex_lock( &retireMutex ); {
+		const unsigned e = cacheEpoch.load() % kCacheEpochs;
+		retiredBlocks[e] = cacheBlocklist_cons( (cacheBlock*)data, retiredBlocks[e] );
+	} vmutex_unlock( &retireMutex );
+}
+
+// Free the blocks retired in the previous epoch, if no reader from then is still pinned
+void cacheEpoch_advance() {
+	cacheBlocklist* retired = NULL;
+	vmutex_lock( &retireMutex ); {
+		const unsigned e = cacheEpoch.load();
+		const unsigned previous = ( e + kCacheEpochs - 1 ) % kCacheEpochs;
+		if ( cacheEpochReaders[previous].load( std::memory_order_acquire ) == 0 ) {
+			retired = retiredBlocks[previous];
+			retiredBlocks[previous] = NULL;
+			cacheEpoch.store( e + 1 );
+		}
+	} vmutex_unlock( &retireMutex );
+
+	for ( cacheBlocklist* b = retired; b; b = b->tail )
+		mem_free( b->head );
+	cacheBlocklist_delete( retired );
+}
+
+// *** Grid table
+uint64_t gridKey( int u, int v ) {
+	const uint32_t uGrid = (uint32_t)( minStride( u, GridCapacity ) / GridCapacity );
+	const uint32_t vGrid = (uint32_t)( minStride( v, GridCapacity ) / GridCapacity );
+	return ( (uint64_t)uGrid << 32 ) | vGrid;
+}
+
+// Finaliser from MurmurHash3; grid coords are small and sequential so need mixing before masking
+unsigned gridHash( uint64_t key ) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return (unsigned)key;
+}
+
+gridTable* gridTable_create( int capacity ) {
+	vAssert( ( capacity & ( capacity - 1 )) == 0 );
+	gridTable* t = (gridTable*)mem_alloc( sizeof( gridTable ) + sizeof( gridSlot ) * capacity );
+	t->capacity = capacity;
+	t->count = 0;
+	t->used = 0;
+	t->slots = (gridSlot*)( t + 1 );
+	for ( int i = 0; i < capacity; ++i ) {
+		t->slots[i].key.store( kGridKeyEmpty, std::memory_order_relaxed );
+		t->slots[i].grid.store( NULL, std::memory_order_relaxed );
+	}
+	return t;
+}
+
+// Lock-free; callers must have pinned the epoch, as a resize retires the old table
+cacheGrid* gridTable_find( gridTable* t, uint64_t key ) {
+	const unsigned mask = t->capacity - 1;
+	for ( unsigned i = gridHash( key ) & mask;; i = ( i + 1 ) & mask ) {
+		const uint64_t k = t->slots[i].key.load( std::memory_order_acquire );
+		if ( k == key )
+			return t->slots[i].grid.load( std::memory_order_relaxed );
+		if ( k == kGridKeyEmpty )
+			return NULL;
+	}
+}
+
+// GridListMutex-Locked
+int gridTable_slot( gridTable* t, uint64_t key ) {
+	const unsigned mask = t->capacity - 1;
+	for ( unsigned i = gridHash( key ) & mask;; i = ( i + 1 ) & mask ) {
+		const uint64_t k = t->slots[i].key.load( std::memory_order_relaxed );
+		if ( k == key )
+			return i;
+		if ( k == kGridKeyEmpty )
+			return -1;
+	}
+}
+
+// GridListMutex-Locked
+void gridTable_insert( gridTable* t, uint64_t key, cacheGrid* g ) {
+	vAssert( t->used < t->capacity / 2 );
+	const unsigned mask = t->capacity - 1;
+	unsigned i = gridHash( key ) & mask;
+	while ( t->slots[i].key.load( std::memory_order_relaxed ) != kGridKeyEmpty )
+		i = ( i + 1 ) & mask;
+	t->slots[i].grid.store( g, std::memory_order_relaxed );
+	t->slots[i].key.store( key, std::memory_order_release );
+	++t->count;
+	++t->used;
+}
+
+// GridListMutex-Locked
+// Keep the load factor (tombstones included) at or below one half so probe runs stay short. Readers still
+// holding the old table see every grid added before the rebuild, so it is simply retired
+void gridTable_add( terrainCache* cache, cacheGrid* g ) {
+	gridTable* t = cache->grids.load( std::memory_order_relaxed );
+	if ( ( t->used + 1 ) * 2 > t->capacity ) {
+		int capacity = kGridTableInitialCapacity;
+		while ( ( t->count + 1 ) * 4 > capacity )
+			capacity *= 2;
+		gridTable* rebuilt = gridTable_create( capacity );
+		for ( int i = 0; i < t->capacity; ++i ) {
+			const uint64_t k = t->slots[i].key.load( std::memory_order_relaxed );
+			if ( k != kGridKeyEmpty && k != kGridKeyTombstone )
+				gridTable_insert( rebuilt, k, t->slots[i].grid.load( std::memory_order_relaxed ));
+		}
+		cache->grids.store( rebuilt, std::memory_order_release );
+		cache_retire( t );
+		t = rebuilt;
+	}
+	gridTable_insert( t, gridKey( g->uMin, g->vMin ), g );
+}
+
+// GridListMutex-Locked
+void gridTable_remove( terrainCache* cache, cacheGrid* g ) {
+	gridTable* t = cache->grids.load( std::memory_order_relaxed );
+	const int i = gridTable_slot( t, gridKey( g->uMin, g->vMin ));
+	vAssert( i >= 0 && t->slots[i].grid.load( std::memory_order_relaxed ) == g );
+	t->slots[i].key.store( kGridKeyTombstone, std::memory_order_release );
+	--t->count;
+}
 
 terrainCache* terrainCache_create() {
 	terrainCache* t = (terrainCache*)mem_alloc(sizeof(terrainCache));
+	memset( (void*)t, 0, sizeof( terrainCache ));
 	t->blocks = cacheBlocklist_create();
-	t->toDelete = NULL;
-	t->grids = NULL;
+	t->grids.store( gridTable_create( kGridTableInitialCapacity ));
+	t->budgetBytes = kTerrainCacheDefaultBudget;
+	vmutex_init( &t->gridListMutex );
+	for ( int i = 0; i < kGridLockStripes; ++i )
+		vmutex_init( &t->gridMutices[i] );
 	return t;
 }
 
+// Free every grid, and with them the cache's refs to its blocks; no-one may still be using the cache.
+// Blocks are retired as ever, so anything else still holding one keeps it until released
+void terrainCache_delete( terrainCache* t ) {
+	gridTable* table = t->grids.load( std::memory_order_relaxed );
+	for ( int i = 0; i < table->capacity; ++i ) {
+		const uint64_t k = table->slots[i].key.load( std::memory_order_relaxed );
+		if ( k == kGridKeyEmpty || k == kGridKeyTombstone )
+			continue;
+		cacheGrid* g = table->slots[i].grid.load( std::memory_order_relaxed );
+		for ( int u = 0; u < GridSize; ++u )
+			for ( int v = 0; v < GridSize; ++v ) {
+				cacheBlockFree( g->blocks[u][v] );
+				if ( g->futures[u][v] )
+					future_delete( g->futures[u][v] );
+			}
+		terrainDisk_close( g->disk );
+		mem_free( g );
+	}
+	mem_free( table );
+	cacheBlocklist_delete( t->blocks );
+	if ( t->diskDir )
+		mem_free( t->diskDir );
+	mem_free( t );
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+}
+
+int gridStripe( int u, int v ) {
+	const unsigned uGrid = (unsigned)( minStride( u, GridCapacity ) / GridCapacity );
+	const unsigned vGrid = (unsigned)( minStride( v, GridCapacity ) / GridCapacity );
+	return ( uGrid * 73856093u ^ vGrid * 19349663u ) % kGridLockStripes;
+}
+
+void gridLock( terrainCache* cache, int u, int v ) {
+	const int stripe = gridStripe( u, v );
+	vmutex_lockStats( &cache->gridMutices[stripe], &cache->gridStats[stripe] );
+}
+
+void gridUnlock( terrainCache* cache, int u, int v ) {
+	const int stripe = gridStripe( u, v );
+	vmutex_unlockStats( &cache->gridMutices[stripe], &cache->gridStats[stripe] );
+}
+
+void terrainCache_printLockStats( terrainCache* cache ) {
+	vlockStats grids;
+	vlockStats_reset( &grids );
+	for ( int i = 0; i < kGridLockStripes; ++i )
+		vlockStats_accumulate( &grids, &cache->gridStats[i] );
+	vlockStats_print( "terrainCache grid list", &cache->gridListStats );
+	vlockStats_print( "terrainCache grids", &grids );
+}
+
+void terrainCache_resetLockStats( terrainCache* cache ) {
+	vlockStats_reset( &cache->gridListStats );
+	for ( int i = 0; i < kGridLockStripes; ++i )
+		vlockStats_reset( &cache->gridStats[i] );
+}
+
 void takeRef( cacheBlock* b ) {
-	vmutex_lock( &blockMutex ); {
-		if (b) ++b->refCount; // TODO - CAS instruction?
-	} vmutex_unlock( &blockMutex );
+	if (b) b->refCount.fetch_add( 1, std::memory_order_relaxed );
 }
 
-void* takeCacheRef( const void* value, void* args ) {
-	(void)args;
-	takeRef( (cacheBlock*)value ); // URGH const cast?
+// Take a ref only if the block is still live; a block whose count has hit zero is already retired
+bool tryTakeRef( cacheBlock* b ) {
+	int count = b->refCount.load( std::memory_order_relaxed );
+	while ( count > 0 )
+		if ( b->refCount.compare_exchange_weak( count, count + 1, std::memory_order_acquire, std::memory_order_relaxed ))
+			return true;
+	return false;
+}
+
+/* Requesters take their own refs in cachesForBlock once every cache is ready, as a ref taken here was never
+   released and so pinned every block forever. A handler is still needed, so the future is executed (and
+   dropped from the futures list) even if it completed before anyone sequenced it */
+void* cacheReady( const void* value, void* args ) {
+	(void)value; (void)args;
 	return NULL;
 }
 
-// Find the grid in the list, else NULL
+// Grids are counted in use while a lookup holds them, so eviction can't remove one from under a worker.
+// As with blocks, a grid found without the list lock may have been removed since; refuse it then
+bool gridTryUse( cacheGrid* g ) {
+	int users = g->users.load( std::memory_order_relaxed );
+	while ( users >= 0 )
+		if ( g->users.compare_exchange_weak( users, users + 1, std::memory_order_acquire, std::memory_order_relaxed ))
+			return true;
+	return false;
+}
+
+void gridRelease( cacheGrid* g ) {
+	if (g) g->users.fetch_sub( 1, std::memory_order_release );
+}
+
+// GridListMutex-Locked
+cacheGrid* gridForInternal( terrainCache* cache, int uMin, int vMin ) {
+	return gridTable_find( cache->grids.load( std::memory_order_relaxed ), gridKey( uMin, vMin ));
+}
+
+// Find the grid in the table and take a use of it, else NULL; callers must gridRelease it.
+// The pin covers the probe, as grids and old tables are retired rather than freed
 cacheGrid* gridFor( terrainCache* cache, int uMin, int vMin ) {
-	const int uGrid = minStride(uMin, GridCapacity);
-	const int vGrid = minStride(vMin, GridCapacity);
-	for( cacheGridlist* g = cache->grids; g && g->head; g = g->tail )
-		if ( g->head->uMin == uGrid && g->head->vMin == vGrid )
-			return g->head;
-	return NULL;
+	const unsigned epoch = cacheEpoch_pin();
+	cacheGrid* g = gridTable_find( cache->grids.load( std::memory_order_acquire ), gridKey( uMin, vMin ));
+	if ( g && !gridTryUse( g ))
+		g = NULL;
+	cacheEpoch_unpin( epoch );
+	return g;
 }
 
-// Find the grid in the list, return it from that, else NULL
+// Grid-Locked
+void gridTouch( terrainCache* cache, cacheGrid* g, int u, int v ) {
+	gridSetLastUsed( g, cache->frame.load( std::memory_order_relaxed ), u, v );
+}
+
+// Find the grid in the table, return it from that, else NULL
+// The grid holds a ref, so while its lock is held the block cannot be retired under us
 cacheBlock* terrainCached( terrainCache* cache, int u, int v ) {
 	cacheBlock* b = NULL;
-	vmutex_lock( &terrainMutex ); {
-		cacheGrid* g = gridFor( cache, u, v );
-		b = g ? gridBlock( g, u, v ) : NULL;
-	} vmutex_unlock( &terrainMutex );
-	takeRef( b );
+	cacheGrid* g = gridFor( cache, u, v );
+	if ( g ) {
+		gridLock( cache, u, v ); {
+			b = gridBlock( g, u, v );
+			takeRef( b );
+			gridTouch( cache, g, u, v );
+		} gridUnlock( cache, u, v );
+		gridRelease( g );
+	}
 	return b;
 }
 
+// GridListMutex-Locked
 cacheGrid* terrainCacheAddGrid( terrainCache* t, cacheGrid* g ) {
-	t->grids = cacheGridlist_cons( g, t->grids );
+	gridTable_add( t, g );
 	return g;
 }
 
-// Idempotent
-void terrain_deleteBlock( terrainCache* cache, cacheBlock* b ) {
-	// Check it's not already in there, it could be!
-	for ( cacheBlocklist* bl = cache->toDelete; bl; bl = bl->tail )
-		if (bl->head == b)
-			return;
-	cache->toDelete = cacheBlocklist_cons( b, cache->toDelete );
-}
-
 cacheGrid* gridForIndex( int u, int v ) {
 	return cacheGrid_create( minStride( u, GridCapacity ), minStride( v, GridCapacity ));
 }
 cacheGrid* gridForBlock( cacheBlock* b ) {
 	return gridForIndex( b->uMin, b->vMin );
 }
+// Returns the grid in use; callers must gridRelease it
+// Grids are only removed under the list lock, so one found here is always live
 cacheGrid* gridGetOrAdd( terrainCache* cache, int u, int v ) {
-	cacheGrid* g = gridFor( cache, u, v );
-	if (!g)
-		g = terrainCacheAddGrid( cache, gridForIndex( u, v ));
+	cacheGrid* g = NULL;
+	vmutex_lockStats( &cache->gridListMutex, &cache->gridListStats ); {
+		g = gridForInternal( cache, u, v );
+		if (!g)
+			g = terrainCacheAddGrid( cache, gridForIndex( u, v ));
+		g->users.fetch_add( 1, std::memory_order_relaxed );
+	} vmutex_unlockStats( &cache->gridListMutex, &cache->gridListStats );
 	vAssert( g );
 	return g;
 }
 
-// TerrainMutex-Locked
-cacheBlock* terrainCacheAddInternal( terrainCache* t, cacheBlock* b ) {
-	cacheGrid* g = gridGetOrAdd( t, b->uMin, b->vMin );
+// Grid-Locked
+// Takes ownership of B's creation ref; returns whichever block ends up cached, with a ref for the caller
+cacheBlock* terrainCacheAddInternal( terrainCache* cache, cacheGrid* g, cacheBlock* b ) {
 	cacheBlock* old = gridBlock( g, b->uMin, b->vMin );
 	if (old && old->lod <= b->lod) {
-		mem_free( b );
+		mem_free( b ); // Never published, so no-one else can see it
+		takeRef( old );
 		return old;
 	}
 	else {
-		if (old) terrain_deleteBlock( t, old );
+		if ( gridEvicted( g, b->uMin, b->vMin )) {
+			cache->regenerations.fetch_add( 1, std::memory_order_relaxed );
+			gridSetEvicted( g, false, b->uMin, b->vMin );
+		}
+		if ( !old )
+			cache->residentBytes.fetch_add( sizeof( cacheBlock ), std::memory_order_relaxed );
 		gridSetBlock( g, b, b->uMin, b->vMin );
-		takeRef( b );
+		gridTouch( cache, g, b->uMin, b->vMin );
+		takeRef( b ); // The grid's ref
+		cacheBlockFree( old ); // Drop the grid's ref to the block we replaced
 		return b;
 	}
 }
 
-int cacheGetNeededLod( terrainCache* cache, int u, int v ) {
-	cacheGrid* g = gridGetOrAdd( cache, u, v );
-	return g ? gridLod( g, u, v ) : lowestLod;
-}
-
 cacheBlock* terrainCacheBuildAndAdd( canyon* c, canyonTerrain* t, int uMin, int vMin, int lod ) {
-	vmutex_lock( &terrainMutex );
-		const int highestLodNeeded = min( cacheGetNeededLod( c->cache, uMin, vMin), lod );
-	vmutex_unlock( &terrainMutex );
-
 	// Only add it if we need to!
-	vmutex_lock( &terrainMutex );
-		cacheGrid* g = gridGetOrAdd( c->cache, uMin, vMin );
+	cacheGrid* g = gridGetOrAdd( c->cache, uMin, vMin );
+	gridLock( c->cache, uMin, vMin );
+		const int highestLodNeeded = min( gridLod( g, uMin, vMin ), lod );
 		cacheBlock* cache = gridBlock( g, uMin, vMin );
-	vmutex_unlock( &terrainMutex );
+		takeRef( cache );
+	gridUnlock( c->cache, uMin, vMin );
 	if (cache && cache->lod <= lod ) {
 		//skip
 		printf( "Skipping building block, already have one.\n" );
 	} else {
-		cacheBlock* b = terrainCacheBlock( c, t, uMin, vMin, highestLodNeeded );
-		vmutex_lock( &terrainMutex );
-			cache = terrainCacheAddInternal( c->cache, b );
-		vmutex_unlock( &terrainMutex );
+		// A coarser block already holds every other sample (or every fourth) of the finer one
+		cacheBlock* b = cache ? terrainCacheRefineBlock( c, t, cache, highestLodNeeded ) : terrainCacheBlock( c, t, uMin, vMin, highestLodNeeded );
+		cacheBlockFree( cache );
+		gridLock( c->cache, uMin, vMin );
+			cache = terrainCacheAddInternal( c->cache, g, b );
+		gridUnlock( c->cache, uMin, vMin );
 	}
+	gridRelease( g );
 
 	return cache;
 }
 
+/* Prefetches don't claim the slot's future, so a request arriving first just builds the block itself, and a
+   prefetch queued behind it finds the block there and does nothing; requests never wait on background work */
+void terrainCachePrefetch( canyon* c, canyonTerrain* t, int uMin, int vMin, int lod ) {
+	terrainCache* cache = c->cache;
+	cacheGrid* g = gridGetOrAdd( cache, uMin, vMin );
+	bool needed = false;
+	gridLock( cache, uMin, vMin ); {
+		const cacheBlock* b = gridBlock( g, uMin, vMin );
+		const future* f = gridFuture( g, uMin, vMin );
+		needed = ( !b || b->lod > lod ) && !( f && !f->complete );
+	} gridUnlock( cache, uMin, vMin );
+	if ( needed ) {
+		cacheBlock* b = terrainCacheBuildAndAdd( c, t, uMin, vMin, lod );
+		gridLock( cache, uMin, vMin ); {
+			if ( gridBlock( g, uMin, vMin ) == b && !gridPrefetched( g, uMin, vMin )) {
+				gridSetPrefetched( g, true, uMin, vMin );
+				cache->prefetches.fetch_add( 1, std::memory_order_relaxed );
+			}
+		} gridUnlock( cache, uMin, vMin );
+		cacheBlockFree( b );
+	}
+	gridRelease( g );
+}
+
 static int numCaches = 0;
 
-vector vecSample( vector* array, int w, int h, float u, float v ) {
-	(void)w;
-	const int iu = (int)floorf(u);
-	const int iv = (int)floorf(v);
-	vAssert( iu >= 0 && iu + 1 < w );
-	vAssert( iv >= 0 && iv + 1 < h );
-	const vector A = array[iu * h + iv];
-	const vector B = array[iu * h + (iv+1)];
-	const vector C = array[(iu+1) * h + iv];
-	const vector D = array[(iu+1) * h + (iv+1)];
-	const float uLerp = fractf(u);
-	const float vLerp = fractf(v);
-	return veclerp(veclerp( A, B, vLerp), veclerp( C, D, vLerp), uLerp);
+vector cacheBlock_position( const cacheBlock* b, int u, int v ) {
+	vAssert( u >= 0 && u < CacheBlockSize && v >= 0 && v < CacheBlockSize );
+	const int iu = u / CacheAnchorInterval;
+	const int iv = v / CacheAnchorInterval;
+	const float uLerp = (float)( u - iu * CacheAnchorInterval ) / (float)CacheAnchorInterval;
+	const float vLerp = (float)( v - iv * CacheAnchorInterval ) / (float)CacheAnchorInterval;
+	const float* A = b->anchors[iu][iv];
+	const float* B = b->anchors[iu][iv+1];
+	const float* C = b->anchors[iu+1][iv];
+	const float* D = b->anchors[iu+1][iv+1];
+	const float x = lerp( lerp( A[0], B[0], vLerp ), lerp( C[0], D[0], vLerp ), uLerp );
+	const float z = lerp( lerp( A[1], B[1], vLerp ), lerp( C[1], D[1], vLerp ), uLerp );
+	return Vector( x, cacheBlock_height( b, u, v ), z, 1.f );
 }
 
-cacheBlock* terrainCacheBlock( canyon* c, canyonTerrain* t, int uMin, int vMin, int requiredLOD ) {
+float cacheBlock_height( const cacheBlock* b, int u, int v ) {
+	return (float)( b->heightBase + (int)b->heights[u][v] ) * CacheHeightStep;
+}
+
+// Quantise the heights sampled at STRIDE; the base is the lowest, so the rest fit 16 bits
+void cacheBlock_storeHeights( cacheBlock* b, float heights[CacheBlockSize][CacheBlockSize], int stride ) {
+	float lowest = heights[0][0];
+	for ( int u = 0; u < CacheBlockSize; u += stride )
+		for ( int v = 0; v < CacheBlockSize; v += stride )
+			lowest = fminf( lowest, heights[u][v] );
+	b->heightBase = (int)floorf( lowest / CacheHeightStep );
+	memset( b->heights, 0, sizeof( b->heights ));
+	for ( int u = 0; u < CacheBlockSize; u += stride )
+		for ( int v = 0; v < CacheBlockSize; v += stride ) {
+			// 512 units of range; the canyon stays well within that in a block, but saturate rather than wrap
+			const int q = (int)lrintf( heights[u][v] / CacheHeightStep ) - b->heightBase;
+			b->heights[u][v] = (uint16_t)min( max( q, 0 ), 0xffff );
+		}
+}
+
+// The grid's disk file, opened the first time a block in the grid is built
+terrainDiskGrid* diskGridFor( terrainCache* cache, canyonTerrain* t, cacheGrid* g ) {
+	terrainDiskGrid* disk = NULL;
+	gridLock( cache, g->uMin, g->vMin ); {
+		if ( !g->disk )
+			g->disk = terrainDisk_open( cache->diskDir, terrainDisk_key( t ), g->uMin / GridCapacity, g->vMin / GridCapacity );
+		disk = g->disk;
+	} gridUnlock( cache, g->uMin, g->vMin );
+	return disk;
+}
+
+// Samples already held by COARSE, if any, are copied rather than generated again
+cacheBlock* terrainCacheBlockFrom( canyon* c, canyonTerrain* t, int uMin, int vMin, int requiredLOD, const cacheBlock* coarse ) {
 	++numCaches;
 	cacheBlock* b = (cacheBlock*)mem_alloc( sizeof( cacheBlock )); // TODO - don't do full mem_alloc here
 	b->uMin = uMin;
 	b->vMin = vMin;
 	b->lod = requiredLOD;
+	b->refCount.store( 1, std::memory_order_relaxed );
+
+	cacheGrid* g = c->cache->diskDir ? gridFor( c->cache, uMin, vMin ) : NULL;
+	terrainDiskGrid* disk = g ? diskGridFor( c->cache, t, g ) : NULL;
+	if ( disk && terrainDisk_read( disk, b )) {
+		c->cache->diskHits.fetch_add( 1, std::memory_order_relaxed );
+		gridRelease( g );
+		return b;
+	}
 	int lod = max( 1, 2 * requiredLOD );
-#define canyonSampleInterval 4
-#define LodVerts ((CacheBlockSize / canyonSampleInterval) + 1)
-	vector worldSpace[LodVerts][LodVerts];
-	for ( int vOffset = 0; vOffset < LodVerts; ++vOffset ) {
-		for ( int uOffset = 0; uOffset < LodVerts; ++uOffset ) {
-			float u, v, x, z;
-			terrain_positionsFromUV( t, uMin + uOffset*canyonSampleInterval, vMin + vOffset*canyonSampleInterval, &u, &v );
-			terrain_worldSpaceFromCanyon( c, u, v, &x, &z );
-			worldSpace[uOffset][vOffset] = Vector(x, 0.f, z, 0.f);
+	const int coarseStride = coarse ? max( 1, 2 * coarse->lod ) : 0;
+	// Anchors don't depend on LOD, so a refined block has them already
+	if ( coarse )
+		memcpy( b->anchors, coarse->anchors, sizeof( b->anchors ));
+	else {
+		canyonSnapshot* snapshot = canyon_snapshot( c );
+		for ( int vOffset = 0; vOffset < CacheAnchors; ++vOffset ) {
+			for ( int uOffset = 0; uOffset < CacheAnchors; ++uOffset ) {
+				float u, v;
+				terrain_positionsFromUV( t, uMin + uOffset*CacheAnchorInterval, vMin + vOffset*CacheAnchorInterval, &u, &v );
+				canyonSnapshot_worldSpaceFromCanyon( snapshot, u, v, &b->anchors[uOffset][vOffset][0], &b->anchors[uOffset][vOffset][1] );
+			}
 		}
+		canyonSnapshot_release( snapshot );
 	}
-	float f = (float)canyonSampleInterval;
+	// Heights are sampled a row at a time, through the batched sampler
+	float sampled[CacheBlockSize][CacheBlockSize];
+	float us[CacheBlockSize], vs[CacheBlockSize], heights[CacheBlockSize];
 	for ( int vOffset = 0; vOffset < CacheBlockSize; vOffset+=lod ) {
+		const bool coarseRow = coarse && vOffset % coarseStride == 0;
+		int count = 0;
 		for ( int uOffset = 0; uOffset < CacheBlockSize; uOffset+=lod ) {
-			float u, v;
-			terrain_positionsFromUV( t, uMin + uOffset, vMin + vOffset, &u, &v );
-			vector vec = vecSample( (vector*)worldSpace, LodVerts, LodVerts, ((float)uOffset) / f, ((float)vOffset) / f );
-			b->positions[uOffset][vOffset] = Vector( vec.coord.x, canyonTerrain_sampleUV( u, v ), vec.coord.z, 1.f );
+			if ( coarseRow && uOffset % coarseStride == 0 )
+				continue;
+			terrain_positionsFromUV( t, uMin + uOffset, vMin + vOffset, &us[count], &vs[count] );
+			++count;
 		}
+		canyonTerrain_sampleUVBatch( us, vs, heights, count );
+		count = 0;
+		for ( int uOffset = 0; uOffset < CacheBlockSize; uOffset+=lod )
+			sampled[uOffset][vOffset] = ( coarseRow && uOffset % coarseStride == 0 ) ? cacheBlock_height( coarse, uOffset, vOffset ) : heights[count++];
 	}
-	b->refCount = 1;
+	cacheBlock_storeHeights( b, sampled, lod );
+	if ( disk ) {
+		c->cache->diskMisses.fetch_add( 1, std::memory_order_relaxed );
+		terrainDisk_write( disk, b );
+	}
+	gridRelease( g );
 	return b;
 }
 
+cacheBlock* terrainCacheBlock( canyon* c, canyonTerrain* t, int uMin, int vMin, int requiredLOD ) {
+	return terrainCacheBlockFrom( c, t, uMin, vMin, requiredLOD, NULL );
+}
+
+cacheBlock* terrainCacheRefineBlock( canyon* c, canyonTerrain* t, const cacheBlock* coarse, int requiredLOD ) {
+	vAssert( coarse->lod > requiredLOD );
+	c->cache->refinements.fetch_add( 1, std::memory_order_relaxed );
+	return terrainCacheBlockFrom( c, t, coarse->uMin, coarse->vMin, requiredLOD, coarse );
+}
+
 // Blocks are ref-counted for thread-safety
 void cacheBlockFree( cacheBlock* b ) {
-	vmutex_lock( &blockMutex ); {
-		if ( b ) {
-			--b->refCount;
-			vAssert( b->refCount >= 0 );
-			if (b->refCount == 0) {
-//				printf( "Deleting cache block %d %d (" xPTRf ")\n", b->uMin, b->vMin, (uintptr_t)b );
-				//mem_free( b );
-				// TODO - we need to have access to the terrain cache here!
-				//terrain_deleteBlock( cache, b );
-			}
-		}
-	} vmutex_unlock( &blockMutex );
+	if ( b ) {
+		const int previous = b->refCount.fetch_sub( 1, std::memory_order_acq_rel );
+		vAssert( previous > 0 );
+		if ( previous == 1 )
+			cache_retire( b );
+	}
 }
 
-/*
-void trimCacheGrid( cacheGrid* g, int v ) {
-	const int vMax = clamp( v - g->vMin, 0, GridSize );
-	//printf( "Trimming for V %d (this block: %d)\n", v, vMax );
-	for ( int u = 0; u < GridSize; ++u )
-		for ( int v = 0; v < vMax; ++v ) {
-			vAssert( !(g->blocks[u][v] && g->blocks[u][v]->refCount < 1))
-			if ( g->blocks[u][v] && g->blocks[u][v]->refCount == 1 ) {
-				// TODO - Need to store a separate RefCount for the co-ord, NOT the block
-				// Allow blocks to be replaced, but not trimmed unless the refcount is 0
-				//printf( "Freeing cache %d %d.\n", g->uMin + u, g->vMin + v );
-				cacheBlockFree(g->blocks[u][v]);
-				g->blocks[u][v] = NULL;
-			}
-		}
+// *** Eviction
+/* The cache is held to a byte budget by evicting the least recently requested blocks. Only the grid's own
+   ref is dropped, so a block a worker is still reading survives until it is released; blocks that have been
+   requested within kCacheEvictMinAge frames, or that anyone else holds a ref to, are left alone. Grids left
+   empty are removed too, so memory stays flat however far the ship flies. */
+typedef struct evictCandidate_s {
+	int lastUsed;
+	cacheGrid* grid;
+	int u;
+	int v;
+} evictCandidate;
+
+int evictCandidate_compare( const void* a, const void* b ) {
+	return ((const evictCandidate*)a)->lastUsed - ((const evictCandidate*)b)->lastUsed;
+}
+
+// Grid-Locked
+// A slot stays busy until its future's handlers have run too, as only then can the future be freed
+bool slotBusy( cacheGrid* g, int u, int v ) {
+	future* f = gridFuture( g, u, v );
+	return f && !future_done( f );
 }
-*/
 
+// Grid-Locked
+bool slotEvictable( terrainCache* cache, cacheGrid* g, int u, int v ) {
+	cacheBlock* b = gridBlock( g, u, v );
+	return b && b->refCount.load( std::memory_order_relaxed ) == 1 && !slotBusy( g, u, v ) &&
+		cache->frame.load( std::memory_order_relaxed ) - gridLastUsed( g, u, v ) >= kCacheEvictMinAge;
+}
+
+// Grid-Locked
+void evictSlot( terrainCache* cache, cacheGrid* g, int u, int v ) {
+	cacheBlock* b = gridBlock( g, u, v );
+	future* f = gridFuture( g, u, v );
+	gridSetBlock( g, NULL, u, v );
+	gridSetFuture( g, NULL, u, v );
+	// Done, and requested too long ago for anyone to still be attaching handlers
+	if ( f )
+		future_delete( f );
+	gridSetLod( g, lowestLod, u, v );
+	gridSetEvicted( g, true, u, v );
+	if ( gridPrefetched( g, u, v )) {
+		cache->prefetchWasted.fetch_add( 1, std::memory_order_relaxed );
+		gridSetPrefetched( g, false, u, v );
+	}
+	cache->residentBytes.fetch_sub( sizeof( cacheBlock ), std::memory_order_relaxed );
+	cache->evictions.fetch_add( 1, std::memory_order_relaxed );
+	cacheBlockFree( b );
+}
+
+// Grid-Locked
 bool gridEmpty( cacheGrid* g ) {
 	bool empty = true;
 	for ( int u = 0; empty && u < GridSize; ++u )
 		for ( int v = 0; empty && v < GridSize; ++v )
-			empty = empty && g->blocks[u][v] == NULL;
+			empty = empty && g->blocks[u][v] == NULL && !( g->futures[u][v] && !future_done( g->futures[u][v] ));
 	return empty;
 }
 
-void terrainCache_trim( terrainCache* t, int v ) {
-	/*
-	vmutex_lock( &terrainMutex ); {
-		//cacheGridlist* nw = NULL;
-		cacheGridlist* g = t->grids;
-		while ( g && g->head ) {
-			//trimCacheGrid( g->head, v );
-			(void)v;
-			if (gridEmpty(g->head)) {
-				//printf( "Freeing grid list " xPTRf "\n", (uintptr_t)g );
-				mem_free( g->head );
-			} else {
-				//vAssert( (uintptr_t)g->head < 0x00ffffffffffffff );
-				nw = cacheGridlist_cons( g->head, nw );
+// Free the futures left in a grid that's been removed; every one is done, or the grid wouldn't be empty
+void gridDeleteFutures( cacheGrid* g ) {
+	for ( int u = 0; u < GridSize; ++u )
+		for ( int v = 0; v < GridSize; ++v )
+			if ( g->futures[u][v] ) {
+				future_delete( g->futures[u][v] );
+				g->futures[u][v] = NULL;
 			}
-			cacheGridlist* next = g->tail;
-			//mem_free( g );
-			g = next;
+}
+
+// Grid-Locked
+// Removal needs the grid unused as well as empty; the list lock stops gridGetOrAdd finding it meanwhile
+bool tryRemoveGrid( terrainCache* cache, cacheGrid* g ) {
+	bool removed = false;
+	vmutex_lockStats( &cache->gridListMutex, &cache->gridListStats ); {
+		int unused = 0;
+		if ( gridEmpty( g ) && g->users.compare_exchange_strong( unused, -1, std::memory_order_acquire )) {
+			gridTable_remove( cache, g );
+			removed = true;
 		}
-		//t->grids = nw;
-	} vmutex_unlock( &terrainMutex );
-*/
-	(void)t;(void)v;
+	} vmutex_unlockStats( &cache->gridListMutex, &cache->gridListStats );
+	return removed;
 }
 
-cacheBlocklist* terrainCache_processDeletes( terrainCache* t ) {
-	for (cacheBlocklist* b = t->toDelete; b; b = b->tail )
-		mem_free(b->head);
-	cacheBlocklist_delete( t->toDelete );
-	return NULL;
+// Grids currently in the table, each taken in use
+cacheGrid** residentGrids( terrainCache* cache, int* count ) {
+	cacheGrid** grids = NULL;
+	vmutex_lockStats( &cache->gridListMutex, &cache->gridListStats ); {
+		gridTable* t = cache->grids.load( std::memory_order_relaxed );
+		grids = (cacheGrid**)mem_alloc( sizeof( cacheGrid* ) * max( 1, t->count ));
+		*count = 0;
+		for ( int i = 0; i < t->capacity; ++i ) {
+			const uint64_t k = t->slots[i].key.load( std::memory_order_relaxed );
+			if ( k != kGridKeyEmpty && k != kGridKeyTombstone ) {
+				cacheGrid* g = t->slots[i].grid.load( std::memory_order_relaxed );
+				g->users.fetch_add( 1, std::memory_order_relaxed );
+				grids[(*count)++] = g;
+			}
+		}
+	} vmutex_unlockStats( &cache->gridListMutex, &cache->gridListStats );
+	return grids;
 }
 
-void terrainCache_tick( terrainCache* t, float dt, vector sample ) {
-	(void)dt; (void)t; (void)sample;
+void terrainCache_trim( terrainCache* t ) {
+	if ( t->residentBytes.load( std::memory_order_relaxed ) <= t->budgetBytes )
+		return;
+
+	int gridCount = 0;
+	cacheGrid** grids = residentGrids( t, &gridCount );
+	evictCandidate* candidates = (evictCandidate*)mem_alloc( sizeof( evictCandidate ) * max( 1, gridCount ) * GridSize * GridSize );
+	int candidateCount = 0;
+	for ( int i = 0; i < gridCount; ++i ) {
+		cacheGrid* g = grids[i];
+		gridLock( t, g->uMin, g->vMin ); {
+			for ( int u = 0; u < GridSize; ++u )
+				for ( int v = 0; v < GridSize; ++v ) {
+					const int uu = g->uMin + u * CacheBlockSize;
+					const int vv = g->vMin + v * CacheBlockSize;
+					if ( slotEvictable( t, g, uu, vv )) {
+						evictCandidate* c = &candidates[candidateCount++];
+						c->lastUsed = gridLastUsed( g, uu, vv );
+						c->grid = g;
+						c->u = uu;
+						c->v = vv;
+					}
+				}
+		} gridUnlock( t, g->uMin, g->vMin );
+	}
+
+	// Oldest first; anything touched since we looked is no longer evictable
+	qsort( candidates, candidateCount, sizeof( evictCandidate ), evictCandidate_compare );
+	for ( int i = 0; i < candidateCount && t->residentBytes.load( std::memory_order_relaxed ) > t->budgetBytes; ++i ) {
+		evictCandidate* c = &candidates[i];
+		gridLock( t, c->u, c->v ); {
+			if ( slotEvictable( t, c->grid, c->u, c->v ) && gridLastUsed( c->grid, c->u, c->v ) == c->lastUsed )
+				evictSlot( t, c->grid, c->u, c->v );
+		} gridUnlock( t, c->u, c->v );
+	}
+	mem_free( candidates );
 
-	vmutex_lock( &terrainMutex ); {
-		t->toDelete = terrainCache_processDeletes( t );
-	} vmutex_unlock( &terrainMutex );
+	for ( int i = 0; i < gridCount; ++i ) {
+		cacheGrid* g = grids[i];
+		gridRelease( g );
+		bool removed = false;
+		gridLock( t, g->uMin, g->vMin ); {
+			removed = tryRemoveGrid( t, g );
+		} gridUnlock( t, g->uMin, g->vMin );
+		if ( removed ) {
+			++t->gridsRemoved;
+			gridDeleteFutures( g );
+			terrainDisk_close( g->disk );
+			cache_retire( g );
+		}
+	}
+	mem_free( grids );
 }
 
-// Need to have locked terrainMutex!
-void setLodNeeded( terrainCache* cache, int u, int v, int lodNeeded ) {
-	cacheGrid* g = gridGetOrAdd( cache, u, v );
+void terrainCache_setBudget( terrainCache* t, long long bytes ) {
+	t->budgetBytes = bytes;
+}
+
+// Set before any blocks are built; grids already holding blocks carry on without a disk file
+void terrainCache_setDiskCache( terrainCache* t, const char* dir ) {
+	if ( t->diskDir )
+		mem_free( t->diskDir );
+	t->diskDir = NULL;
+	if ( dir ) {
+		mkdir( dir, 0755 );
+		t->diskDir = (char*)mem_alloc( strlen( dir ) + 1 );
+		strcpy( t->diskDir, dir );
+	}
+}
+
+void terrainCache_printStats( terrainCache* t ) {
+	int grids = 0;
+	vmutex_lockStats( &t->gridListMutex, &t->gridListStats ); {
+		grids = t->grids.load( std::memory_order_relaxed )->count;
+	} vmutex_unlockStats( &t->gridListMutex, &t->gridListStats );
+	printf( "terrainCache: %lld/%lld KB resident in %d grids; %d evictions, %d regenerations, %d refinements, %d grids removed; %d disk hits, %d disk misses; %d prefetched, %d hits, %d wasted\n",
+			t->residentBytes.load() / KILOBYTES, t->budgetBytes / KILOBYTES, grids,
+			t->evictions.load(), t->regenerations.load(), t->refinements.load(), t->gridsRemoved, t->diskHits.load(), t->diskMisses.load(),
+			t->prefetches.load(), t->prefetchHits.load(), t->prefetchWasted.load() );
+}
+
+void terrainCache_prefetchStats( terrainCache* t, int* prefetches, int* hits, int* wasted ) {
+	*prefetches = t->prefetches.load();
+	*hits = t->prefetchHits.load();
+	*wasted = t->prefetchWasted.load();
+}
+
+void terrainCache_tick( terrainCache* t, float dt, vector sample ) {
+	(void)dt; (void)sample;
+	t->frame.fetch_add( 1, std::memory_order_relaxed );
+	terrainCache_trim( t );
+	cacheEpoch_advance();
+}
+
+// Need to have locked the grid!
+void setLodNeeded( cacheGrid* g, int u, int v, int lodNeeded ) {
 	const int lod = min(gridLod(g, u, v), lodNeeded);
 	gridSetLod( g, lod, u, v );
 }
@@ -277,17 +796,23 @@ void setLodNeeded( terrainCache* cache, int u, int v, int lodNeeded ) {
 bool cacheBlockFuture( terrainCache* cache, int uMin, int vMin, int lodNeeded, future** f ) {
 	(void)lodNeeded;
 	bool empty = false;
-	vmutex_lock( &terrainMutex ); {
-		cacheGrid* g = gridGetOrAdd( cache, uMin, vMin );
+	cacheGrid* g = gridGetOrAdd( cache, uMin, vMin );
+	gridLock( cache, uMin, vMin ); {
 		future* fut = gridFuture(g, uMin, vMin);
 		empty = !fut || (gridLod(g, uMin, vMin) > lodNeeded);
 		if (empty) {
 			fut = future_create();
 			gridSetFuture(g, fut, uMin, vMin);
 		}
-		setLodNeeded( cache, uMin, vMin, lodNeeded );
+		setLodNeeded( g, uMin, vMin, lodNeeded );
+		gridTouch( cache, g, uMin, vMin );
+		if ( gridPrefetched( g, uMin, vMin )) {
+			cache->prefetchHits.fetch_add( 1, std::memory_order_relaxed );
+			gridSetPrefetched( g, false, uMin, vMin );
+		}
 		*f = fut;
-	} vmutex_unlock( &terrainMutex );
+	} gridUnlock( cache, uMin, vMin );
+	gridRelease( g );
 	return empty;
 }
 
@@ -298,7 +823,13 @@ void cacheBlockFor( canyonTerrainBlock* b, int uRelative, int vRelative, int* uC
 	*vCache = vReal - offset( vReal, CacheBlockSize );
 }
 
-cacheBlock* cachedBlock( terrainCache* cache, int uMin, int vMin ) { return gridBlock( gridFor( cache, uMin, vMin ), uMin, vMin ); }
+// Unlocked read of the grid; callers must pin the epoch and use tryTakeRef
+cacheBlock* cachedBlock( terrainCache* cache, int uMin, int vMin ) {
+	cacheGrid* g = gridFor( cache, uMin, vMin );
+	cacheBlock* b = g ? gridBlock( g, uMin, vMin ) : NULL;
+	gridRelease( g );
+	return b;
+}
 
 void getCacheExtents( canyonTerrainBlock* b, int& cacheMinU, int& cacheMinV, int& cacheMaxU, int& cacheMaxV ) {
 	const int maxStride = 4;
@@ -307,6 +838,8 @@ void getCacheExtents( canyonTerrainBlock* b, int& cacheMinU, int& cacheMinV, int
 	cacheBlockFor( b, b->u_samples * stride + maxStride, b->v_samples * stride + maxStride, &cacheMaxU, &cacheMaxV );
 }
 
+// A block evicted between being requested and being read here is rebuilt on the spot.
+// The list is scratch, so lasts only as long as the calling task
 cacheBlocklist* cachesForBlock( canyonTerrainBlock* b ) {
 	int cacheMinU = 0, cacheMinV = 0, cacheMaxU = 0, cacheMaxV = 0;
 	getCacheExtents(b, cacheMinU, cacheMinV, cacheMaxU, cacheMaxV );
@@ -314,11 +847,616 @@ cacheBlocklist* cachesForBlock( canyonTerrainBlock* b ) {
 	cacheBlocklist* caches = NULL;
 	for (int u = cacheMinU; u <= cacheMaxU; u+=CacheBlockSize )
 		for (int v = cacheMinV; v <= cacheMaxV; v+=CacheBlockSize ) {
+			const unsigned epoch = cacheEpoch_pin();
 			cacheBlock* c = cachedBlock( b->_canyon->cache, u, v );
-			takeRef( c );
-			caches = cacheBlocklist_cons( c, caches );
+			if ( c && !tryTakeRef( c ))
+				c = NULL;
+			cacheEpoch_unpin( epoch );
+			if ( !c )
+				c = terrainCacheBuildAndAdd( b->_canyon, b->terrain, u, v, b->lod_level );
+			cacheBlocklist* cell = scratchArray( cacheBlocklist, 1 );
+			cell->head = c;
+			cell->tail = caches;
+			caches = cell;
 		}
 	return caches;
 }
 
 bool cacheBlockContains( cacheBlock* b, int u, int v ) { return ( b->uMin == u && b->vMin == v ); }
+
+#if UNIT_TEST
+cacheBlock* testCacheBlock( int u, int v ) {
+	cacheBlock* b = (cacheBlock*)mem_alloc( sizeof( cacheBlock ));
+	memset( (void*)b, 0, sizeof( cacheBlock ));
+	b->uMin = u;
+	b->vMin = v;
+	b->refCount.store( 1 );
+	return b;
+}
+
+bool cacheBlock_retired( cacheBlock* b ) {
+	bool retired = false;
+	vmutex_lock( &retireMutex ); {
+		for ( int e = 0; e < kCacheEpochs; ++e )
+			for ( cacheBlocklist* l = retiredBlocks[e]; l; l = l->tail )
+				retired = retired || l->head == b;
+	} vmutex_unlock( &retireMutex );
+	return retired;
+}
+
+// Look up a grid without keeping it in use
+cacheGrid* testGridFor( terrainCache* cache, int u, int v ) {
+	cacheGrid* g = gridFor( cache, u, v );
+	gridRelease( g );
+	return g;
+}
+
+// Add a block as if built on FRAME
+void testCacheAdd( terrainCache* cache, int u, int v, int frame ) {
+	cache->frame.store( frame );
+	cacheGrid* g = gridGetOrAdd( cache, u, v );
+	gridLock( cache, u, v ); {
+		cacheBlockFree( terrainCacheAddInternal( cache, g, testCacheBlock( u, v )));
+	} gridUnlock( cache, u, v );
+	gridRelease( g );
+}
+
+void test_terrainCacheEviction() {
+	terrainCache* cache = terrainCache_create();
+	terrainCache_setBudget( cache, 2 * sizeof( cacheBlock ));
+	for ( int i = 0; i < 4; ++i )
+		testCacheAdd( cache, 0, i * CacheBlockSize, i );
+	test( cache->residentBytes.load() == 4 * (long long)sizeof( cacheBlock ), "Cache counts resident bytes", "Cache resident bytes wrong" );
+
+	// Nothing is old enough to evict yet
+	cache->frame.store( 3 );
+	terrainCache_trim( cache );
+	test( cache->evictions.load() == 0, "Recently requested blocks aren't evicted", "Evicted a recently requested block" );
+
+	// The oldest block is held by a reader, so the next two oldest go instead
+	cacheBlock* held = terrainCached( cache, 0, 0 );
+	cache->frame.store( kCacheEvictMinAge + 3 );
+	gridLock( cache, 0, 0 ); {
+		cacheGrid* g = testGridFor( cache, 0, 0 );
+		gridSetLastUsed( g, 0, 0, 0 );
+	} gridUnlock( cache, 0, 0 );
+	terrainCache_trim( cache );
+	cacheBlock* kept = terrainCached( cache, 0, 3 * CacheBlockSize );
+	test( cache->evictions.load() == 2 && kept && !terrainCached( cache, 0, CacheBlockSize ),
+			"Least recently used blocks evicted down to budget", "Wrong blocks evicted" );
+	test( cache->residentBytes.load() <= cache->budgetBytes, "Cache within budget after trim", "Cache over budget after trim" );
+	cacheBlockFree( kept );
+	cacheBlockFree( held );
+
+	testCacheAdd( cache, 0, CacheBlockSize, cache->frame.load() );
+	test( cache->regenerations.load() == 1, "Rebuilding an evicted block counts a regeneration", "Regeneration not counted" );
+
+	// Once every block has gone the grid is removed as well
+	terrainCache_setBudget( cache, 0 );
+	cache->frame.store( 10 * kCacheEvictMinAge );
+	terrainCache_trim( cache );
+	test( cache->residentBytes.load() == 0 && cache->gridsRemoved == 1 && !testGridFor( cache, 0, 0 ),
+			"Empty grids removed", "Empty grid not removed" );
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+
+	// A slot's future goes with its block, but not before its handlers have run
+	const size_t heapBefore = static_heap->total_allocated;
+	future* f = NULL;
+	cacheBlockFuture( cache, 0, 0, 0, &f );
+	future_onComplete( f, cacheReady, NULL );
+	testCacheAdd( cache, 0, 0, cache->frame.load() );
+	future_complete( f, NULL );
+	cache->frame.store( 20 * kCacheEvictMinAge );
+	terrainCache_trim( cache );
+	test( testGridFor( cache, 0, 0 ) != NULL, "Slots kept until their future has run", "Evicted a slot with a future still to run" );
+	vmutex_lock( &futuresMutex ); {
+		future_tryExecute( f );
+	} vmutex_unlock( &futuresMutex );
+	terrainCache_trim( cache );
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+	test( !testGridFor( cache, 0, 0 ) && static_heap->total_allocated == heapBefore, "Evicted slots free their futures", "Evicted slot's future leaked" );
+	terrainCache_delete( cache );
+}
+
+// Sampled positions of A and B match at LOD
+bool cacheBlock_samplesMatch( cacheBlock* a, cacheBlock* b, int lod ) {
+	const int stride = max( 1, 2 * lod );
+	for ( int u = 0; u < CacheBlockSize; u += stride )
+		for ( int v = 0; v < CacheBlockSize; v += stride ) {
+			const vector pa = cacheBlock_position( a, u, v );
+			const vector pb = cacheBlock_position( b, u, v );
+			if ( memcmp( &pa, &pb, sizeof( vector )) != 0 )
+				return false;
+		}
+	return true;
+}
+
+void test_terrainCacheRefine() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	const int u = -CacheBlockSize, v = 3 * CacheBlockSize;
+
+	cacheBlock* coarse = terrainCacheBlock( c, t, u, v, 2 );
+	cacheBlock* medium = terrainCacheRefineBlock( c, t, coarse, 1 );
+	cacheBlock* fine = terrainCacheRefineBlock( c, t, medium, 0 );
+	cacheBlock* mediumFull = terrainCacheBlock( c, t, u, v, 1 );
+	cacheBlock* fineFull = terrainCacheBlock( c, t, u, v, 0 );
+	test( medium->lod == 1 && cacheBlock_samplesMatch( medium, mediumFull, 1 ), "Refined LOD 1 block matches a full build", "Refined LOD 1 block differs from a full build" );
+	test( fine->lod == 0 && cacheBlock_samplesMatch( fine, fineFull, 0 ), "Refined LOD 0 block matches a full build", "Refined LOD 0 block differs from a full build" );
+
+	// Building a finer block over a cached coarse one refines it
+	cacheBlockFree( terrainCacheBuildAndAdd( c, t, u, v, 2 ));
+	cacheBlock* cached = terrainCacheBuildAndAdd( c, t, u, v, 0 );
+	test( c->cache->refinements.load() == 3 && cached->lod == 0 && cacheBlock_samplesMatch( cached, fineFull, 0 ),
+			"Cache refines coarse blocks to finer LODs", "Cache didn't refine a coarse block" );
+	cacheBlockFree( cached );
+
+	cacheBlock* blocks[] = { coarse, medium, fine, mediumFull, fineFull };
+	for ( unsigned i = 0; i < sizeof( blocks ) / sizeof( blocks[0] ); ++i )
+		mem_free( blocks[i] ); // Never published
+	testTerrain_delete( t );
+}
+
+// Compact blocks against the canyon they were sampled from, and what the compaction saves
+void test_terrainCacheCompact() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	const int uMin = -CacheBlockSize, vMin = 2 * CacheBlockSize;
+	cacheBlock* b = terrainCacheBlock( c, t, uMin, vMin, 0 );
+
+	float worstHeight = 0.f, worstAnchor = 0.f;
+	float us[CacheBlockSize], vs[CacheBlockSize], heights[CacheBlockSize];
+	for ( int v = 0; v < CacheBlockSize; ++v ) {
+		for ( int u = 0; u < CacheBlockSize; ++u )
+			terrain_positionsFromUV( t, uMin + u, vMin + v, &us[u], &vs[u] );
+		canyonTerrain_sampleUVBatch( us, vs, heights, CacheBlockSize );
+		for ( int u = 0; u < CacheBlockSize; ++u )
+			worstHeight = fmaxf( worstHeight, fabsf( cacheBlock_height( b, u, v ) - heights[u] ));
+	}
+	for ( int v = 0; v < CacheBlockSize; v += CacheAnchorInterval )
+		for ( int u = 0; u < CacheBlockSize; u += CacheAnchorInterval ) {
+			float cu, cv, x, z;
+			terrain_positionsFromUV( t, uMin + u, vMin + v, &cu, &cv );
+			terrain_worldSpaceFromCanyon( c, cu, cv, &x, &z );
+			const vector p = cacheBlock_position( b, u, v );
+			worstAnchor = fmaxf( worstAnchor, fmaxf( fabsf( p.coord.x - x ), fabsf( p.coord.z - z )));
+		}
+	printf( "Compact cacheBlock: worst height error %.5f (step %.5f), worst anchor error %.5f\n", worstHeight, CacheHeightStep, worstAnchor );
+	test( worstHeight <= CacheHeightStep * 0.5f, "Compact heights within half a step", "Compact heights off by more than half a step" );
+	test( worstAnchor == 0.f, "Compact anchors exact", "Compact anchors differ from the canyon" );
+
+	// The layout this replaced: a full vector per sample
+	const size_t fullBytes = sizeof( vector ) * CacheBlockSize * CacheBlockSize + 4 * sizeof( int );
+	float uPerSample, vPerSample;
+	terrain_positionsFromUV( t, 1, 1, &uPerSample, &vPerSample );
+	const float blocksPerKm = ceilf( 2.f * t->u_radius / ( uPerSample * CacheBlockSize )) * 1000.f / ( vPerSample * CacheBlockSize );
+	printf( "cacheBlock: %zu bytes (was %zu, %.1fx smaller); LOD 0 cache %.2f MB/km (was %.2f MB/km)\n",
+			sizeof( cacheBlock ), fullBytes, (float)fullBytes / (float)sizeof( cacheBlock ),
+			blocksPerKm * sizeof( cacheBlock ) / ( MEGABYTES ), blocksPerKm * fullBytes / ( MEGABYTES ));
+	test( sizeof( cacheBlock ) * 4 < fullBytes, "Compact cacheBlock under a quarter the size", "Compact cacheBlock not under a quarter the size" );
+	mem_free( b ); // Never published
+	testTerrain_delete( t );
+}
+
+void test_terrainCache() {
+	printf( "--- Beginning Unit Test: Terrain Cache ---\n" );
+	cacheBlock* b = testCacheBlock( 0, 0 );
+	takeRef( b );
+	cacheBlockFree( b );
+	test( b->refCount.load() == 1, "CacheBlock take/release balances", "CacheBlock take/release unbalanced" );
+	test( tryTakeRef( b ), "Live cacheBlock can be re-referenced", "Live cacheBlock refused a ref" );
+	cacheBlockFree( b );
+
+	// Pin as a reader would, then drop the last ref; the block must survive until we unpin
+	const unsigned epoch = cacheEpoch_pin();
+	cacheBlockFree( b );
+	test( !tryTakeRef( b ), "Dead cacheBlock refuses new refs", "Dead cacheBlock was resurrected" );
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+	test( cacheBlock_retired( b ), "Retired cacheBlock kept while a reader is pinned", "Retired cacheBlock freed under a pinned reader" );
+	cacheEpoch_unpin( epoch );
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+	test( !cacheBlock_retired( b ), "Retired cacheBlock freed once readers unpin", "Retired cacheBlock never freed" );
+
+	// Enough grids to force the table through several resizes, either side of the origin
+	terrainCache* cache = terrainCache_create();
+	for ( int i = 0; i < 300; ++i )
+		gridRelease( gridGetOrAdd( cache, ( i % 20 - 10 ) * GridCapacity, ( i / 20 - 3 ) * GridCapacity ));
+	bool found = true;
+	for ( int i = 0; i < 300; ++i ) {
+		const int u = ( i % 20 - 10 ) * GridCapacity + 5;
+		const int v = ( i / 20 - 3 ) * GridCapacity + 7;
+		cacheGrid* g = gridFor( cache, u, v );
+		found = found && g && g->uMin == minStride( u, GridCapacity ) && g->vMin == minStride( v, GridCapacity );
+		gridRelease( g );
+	}
+	test( found, "Grid table finds every added grid", "Grid table lost a grid" );
+	test( gridFor( cache, 0, 100 * GridCapacity ) == NULL, "Grid table misses absent grids", "Grid table found an absent grid" );
+	cacheGrid* added = gridGetOrAdd( cache, 0, 0 );
+	cacheGrid* found0 = gridFor( cache, 0, 0 );
+	test( added == found0, "Grid table doesn't duplicate grids", "Grid table added a grid twice" );
+	gridRelease( added );
+	gridRelease( found0 );
+	terrainCache_delete( cache );
+
+	test_terrainCacheEviction();
+	test_terrainCacheRefine();
+	test_terrainCacheCompact();
+}
+
+#define kBenchCacheThreads 4
+#define kBenchCacheBlocks 64
+#define kBenchCacheIterations 1000000
+
+cacheBlock* benchBlocks[kBenchCacheBlocks];
+std::atomic<int> benchCacheFinished( 0 );
+vmutex benchCacheMutex = kMutexInitialiser;
+int benchCacheMutexCounts[kBenchCacheBlocks];
+
+// As the workers do it: pin, take a ref on a block, release it
+void* benchCacheRefsThread( void* args ) {
+	const int offset = (int)(uintptr_t)args;
+	for ( int i = 0; i < kBenchCacheIterations; ++i ) {
+		cacheBlock* b = benchBlocks[( i + offset ) % kBenchCacheBlocks];
+		const unsigned epoch = cacheEpoch_pin();
+		bool live = tryTakeRef( b );
+		cacheEpoch_unpin( epoch );
+		if ( live )
+			cacheBlockFree( b );
+	}
+	benchCacheFinished.fetch_add( 1 );
+	return NULL;
+}
+
+// The previous scheme, a single global mutex around every refcount change
+void* benchCacheMutexThread( void* args ) {
+	const int offset = (int)(uintptr_t)args;
+	for ( int i = 0; i < kBenchCacheIterations; ++i ) {
+		const int block = ( i + offset ) % kBenchCacheBlocks;
+		vmutex_lock( &benchCacheMutex ); { ++benchCacheMutexCounts[block]; } vmutex_unlock( &benchCacheMutex );
+		vmutex_lock( &benchCacheMutex ); { --benchCacheMutexCounts[block]; } vmutex_unlock( &benchCacheMutex );
+	}
+	benchCacheFinished.fetch_add( 1 );
+	return NULL;
+}
+
+double benchCacheRun( vthreadfunc func ) {
+	benchCacheFinished.store( 0 );
+	const double start = bench_seconds();
+	for ( int i = 0; i < kBenchCacheThreads; ++i )
+		vthread_create( func, (void*)(uintptr_t)( i * 7 ));
+	while ( benchCacheFinished.load() < kBenchCacheThreads )
+		vthread_yield();
+	return bench_seconds() - start;
+}
+
+void bench_terrainCacheRefs() {
+	for ( int i = 0; i < kBenchCacheBlocks; ++i )
+		benchBlocks[i] = testCacheBlock( i * CacheBlockSize, 0 );
+
+	const long long operations = (long long)kBenchCacheThreads * kBenchCacheIterations;
+	bench_report( "cacheBlock take/release (global mutex)", operations, benchCacheRun( benchCacheMutexThread ));
+	bench_report( "cacheBlock take/release (atomic)", operations, benchCacheRun( benchCacheRefsThread ));
+
+	for ( int i = 0; i < kBenchCacheBlocks; ++i ) {
+		vAssert( benchBlocks[i]->refCount.load() == 1 );
+		cacheBlockFree( benchBlocks[i] );
+	}
+	for ( int i = 0; i < kCacheEpochs; ++i )
+		cacheEpoch_advance();
+}
+
+#define kBenchGridLookups 1000000
+
+// The previous scheme, walking the list of grids
+cacheGrid* benchGridFromList( cacheGridlist* grids, int u, int v ) {
+	const int uGrid = minStride( u, GridCapacity );
+	const int vGrid = minStride( v, GridCapacity );
+	for ( cacheGridlist* g = grids; g && g->head; g = g->tail )
+		if ( g->head->uMin == uGrid && g->head->vMin == vGrid )
+			return g->head;
+	return NULL;
+}
+
+// Grids are laid out as the canyon streams them in, a few wide and many long
+void bench_terrainGridLookup() {
+	terrainCache* cache = terrainCache_create();
+	cacheGridlist* list = NULL;
+	int resident = 0;
+	for ( int grids = 16; grids <= 1024; grids *= 4 ) {
+		for ( ; resident < grids; ++resident ) {
+			cacheGrid* g = gridGetOrAdd( cache, ( resident % 4 ) * GridCapacity, ( resident / 4 ) * GridCapacity );
+			gridRelease( g );
+			list = cacheGridlist_cons( g, list );
+		}
+
+		uintptr_t check = 0;
+		double start = bench_seconds();
+		for ( int i = 0; i < kBenchGridLookups; ++i ) {
+			const int g = (int)(( (unsigned)i * 7919u ) % (unsigned)grids );
+			check += (uintptr_t)benchGridFromList( list, ( g % 4 ) * GridCapacity, ( g / 4 ) * GridCapacity );
+		}
+		const double listSeconds = bench_seconds() - start;
+
+		start = bench_seconds();
+		for ( int i = 0; i < kBenchGridLookups; ++i ) {
+			const int g = (int)(( (unsigned)i * 7919u ) % (unsigned)grids );
+			cacheGrid* grid = gridFor( cache, ( g % 4 ) * GridCapacity, ( g / 4 ) * GridCapacity );
+			check -= (uintptr_t)grid;
+			gridRelease( grid );
+		}
+		const double tableSeconds = bench_seconds() - start;
+		vAssert( check == 0 );
+
+		char name[64];
+		snprintf( name, sizeof( name ), "grid lookup, %d grids (list)", grids );
+		bench_report( name, kBenchGridLookups, listSeconds );
+		snprintf( name, sizeof( name ), "grid lookup, %d grids (hash)", grids );
+		bench_report( name, kBenchGridLookups, tableSeconds );
+	}
+	cacheGridlist_delete( list );
+	terrainCache_delete( cache );
+}
+#endif // UNIT_TEST
+
+#if UNIT_TEST
+#define kBenchScalingBlocks 1024
+#define kBenchScalingColumns 32		// So the rows stay within the canyon window
+#define kBenchScalingMaxThreads 8
+
+typedef struct benchScalingArgs_s {
+	canyon* c;
+	canyonTerrain* t;
+	int first;
+	int count;
+	vmutex* serialise;
+} benchScalingArgs;
+
+vmutex benchScalingMutex = kMutexInitialiser;
+
+// Build a run of cache blocks along the canyon, as buildCacheBlockTask does on the workers
+void* benchCacheScalingThread( void* args ) {
+	benchScalingArgs* a = (benchScalingArgs*)args;
+	for ( int i = a->first; i < a->first + a->count; ++i ) {
+		const int u = ( i % kBenchScalingColumns - kBenchScalingColumns / 2 ) * CacheBlockSize;
+		const int v = ( i / kBenchScalingColumns ) * CacheBlockSize;
+		if ( a->serialise )
+			vmutex_lock( a->serialise );
+		cacheBlockFree( terrainCacheBuildAndAdd( a->c, a->t, u, v, 0 ));
+		if ( a->serialise )
+			vmutex_unlock( a->serialise );
+	}
+	return NULL;
+}
+
+// Build kBenchScalingBlocks on THREADS threads, a run each, into a fresh cache. With SERIALISE, every build holds
+// it throughout, as every worker once held terrainMutex
+double benchCacheScalingRun( int threads, vmutex* serialise ) {
+	canyonTerrain* t = testTerrain_create();
+	benchScalingArgs args[kBenchScalingMaxThreads];
+	vthread workers[kBenchScalingMaxThreads];
+	const double start = bench_seconds();
+	for ( int i = 0; i < threads; ++i ) {
+		args[i].c = t->_canyon;
+		args[i].t = t;
+		args[i].count = kBenchScalingBlocks / threads;
+		args[i].first = i * args[i].count;
+		args[i].serialise = serialise;
+		workers[i] = vthread_create( benchCacheScalingThread, &args[i] );
+	}
+	for ( int i = 0; i < threads; ++i )
+		vthread_join( workers[i] );
+	const double seconds = bench_seconds() - start;
+
+	char name[64];
+	snprintf( name, sizeof( name ), "cacheBlock generation (%d workers, %s)", threads, serialise ? "global mutex" : "striped" );
+	bench_report( name, kBenchScalingBlocks, seconds );
+	if ( !serialise )
+		terrainCache_printLockStats( t->_canyon->cache );
+	testTerrain_delete( t );
+	return seconds;
+}
+
+// Cache block generation throughput across worker counts, with the striped grid locks and with one global mutex
+void bench_terrainCacheScaling() {
+	noise_staticInit();
+	double single[2] = { 0.0, 0.0 };
+	for ( int threads = 1; threads <= kBenchScalingMaxThreads; threads *= 2 ) {
+		const double striped = benchCacheScalingRun( threads, NULL );
+		const double global = benchCacheScalingRun( threads, &benchScalingMutex );
+		if ( threads == 1 ) {
+			single[0] = striped;
+			single[1] = global;
+		}
+		printf( "%d workers: %.2fx one worker's throughput striped, %.2fx with a global mutex\n",
+				threads, single[0] / striped, single[1] / global );
+	}
+}
+
+#define kSoakDistance 100000.f
+#define kSoakSamplesPerFrame 4
+#define kSoakWarmUpDistance 10000.f	// At least; the warm-up runs on until the cache is full and evicting
+#define kSoakBudget (16*MEGABYTES)
+
+// Fly the canyon headlessly, requesting the cache blocks the terrain would around the ship each frame, and
+// check the cache holds to its budget and the heap stays flat
+void bench_terrainCacheSoak() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	terrainCache* cache = c->cache;
+	terrainCache_setBudget( cache, kSoakBudget );
+
+	float uPerSample, vPerSample;
+	terrain_positionsFromUV( t, 1, 1, &uPerSample, &vPerSample );
+	const int uSamples = (int)( t->u_radius / uPerSample );
+	const int vSamples = (int)( t->v_radius / vPerSample );
+	const int uMin = minStride( -uSamples, CacheBlockSize );
+
+	size_t warmHeap = 0, peakHeap = 0;
+	float warmDistance = 0.f;
+	long long peakResident = 0;
+	int frames = 0;
+	const double start = bench_seconds();
+	for ( int vShip = vSamples; vShip * vPerSample < kSoakDistance; vShip += kSoakSamplesPerFrame, ++frames ) {
+		const float distance = vShip * vPerSample;
+		canyonBuffer_seek( c, max( 0, (int)( distance / CanyonSegmentLength ) - TrailingCanyonSegments ));
+		for ( int v = minStride( vShip - vSamples, CacheBlockSize ); v <= vShip + vSamples; v += CacheBlockSize )
+			for ( int u = uMin; u <= uSamples; u += CacheBlockSize ) {
+				const int lod = min( 2, abs( v - vShip ) / ( 4 * CacheBlockSize ));
+				cacheBlock* b = terrainCached( cache, u, v );
+				if ( !b || b->lod > lod ) {
+					cacheBlockFree( b );
+					b = terrainCacheBuildAndAdd( c, t, u, v, lod );
+				}
+				cacheBlockFree( b );
+			}
+		terrainCache_tick( cache, 1.f / 60.f, Vector( 0.f, 0.f, distance, 1.f ));
+
+		if ( cache->residentBytes.load() > peakResident )
+			peakResident = cache->residentBytes.load();
+		if ( distance < kSoakWarmUpDistance || cache->evictions.load() == 0 ) {
+			warmHeap = static_heap->total_allocated;
+			warmDistance = distance;
+		}
+		else if ( static_heap->total_allocated > peakHeap )
+			peakHeap = static_heap->total_allocated;
+	}
+	const double seconds = bench_seconds() - start;
+
+	bench_report( "terrain cache soak (frames)", frames, seconds );
+	terrainCache_printStats( cache );
+	printf( "Heap after warm-up (%.1fkm) %zu KB, peak after %zu KB\n", warmDistance / 1000.f, warmHeap / KILOBYTES, peakHeap / KILOBYTES );
+	test( peakResident <= kSoakBudget, "Terrain cache held to budget over 100km", "Terrain cache exceeded budget" );
+	test( peakHeap <= warmHeap + MEGABYTES, "Heap flat over 100km", "Heap grew over 100km" );
+	testTerrain_delete( t );
+}
+
+/* Build every cache block the terrain needs for its first frame, from a fresh canyon, timing each.
+   Returns the total time and fills SAMPLE with a copy of the positions of one block, for comparison */
+double benchFirstFrame( const char* diskDir, const char* name, cacheBlock* sample ) {
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	terrainCache_setDiskCache( c->cache, diskDir );
+
+	float uPerSample, vPerSample;
+	terrain_positionsFromUV( t, 1, 1, &uPerSample, &vPerSample );
+	const int uSamples = (int)( t->u_radius / uPerSample );
+	const int vSamples = (int)( t->v_radius / vPerSample );
+	const int maxBlocks = ( 2 * uSamples / CacheBlockSize + 2 ) * ( 2 * vSamples / CacheBlockSize + 2 );
+	double* latencies = (double*)mem_alloc( sizeof( double ) * maxBlocks );
+	int blocks = 0;
+
+	const double start = bench_seconds();
+	for ( int v = minStride( -vSamples, CacheBlockSize ); v <= vSamples; v += CacheBlockSize )
+		for ( int u = minStride( -uSamples, CacheBlockSize ); u <= uSamples; u += CacheBlockSize ) {
+			const double blockStart = bench_seconds();
+			cacheBlock* b = terrainCacheBuildAndAdd( c, t, u, v, min( 2, abs( v ) / ( 4 * CacheBlockSize )));
+			latencies[blocks++] = bench_seconds() - blockStart;
+			if ( u == 0 && v == 0 ) {
+				sample->heightBase = b->heightBase;
+				memcpy( sample->anchors, b->anchors, sizeof( b->anchors ));
+				memcpy( sample->heights, b->heights, sizeof( b->heights ));
+			}
+			cacheBlockFree( b );
+		}
+	const double seconds = bench_seconds() - start;
+	vAssert( blocks <= maxBlocks );
+
+	qsort( latencies, blocks, sizeof( double ), bench_compareDoubles );
+	bench_report( name, blocks, seconds );
+	printf( "Block latency p50 %.3fms, p99 %.3fms\n", latencies[blocks / 2] * 1000.0, latencies[blocks * 99 / 100] * 1000.0 );
+	terrainCache_printStats( c->cache );
+	mem_free( latencies );
+	testTerrain_delete( t );
+	return seconds;
+}
+
+void bench_removeDiskCache( const char* dir ) {
+	DIR* d = opendir( dir );
+	if ( d ) {
+		char path[PATH_MAX];
+		while ( struct dirent* e = readdir( d ))
+			if ( e->d_name[0] != '.' ) {
+				// Never unlink a truncated path; it names some other file
+				const int length = snprintf( path, sizeof( path ), "%s/%s", dir, e->d_name );
+				if ( length < 0 || length >= (int)sizeof( path ))
+					continue;
+				unlink( path );
+			}
+		closedir( d );
+	}
+	rmdir( dir );
+}
+
+#define kBenchRefineBlocks 256
+
+// Time building kBenchRefineBlocks blocks at LOD, either from scratch or refined from COARSE
+double bench_buildLod( canyon* c, canyonTerrain* t, cacheBlock** coarse, cacheBlock** built, int lod ) {
+	const double start = bench_seconds();
+	for ( int i = 0; i < kBenchRefineBlocks; ++i ) {
+		const int u = ( i % 16 - 8 ) * CacheBlockSize, v = ( i / 16 ) * CacheBlockSize;
+		built[i] = coarse ? terrainCacheRefineBlock( c, t, coarse[i], lod ) : terrainCacheBlock( c, t, u, v, lod );
+	}
+	return bench_seconds() - start;
+}
+
+void bench_freeBlocks( cacheBlock** blocks ) {
+	for ( int i = 0; i < kBenchRefineBlocks; ++i )
+		mem_free( blocks[i] );
+}
+
+// The generation time a block saves when it moves to a finer LOD, by reusing the samples it already has
+void bench_terrainLodRefine() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	cacheBlock* lod2[kBenchRefineBlocks];
+	cacheBlock* full[kBenchRefineBlocks];
+	cacheBlock* refined[kBenchRefineBlocks];
+	bench_buildLod( c, t, NULL, lod2, 2 );
+
+	for ( int lod = 1; lod >= 0; --lod ) {
+		cacheBlock** coarse = lod == 1 ? lod2 : refined;
+		cacheBlock* next[kBenchRefineBlocks];
+		const double fullSeconds = bench_buildLod( c, t, NULL, full, lod );
+		const double refinedSeconds = bench_buildLod( c, t, coarse, next, lod );
+		char name[64];
+		snprintf( name, sizeof( name ), "LOD %d->%d transition (full rebuild)", lod + 1, lod );
+		bench_report( name, kBenchRefineBlocks, fullSeconds );
+		snprintf( name, sizeof( name ), "LOD %d->%d transition (refined)", lod + 1, lod );
+		bench_report( name, kBenchRefineBlocks, refinedSeconds );
+		printf( "LOD %d->%d: %.3fms saved per block (%.0f%%)\n", lod + 1, lod,
+				( fullSeconds - refinedSeconds ) * 1000.0 / kBenchRefineBlocks, 100.0 * ( 1.0 - refinedSeconds / fullSeconds ));
+		bench_freeBlocks( full );
+		bench_freeBlocks( coarse );
+		memcpy( refined, next, sizeof( next ));
+	}
+	bench_freeBlocks( refined );
+	testTerrain_delete( t );
+}
+
+// Startup-to-first-frame cost for the terrain cache: no disk cache, an empty one (cold) and a full one (warm)
+void bench_terrainDiskCache() {
+	noise_staticInit();
+	char dir[64];
+	snprintf( dir, sizeof( dir ), "/tmp/vitae_terrain_bench_%d", (int)getpid() );
+	bench_removeDiskCache( dir );
+
+	cacheBlock* generated = testCacheBlock( 0, 0 );
+	cacheBlock* loaded = testCacheBlock( 0, 0 );
+	benchFirstFrame( NULL, "first frame cache blocks (no disk cache)", generated );
+	benchFirstFrame( dir, "first frame cache blocks (disk cache, cold)", generated );
+	benchFirstFrame( dir, "first frame cache blocks (disk cache, warm)", loaded );
+	test( cacheBlock_samplesMatch( generated, loaded, 0 ),
+			"Disk cached positions match generated", "Disk cached positions differ from generated" );
+	mem_free( generated );
+	mem_free( loaded );
+	bench_removeDiskCache( dir );
+}
+#endif // UNIT_TEST
@@ -4,26 +4,36 @@
 #include "base/list.h"
 #include "system/thread.h"
 #include "terrain/grid.h"
+#include <atomic>
 
 #define CacheBlockSize 32
-#define lowestLod 2;
+#define lowestLod 2
+
+#define CacheAnchorInterval 4		// Samples between the anchors X and Z are interpolated from
+#define CacheAnchors ((CacheBlockSize / CacheAnchorInterval) + 1)
+#define CacheHeightStep (1.f / 128.f)	// World units per quantised height step
 
 // *** Types
 
+/* Only what can't be recomputed is stored. X and Z are always a bilinear interpolation of a coarse grid of
+   anchors (the canyon transform, sampled every CacheAnchorInterval samples), so just the anchors are kept;
+   heights are 16-bit, in fixed steps above a per-block base. The step is the same for every block, so a
+   height quantises the same whatever the block's base, and refining a block copies its samples exactly */
 struct cacheBlock_s {
 	int uMin;
 	int vMin;
-	vector positions[CacheBlockSize][CacheBlockSize];
 	int lod;
-	int refCount;
+	int heightBase;	// In CacheHeightSteps
+	float anchors[CacheAnchors][CacheAnchors][2];	// World X,Z
+	uint16_t heights[CacheBlockSize][CacheBlockSize];	// Above heightBase, in CacheHeightSteps
+	std::atomic<int> refCount;
 };
 
 DEF_LIST(cacheBlock)
 
-extern vmutex terrainMutex;
-
 // *** Terrain Cache
 terrainCache* terrainCache_create();
+void terrainCache_delete( terrainCache* t );
 
 // Retrieve a currently cached block (if it exists; may return NULL)
 cacheBlock* terrainCached( terrainCache* cache, int uMin, int vMin );
@@ -34,21 +44,56 @@ cacheBlock* terrainCacheBuildAndAdd( canyon* c, canyonTerrain* t, int uMin, int
 // Create a new cache block
 cacheBlock* terrainCacheBlock( canyon* c, canyonTerrain* t, int uMin, int vMin, int requiredLOD );
 
-// Trim cache blocks (and grids) that are too far behind the V coord
-void terrainCache_trim( terrainCache* t, int v );
+// Create a new cache block at a finer LOD than COARSE, a block already built for the same place. The LOD
+// levels nest (each holds every other sample of the next finer), so COARSE's samples are copied and only
+// the rest are generated
+cacheBlock* terrainCacheRefineBlock( canyon* c, canyonTerrain* t, const cacheBlock* coarse, int requiredLOD );
+
+// Build the cache block at (U,V) ahead of need, unless it's already built (or building) at LOD or finer
+void terrainCachePrefetch( canyon* c, canyonTerrain* t, int uMin, int vMin, int lod );
+
+// Evict the least recently requested cache blocks (and empty grids) until within the byte budget
+void terrainCache_trim( terrainCache* t );
+
+// Set the byte budget for resident cache blocks
+void terrainCache_setBudget( terrainCache* t, long long bytes );
+
+// Load and store cache blocks in DIR, to skip regenerating terrain seen on a previous run; NULL disables
+void terrainCache_setDiskCache( terrainCache* t, const char* dir );
 
-// Free a cacheblock once no longer referenced
+// Report resident size, evictions, regenerations, disk cache hits and prefetches
+void terrainCache_printStats( terrainCache* t );
+
+// Blocks built by prefetching, how many were later requested, and how many were evicted unrequested
+void terrainCache_prefetchStats( terrainCache* t, int* prefetches, int* hits, int* wasted );
+
+// World position of sample (U,V) of B, reconstructed from its compact form
+vector cacheBlock_position( const cacheBlock* b, int u, int v );
+float cacheBlock_height( const cacheBlock* b, int u, int v );
+
+// Release a ref to a cacheblock; once no longer referenced it is retired, and freed by terrainCache_tick
 void cacheBlockFree( cacheBlock* b );
 
+// Epoch reclamation, for anything workers read without locks. Readers pin the current epoch while they
+// may hold pointers; retired allocations (mem_alloc'd) are freed once no reader pinned before is left
+unsigned cacheEpoch_pin();
+void cacheEpoch_unpin( unsigned epoch );
+void cache_retire( void* data );
+void cacheEpoch_advance();
+
 // Tick the cache
 void terrainCache_tick( terrainCache* t, float dt, vector sample );
 
+// Report time spent waiting for and holding the cache locks
+void terrainCache_printLockStats( terrainCache* cache );
+void terrainCache_resetLockStats( terrainCache* cache );
+
 bool cacheBlockFuture( terrainCache* cache, int uMin, int vMin, int lodNeeded, future** f );
 
-// Take a ref to a cache (from a future)
-void* takeCacheRef( const void* value, void* args );
+// Future handler for a requested cache becoming ready
+void* cacheReady( const void* value, void* args );
 
-// Return a list of cacheblocks needed for building a given block
+// Return a list of cacheblocks needed for building a given block, taking a ref to each; the list is scratch
 cacheBlocklist* cachesForBlock( canyonTerrainBlock* b );
 
 // Calculate the cacheblock indices for a given point coord
@@ -58,3 +103,13 @@ void cacheBlockFor( canyonTerrainBlock* b, int uRelative, int vRelative, int* uC
 void getCacheExtents( canyonTerrainBlock* b, int& cacheMinU, int& cacheMinV, int& cacheMaxU, int& cacheMaxV );
 
 bool cacheBlockContains( cacheBlock* b, int u, int v );
+
+#if UNIT_TEST
+void test_terrainCache();
+void bench_terrainCacheRefs();
+void bench_terrainGridLookup();
+void bench_terrainCacheScaling();
+void bench_terrainCacheSoak();
+void bench_terrainDiskCache();
+void bench_terrainLodRefine();
+#endif // UNIT_TEST
@@ -0,0 +1,162 @@
+// diskCache.c
+#include "src/common.h"
+#include "src/terrain/diskCache.h"
+//---------------------
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "noise.h"
+#include "mem/allocator.h"
+#include "terrain/cache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kTerrainDiskMagic 0x31435456 // "VTC1"
+#define kTerrainDiskVersion 3
+#define kTerrainDiskMaxPath 256
+
+/* File layout: a header, then one fixed-size record per block slot. A record is the block's compact
+   storage as is: height base, X/Z anchors and quantised heights, of which only those sampled at the
+   block's LOD are meaningful. Files are created at full size, so are sparse until
+   filled. A slot is zeroed while its record is written and set to LOD+1 after, so a reader that sees the
+   slot unchanged either side of its copy has a whole record */
+typedef struct terrainDiskHeader_s {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	int32_t uGrid;
+	int32_t vGrid;
+	uint32_t slots[GridSize][GridSize]; // LOD + 1, or 0 if empty
+} terrainDiskHeader;
+
+typedef struct terrainDiskRecord_s {
+	int32_t heightBase;
+	float anchors[CacheAnchors][CacheAnchors][2];
+	uint16_t heights[CacheBlockSize][CacheBlockSize];
+} terrainDiskRecord;
+
+struct terrainDiskGrid_s {
+	int fd;
+	size_t size;
+	terrainDiskHeader* header;
+	terrainDiskRecord* records;
+};
+
+// FNV-1a
+uint64_t terrainDisk_hash( uint64_t hash, const void* data, size_t length ) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for ( size_t i = 0; i < length; ++i )
+		hash = ( hash ^ bytes[i] ) * 0x100000001b3ull;
+	return hash;
+}
+
+uint64_t terrainDisk_key( canyonTerrain* t ) {
+	const long int seed = canyon_seed();
+	const int version = kTerrainDiskVersion;
+	const int noiseBackend = NOISE_BACKEND;
+	uint64_t key = 0xcbf29ce484222325ull;
+	key = terrainDisk_hash( key, &version, sizeof( version ));
+	key = terrainDisk_hash( key, &noiseBackend, sizeof( noiseBackend ));
+	key = terrainDisk_hash( key, &seed, sizeof( seed ));
+	key = terrainDisk_hash( key, &t->u_radius, sizeof( t->u_radius ));
+	key = terrainDisk_hash( key, &t->v_radius, sizeof( t->v_radius ));
+	key = terrainDisk_hash( key, &t->u_block_count, sizeof( t->u_block_count ));
+	key = terrainDisk_hash( key, &t->v_block_count, sizeof( t->v_block_count ));
+	key = terrainDisk_hash( key, &t->uSamplesPerBlock, sizeof( t->uSamplesPerBlock ));
+	key = terrainDisk_hash( key, &t->vSamplesPerBlock, sizeof( t->vSamplesPerBlock ));
+	return key;
+}
+
+bool terrainDisk_valid( terrainDiskHeader* h, uint64_t key, int uGrid, int vGrid ) {
+	return h->magic == kTerrainDiskMagic && h->version == kTerrainDiskVersion && h->key == key && h->uGrid == uGrid && h->vGrid == vGrid;
+}
+
+terrainDiskGrid* terrainDisk_open( const char* dir, uint64_t key, int uGrid, int vGrid ) {
+	char path[kTerrainDiskMaxPath];
+	snprintf( path, kTerrainDiskMaxPath, "%s/%016llx_%d_%d.vtc", dir, (unsigned long long)key, uGrid, vGrid );
+	const int fd = open( path, O_RDWR | O_CREAT, 0644 );
+	if ( fd < 0 )
+		return NULL;
+
+	const size_t size = sizeof( terrainDiskHeader ) + sizeof( terrainDiskRecord ) * GridSize * GridSize;
+	struct stat st;
+	const bool existing = fstat( fd, &st ) == 0 && (size_t)st.st_size == size;
+	if ( !existing && ftruncate( fd, 0 ) != 0 ) {
+		close( fd );
+		return NULL;
+	}
+	if ( ftruncate( fd, size ) != 0 ) {
+		close( fd );
+		return NULL;
+	}
+	void* mapped = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( mapped == MAP_FAILED ) {
+		close( fd );
+		return NULL;
+	}
+
+	terrainDiskGrid* d = (terrainDiskGrid*)mem_alloc( sizeof( terrainDiskGrid ));
+	d->fd = fd;
+	d->size = size;
+	d->header = (terrainDiskHeader*)mapped;
+	d->records = (terrainDiskRecord*)( d->header + 1 );
+	// A stale or foreign file is simply reset; its contents are regenerated as needed
+	if ( !terrainDisk_valid( d->header, key, uGrid, vGrid )) {
+		memset( d->header, 0, sizeof( terrainDiskHeader ));
+		d->header->magic = kTerrainDiskMagic;
+		d->header->version = kTerrainDiskVersion;
+		d->header->key = key;
+		d->header->uGrid = uGrid;
+		d->header->vGrid = vGrid;
+	}
+	return d;
+}
+
+void terrainDisk_close( terrainDiskGrid* d ) {
+	if ( d ) {
+		munmap( d->header, d->size );
+		close( d->fd );
+		mem_free( d );
+	}
+}
+
+void terrainDisk_slot( cacheBlock* b, int* u, int* v ) {
+	*u = offset( b->uMin, GridCapacity ) / CacheBlockSize;
+	*v = offset( b->vMin, GridCapacity ) / CacheBlockSize;
+}
+
+bool terrainDisk_read( terrainDiskGrid* d, cacheBlock* b ) {
+	int u, v;
+	terrainDisk_slot( b, &u, &v );
+	uint32_t* slot = &d->header->slots[u][v];
+	const uint32_t stored = __atomic_load_n( slot, __ATOMIC_ACQUIRE );
+	if ( stored == 0 || (int)stored - 1 > b->lod )
+		return false;
+
+	const int lod = (int)stored - 1;
+	const terrainDiskRecord* record = &d->records[u * GridSize + v];
+	b->heightBase = record->heightBase;
+	memcpy( b->anchors, record->anchors, sizeof( b->anchors ));
+	memcpy( b->heights, record->heights, sizeof( b->heights ));
+	if ( __atomic_load_n( slot, __ATOMIC_ACQUIRE ) != stored )
+		return false;
+	b->lod = lod;
+	return true;
+}
+
+void terrainDisk_write( terrainDiskGrid* d, cacheBlock* b ) {
+	int u, v;
+	terrainDisk_slot( b, &u, &v );
+	uint32_t* slot = &d->header->slots[u][v];
+	const uint32_t stored = __atomic_load_n( slot, __ATOMIC_ACQUIRE );
+	if ( stored != 0 && (int)stored - 1 <= b->lod )
+		return;
+
+	__atomic_store_n( slot, 0, __ATOMIC_RELEASE );
+	terrainDiskRecord* record = &d->records[u * GridSize + v];
+	record->heightBase = b->heightBase;
+	memcpy( record->anchors, b->anchors, sizeof( record->anchors ));
+	memcpy( record->heights, b->heights, sizeof( record->heights ));
+	__atomic_store_n( slot, (uint32_t)( b->lod + 1 ), __ATOMIC_RELEASE );
+}
@@ -0,0 +1,19 @@
+// diskCache.h
+#pragma once
+
+/* Optional on-disk store of cacheBlock positions, so a canyon that has been flown before loads its terrain
+   instead of regenerating it from noise. There is one file per cacheGrid, mapped into memory, keyed by the
+   canyon seed, the terrain layout and the grid coordinate; each block slot records the LOD it was built at */
+
+// Key for a given canyon and terrain layout; changes whenever the generated positions would
+uint64_t terrainDisk_key( canyonTerrain* t );
+
+// Open (or create) the disk file for the grid at (uGrid,vGrid); NULL if it can't be mapped
+terrainDiskGrid* terrainDisk_open( const char* dir, uint64_t key, int uGrid, int vGrid );
+void terrainDisk_close( terrainDiskGrid* d );
+
+// Fill B's positions from disk if a block of at least B's LOD is stored; B's LOD is set to the stored LOD
+bool terrainDisk_read( terrainDiskGrid* d, cacheBlock* b );
+
+// Store B, unless an equal or finer LOD is already stored
+void terrainDisk_write( terrainDiskGrid* d, cacheBlock* b );
@@ -51,12 +51,59 @@ future* gridFuture( cacheGrid* g, int u, int v ) {
 	vAssert( vMin >= 0 && vMin < GridSize );
 	return g->futures[uMin][vMin];
 }
+void gridSetLastUsed( cacheGrid* g, int frame, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	g->lastUsed[uMin][vMin] = frame;
+}
+int gridLastUsed( cacheGrid* g, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	return g->lastUsed[uMin][vMin];
+}
+void gridSetEvicted( cacheGrid* g, bool evicted, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	g->evicted[uMin][vMin] = evicted;
+}
+bool gridEvicted( cacheGrid* g, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	return g->evicted[uMin][vMin];
+}
+void gridSetPrefetched( cacheGrid* g, bool prefetched, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	g->prefetched[uMin][vMin] = prefetched;
+}
+bool gridPrefetched( cacheGrid* g, int u, int v ) {
+	const int uMin = gridIndex(u, minStride(u, GridCapacity));
+	const int vMin = gridIndex(v, minStride(v, GridCapacity));
+	vAssert( uMin >= 0 && uMin < GridSize );
+	vAssert( vMin >= 0 && vMin < GridSize );
+	return g->prefetched[uMin][vMin];
+}
 
 cacheGrid* cacheGrid_create( int u, int v ) {
 	cacheGrid* g = (cacheGrid*)mem_alloc( sizeof( cacheGrid ));
 	memset( g->blocks, 0, sizeof( cacheBlock* ) * GridSize * GridSize );
 	memset( g->futures, 0, sizeof( future* ) * GridSize * GridSize );
 	memset( g->neededLods, 0, sizeof( int ) * GridSize * GridSize );
+	memset( g->lastUsed, 0, sizeof( int ) * GridSize * GridSize );
+	memset( g->evicted, 0, sizeof( bool ) * GridSize * GridSize );
+	memset( g->prefetched, 0, sizeof( bool ) * GridSize * GridSize );
+	g->users.store( 0 );
+	g->disk = NULL;
 	for ( int x = 0; x < GridSize; ++x )
 		for ( int y = 0; y < GridSize; ++y )
 			g->neededLods[x][y] = lowestLod;
@@ -1,5 +1,6 @@
 // grid.h
 #pragma once
+#include <atomic>
 
 #define GridSize 16
 #define GridCapacity (CacheBlockSize * GridSize)
@@ -10,6 +11,11 @@ typedef struct cacheGrid_s {
 	cacheBlock* blocks[GridSize][GridSize];
 	future* futures[GridSize][GridSize];
 	int neededLods[GridSize][GridSize];
+	int lastUsed[GridSize][GridSize];	// Cache frame each slot was last requested, for LRU eviction
+	bool evicted[GridSize][GridSize];	// Slot was evicted, so building it again counts as a regeneration
+	bool prefetched[GridSize][GridSize];	// Slot was built by a prefetch, and not yet requested
+	std::atomic<int> users;				// Lookups holding the grid; -1 once removed from the cache
+	terrainDiskGrid* disk;				// Mapped disk file, if the disk cache is enabled; opened on first build
 } cacheGrid;
 
 
@@ -23,4 +29,13 @@ int		gridLod( cacheGrid* g, int u, int v );
 void	gridSetFuture( cacheGrid* g, future* f, int u, int v );
 future* gridFuture( cacheGrid* g, int u, int v );
 
+void	gridSetLastUsed( cacheGrid* g, int frame, int u, int v );
+int		gridLastUsed( cacheGrid* g, int u, int v );
+
+void	gridSetEvicted( cacheGrid* g, bool evicted, int u, int v );
+bool	gridEvicted( cacheGrid* g, int u, int v );
+
+void	gridSetPrefetched( cacheGrid* g, bool prefetched, int u, int v );
+bool	gridPrefetched( cacheGrid* g, int u, int v );
+
 cacheGrid* cacheGrid_create( int u, int v );
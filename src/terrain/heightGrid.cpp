@@ -0,0 +1,197 @@
+// heightGrid.c
+#include "src/common.h"
+#include "src/terrain/heightGrid.h"
+//---------------------
+#include "test.h"
+#include "mem/allocator.h"
+
+// fminf/fmaxf are out-of-line calls without -ffast-math, and dominated building a grid
+static inline float fastMin( float a, float b ) { return a < b ? a : b; }
+static inline float fastMax( float a, float b ) { return a > b ? a : b; }
+
+static inline heightRange heightRange_union( heightRange a, heightRange b ) {
+	heightRange r = { fastMin( a.min, b.min ), fastMax( a.max, b.max ) };
+	return r;
+}
+
+static int heightGrid_levelCount( int u, int v, int level_u[kHeightGridMaxLevels], int level_v[kHeightGridMaxLevels] ) {
+	int levels = 0;
+	u = ( u - 1 + kHeightGridLeafCells - 1 ) / kHeightGridLeafCells;
+	v = ( v - 1 + kHeightGridLeafCells - 1 ) / kHeightGridLeafCells;
+	while ( true ) {
+		vAssert( levels < kHeightGridMaxLevels );
+		level_u[levels] = u;
+		level_v[levels] = v;
+		++levels;
+		if ( u == 1 && v == 1 )
+			return levels;
+		u = ( u + 1 ) / 2;
+		v = ( v + 1 ) / 2;
+	}
+}
+
+// Level 0 from the positions; each leaf includes the verts on its far edges, so covers every cell it bounds
+static void heightGrid_buildLeaves( terrainHeightGrid* g ) {
+	for ( int lv = 0; lv < g->level_v[0]; ++lv )
+		for ( int lu = 0; lu < g->level_u[0]; ++lu ) {
+			const int uMax = min( ( lu + 1 ) * kHeightGridLeafCells, g->u_samples - 1 );
+			const int vMax = min( ( lv + 1 ) * kHeightGridLeafCells, g->v_samples - 1 );
+			heightRange r = { FLT_MAX, -FLT_MAX };
+			for ( int v = lv * kHeightGridLeafCells; v <= vMax; ++v )
+				for ( int u = lu * kHeightGridLeafCells; u <= uMax; ++u ) {
+					const float y = g->positions[u + v * g->u_samples][1];
+					r.min = fastMin( r.min, y );
+					r.max = fastMax( r.max, y );
+				}
+			g->ranges[0][lu + lv * g->level_u[0]] = r;
+		}
+}
+
+static void heightGrid_buildLevel( terrainHeightGrid* g, int level ) {
+	const heightRange* below = g->ranges[level - 1];
+	const int belowU = g->level_u[level - 1];
+	const int belowV = g->level_v[level - 1];
+	for ( int v = 0; v < g->level_v[level]; ++v )
+		for ( int u = 0; u < g->level_u[level]; ++u ) {
+			heightRange r = below[2*u + 2*v * belowU];
+			if ( 2*u + 1 < belowU )
+				r = heightRange_union( r, below[2*u + 1 + 2*v * belowU] );
+			if ( 2*v + 1 < belowV ) {
+				r = heightRange_union( r, below[2*u + ( 2*v + 1 ) * belowU] );
+				if ( 2*u + 1 < belowU )
+					r = heightRange_union( r, below[2*u + 1 + ( 2*v + 1 ) * belowU] );
+			}
+			g->ranges[level][u + v * g->level_u[level]] = r;
+		}
+}
+
+terrainHeightGrid* terrainHeightGrid_create( const vector* verts, int u_samples, int v_samples, int row_stride ) {
+	vAssert( u_samples > 1 && v_samples > 1 && row_stride >= u_samples );
+	int level_u[kHeightGridMaxLevels], level_v[kHeightGridMaxLevels];
+	const int levels = heightGrid_levelCount( u_samples, v_samples, level_u, level_v );
+	int rangeCount = 0;
+	for ( int i = 0; i < levels; ++i )
+		rangeCount += level_u[i] * level_v[i];
+
+	// One allocation: grid, positions, then ranges
+	const size_t positionBytes = sizeof( float[3] ) * u_samples * v_samples;
+	const size_t headerBytes = ( sizeof( terrainHeightGrid ) + 15 ) & ~(size_t)15;
+	terrainHeightGrid* g = (terrainHeightGrid*)mem_alloc( headerBytes + positionBytes + sizeof( heightRange ) * rangeCount );
+	memset( (void*)g, 0, sizeof( terrainHeightGrid ));
+	g->u_samples = u_samples;
+	g->v_samples = v_samples;
+	g->positions = (float(*)[3])( (uint8_t*)g + headerBytes );
+	g->levels = levels;
+	heightRange* ranges = (heightRange*)( (uint8_t*)g->positions + positionBytes );
+	for ( int i = 0; i < levels; ++i ) {
+		g->level_u[i] = level_u[i];
+		g->level_v[i] = level_v[i];
+		g->ranges[i] = ranges;
+		ranges += level_u[i] * level_v[i];
+	}
+
+	vector lo = verts[0], hi = verts[0];
+	for ( int v = 0; v < v_samples; ++v )
+		for ( int u = 0; u < u_samples; ++u ) {
+			const vector p = verts[u + v * row_stride];
+			float* out = g->positions[u + v * u_samples];
+			out[0] = p.coord.x;
+			out[1] = p.coord.y;
+			out[2] = p.coord.z;
+			lo.coord.x = fastMin( lo.coord.x, p.coord.x );
+			lo.coord.z = fastMin( lo.coord.z, p.coord.z );
+			hi.coord.x = fastMax( hi.coord.x, p.coord.x );
+			hi.coord.z = fastMax( hi.coord.z, p.coord.z );
+		}
+
+	heightGrid_buildLeaves( g );
+	for ( int i = 1; i < levels; ++i )
+		heightGrid_buildLevel( g, i );
+	const heightRange root = g->ranges[levels - 1][0];
+	g->bounds.min = Vector( lo.coord.x, root.min, lo.coord.z, 1.f );
+	g->bounds.max = Vector( hi.coord.x, root.max, hi.coord.z, 1.f );
+	g->refCount.store( 1, std::memory_order_relaxed );
+	return g;
+}
+
+void terrainHeightGrid_take( terrainHeightGrid* g ) {
+	const int before = g->refCount.fetch_add( 1, std::memory_order_relaxed );
+	vAssert( before > 0 );
+	(void)before;
+}
+
+void terrainHeightGrid_release( terrainHeightGrid* g ) {
+	if ( g->refCount.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+		mem_free( g );
+}
+
+size_t terrainHeightGrid_bytes( const terrainHeightGrid* g ) {
+	size_t bytes = sizeof( terrainHeightGrid ) + sizeof( float[3] ) * g->u_samples * g->v_samples;
+	for ( int i = 0; i < g->levels; ++i )
+		bytes += sizeof( heightRange ) * g->level_u[i] * g->level_v[i];
+	return bytes;
+}
+
+#if UNIT_TEST
+// Every range in the hierarchy against the verts it covers, by brute force
+static bool heightGrid_rangesExact( const terrainHeightGrid* g ) {
+	for ( int level = 0; level < g->levels; ++level ) {
+		const int cells = kHeightGridLeafCells << level;
+		for ( int lv = 0; lv < g->level_v[level]; ++lv )
+			for ( int lu = 0; lu < g->level_u[level]; ++lu ) {
+				heightRange expected = { FLT_MAX, -FLT_MAX };
+				for ( int v = lv * cells; v <= min(( lv + 1 ) * cells, g->v_samples - 1 ); ++v )
+					for ( int u = lu * cells; u <= min(( lu + 1 ) * cells, g->u_samples - 1 ); ++u ) {
+						expected.min = fastMin( expected.min, terrainHeightGrid_position( g, u, v ).coord.y );
+						expected.max = fastMax( expected.max, terrainHeightGrid_position( g, u, v ).coord.y );
+					}
+				const heightRange r = terrainHeightGrid_range( g, level, lu, lv );
+				if ( r.min != expected.min || r.max != expected.max )
+					return false;
+			}
+	}
+	return true;
+}
+
+void test_terrainHeightGrid() {
+	printf( "--- Beginning Unit Test: Terrain Height Grid ---\n" );
+	// A block's worth at LOD 0, with the one-vert margin block generation has
+	const int uSamples = 65, vSamples = 49, stride = uSamples + 2;
+	vector* verts = (vector*)mem_alloc( sizeof( vector ) * stride * ( vSamples + 2 ));
+	for ( int i = 0; i < stride * ( vSamples + 2 ); ++i ) {
+		const float u = (float)( i % stride ), v = (float)( i / stride );
+		verts[i] = Vector( u * 10.f + sinf( v * 0.3f ) * 4.f, sinf( u * 0.7f ) * cosf( v * 0.45f ) * 60.f + v, v * 20.f, 1.f );
+	}
+	const vector* first = &verts[1 + stride];
+	terrainHeightGrid* g = terrainHeightGrid_create( first, uSamples, vSamples, stride );
+
+	bool positions = true;
+	aabb expected = { first[0], first[0] };
+	for ( int v = 0; v < vSamples; ++v )
+		for ( int u = 0; u < uSamples; ++u ) {
+			const vector p = first[u + v * stride];
+			const vector stored = terrainHeightGrid_position( g, u, v );
+			positions = positions && vector_equal( &p, &stored );
+			for ( int axis = 0; axis < 3; ++axis ) {
+				expected.min.val[axis] = fastMin( expected.min.val[axis], p.val[axis] );
+				expected.max.val[axis] = fastMax( expected.max.val[axis], p.val[axis] );
+			}
+		}
+	test( positions, "Height grid positions match the source", "Height grid positions differ from the source" );
+	test( vector_equal( &expected.min, &g->bounds.min ) && vector_equal( &expected.max, &g->bounds.max ),
+			"Height grid bounds exact", "Height grid bounds wrong" );
+	test( g->levels == 5 && g->level_u[g->levels - 1] == 1 && g->level_v[g->levels - 1] == 1,
+			"Height grid hierarchy reaches a single range", "Height grid hierarchy doesn't reach a single range" );
+	test( heightGrid_rangesExact( g ), "Height grid ranges bound their cells exactly", "Height grid ranges wrong" );
+
+	// What collision held before: its own copy of every position
+	const size_t copyBytes = sizeof( vector ) * uSamples * vSamples;
+	printf( "Height grid: %zu bytes shared, against a %zu byte collision copy\n", terrainHeightGrid_bytes( g ), copyBytes );
+
+	terrainHeightGrid_take( g );
+	terrainHeightGrid_release( g );
+	test( g->refCount.load() == 1, "Height grid take/release balances", "Height grid take/release unbalanced" );
+	terrainHeightGrid_release( g );
+	mem_free( verts );
+}
+#endif // UNIT_TEST
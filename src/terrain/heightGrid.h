@@ -0,0 +1,51 @@
+// heightGrid.h
+#pragma once
+#include "frustum.h"
+#include "maths/vector.h"
+#include <atomic>
+
+#define kHeightGridLeafCells 4		// Cells a side bounded by each level 0 height range
+#define kHeightGridMaxLevels 8
+
+typedef struct heightRange_s {
+	float min;
+	float max;
+} heightRange;
+
+/* A terrain block's vertex positions, built once by block generation and then shared, immutable, by whatever
+   needs them after (collision, for one) rather than each taking a copy. Alongside the positions is a hierarchy
+   of height ranges: level 0 bounds each kHeightGridLeafCells-square run of cells, and each level above bounds
+   2x2 of the one below, up to a single range for the whole grid. Refcounted; the last release frees it */
+struct terrainHeightGrid_s {
+	int u_samples;
+	int v_samples;
+	float (*positions)[3];	// u + v * u_samples
+	aabb bounds;
+	int levels;
+	int level_u[kHeightGridMaxLevels];
+	int level_v[kHeightGridMaxLevels];
+	heightRange* ranges[kHeightGridMaxLevels];	// u + v * level_u[level]
+	std::atomic<int> refCount;
+};
+
+// A grid of U_SAMPLES x V_SAMPLES from VERTS, whose rows are ROW_STRIDE apart; the caller holds the one ref
+terrainHeightGrid* terrainHeightGrid_create( const vector* verts, int u_samples, int v_samples, int row_stride );
+
+void terrainHeightGrid_take( terrainHeightGrid* g );
+void terrainHeightGrid_release( terrainHeightGrid* g );
+
+// Bytes held by G, including the grid itself
+size_t terrainHeightGrid_bytes( const terrainHeightGrid* g );
+
+static inline vector terrainHeightGrid_position( const terrainHeightGrid* g, int u, int v ) {
+	const float* p = g->positions[u + v * g->u_samples];
+	return Vector( p[0], p[1], p[2], 1.f );
+}
+
+static inline heightRange terrainHeightGrid_range( const terrainHeightGrid* g, int level, int u, int v ) {
+	return g->ranges[level][u + v * g->level_u[level]];
+}
+
+#if UNIT_TEST
+void test_terrainHeightGrid();
+#endif // UNIT_TEST
@@ -0,0 +1,122 @@
+// latency.c
+#include "src/common.h"
+#include "src/terrain/latency.h"
+//---------------------
+#include "canyon_terrain.h"
+#include "terrain_generate.h"
+#include "test.h"
+#include "maths/vector.h"
+#include "render/debugdraw.h"
+
+const char* terrainBlockStageNames[kBlockStageCount] = { "requested", "cache_ready", "verts_generated", "collision_built", "upload_queued", "vbo_live" };
+
+typedef struct latencyRecord_s {
+	long long stamps[kBlockStageCount];
+} latencyRecord;
+
+static latencyRecord latency_records[kTerrainLatencyRecords];
+static int latency_recorded = 0;	// Ever, so the ring is full once it passes kTerrainLatencyRecords
+
+void terrainLatency_stamp( canyonTerrainBlock* b, int stage ) {
+	vAssert( stage >= 0 && stage < kBlockStageCount );
+	b->lifecycle[stage] = terrainStage_begin(); // The stage timers' monotonic clock, in nanoseconds
+}
+
+void terrainLatency_record( const canyonTerrainBlock* b ) {
+	latencyRecord* r = &latency_records[latency_recorded++ % kTerrainLatencyRecords];
+	memcpy( r->stamps, b->lifecycle, sizeof( r->stamps ));
+}
+
+void terrainLatency_reset() { latency_recorded = 0; }
+
+static int compareDoubles( const void* a, const void* b ) {
+	const double x = *(const double*)a, y = *(const double*)b;
+	return ( x > y ) - ( x < y );
+}
+
+// Percentiles of the time between stages FROM and TO, over the first COUNT records
+static latencyPercentiles latency_percentiles( int count, int from, int to ) {
+	double seconds[kTerrainLatencyRecords];
+	for ( int i = 0; i < count; ++i )
+		seconds[i] = (double)( latency_records[i].stamps[to] - latency_records[i].stamps[from] ) * 0.000000001;
+	qsort( seconds, count, sizeof( double ), compareDoubles );
+	latencyPercentiles p = { seconds[count * 50 / 100], seconds[count * 95 / 100], seconds[count * 99 / 100] };
+	return p;
+}
+
+void terrainLatency_summarise( terrainLatencySummary* s ) {
+	memset( s, 0, sizeof( terrainLatencySummary ));
+	s->blocks = min( latency_recorded, kTerrainLatencyRecords );
+	if ( s->blocks == 0 )
+		return;
+	for ( int stage = kBlockRequested + 1; stage < kBlockStageCount; ++stage )
+		s->stages[stage] = latency_percentiles( s->blocks, stage - 1, stage );
+	s->total = latency_percentiles( s->blocks, kBlockRequested, kBlockLive );
+}
+
+void terrainLatency_print( FILE* out, const terrainLatencySummary* s ) {
+	fprintf( out, "Terrain block latency over the last %d blocks (ms, p50 / p95 / p99):\n", s->blocks );
+	for ( int stage = kBlockRequested + 1; stage < kBlockStageCount; ++stage ) {
+		const latencyPercentiles* p = &s->stages[stage];
+		fprintf( out, "\t%-16s %8.3f %8.3f %8.3f\n", terrainBlockStageNames[stage], p->p50 * 1000.0, p->p95 * 1000.0, p->p99 * 1000.0 );
+	}
+	fprintf( out, "\t%-16s %8.3f %8.3f %8.3f\n", "total", s->total.p50 * 1000.0, s->total.p95 * 1000.0, s->total.p99 * 1000.0 );
+}
+
+// One row per stage, then the total; p50, p95 and p99 as green, yellow and red bars down each row
+void terrainLatency_drawOverlay( const terrainLatencySummary* s, float x, float y, float width, float height ) {
+	const vector color_yellow = Vector( 1.f, 1.f, 0.f, 1.f );
+	const float rowHeight = height / (float)kBlockStageCount;
+	const float scale = width / ( kTerrainLatencyOverlayMs * 0.001f );
+	for ( int row = 0; row < kBlockStageCount; ++row ) {
+		const latencyPercentiles* p = row + 1 < kBlockStageCount ? &s->stages[row + 1] : &s->total;
+		const double seconds[3] = { p->p50, p->p95, p->p99 };
+		const vector colors[3] = { color_green, color_yellow, color_red };
+		for ( int i = 0; i < 3; ++i ) {
+			const float yy = y + rowHeight * ( (float)row + (float)( i + 1 ) * 0.25f );
+			const float length = fminf( (float)seconds[i] * scale, width );
+			debugdraw_line2d( Vector( x, yy, 0.f, 1.f ), Vector( x + length, yy, 0.f, 1.f ), colors[i] );
+		}
+	}
+	const vector tl = Vector( x, y, 0.f, 1.f );
+	const vector tr = Vector( x + width, y, 0.f, 1.f );
+	const vector bl = Vector( x, y + height, 0.f, 1.f );
+	const vector br = Vector( x + width, y + height, 0.f, 1.f );
+	debugdraw_line2d( tl, tr, color_red );
+	debugdraw_line2d( tr, br, color_red );
+	debugdraw_line2d( br, bl, color_red );
+	debugdraw_line2d( bl, tl, color_red );
+}
+
+#if UNIT_TEST
+void test_terrainLatency() {
+	printf( "--- Beginning Unit Test: Terrain Block Latency ---\n" );
+	terrainLatency_reset();
+	terrainLatencySummary s;
+	terrainLatency_summarise( &s );
+	test( s.blocks == 0 && s.total.p99 == 0.0, "Empty latency ring summarises to nothing", "Empty latency ring summarised" );
+
+	// Blocks whose stages take 1..5ms times a scale: once round the ring at 1000, which should all be overwritten by
+	// going round again at 1..kTerrainLatencyRecords
+	canyonTerrainBlock b;
+	memset( &b, 0, sizeof( b ));
+	const long long ms = 1000000LL;
+	for ( int i = 1; i <= 2 * kTerrainLatencyRecords; ++i ) {
+		const int scale = i > kTerrainLatencyRecords ? i - kTerrainLatencyRecords : 1000;
+		for ( int stage = kBlockRequested + 1; stage < kBlockStageCount; ++stage )
+			b.lifecycle[stage] = b.lifecycle[stage - 1] + stage * scale * ms;
+		terrainLatency_record( &b );
+	}
+	terrainLatency_summarise( &s );
+	const double p50 = (double)( kTerrainLatencyRecords * 50 / 100 + 1 ) * 0.001;
+	const double p99 = (double)( kTerrainLatencyRecords * 99 / 100 + 1 ) * 0.001;
+	bool stagesRight = true;
+	for ( int stage = kBlockRequested + 1; stage < kBlockStageCount; ++stage )
+		stagesRight = stagesRight && fabs( s.stages[stage].p50 - stage * p50 ) < 1e-9 && fabs( s.stages[stage].p99 - stage * p99 ) < 1e-9;
+	test( s.blocks == kTerrainLatencyRecords, "Latency ring holds the most recent blocks", "Latency ring size wrong" );
+	test( stagesRight, "Per-stage latency percentiles right", "Per-stage latency percentiles wrong" );
+	test( fabs( s.total.p50 - 15.0 * p50 ) < 1e-9 && s.total.p95 <= s.total.p99, "Total latency percentiles right", "Total latency percentiles wrong" );
+	terrainLatency_print( stdout, &s );
+	terrainLatency_reset();
+}
+#endif // UNIT_TEST
@@ -0,0 +1,52 @@
+// latency.h
+#pragma once
+
+/* Streaming latency of canyon terrain blocks. Each block stamps the time it reaches each stage of its lifecycle;
+   once it's handed to the terrain its stamps go into a fixed ring of the most recent blocks, from which we
+   take percentiles of the time spent reaching each stage from the one before. Stamps are taken wherever the
+   stage happens (workers included); records are pushed and summarised on the main thread only */
+
+enum terrainBlockStage {
+	kBlockRequested,		// Created, and its generation queued
+	kBlockCacheReady,		// Every cache block it needs is built; positions are sampled from here
+	kBlockVertsGenerated,	// Positions, normals and render vertices done
+	kBlockCollisionBuilt,
+	kBlockUploadQueued,		// Vertex buffers requested from the render thread
+	kBlockLive,				// Buffers up, and handed to the terrain
+	kBlockStageCount
+};
+
+extern const char* terrainBlockStageNames[kBlockStageCount];
+
+#define kTerrainLatencyRecords 512
+
+typedef struct latencyPercentiles_s {
+	double p50;
+	double p95;
+	double p99;
+} latencyPercentiles;	// Seconds
+
+typedef struct terrainLatencySummary_s {
+	int blocks;
+	latencyPercentiles stages[kBlockStageCount];	// Reaching each stage from the one before; kBlockRequested unused
+	latencyPercentiles total;						// Requested to live
+} terrainLatencySummary;
+
+// Stamp B as reaching STAGE now
+void terrainLatency_stamp( canyonTerrainBlock* b, int stage );
+
+// Push B's stamps into the ring, overwriting the oldest once it's full
+void terrainLatency_record( const canyonTerrainBlock* b );
+
+void terrainLatency_summarise( terrainLatencySummary* s );
+void terrainLatency_reset();
+
+// Per-stage percentiles as text to OUT
+void terrainLatency_print( FILE* out, const terrainLatencySummary* s );
+// Per-stage percentiles as bars, for the debug overlay; a full-width bar is kTerrainLatencyOverlayMs
+#define kTerrainLatencyOverlayMs 100.f
+void terrainLatency_drawOverlay( const terrainLatencySummary* s, float x, float y, float width, float height );
+
+#if UNIT_TEST
+void test_terrainLatency();
+#endif // UNIT_TEST
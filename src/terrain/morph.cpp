@@ -0,0 +1,201 @@
+// morph.c
+#include "src/common.h"
+#include "src/terrain/morph.h"
+//---------------------
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "future.h"
+#include "noise.h"
+#include "terrain_generate.h"
+#include "test.h"
+#include "maths/maths.h"
+#include "mem/allocator.h"
+#include "mem/scratch.h"
+#include "render/graphicsbuffer.h"
+#include "terrain/buildCacheTask.h"
+#include "terrain/heightGrid.h"
+
+static inline void morph_store( float* out, vector p ) {
+	out[0] = p.coord.x;
+	out[1] = p.coord.y;
+	out[2] = p.coord.z;
+}
+
+static inline void morph_storeMidpoint( float* out, const vector& a, const vector& b ) {
+	out[0] = ( a.coord.x + b.coord.x ) * 0.5f;
+	out[1] = ( a.coord.y + b.coord.y ) * 0.5f;
+	out[2] = ( a.coord.z + b.coord.z ) * 0.5f;
+}
+
+void terrainMorph_fillTargets( canyonTerrainBlock* b, const vector* verts, float* targets ) {
+	// Each LOD's grid is every other sample of the one below, so (samples - 1) is always even
+	vAssert(( b->u_samples & 1 ) && ( b->v_samples & 1 ));
+	const bool coarsest = b->lod_level >= LowestLod;
+	for ( int v = 0; v < b->v_samples; ++v )
+		for ( int u = 0; u < b->u_samples; ++u ) {
+			float* out = &targets[3 * canyonTerrainBlock_renderIndexFromUV( b, u, v )];
+			const bool border = u == 0 || v == 0 || u == b->u_samples - 1 || v == b->v_samples - 1;
+			const bool oddU = u % 2 == 1, oddV = v % 2 == 1;
+			if ( coarsest || border || ( !oddU && !oddV ))
+				morph_store( out, verts[indexFromUV( b, u, v )] );
+			else if ( oddU && !oddV )
+				morph_storeMidpoint( out, verts[indexFromUV( b, u - 1, v )], verts[indexFromUV( b, u + 1, v )] );
+			else if ( oddV && !oddU )
+				morph_storeMidpoint( out, verts[indexFromUV( b, u, v - 1 )], verts[indexFromUV( b, u, v + 1 )] );
+			else // The coarse quad's diagonal, as terrainElements_fill triangulates it
+				morph_storeMidpoint( out, verts[indexFromUV( b, u + 1, v - 1 )], verts[indexFromUV( b, u - 1, v + 1 )] );
+		}
+}
+
+/* How far through its band of an axis's LOD interval a block DISTANCE blocks away sits, from 0 to 1.
+   canyonTerrain_lodLevelAround counts whole bands of the distance rounded to blocks, so a band of BAND runs from
+   half a block short of one multiple of INTERVAL to half a block short of the next */
+static float morph_alongBand( float distance, int interval, int band ) {
+	return fclamp(( distance + 0.5f - (float)( band * interval )) / (float)interval, 0.f, 1.f );
+}
+
+float terrainMorph_factor( canyonTerrain* t, canyonTerrainBlock* b, float u, float v ) {
+	if ( b->lod_level >= LowestLod )
+		return 0.f;
+	// The bands as canyonTerrain_lodLevelAround counts them; a block not yet swapped to its LOD is held at either end
+	int center[2];
+	canyonTerrain_blockAt( t, u, v, center );
+	const int bandU = abs( b->u.coord - center[0] ) / t->lod_interval_u;
+	const int bandV = abs( b->v.coord - center[1] ) / t->lod_interval_v;
+	const int lod = min( LowestLod, bandU + bandV );
+	if ( lod != b->lod_level )
+		return lod > b->lod_level ? 1.f : 0.f;
+
+	// Each axis ramps over the end of its band, reaching 1 just where crossing that axis's threshold swaps the block
+	// to the coarser LOD. They add, as the bands do; only where both ramp at once (diagonally, toward a two-LOD
+	// step) does the clamp leave a jump
+	const float block_width = ( 2.f * t->u_radius ) / (float)t->u_block_count;
+	const float block_height = ( 2.f * t->v_radius ) / (float)t->v_block_count;
+	const float alongU = morph_alongBand( fabsf((float)b->u.coord - u / block_width ), t->lod_interval_u, bandU );
+	const float alongV = morph_alongBand( fabsf((float)b->v.coord - v / block_height ), t->lod_interval_v, bandV );
+	const float morphStart = 1.f - kTerrainMorphBand;
+	return fminf( 1.f, fmaxf( 0.f, alongU - morphStart ) / kTerrainMorphBand + fmaxf( 0.f, alongV - morphStart ) / kTerrainMorphBand );
+}
+
+#if UNIT_TEST
+// A block at LOD built headless, just beyond the terrain's bounds so that handing it over deletes it
+static canyonTerrainBlock* morphTestBlock( canyonTerrain* t, engine* e, int lod ) {
+	const absolute u = { 0 };
+	const absolute v = { t->bounds[1][1] + 1 };
+	canyonTerrainBlock* b = newBlock( t, u, v, e );
+	canyonTerrainBlock_setLayout( b, t, u, v, lod );
+	terrainBlock_generateNow( b );
+	return b;
+}
+
+static void morphTestRelease( canyonTerrainBlock* b ) {
+	render_bufferDiscardRequests();
+	future_complete_( b->ready );
+	futures_tick( 0.f );
+}
+
+static bool morph_equal( vector p, const float* q ) { return p.coord.x == q[0] && p.coord.y == q[1] && p.coord.z == q[2]; }
+
+// The coarse block's surface under fine sample (U,V): its vertex if it has one, else the edge midpoint the fine one splits
+static vector morph_coarseSurface( canyonTerrainBlock* coarse, int u, int v ) {
+	#define COARSE( uu, vv ) terrainHeightGrid_position( coarse->heights, ( uu ) / 2, ( vv ) / 2 )
+	float mid[3];
+	if ( u % 2 == 0 && v % 2 == 0 )
+		return COARSE( u, v );
+	else if ( v % 2 == 0 )
+		morph_storeMidpoint( mid, COARSE( u - 1, v ), COARSE( u + 1, v ));
+	else if ( u % 2 == 0 )
+		morph_storeMidpoint( mid, COARSE( u, v - 1 ), COARSE( u, v + 1 ));
+	else
+		morph_storeMidpoint( mid, COARSE( u + 1, v - 1 ), COARSE( u - 1, v + 1 ));
+	#undef COARSE
+	return Vector( mid[0], mid[1], mid[2], 1.f );
+}
+
+void test_terrainMorph() {
+	printf( "--- Beginning Unit Test: Terrain Geomorphing ---\n" );
+	noise_staticInit();
+	if ( !scratch_hasArena() )
+		scratch_threadInit( kScratchArenaSize );
+	canyonTerrain* t = testTerrain_create();
+	engine* e = engine_create();
+
+	// Blocks keep their float positions only in their height grids; the vertices were packed from the same ones
+	bool fineExact = true, coarseExact = true, sharedExact = true, bordersHeld = true;
+	for ( int lod = 0; lod < LowestLod; ++lod ) {
+		canyonTerrainBlock* fine = morphTestBlock( t, e, lod );
+		canyonTerrainBlock* coarse = morphTestBlock( t, e, lod + 1 );
+		const float* targets = fine->renderable->morph_targets;
+		for ( int v = 0; v < fine->v_samples; ++v )
+			for ( int u = 0; u < fine->u_samples; ++u ) {
+				const int i = canyonTerrainBlock_renderIndexFromUV( fine, u, v );
+				const vector p = terrainHeightGrid_position( fine->heights, u, v );
+				const float* target = &targets[3 * i];
+				fineExact = fineExact && morph_equal( terrainMorph_position( p, target, 0.f ), &p.val[0] );
+				float morphed[3];
+				morph_store( morphed, terrainMorph_position( p, target, 1.f ));
+				if ( u % 2 == 0 && v % 2 == 0 ) {
+					const vector shared = terrainHeightGrid_position( coarse->heights, u / 2, v / 2 );
+					sharedExact = sharedExact && morph_equal( shared, &p.val[0] );
+				}
+				if ( u == 0 || v == 0 || u == fine->u_samples - 1 || v == fine->v_samples - 1 )
+					bordersHeld = bordersHeld && morph_equal( p, morphed );
+				else
+					coarseExact = coarseExact && morph_equal( morph_coarseSurface( coarse, u, v ), morphed );
+			}
+		morphTestRelease( coarse );
+		morphTestRelease( fine );
+	}
+	// The coarsest LOD has nothing to morph to
+	canyonTerrainBlock* coarsest = morphTestBlock( t, e, LowestLod );
+	bool coarsestHeld = true;
+	for ( int v = 0; v < coarsest->v_samples; ++v )
+		for ( int u = 0; u < coarsest->u_samples; ++u ) {
+			const int i = canyonTerrainBlock_renderIndexFromUV( coarsest, u, v );
+			coarsestHeld = coarsestHeld && morph_equal( terrainHeightGrid_position( coarsest->heights, u, v ), &coarsest->renderable->morph_targets[3 * i] );
+		}
+	test( fineExact, "Morph factor 0 gives the fine grid exactly", "Morph factor 0 moves the fine grid" );
+	test( sharedExact, "Fine and coarse LODs share their common samples exactly", "Fine and coarse LODs differ at common samples" );
+	test( coarseExact, "Morph factor 1 gives the coarse grid exactly", "Morph factor 1 doesn't match the coarse grid" );
+	test( bordersHeld, "Morphing holds block borders", "Morphing moves block borders" );
+	test( coarsestHeld, "Coarsest LOD morphs to itself", "Coarsest LOD has morph targets" );
+
+	// Sweep the camera away from a block along each axis, with the game's LOD intervals. The block takes whatever
+	// LOD the terrain would give it there, so at each switch the morph must already show the coarser LOD
+	canyonTerrain_setLodIntervals( t, 1, 3 );
+	canyonTerrainBlock probe = *coarsest;
+	const float block_width = ( 2.f * t->u_radius ) / (float)t->u_block_count;
+	const float block_height = ( 2.f * t->v_radius ) / (float)t->v_block_count;
+	const float centreU = (float)probe.u.coord * block_width, centreV = (float)probe.v.coord * block_height;
+	bool continuous = true, switchesMorphed = true;
+	int switches = 0;
+	for ( int axis = 0; axis < 2; ++axis ) {
+		float lastShown = 0.f;
+		int lastLod = 0;
+		for ( int step = 0; step <= ( 3 * LowestLod + 1 ) * 256; ++step ) {
+			const float d = (float)step / 256.f;
+			const float u = axis == 0 ? centreU + d * block_width : centreU;
+			const float v = axis == 1 ? centreV - d * block_height : centreV;
+			int center[2];
+			canyonTerrain_blockAt( t, u, v, center );
+			probe.lod_level = canyonTerrain_lodLevelAround( t, center, probe.u, probe.v );
+			const float factor = terrainMorph_factor( t, &probe, u, v );
+			const float shown = (float)probe.lod_level + factor;
+			if ( step > 0 ) {
+				continuous = continuous && fabsf( shown - lastShown ) < 0.02f;
+				if ( probe.lod_level != lastLod ) {
+					++switches;
+					switchesMorphed = switchesMorphed && lastShown > (float)probe.lod_level - 0.02f && factor < 0.02f;
+				}
+			}
+			lastShown = shown;
+			lastLod = probe.lod_level;
+		}
+	}
+	test( switches == 2 * LowestLod && switchesMorphed, "Morph factor reaches 1 at each LOD switch", "Morph factor short of 1 at a LOD switch" );
+	test( continuous, "Morphed LOD continuous across switches on either axis", "Morphed LOD jumps on crossing a switch" );
+	test( terrainMorph_factor( t, coarsest, centreU, centreV - block_height * 100.f ) == 0.f, "Coarsest LOD never morphs", "Coarsest LOD morphs" );
+	morphTestRelease( coarsest );
+	testTerrain_delete( t );
+}
+#endif // UNIT_TEST
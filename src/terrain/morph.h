@@ -0,0 +1,29 @@
+// morph.h
+#pragma once
+#include "maths/vector.h"
+
+/* Geomorphing between terrain LODs. Each block carries, beside its vertices, a morph target per vertex: where
+   that vertex lies on the next coarser LOD's surface. Samples the coarser grid shares are their own target;
+   the others target the midpoint of the coarse triangle edge they split. The terrain shader blends towards the
+   targets by a per-block factor which rises from 0 to 1 as the block nears the distance it would drop to the
+   coarser LOD, so the swap itself changes nothing on screen. Border verts target themselves: neighbouring
+   blocks morph by different factors, and the borders are already stitched to the coarsest LOD */
+
+#define kTerrainMorphBand 0.5f	// The fraction of each axis's LOD band over which blocks morph, ending where it swaps LOD
+
+// Fill TARGETS (3 floats per render vertex) for B from its final positions VERTS, laid out as indexFromUV
+void terrainMorph_fillTargets( canyonTerrainBlock* b, const vector* verts, float* targets );
+
+// The morph factor for B, seen from canyon-space (U,V)
+float terrainMorph_factor( canyonTerrain* t, canyonTerrainBlock* b, float u, float v );
+
+// Where the shader puts a vertex at FINE with morph target TARGET, at factor K: exactly FINE at 0, TARGET at 1
+static inline vector terrainMorph_position( vector fine, const float* target, float k ) {
+	return Vector( fine.coord.x * ( 1.f - k ) + target[0] * k,
+					fine.coord.y * ( 1.f - k ) + target[1] * k,
+					fine.coord.z * ( 1.f - k ) + target[2] * k, 1.f );
+}
+
+#if UNIT_TEST
+void test_terrainMorph();
+#endif // UNIT_TEST
@@ -0,0 +1,259 @@
+// prefetch.c
+#include "src/common.h"
+#include "src/terrain/prefetch.h"
+//---------------------
+#include "bounds.h"
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "future.h"
+#include "test.h"
+#include "worker.h"
+#include "base/pair.h"
+#include "mem/allocator.h"
+#include "terrain/cache.h"
+
+#define kPrefetchDefaultLookahead 1.f
+#define kPrefetchVelocitySmoothing 0.25f // Seconds
+
+terrainPrefetch* terrainPrefetch_create() {
+	terrainPrefetch* p = (terrainPrefetch*)mem_alloc( sizeof( terrainPrefetch ));
+	memset( p, 0, sizeof( terrainPrefetch ));
+	p->lookahead = kPrefetchDefaultLookahead;
+	p->dispatch = worker_addBackgroundTask;
+	return p;
+}
+
+void terrainPrefetch_delete( terrainPrefetch* p ) {
+	mem_free( p );
+}
+
+void terrainPrefetch_setLookahead( terrainPrefetch* p, float seconds ) {
+	p->lookahead = fmaxf( 0.f, seconds );
+}
+
+void* prefetchCacheTask( void* args ) {
+	canyonTerrain* t = (canyonTerrain*)_1( args );
+	const int u = (int)(intptr_t)_2( args );
+	const int v = (int)(intptr_t)_3( args );
+	const int lod = (int)(intptr_t)_4( args );
+	terrainCachePrefetch( t->_canyon, t, u, v, lod );
+	mem_free( args );
+	return NULL;
+}
+
+// Queue the cache blocks the terrain block at (U,V) will need at LOD
+void prefetchBlock( terrainPrefetch* p, canyonTerrain* t, absolute u, absolute v, int lod ) {
+	canyonTerrainBlock b;
+	memset( &b, 0, sizeof( b ));
+	b.terrain = t;
+	b._canyon = t->_canyon;
+	canyonTerrainBlock_setLayout( &b, t, u, v, lod );
+
+	int cacheMinU = 0, cacheMinV = 0, cacheMaxU = 0, cacheMaxV = 0;
+	getCacheExtents( &b, cacheMinU, cacheMinV, cacheMaxU, cacheMaxV );
+	for ( int cu = cacheMinU; cu <= cacheMaxU; cu += CacheBlockSize )
+		for ( int cv = cacheMinV; cv <= cacheMaxV; cv += CacheBlockSize ) {
+			void* args = Quad( t, (void*)(intptr_t)cu, (void*)(intptr_t)cv, (void*)(intptr_t)lod );
+			if ( p->dispatch( task( prefetchCacheTask, args )))
+				++p->requests;
+			else {
+				mem_free( args );
+				++p->dropped;
+			}
+		}
+}
+
+void terrainPrefetch_tick( terrainPrefetch* p, canyonTerrain* t, float u, float v, float dt ) {
+	if ( p->tracking && dt > 0.f ) {
+		const float blend = 1.f - expf( -dt / kPrefetchVelocitySmoothing );
+		p->velocity_u += (( u - p->u ) / dt - p->velocity_u ) * blend;
+		p->velocity_v += (( v - p->v ) / dt - p->velocity_v ) * blend;
+	}
+	p->u = u;
+	p->v = v;
+	p->tracking = true;
+	if ( p->lookahead <= 0.f )
+		return;
+
+	int center[2], current[2], bounds[2][2];
+	canyonTerrain_blockAt( t, u + p->velocity_u * p->lookahead, v + p->velocity_v * p->lookahead, center );
+	if ( p->issued && center[0] == p->center[0] && center[1] == p->center[1] )
+		return;
+	canyonTerrain_blockAt( t, u, v, current );
+	canyonTerrain_boundsAround( t, center, bounds );
+
+	for ( int bv = bounds[0][1]; bv <= bounds[1][1]; ++bv )
+		for ( int bu = bounds[0][0]; bu <= bounds[1][0]; ++bu ) {
+			int coord[2] = { bu, bv };
+			const absolute uu = { bu }, vv = { bv };
+			const int lod = canyonTerrain_lodLevelAround( t, center, uu, vv );
+			// Blocks the terrain already has at this LOD or finer are built, or being built
+			if ( boundsContains( t->bounds, coord ) && canyonTerrain_lodLevelAround( t, current, uu, vv ) <= lod )
+				continue;
+			if ( p->issued && boundsContains( p->bounds, coord ) && canyonTerrain_lodLevelAround( t, p->center, uu, vv ) <= lod )
+				continue;
+			prefetchBlock( p, t, uu, vv, lod );
+		}
+
+	memcpy( p->center, center, sizeof( p->center ));
+	memcpy( p->bounds, bounds, sizeof( p->bounds ));
+	p->issued = true;
+}
+
+#if UNIT_TEST
+#define kFlythroughDistance 8000.f
+#define kFlythroughSpeed 240.f			// Canyon units per second
+#define kFlythroughBuildsPerFrame 3	// Cache blocks the workers can build in a frame
+#define kFlythroughMaxRequests 4096
+
+typedef struct flythroughRequest_s {
+	int u;
+	int v;
+	int lod;
+	future* f;
+} flythroughRequest;
+
+typedef struct flythroughStats_s {
+	int frames;
+	int missingFrames;	// Frames ending with a block still waiting on its cache blocks
+	int requestBuilds;
+	int prefetchBuilds;
+	int hits;
+	int wasted;
+} flythroughStats;
+
+// The flythrough's own background queue, as the live workers would take from the real one
+#define kFlythroughMaxPrefetches 2048
+worker_task flythroughPrefetches[kFlythroughMaxPrefetches];
+int flythroughPrefetchCount = 0;
+
+bool flythrough_dispatch( worker_task t ) {
+	if ( flythroughPrefetchCount == kFlythroughMaxPrefetches )
+		return false;
+	flythroughPrefetches[flythroughPrefetchCount++] = t;
+	return true;
+}
+
+// Run the oldest queued prefetch, if there is one
+bool flythrough_runPrefetch() {
+	if ( flythroughPrefetchCount == 0 )
+		return false;
+	const worker_task t = flythroughPrefetches[0];
+	memmove( &flythroughPrefetches[0], &flythroughPrefetches[1], sizeof( worker_task ) * --flythroughPrefetchCount );
+	t.func( t.args );
+	return true;
+}
+
+/* Fly the canyon headlessly, standing in for canyonTerrain_updateBlocks and the workers: each frame the blocks
+   that are new (or now finer) request their cache blocks, then a fixed number of builds run, requests before
+   prefetches. Returns how many frames were left waiting on terrain */
+static flythroughStats flythrough( float lookahead ) {
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	canyonTerrain_setLodIntervals( t, 1, 3 );
+	terrainPrefetch_setLookahead( t->prefetch, lookahead );
+	t->prefetch->dispatch = flythrough_dispatch;
+	flythroughRequest* pending = (flythroughRequest*)mem_alloc( sizeof( flythroughRequest ) * kFlythroughMaxRequests );
+	int pendingCount = 0;
+	flythroughStats stats;
+	memset( &stats, 0, sizeof( stats ));
+
+	const float dt = 1.f / 60.f;
+	int lastCenter[2] = { 0, 0 };
+	int lastBounds[2][2];
+	bool first = true, warm = false;
+	for ( float v = 0.f; v < kFlythroughDistance; v += kFlythroughSpeed * dt ) {
+		canyonBuffer_seek( c, max( 0, (int)( v / CanyonSegmentLength ) - TrailingCanyonSegments ));
+		int center[2], bounds[2][2];
+		canyonTerrain_blockAt( t, 0.f, v, center );
+		canyonTerrain_boundsAround( t, center, bounds );
+		if ( first || center[0] != lastCenter[0] || center[1] != lastCenter[1] ) {
+			for ( int bv = bounds[0][1]; bv <= bounds[1][1]; ++bv )
+				for ( int bu = bounds[0][0]; bu <= bounds[1][0]; ++bu ) {
+					int coord[2] = { bu, bv };
+					const absolute uu = { bu }, vv = { bv };
+					const int lod = canyonTerrain_lodLevelAround( t, center, uu, vv );
+					if ( !first && boundsContains( lastBounds, coord ) && canyonTerrain_lodLevelAround( t, lastCenter, uu, vv ) <= lod )
+						continue;
+					canyonTerrainBlock b;
+					memset( &b, 0, sizeof( b ));
+					b.terrain = t;
+					b._canyon = c;
+					canyonTerrainBlock_setLayout( &b, t, uu, vv, lod );
+					int cacheMinU = 0, cacheMinV = 0, cacheMaxU = 0, cacheMaxV = 0;
+					getCacheExtents( &b, cacheMinU, cacheMinV, cacheMaxU, cacheMaxV );
+					for ( int cu = cacheMinU; cu <= cacheMaxU; cu += CacheBlockSize )
+						for ( int cv = cacheMinV; cv <= cacheMaxV; cv += CacheBlockSize ) {
+							future* f = NULL;
+							if ( cacheBlockFuture( c->cache, cu, cv, lod, &f )) {
+								vAssert( pendingCount < kFlythroughMaxRequests );
+								const flythroughRequest r = { cu, cv, lod, f };
+								pending[pendingCount++] = r;
+							}
+							future_onComplete( f, cacheReady, NULL );
+						}
+				}
+			memcpy( lastCenter, center, sizeof( lastCenter ));
+			memcpy( lastBounds, bounds, sizeof( lastBounds ));
+			first = false;
+		}
+		memcpy( t->bounds, bounds, sizeof( t->bounds ));
+		terrainPrefetch_tick( t->prefetch, t, 0.f, v, dt );
+
+		// As buildCacheBlockTask, for requests; whatever build time is left goes to prefetching
+		int builds = kFlythroughBuildsPerFrame;
+		int done = 0;
+		for ( ; done < pendingCount && builds > 0; ++done ) {
+			const flythroughRequest* r = &pending[done];
+			cacheBlock* b = terrainCached( c->cache, r->u, r->v );
+			if ( !b || b->lod > r->lod ) {
+				cacheBlockFree( b );
+				b = terrainCacheBuildAndAdd( c, t, r->u, r->v, r->lod );
+				--builds;
+				++stats.requestBuilds;
+			}
+			future_complete( r->f, b );
+			cacheBlockFree( b );
+		}
+		memmove( pending, &pending[done], sizeof( flythroughRequest ) * ( pendingCount - done ));
+		pendingCount -= done;
+		while ( builds > 0 ) {
+			int before = 0, after = 0, unused = 0;
+			terrainCache_prefetchStats( c->cache, &before, &unused, &unused );
+			if ( !flythrough_runPrefetch() )
+				break;
+			terrainCache_prefetchStats( c->cache, &after, &unused, &unused );
+			builds -= after - before;
+		}
+
+		// Don't count the first frames, where every block is missing whatever we do
+		warm = warm || pendingCount == 0;
+		if ( warm ) {
+			++stats.frames;
+			stats.missingFrames += pendingCount > 0;
+		}
+		terrainCache_tick( c->cache, dt, Vector( 0.f, 0.f, v, 1.f ));
+		futures_tick( dt );
+	}
+	terrainCache_prefetchStats( c->cache, &stats.prefetchBuilds, &stats.hits, &stats.wasted );
+	// Drop whatever is still queued against this canyon, so none of it runs against the next
+	for ( int i = 0; i < flythroughPrefetchCount; ++i )
+		mem_free( flythroughPrefetches[i].args );
+	flythroughPrefetchCount = 0;
+	mem_free( pending );
+	testTerrain_delete( t );
+	return stats;
+}
+
+void test_terrainPrefetch() {
+	const flythroughStats without = flythrough( 0.f );
+	const flythroughStats with = flythrough( kPrefetchDefaultLookahead );
+	printf( "Flythrough without prefetch: %d/%d frames missing blocks, %d request builds\n",
+			without.missingFrames, without.frames, without.requestBuilds );
+	printf( "Flythrough with %.1fs prefetch: %d/%d frames missing blocks, %d request builds; %d prefetched, %d hits, %d wasted\n",
+			kPrefetchDefaultLookahead, with.missingFrames, with.frames, with.requestBuilds, with.prefetchBuilds, with.hits, with.wasted );
+	test( without.prefetchBuilds == 0, "No prefetching with zero lookahead", "Prefetched with zero lookahead" );
+	test( with.hits > 0, "Prefetched cache blocks were requested", "No prefetched cache block was requested" );
+	test( with.missingFrames < without.missingFrames, "Prefetch reduced frames missing terrain", "Prefetch didn't reduce frames missing terrain" );
+}
+#endif // UNIT_TEST
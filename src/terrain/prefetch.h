@@ -0,0 +1,38 @@
+// prefetch.h
+#pragma once
+
+/* Predictive prefetch of terrain cache blocks. The ship's velocity is tracked in canyon space, so extrapolating
+   it follows the canyon spline. The cache blocks for the terrain around where the ship will be, LOOKAHEAD
+   seconds from now, are queued as background worker tasks, so they are usually built before
+   canyonTerrain_updateBlocks asks for them */
+
+// How prefetch tasks get to the workers; returns false if T was dropped
+typedef bool (*prefetchDispatch)( worker_task t );
+
+struct terrainPrefetch_s {
+	float lookahead;				// Seconds; zero disables prefetching
+	bool tracking;
+	float u;						// Last canyon-space position
+	float v;
+	float velocity_u;				// Smoothed, in canyon units per second
+	float velocity_v;
+	bool issued;
+	int center[2];					// Block the last prefetch was centred on
+	int bounds[2][2];				// Blocks the last prefetch covered
+	int requests;					// Cache blocks queued for prefetch
+	int dropped;					// Requests dropped as the background queue was full
+	prefetchDispatch dispatch;		// worker_addBackgroundTask, unless a test runs its own queue
+};
+
+terrainPrefetch* terrainPrefetch_create();
+void terrainPrefetch_delete( terrainPrefetch* p );
+
+// Seconds to look ahead; zero disables prefetching
+void terrainPrefetch_setLookahead( terrainPrefetch* p, float seconds );
+
+// Track the ship at canyon-space (U,V), and queue prefetches if the terrain's predicted bounds have moved
+void terrainPrefetch_tick( terrainPrefetch* p, canyonTerrain* t, float u, float v, float dt );
+
+#if UNIT_TEST
+void test_terrainPrefetch();
+#endif // UNIT_TEST
@@ -0,0 +1,426 @@
+// query.c
+#include "src/common.h"
+#include "src/terrain/query.h"
+//---------------------
+#include "bench.h"
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "collision.h"
+#include "engine.h"
+#include "future.h"
+#include "noise.h"
+#include "test.h"
+#include "vtime.h"
+#include "mem/allocator.h"
+#include "mem/scratch.h"
+#include "render/graphicsbuffer.h"
+#include "system/thread.h"
+#include "terrain/buildCacheTask.h"
+#include "terrain/heightGrid.h"
+
+#define kQueryGridCell 128.f	// World units; about a block across
+
+// The collision field of block INDEX, if it's loaded; the terrain mutex must be held
+static heightField* terrainQuery_field( canyonTerrain* t, int index ) {
+	canyonTerrainBlock* b = t->blocks[index];
+	return b && b->collision ? b->collision->_shape->height_field : NULL;
+}
+
+static inline bool terrainQuery_over( heightField* h, float x, float z ) {
+	const aabb& bb = h->grid->bounds;
+	return x >= bb.min.coord.x && x <= bb.max.coord.x && z >= bb.min.coord.z && z <= bb.max.coord.z;
+}
+
+/* A world-space x-z grid of the loaded blocks, each listed in every cell its bounds overlap, so a batch finds the
+   blocks near a point directly. Not through canyon space: its inverse is only approximate away from the canyon's
+   centre line, often by several blocks */
+typedef struct terrainQueryGrid_s {
+	float x_min;
+	float z_min;
+	int cells_x;
+	int cells_z;
+	int* starts;	// Into BLOCKS for each cell, plus one past the end
+	int* blocks;
+} terrainQueryGrid;
+
+static void terrainQueryGrid_cellRange( const terrainQueryGrid* g, float x_min, float x_max, float z_min, float z_max, int range[2][2] ) {
+	range[0][0] = max( 0, (int)floorf(( x_min - g->x_min ) / kQueryGridCell ));
+	range[0][1] = max( 0, (int)floorf(( z_min - g->z_min ) / kQueryGridCell ));
+	range[1][0] = min( g->cells_x - 1, (int)floorf(( x_max - g->x_min ) / kQueryGridCell ));
+	range[1][1] = min( g->cells_z - 1, (int)floorf(( z_max - g->z_min ) / kQueryGridCell ));
+}
+
+// The terrain mutex must be held for as long as the grid's in use
+static void terrainQueryGrid_build( terrainQueryGrid* g, canyonTerrain* t ) {
+	memset( g, 0, sizeof( terrainQueryGrid ));
+	float x_max = -FLT_MAX, z_max = -FLT_MAX;
+	g->x_min = FLT_MAX;
+	g->z_min = FLT_MAX;
+	for ( int i = 0; i < t->total_block_count; ++i )
+		if ( heightField* h = terrainQuery_field( t, i )) {
+			const aabb& bb = h->grid->bounds;
+			g->x_min = fminf( g->x_min, bb.min.coord.x );
+			g->z_min = fminf( g->z_min, bb.min.coord.z );
+			x_max = fmaxf( x_max, bb.max.coord.x );
+			z_max = fmaxf( z_max, bb.max.coord.z );
+		}
+	if ( x_max < g->x_min ) { // Nothing loaded
+		g->starts = (int*)mem_alloc( sizeof( int ));
+		g->starts[0] = 0;
+		return;
+	}
+	g->cells_x = (int)(( x_max - g->x_min ) / kQueryGridCell ) + 1;
+	g->cells_z = (int)(( z_max - g->z_min ) / kQueryGridCell ) + 1;
+	const int cells = g->cells_x * g->cells_z;
+	g->starts = (int*)mem_alloc( sizeof( int ) * ( cells + 1 ));
+	memset( g->starts, 0, sizeof( int ) * ( cells + 1 ));
+
+	// Count, then fill, each block into the cells its bounds overlap
+	for ( int pass = 0; pass < 2; ++pass ) {
+		for ( int i = 0; i < t->total_block_count; ++i )
+			if ( heightField* h = terrainQuery_field( t, i )) {
+				const aabb& bb = h->grid->bounds;
+				int range[2][2];
+				terrainQueryGrid_cellRange( g, bb.min.coord.x, bb.max.coord.x, bb.min.coord.z, bb.max.coord.z, range );
+				for ( int cz = range[0][1]; cz <= range[1][1]; ++cz )
+					for ( int cx = range[0][0]; cx <= range[1][0]; ++cx ) {
+						const int cell = cx + cz * g->cells_x;
+						if ( pass == 0 )
+							++g->starts[cell + 1];
+						else
+							g->blocks[g->starts[cell]++] = i;
+					}
+			}
+		if ( pass == 0 ) {
+			for ( int cell = 0; cell < cells; ++cell )
+				g->starts[cell + 1] += g->starts[cell];
+			g->blocks = (int*)mem_alloc( sizeof( int ) * max( 1, g->starts[cells] ));
+		} else {
+			// Filling moved each start on to the next's; move them back
+			for ( int cell = cells; cell > 0; --cell )
+				g->starts[cell] = g->starts[cell - 1];
+			g->starts[0] = 0;
+		}
+	}
+}
+
+static void terrainQueryGrid_free( terrainQueryGrid* g ) {
+	mem_free( g->starts );
+	if ( g->blocks )
+		mem_free( g->blocks );
+}
+
+// The cell (X,Z) is in, or -1 if off the grid
+static int terrainQueryGrid_cell( const terrainQueryGrid* g, float x, float z ) {
+	const int cx = (int)floorf(( x - g->x_min ) / kQueryGridCell ), cz = (int)floorf(( z - g->z_min ) / kQueryGridCell );
+	return cx < 0 || cz < 0 || cx >= g->cells_x || cz >= g->cells_z ? -1 : cx + cz * g->cells_x;
+}
+
+// ORDER gets 0..N-1 sorted by KEYS, each in [-1, BUCKETS - 1)
+static void terrainQuery_sort( const int* keys, int n, int buckets, int* order ) {
+	int* starts = (int*)mem_alloc( sizeof( int ) * buckets );
+	memset( starts, 0, sizeof( int ) * buckets );
+	for ( int i = 0; i < n; ++i )
+		++starts[keys[i] + 1];
+	for ( int k = 0, total = 0; k < buckets; ++k ) {
+		const int count = starts[k];
+		starts[k] = total;
+		total += count;
+	}
+	for ( int i = 0; i < n; ++i )
+		order[starts[keys[i] + 1]++] = i;
+	mem_free( starts );
+}
+
+float terrain_queryHeight( canyonTerrain* t, vector point ) {
+	const float x = point.coord.x, z = point.coord.z;
+	float y;
+	bool loaded = false;
+	vmutex_lock( &t->mutex ); {
+		for ( int i = 0; i < t->total_block_count && !loaded; ++i ) {
+			heightField* h = terrainQuery_field( t, i );
+			loaded = h && terrainQuery_over( h, x, z ) && heightField_height( h, x, z, &y );
+		}
+	} vmutex_unlock( &t->mutex );
+	if ( loaded )
+		return y;
+	float u, v;
+	canyonSpaceFromWorld( t->_canyon, x, z, &u, &v );
+	return canyonTerrain_sampleUV( u, v );
+}
+
+void terrain_queryHeights( canyonTerrain* t, const vector* points, int n, float* out ) {
+	if ( n <= 0 )
+		return;
+	float* x = (float*)mem_alloc( ( sizeof( float ) * 4 + sizeof( int ) * 2 ) * n );
+	float* z = x + n;
+	float* u = z + n;
+	float* v = u + n;
+	int* cell = (int*)( v + n );
+	int* order = cell + n;
+
+	// A cell at a time, from the loaded fields; those left over are gathered to the front of ORDER
+	int fallbacks = 0;
+	vmutex_lock( &t->mutex ); {
+		terrainQueryGrid g;
+		terrainQueryGrid_build( &g, t );
+		for ( int i = 0; i < n; ++i )
+			cell[i] = terrainQueryGrid_cell( &g, points[i].coord.x, points[i].coord.z );
+		terrainQuery_sort( cell, n, g.cells_x * g.cells_z + 1, order );
+		for ( int k = 0; k < n; ++k ) {
+			const int i = order[k];
+			const float px = points[i].coord.x, pz = points[i].coord.z;
+			bool loaded = false;
+			if ( cell[i] >= 0 )
+				for ( int b = g.starts[cell[i]]; b < g.starts[cell[i] + 1] && !loaded; ++b ) {
+					heightField* h = terrainQuery_field( t, g.blocks[b] );
+					loaded = terrainQuery_over( h, px, pz ) && heightField_height( h, px, pz, &out[i] );
+				}
+			if ( !loaded )
+				order[fallbacks++] = i;
+		}
+		terrainQueryGrid_free( &g );
+	} vmutex_unlock( &t->mutex );
+
+	// The rest from the procedural surface, 4-wide
+	for ( int k = 0; k < fallbacks; ++k ) {
+		x[k] = points[order[k]].coord.x;
+		z[k] = points[order[k]].coord.z;
+	}
+	canyonSpaceFromWorldBatch( t->_canyon, x, z, u, v, fallbacks );
+	canyonTerrain_sampleUVBatch( u, v, x, fallbacks );
+	for ( int k = 0; k < fallbacks; ++k )
+		out[order[k]] = x[k];
+	mem_free( x );
+}
+
+// Could R meet anything inside BB
+static bool terrainRay_overlaps( const terrainRay* r, const aabb* bb ) {
+	float near = 0.f, far = r->length;
+	for ( int axis = 0; axis < 3; ++axis ) {
+		const float o = r->origin.val[axis], d = r->dir.val[axis];
+		if ( d == 0.f ) {
+			if ( o < bb->min.val[axis] || o > bb->max.val[axis] )
+				return false;
+			continue;
+		}
+		float enter = ( bb->min.val[axis] - o ) / d, leave = ( bb->max.val[axis] - o ) / d;
+		if ( enter > leave ) {
+			const float swap = enter;
+			enter = leave;
+			leave = swap;
+		}
+		near = fmaxf( near, enter );
+		far = fminf( far, leave );
+		if ( near > far )
+			return false;
+	}
+	return true;
+}
+
+// Test R against block INDEX, shortening HIT to anything nearer
+static void terrainQuery_raycastBlock( canyonTerrain* t, int index, const terrainRay* r, terrainHit* hit ) {
+	heightField* h = terrainQuery_field( t, index );
+	float along;
+	if ( h && terrainRay_overlaps( r, &h->grid->bounds ) && heightField_raycast( h, r->origin, r->dir, hit->t, &along )) {
+		hit->hit = true;
+		hit->t = along;
+	}
+}
+
+static inline vector terrainRay_end( const terrainRay* r ) { return vector_add( r->origin, vector_scaled( r->dir, r->length )); }
+
+bool terrain_raycast( canyonTerrain* t, const terrainRay* ray, terrainHit* hit ) {
+	hit->hit = false;
+	hit->t = ray->length;
+	vmutex_lock( &t->mutex ); {
+		for ( int i = 0; i < t->total_block_count; ++i )
+			terrainQuery_raycastBlock( t, i, ray, hit );
+	} vmutex_unlock( &t->mutex );
+	return hit->hit;
+}
+
+void terrain_raycastBatch( canyonTerrain* t, const terrainRay* rays, int n, terrainHit* hits ) {
+	if ( n <= 0 )
+		return;
+	int* cell = (int*)mem_alloc( sizeof( int ) * ( 2 * n + t->total_block_count ));
+	int* order = cell + n;
+	int* tested = order + n;	// The last ray each block was tested against, as blocks span several cells
+	for ( int i = 0; i < t->total_block_count; ++i )
+		tested[i] = -1;
+
+	vmutex_lock( &t->mutex ); {
+		terrainQueryGrid g;
+		terrainQueryGrid_build( &g, t );
+		for ( int i = 0; i < n; ++i )
+			cell[i] = terrainQueryGrid_cell( &g, rays[i].origin.coord.x, rays[i].origin.coord.z );
+		terrainQuery_sort( cell, n, g.cells_x * g.cells_z + 1, order );
+		for ( int k = 0; k < n; ++k ) {
+			const int i = order[k];
+			const terrainRay* r = &rays[i];
+			const vector end = terrainRay_end( r );
+			int range[2][2];
+			terrainQueryGrid_cellRange( &g, fminf( r->origin.coord.x, end.coord.x ), fmaxf( r->origin.coord.x, end.coord.x ),
+												fminf( r->origin.coord.z, end.coord.z ), fmaxf( r->origin.coord.z, end.coord.z ), range );
+			hits[i].hit = false;
+			hits[i].t = r->length;
+			for ( int cz = range[0][1]; cz <= range[1][1]; ++cz )
+				for ( int cx = range[0][0]; cx <= range[1][0]; ++cx ) {
+					const int c = cx + cz * g.cells_x;
+					for ( int b = g.starts[c]; b < g.starts[c + 1]; ++b )
+						if ( tested[g.blocks[b]] != i ) {
+							tested[g.blocks[b]] = i;
+							terrainQuery_raycastBlock( t, g.blocks[b], r, &hits[i] );
+						}
+				}
+		}
+		terrainQueryGrid_free( &g );
+	} vmutex_unlock( &t->mutex );
+	mem_free( cell );
+}
+
+#if UNIT_TEST
+#define kQueryTestCount 4099	// Not a multiple of four, to cover the padded tail of the procedural fallback
+#define kQueryBenchCount 4096
+#define kQueryBenchPasses 8
+#define kQueryRayLength 300.f
+
+// Load every block in T's bounds, headless
+static void terrainQuery_fillTerrain( canyonTerrain* t, engine* e ) {
+	for ( int v = t->bounds[0][1]; v <= t->bounds[1][1]; ++v )
+		for ( int u = t->bounds[0][0]; u <= t->bounds[1][0]; ++u ) {
+			const absolute bu = { u }, bv = { v };
+			canyonTerrainBlock* b = newBlock( t, bu, bv, e );
+			terrainBlock_generateNow( b );
+			render_bufferDiscardRequests();
+			future_complete_( b->ready );
+			futures_tick( 0.f );
+		}
+}
+
+/* Points and rays scattered over the loaded terrain and a little beyond it, in no particular order; rays start
+   above the surface and mostly head down at a slant, as bullets and avoidance probes would */
+static void terrainQuery_testQueries( canyonTerrain* t, vector* points, terrainRay* rays, int n, long int seed ) {
+	randSeq r;
+	deterministic_seedRandSeq( seed, &r );
+	const float block_width = ( 2.f * t->u_radius ) / (float)t->u_block_count;
+	const float block_height = ( 2.f * t->v_radius ) / (float)t->v_block_count;
+	const float vMin = ( (float)t->bounds[0][1] - 1.f ) * block_height, vMax = ( (float)t->bounds[1][1] + 1.f ) * block_height;
+	const float uRadius = ( (float)t->bounds[1][0] + 1.f ) * block_width;
+	for ( int i = 0; i < n; ++i ) {
+		const float u = deterministic_frand( &r, -uRadius, uRadius ), v = deterministic_frand( &r, vMin, vMax );
+		float x, z;
+		terrain_worldSpaceFromCanyon( t->_canyon, u, v, &x, &z );
+		const float y = canyonTerrain_sampleUV( u, v );
+		points[i] = Vector( x, y + deterministic_frand( &r, -20.f, 20.f ), z, 1.f );
+		rays[i].origin = Vector( x, y + deterministic_frand( &r, 5.f, 80.f ), z, 1.f );
+		rays[i].dir = normalized( Vector( deterministic_frand( &r, -1.f, 1.f ), deterministic_frand( &r, -1.f, 0.2f ), deterministic_frand( &r, -1.f, 1.f ), 0.f ));
+		rays[i].length = kQueryRayLength;
+	}
+}
+
+// R's nearest hit on every loaded block
+static terrainHit terrainQuery_raycastBrute( canyonTerrain* t, const terrainRay* r ) {
+	terrainHit hit = { false, r->length };
+	for ( int i = 0; i < t->total_block_count; ++i ) {
+		heightField* h = terrainQuery_field( t, i );
+		float along;
+		if ( h && heightField_raycastBrute( h, r->origin, r->dir, hit.t, &along )) {
+			hit.hit = true;
+			hit.t = along;
+		}
+	}
+	return hit;
+}
+
+static canyonTerrain* terrainQuery_testTerrain( engine** e ) {
+	noise_staticInit();
+	if ( !scratch_hasArena() )
+		scratch_threadInit( kScratchArenaSize );
+	canyonTerrain* t = testTerrain_create();
+	*e = engine_create();
+	terrainQuery_fillTerrain( t, *e );
+	return t;
+}
+
+void test_terrainQuery() {
+	printf( "--- Beginning Unit Test: Terrain Batch Queries ---\n" );
+	engine* e;
+	canyonTerrain* t = terrainQuery_testTerrain( &e );
+	vector* points = (vector*)mem_alloc( sizeof( vector ) * kQueryTestCount );
+	terrainRay* rays = (terrainRay*)mem_alloc( sizeof( terrainRay ) * kQueryTestCount );
+	float* heights = (float*)mem_alloc( sizeof( float ) * kQueryTestCount );
+	terrainHit* hits = (terrainHit*)mem_alloc( sizeof( terrainHit ) * kQueryTestCount );
+	terrainQuery_testQueries( t, points, rays, kQueryTestCount, 0x9e7 );
+
+	// Heights off the loaded blocks come from the 4-wide procedural path, within its tolerance of the scalar one
+	terrain_queryHeights( t, points, kQueryTestCount, heights );
+	int exact = 0;
+	float worst = 0.f;
+	for ( int i = 0; i < kQueryTestCount; ++i ) {
+		const float single = terrain_queryHeight( t, points[i] );
+		exact += single == heights[i];
+		worst = fmaxf( worst, fabsf( single - heights[i] ));
+	}
+	printf( "Batch heights: %d of %d identical to single queries, worst difference %g\n", exact, kQueryTestCount, worst );
+	test( worst < 0.01f && exact > kQueryTestCount / 2, "Batch heights match single queries", "Batch heights differ from single queries" );
+
+	terrain_raycastBatch( t, rays, kQueryTestCount, hits );
+	int hitCount = 0;
+	bool singleMatch = true, bruteMatch = true;
+	for ( int i = 0; i < kQueryTestCount; ++i ) {
+		terrainHit single;
+		terrain_raycast( t, &rays[i], &single );
+		const terrainHit brute = terrainQuery_raycastBrute( t, &rays[i] );
+		hitCount += hits[i].hit;
+		singleMatch = singleMatch && single.hit == hits[i].hit && ( !single.hit || single.t == hits[i].t );
+		bruteMatch = bruteMatch && brute.hit == hits[i].hit && ( !brute.hit || fabsf( brute.t - hits[i].t ) < 0.0001f );
+	}
+	printf( "Batch raycasts: %d of %d hit\n", hitCount, kQueryTestCount );
+	test( hitCount > 0 && singleMatch, "Batch raycasts match single raycasts", "Batch raycasts differ from single raycasts" );
+	test( bruteMatch, "Raycasts find the nearest hit on any loaded block", "Raycasts miss hits on loaded blocks" );
+
+	mem_free( points );
+	mem_free( rays );
+	mem_free( heights );
+	mem_free( hits );
+	testTerrain_delete( t );
+}
+
+void bench_terrainQuery() {
+	engine* e;
+	canyonTerrain* t = terrainQuery_testTerrain( &e );
+	vector* points = (vector*)mem_alloc( sizeof( vector ) * kQueryBenchCount );
+	terrainRay* rays = (terrainRay*)mem_alloc( sizeof( terrainRay ) * kQueryBenchCount );
+	float* heights = (float*)mem_alloc( sizeof( float ) * kQueryBenchCount );
+	terrainHit* hits = (terrainHit*)mem_alloc( sizeof( terrainHit ) * kQueryBenchCount );
+	terrainQuery_testQueries( t, points, rays, kQueryBenchCount, 0xbe4c );
+	const long long queries = (long long)kQueryBenchCount * kQueryBenchPasses;
+
+	double start = bench_seconds();
+	for ( int pass = 0; pass < kQueryBenchPasses; ++pass )
+		for ( int i = 0; i < kQueryBenchCount; ++i )
+			heights[i] = terrain_queryHeight( t, points[i] );
+	bench_report( "terrain height queries (single)", queries, bench_seconds() - start );
+	start = bench_seconds();
+	for ( int pass = 0; pass < kQueryBenchPasses; ++pass )
+		terrain_queryHeights( t, points, kQueryBenchCount, heights );
+	bench_report( "terrain height queries (batch)", queries, bench_seconds() - start );
+
+	start = bench_seconds();
+	for ( int pass = 0; pass < kQueryBenchPasses; ++pass )
+		for ( int i = 0; i < kQueryBenchCount; ++i )
+			terrain_raycast( t, &rays[i], &hits[i] );
+	bench_report( "terrain raycasts (single)", queries, bench_seconds() - start );
+	start = bench_seconds();
+	for ( int pass = 0; pass < kQueryBenchPasses; ++pass )
+		terrain_raycastBatch( t, rays, kQueryBenchCount, hits );
+	bench_report( "terrain raycasts (batch)", queries, bench_seconds() - start );
+
+	mem_free( points );
+	mem_free( rays );
+	mem_free( heights );
+	mem_free( hits );
+	testTerrain_delete( t );
+}
+#endif // UNIT_TEST
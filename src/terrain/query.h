@@ -0,0 +1,34 @@
+// query.h
+#pragma once
+#include "maths/vector.h"
+
+/* Terrain questions from gameplay: the surface height under a point, and where a ray first meets the surface.
+   Answers come from the loaded blocks' collision fields, so they match what's drawn and collided with; heights
+   outside the loaded blocks fall back to the procedural surface, and rays only hit loaded blocks. The batch
+   versions bucket the loaded blocks into a coarse world-space grid once, sort the queries by grid cell so runs of
+   them search the same few blocks, and sample the procedural fallbacks 4-wide under one canyon snapshot */
+
+typedef struct terrainRay_s {
+	vector origin;
+	vector dir;		// Needn't be normalised; hits are measured in units of it
+	float length;	// How far to look, in units of DIR
+} terrainRay;
+
+typedef struct terrainHit_s {
+	bool hit;
+	float t;		// Along the ray, in units of its DIR
+} terrainHit;
+
+// Surface height under world-space X and Z of POINT
+float terrain_queryHeight( canyonTerrain* t, vector point );
+// Heights under N POINTS into OUT
+void terrain_queryHeights( canyonTerrain* t, const vector* points, int n, float* out );
+
+bool terrain_raycast( canyonTerrain* t, const terrainRay* ray, terrainHit* hit );
+// N RAYS into HITS
+void terrain_raycastBatch( canyonTerrain* t, const terrainRay* rays, int n, terrainHit* hits );
+
+#if UNIT_TEST
+void test_terrainQuery();
+void bench_terrainQuery();
+#endif // UNIT_TEST
@@ -0,0 +1,379 @@
+// vertex.c
+#include "src/common.h"
+#include "src/terrain/vertex.h"
+//---------------------
+#include "bench.h"
+#include "canyon.h"
+#include "canyon_terrain.h"
+#include "future.h"
+#include "noise.h"
+#include "terrain_render.h"
+#include "test.h"
+#include "vtime.h"
+#include "maths/maths.h"
+#include "maths/simd.h"
+#include "mem/allocator.h"
+#include "mem/scratch.h"
+#include "render/graphicsbuffer.h"
+#include "render/render.h"
+#include "terrain/buildCacheTask.h"
+#include "terrain/cache.h"
+#include "terrain/heightGrid.h"
+
+static_assert( sizeof( terrainVertex ) == 20, "terrainVertex should pack to 20 bytes" );
+static_assert( offsetof( terrainVertex, texture_v ) == sizeof( uint16_t[3] ), "The GPU reads texture_v as position.w" );
+
+#define kQuantMax 65535.f
+#define kSnormMax 32767.f
+
+// Four at once, branchless: every lane computes each case and selects its own
+static vuint4 half_fromFloat4( vfloat4 f ) {
+	const vuint4 x = (vuint4)f;
+	const vuint4 sign = ( x >> 16 ) & 0x8000;
+	const vuint4 a = x & 0x7fffffff;
+	// Overflow and infinity saturate; NaN stays quiet NaN
+	const vuint4 overflow = 0x7c00 | ( (vuint4)( a > 0x7f800000u ) & 0x200 );
+	// Subnormal halves: adding 0.5 lines the mantissa up with a half's subnormal steps, and the FPU rounds
+	// to nearest even on the way
+	const vuint4 subnormal = (vuint4)( (vfloat4)a + 0.5f ) - 0x3f000000u;
+	// Rebias the exponent from 127 to 15 and round to nearest even; a carry out of the mantissa correctly
+	// bumps the exponent
+	const vuint4 normal = ( a - 0x38000000u + 0xfff + (( a >> 13 ) & 1 )) >> 13;
+	const vuint4 h = vu4_select( a >= 0x47800000u, overflow, vu4_select( a < 0x38800000u, subnormal, normal ));
+	return sign | h;
+}
+
+uint16_t half_fromFloat( float f ) {
+	return (uint16_t)half_fromFloat4( vf4( f ))[0];
+}
+
+float half_toFloat( uint16_t h ) {
+	const uint32_t sign = ( h & 0x8000 ) << 16;
+	const uint32_t e = ( h >> 10 ) & 0x1f;
+	const uint32_t m = h & 0x3ff;
+	if ( e == 0 ) {
+		const float f = (float)m * ( 1.f / 16777216.f );
+		return sign ? -f : f;
+	}
+	const uint32_t x = sign | ( e == 31 ? 0x7f800000 | ( m << 13 ) : (( e + 112 ) << 23 ) | ( m << 13 ));
+	float f;
+	memcpy( &f, &x, sizeof( f ));
+	return f;
+}
+
+static float signNotZero( float f ) { return f < 0.f ? -1.f : 1.f; }
+
+static vfloat4 signNotZero4( vfloat4 f ) { return vf4_select( f < 0.f, vf4( -1.f ), vf4( 1.f )); }
+
+// Rounding half away from zero, as roundf
+static vuint4 snorm16_4( vfloat4 f ) {
+	const vfloat4 s = vf4_clamp( f, vf4( -1.f ), vf4( 1.f )) * kSnormMax;
+	return (vuint4)vf4_toInt( s + vf4_select( s < 0.f, vf4( -0.5f ), vf4( 0.5f ))) & 0xffff;
+}
+
+static float fromSnorm16( uint32_t bits ) { return fmaxf( (float)(int16_t)(uint16_t)bits / kSnormMax, -1.f ); }
+
+static vuint4 octNormal_encode4( vfloat4 x, vfloat4 y, vfloat4 z ) {
+	const vfloat4 l1 = vf4_abs( x ) + vf4_abs( y ) + vf4_abs( z );
+	// A zero normal has zero x and y already
+	const vfloat4 invL1 = 1.f / vf4_select( l1 > 0.f, l1, vf4( 1.f ));
+	x *= invL1;
+	y *= invL1;
+	// Fold the lower hemisphere out over the diagonals
+	const vint4 lower = z < 0.f;
+	const vfloat4 fx = ( 1.f - vf4_abs( y )) * signNotZero4( x );
+	const vfloat4 fy = ( 1.f - vf4_abs( x )) * signNotZero4( y );
+	return snorm16_4( vf4_select( lower, fx, x )) | ( snorm16_4( vf4_select( lower, fy, y )) << 16 );
+}
+
+uint32_t octNormal_encode( vector n ) {
+	return octNormal_encode4( vf4( n.coord.x ), vf4( n.coord.y ), vf4( n.coord.z ))[0];
+}
+
+vector octNormal_decode( uint32_t packed ) {
+	float x = fromSnorm16( packed & 0xffff );
+	float y = fromSnorm16( packed >> 16 );
+	const float z = 1.f - fabsf( x ) - fabsf( y );
+	if ( z < 0.f ) {
+		const float fx = ( 1.f - fabsf( y )) * signNotZero( x );
+		const float fy = ( 1.f - fabsf( x )) * signNotZero( y );
+		x = fx;
+		y = fy;
+	}
+	return normalized( Vector( x, y, z, 0.f ));
+}
+
+void terrainVertex_frameFor( terrainVertexFrame* frame, const vertex* verts, int count ) {
+	vAssert( count > 0 );
+	vfloat4 lo = vf4_load( verts[0].position.val ), hi = lo;
+	vfloat4 texLo = { verts[0].uv.x, verts[0].uv.y, verts[0].normal.coord.w, 0.f };
+	for ( int i = 1; i < count; ++i ) {
+		const vfloat4 p = vf4_load( verts[i].position.val );
+		const vfloat4 tex = { verts[i].uv.x, verts[i].uv.y, verts[i].normal.coord.w, 0.f };
+		lo = vf4_min( lo, p );
+		hi = vf4_max( hi, p );
+		texLo = vf4_min( texLo, tex );
+	}
+	const vfloat4 scale = ( hi - lo ) / kQuantMax;
+	frame->origin = Vector( lo[0], lo[1], lo[2], 1.f );
+	frame->scale = Vector( scale[0], scale[1], scale[2], 0.f );
+	frame->uv_origin = Vec2( floorf( texLo[0] ), floorf( texLo[1] ));
+	frame->texture_v_origin = floorf( texLo[2] );
+}
+
+// Positions from the frame's origin, in steps of INVSCALE (the reciprocal of the step, or 0 for an axis with
+// no extent)
+static vuint4 quantise4( vfloat4 f, float origin, float invScale ) {
+	const vfloat4 q = vf4_clamp(( f - origin ) * invScale, vf4( 0.f ), vf4( kQuantMax ));
+	return (vuint4)vf4_toInt( q + 0.5f );
+}
+
+static float reciprocalOrZero( float f ) { return f > 0.f ? 1.f / f : 0.f; }
+
+// Four vertices at a time, transposed into lanes; a short tail repeats the last vertex and stores only its own
+#define kPackLanes 4
+#define PackLanes( field ) { in[lane[0]].field, in[lane[1]].field, in[lane[2]].field, in[lane[3]].field }
+
+void terrainVertex_pack( const terrainVertexFrame* frame, const vertex* in, terrainVertex* out, int count ) {
+	const vector o = frame->origin;
+	const float invScale[3] = { reciprocalOrZero( frame->scale.coord.x ), reciprocalOrZero( frame->scale.coord.y ), reciprocalOrZero( frame->scale.coord.z ) };
+	for ( int i = 0; i < count; i += kPackLanes ) {
+		int lane[kPackLanes];
+		for ( int j = 0; j < kPackLanes; ++j )
+			lane[j] = min( i + j, count - 1 );
+		const vfloat4 px = PackLanes( position.coord.x );
+		const vfloat4 py = PackLanes( position.coord.y );
+		const vfloat4 pz = PackLanes( position.coord.z );
+		const vfloat4 nx = PackLanes( normal.coord.x );
+		const vfloat4 ny = PackLanes( normal.coord.y );
+		const vfloat4 nz = PackLanes( normal.coord.z );
+		const vfloat4 tv = PackLanes( normal.coord.w );
+		const vfloat4 uvx = PackLanes( uv.x );
+		const vfloat4 uvy = PackLanes( uv.y );
+
+		const vuint4 qx = quantise4( px, o.coord.x, invScale[0] );
+		const vuint4 qy = quantise4( py, o.coord.y, invScale[1] );
+		const vuint4 qz = quantise4( pz, o.coord.z, invScale[2] );
+		const vuint4 normal = octNormal_encode4( nx, ny, nz );
+		const vuint4 texture_v = half_fromFloat4( tv - frame->texture_v_origin );
+		const vuint4 u = half_fromFloat4( uvx - frame->uv_origin.x );
+		const vuint4 v = half_fromFloat4( uvy - frame->uv_origin.y );
+
+		const int lanes = min( kPackLanes, count - i );
+		for ( int j = 0; j < lanes; ++j ) {
+			terrainVertex* p = &out[i + j];
+			p->position[0] = (uint16_t)qx[j];
+			p->position[1] = (uint16_t)qy[j];
+			p->position[2] = (uint16_t)qz[j];
+			p->texture_v = (uint16_t)texture_v[j];
+			p->normal = normal[j];
+			p->uv[0] = (uint16_t)u[j];
+			p->uv[1] = (uint16_t)v[j];
+			p->color = in[i + j].color;
+		}
+	}
+}
+
+#undef PackLanes
+
+void terrainVertex_unpack( const terrainVertexFrame* frame, const terrainVertex* in, vertex* out, int count ) {
+	const vector o = frame->origin, s = frame->scale;
+	for ( int i = 0; i < count; ++i ) {
+		out[i].position = Vector( o.coord.x + (float)in[i].position[0] * s.coord.x,
+								o.coord.y + (float)in[i].position[1] * s.coord.y,
+								o.coord.z + (float)in[i].position[2] * s.coord.z, 1.f );
+		out[i].normal = octNormal_decode( in[i].normal );
+		out[i].normal.coord.w = half_toFloat( in[i].texture_v ) + frame->texture_v_origin;
+		out[i].uv = Vec2( half_toFloat( in[i].uv[0] ) + frame->uv_origin.x, half_toFloat( in[i].uv[1] ) + frame->uv_origin.y );
+		out[i].color = in[i].color;
+	}
+}
+
+#if UNIT_TEST
+// Angle between unit vectors; atan2 keeps its precision for tiny angles, where acos of the dot doesn't
+static float angleDegrees( vector a, vector b ) {
+	const vector c = vector_cross( a, b );
+	return atan2f( vector_length( &c ), Dot( &a, &b )) * 180.f / PI;
+}
+
+static const float kTestTextureScale = 0.0325f;	// As terrain_render's texture_scale
+
+// Generic vertices for a cacheBlock of real terrain, laid out as terrain_render would fill them
+static void testVerticesFromCache( const cacheBlock* b, vertex* verts ) {
+	for ( int v = 0; v < CacheBlockSize; ++v ) {
+		for ( int u = 0; u < CacheBlockSize; ++u ) {
+			const vector p = cacheBlock_position( b, u, v );
+			const vector du = vector_sub( cacheBlock_position( b, min( u + 1, CacheBlockSize - 1 ), v ), cacheBlock_position( b, max( u - 1, 0 ), v ));
+			const vector dv = vector_sub( cacheBlock_position( b, u, min( v + 1, CacheBlockSize - 1 )), cacheBlock_position( b, u, max( v - 1, 0 )));
+			vertex* out = &verts[u + v * CacheBlockSize];
+			out->position = Vector( p.coord.x, p.coord.y, p.coord.z, 1.f );
+			out->normal = normalized( vector_cross( dv, du ));
+			out->normal.coord.w = fmodf(( b->vMin + v ) * kTestTextureScale, 10.f );
+			out->uv = Vec2( p.coord.x * kTestTextureScale, p.coord.y * kTestTextureScale );
+			out->color = intFromVector( Vector( frand( 0.f, 1.f ), 0.f, 0.f, 1.f ));
+		}
+	}
+}
+
+// Worst-case errors of a round trip, over COUNT vertices
+struct vertexErrors {
+	float position;		// In quantisation steps
+	float normalDegrees;
+	float uv;			// Relative to the uv's distance from its block origin
+	bool colorExact;
+};
+
+static vertexErrors roundTripErrors( const terrainVertexFrame* frame, const vertex* in, const vertex* out, int count ) {
+	vertexErrors e = { 0.f, 0.f, 0.f, true };
+	for ( int i = 0; i < count; ++i ) {
+		for ( int axis = 0; axis < 3; ++axis ) {
+			const float scale = frame->scale.val[axis];
+			if ( scale <= 0.f )
+				continue;
+			// Allow for the float rounding of the decoded world position itself
+			const float ulp = fabsf( in[i].position.val[axis] ) * 1.2e-7f;
+			e.position = fmaxf( e.position, ( fabsf( out[i].position.val[axis] - in[i].position.val[axis] ) - ulp ) / scale );
+		}
+		e.normalDegrees = fmaxf( e.normalDegrees, angleDegrees( in[i].normal, out[i].normal ));
+		const float uvs[3][2] = {{ in[i].uv.x - frame->uv_origin.x, out[i].uv.x - in[i].uv.x },
+									{ in[i].uv.y - frame->uv_origin.y, out[i].uv.y - in[i].uv.y },
+									{ in[i].normal.coord.w - frame->texture_v_origin, out[i].normal.coord.w - in[i].normal.coord.w }};
+		for ( int j = 0; j < 3; ++j )
+			e.uv = fmaxf( e.uv, fabsf( uvs[j][1] ) / fmaxf( fabsf( uvs[j][0] ), 1.f / 1024.f ));
+		e.colorExact = e.colorExact && out[i].color == in[i].color;
+	}
+	return e;
+}
+
+static void test_halfFloat() {
+	bool exact = true;
+	const float representable[] = { 0.f, 1.f, -2.f, 0.5f, 1024.f, 65504.f, 6.1035156e-5f, 5.9604645e-8f, 0.333251953125f };
+	for ( size_t i = 0; i < sizeof( representable ) / sizeof( representable[0] ); ++i )
+		exact = exact && half_toFloat( half_fromFloat( representable[i] )) == representable[i];
+	test( exact, "Representable halfs round-trip exactly", "Representable halfs don't round-trip exactly" );
+	test( half_fromFloat( 1.f + 1.f / 2048.f ) == 0x3c00 && half_fromFloat( 1.f + 3.f / 2048.f ) == 0x3c02,
+			"Half rounds ties to even", "Half doesn't round ties to even" );
+	test( half_fromFloat( 1e6f ) == 0x7c00 && half_fromFloat( -1e6f ) == 0xfc00,
+			"Half saturates to infinity", "Half doesn't saturate to infinity" );
+	test( half_fromFloat( NAN ) == 0x7e00, "Half keeps NaN", "Half loses NaN" );
+
+	// Every finite half, subnormals included, and the float halfway between each and the next
+	bool allExact = true, allTiesEven = true;
+	for ( uint32_t h = 0; h < 0x7c00; ++h ) {
+		const float f = half_toFloat( (uint16_t)h );
+		allExact = allExact && half_fromFloat( f ) == h && half_fromFloat( -f ) == ( h | 0x8000 );
+		if ( h + 1 < 0x7c00 ) {
+			const float halfway = ( f + half_toFloat( (uint16_t)( h + 1 ))) * 0.5f;
+			allTiesEven = allTiesEven && half_fromFloat( halfway ) == (( h & 1 ) ? h + 1 : h );
+		}
+	}
+	test( allExact && allTiesEven, "Every finite half round-trips, and ties round to even",
+			"Some halfs don't round-trip or round to even" );
+}
+
+void test_terrainVertex() {
+	test_halfFloat();
+
+	float worstNormal = 0.f;
+	for ( int i = 0; i < 20000; ++i ) {
+		const vector n = normalized( Vector( frand( -1.f, 1.f ), frand( -1.f, 1.f ), frand( -1.f, 1.f ), 0.f ));
+		const vector m = octNormal_decode( octNormal_encode( n ));
+		worstNormal = fmaxf( worstNormal, angleDegrees( n, m ));
+	}
+	test( worstNormal < 0.01f, "Octahedral normals round-trip within 0.01 degrees", "Octahedral normals lose too much precision" );
+
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	const int count = CacheBlockSize * CacheBlockSize;
+	vertex* verts = (vertex*)mem_alloc( sizeof( vertex ) * count );
+	vertex* unpacked = (vertex*)mem_alloc( sizeof( vertex ) * count );
+	terrainVertex* packed = (terrainVertex*)mem_alloc( sizeof( terrainVertex ) * count );
+	vertexErrors worst = { 0.f, 0.f, 0.f, true };
+	for ( int block = 0; block < 8; ++block ) {
+		cacheBlock* b = terrainCacheBlock( c, t, ( block - 4 ) * CacheBlockSize, ( block * 3 - 4 ) * CacheBlockSize, 0 );
+		testVerticesFromCache( b, verts );
+		terrainVertexFrame frame;
+		terrainVertex_frameFor( &frame, verts, count );
+		terrainVertex_pack( &frame, verts, packed, count );
+		terrainVertex_unpack( &frame, packed, unpacked, count );
+		const vertexErrors e = roundTripErrors( &frame, verts, unpacked, count );
+		worst.position = fmaxf( worst.position, e.position );
+		worst.normalDegrees = fmaxf( worst.normalDegrees, e.normalDegrees );
+		worst.uv = fmaxf( worst.uv, e.uv );
+		worst.colorExact = worst.colorExact && e.colorExact;
+		mem_free( b );
+	}
+	printf( "Packed terrain vertex worst error: position %.3f steps, normal %.4f degrees, uv %.5f relative\n",
+			worst.position, worst.normalDegrees, worst.uv );
+	test( worst.position <= 0.51f, "Packed positions within half a quantisation step", "Packed positions off by more than half a step" );
+	test( worst.normalDegrees < 0.01f, "Packed normals within 0.01 degrees", "Packed normals lose too much precision" );
+	// A half has an 11-bit significand, so rounding is within 2^-11 of the value
+	test( worst.uv <= 1.f / 2048.f, "Packed uvs within half precision", "Packed uvs lose more than half precision" );
+	test( worst.colorExact, "Packed colors are exact", "Packed colors differ" );
+
+	// A block built headless, just beyond the terrain's bounds so that handing it over deletes it; its VBO is
+	// uploaded from the vertices terrainBlock_build packed
+	if ( !scratch_hasArena() )
+		scratch_threadInit( kScratchArenaSize );
+	engine* e = engine_create();
+	const absolute u = { 0 };
+	const absolute v = { t->bounds[1][1] + 1 };
+	canyonTerrainBlock* built = newBlock( t, u, v, e );
+	canyonTerrainBlock_setLayout( built, t, u, v, 0 );
+	terrainBlock_generateNow( built );
+	// The generic vertices are gone by now, so check the packed positions against the height grid's
+	const terrainRenderable* r = built->renderable;
+	const int builtCount = canyonTerrainBlock_renderVertCount( built );
+	vertex* builtUnpacked = (vertex*)mem_alloc( sizeof( vertex ) * builtCount );
+	terrainVertex_unpack( &r->packed_frame_alt, r->packed_vertices, builtUnpacked, builtCount );
+	vertex* builtPositions = (vertex*)mem_alloc( sizeof( vertex ) * builtCount );
+	memcpy( builtPositions, builtUnpacked, sizeof( vertex ) * builtCount );
+	for ( int v = 0; v < built->v_samples; ++v )
+		for ( int u = 0; u < built->u_samples; ++u )
+			builtPositions[canyonTerrainBlock_renderIndexFromUV( built, u, v )].position = terrainHeightGrid_position( built->heights, u, v );
+	const vertexErrors b = roundTripErrors( &r->packed_frame_alt, builtPositions, builtUnpacked, builtCount );
+	test( b.position <= 0.51f, "Built blocks carry their vertices packed", "Built blocks' packed vertices don't match their own" );
+	mem_free( builtUnpacked );
+	mem_free( builtPositions );
+	render_bufferDiscardRequests();
+	future_complete_( built->ready );
+	futures_tick( 0.f );
+
+	mem_free( verts );
+	mem_free( unpacked );
+	mem_free( packed );
+	testTerrain_delete( t );
+}
+
+void bench_terrainVertex() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	canyon* c = t->_canyon;
+	const int count = CacheBlockSize * CacheBlockSize;
+	vertex* verts = (vertex*)mem_alloc( sizeof( vertex ) * count );
+	terrainVertex* packed = (terrainVertex*)mem_alloc( sizeof( terrainVertex ) * count );
+	cacheBlock* b = terrainCacheBlock( c, t, 0, 0, 0 );
+	testVerticesFromCache( b, verts );
+	mem_free( b );
+
+	const int passes = 2000;
+	const double start = bench_seconds();
+	for ( int i = 0; i < passes; ++i ) {
+		terrainVertexFrame frame;
+		terrainVertex_frameFor( &frame, verts, count );
+		terrainVertex_pack( &frame, verts, packed, count );
+	}
+	const double seconds = bench_seconds() - start;
+	bench_report( "terrain vertices packed", (long long)passes * count, seconds );
+
+	// The largest render block; the vertex buffers are sized for it
+	const int blockVerts = ( t->uSamplesPerBlock + 1 ) * ( t->vSamplesPerBlock + 1 );
+	printf( "Terrain block vertices (%d): %d bytes generic, %d bytes packed (%.0f%% smaller); packing %.1fus per block\n",
+			blockVerts, (int)sizeof( vertex ) * blockVerts, (int)sizeof( terrainVertex ) * blockVerts,
+			100.0 * ( 1.0 - (double)sizeof( terrainVertex ) / sizeof( vertex )), seconds * 1e6 / passes * blockVerts / count );
+	mem_free( verts );
+	mem_free( packed );
+	testTerrain_delete( t );
+}
+#endif // UNIT_TEST
@@ -0,0 +1,47 @@
+// vertex.h
+#pragma once
+#include "maths/vector.h"
+
+/* Compact vertex format for terrain blocks: 20 bytes against the 44 of the generic vertex. Positions are
+   16-bit, quantised across the block's bounds; the normal is octahedral-mapped into two 16-bit snorms;
+   uvs and the canyon-space texture coordinate (carried in normal.w by the generic vertex) are half floats,
+   relative to an integral uv origin per block so they stay small (the textures tile, so the offset is
+   invisible). The frame holds what's needed to decode a block's vertices.
+   terrainBlock_build packs each block's vertices from a scratch array of generic ones, and keeps only the packed
+   ones, which are what its VBO holds; the terrain shaders take the frame as uniforms and decode on the GPU. The
+   morph targets stay as floats */
+
+struct terrainVertex_s {
+	uint16_t position[3];
+	uint16_t texture_v;
+	uint32_t normal;
+	uint16_t uv[2];
+	uint32_t color;
+};
+
+struct terrainVertexFrame_s {
+	vector origin;		// Position of quantised (0,0,0)
+	vector scale;		// World units per quantisation step, per axis
+	vec2 uv_origin;
+	float texture_v_origin;
+};
+
+// IEEE 754 half precision, rounding to nearest even
+uint16_t half_fromFloat( float f );
+float half_toFloat( uint16_t h );
+
+// Octahedral unit normal, as two 16-bit snorms (x in the low half)
+uint32_t octNormal_encode( vector n );
+vector octNormal_decode( uint32_t packed );
+
+// Fit a frame around COUNT generic vertices
+void terrainVertex_frameFor( terrainVertexFrame* frame, const vertex* verts, int count );
+
+// Convert COUNT generic vertices to the packed format, and back
+void terrainVertex_pack( const terrainVertexFrame* frame, const vertex* in, terrainVertex* out, int count );
+void terrainVertex_unpack( const terrainVertexFrame* frame, const terrainVertex* in, vertex* out, int count );
+
+#if UNIT_TEST
+void test_terrainVertex();
+void bench_terrainVertex();
+#endif // UNIT_TEST
@@ -2,9 +2,19 @@
 #include "common.h"
 #include "terrain_collision.h"
 //-----------------------
+#include "bench.h"
+#include "canyon.h"
 #include "canyon_terrain.h"
 #include "collision.h"
+#include "future.h"
+#include "noise.h"
 #include "terrain_render.h"
+#include "test.h"
+#include "vtime.h"
+#include "mem/scratch.h"
+#include "render/graphicsbuffer.h"
+#include "terrain/buildCacheTask.h"
+#include "terrain/heightGrid.h"
 
 // total verts, including those not rendered but that are generated for correct normal generation at block boundaries
 
@@ -18,18 +28,8 @@ void terrainBlock_calculateCollision( canyonTerrainBlock* b ) {
 	if ( b->collision)
 		terrainBlock_removeCollision( b );
 
-	heightField* h = heightField_create( b->u_max - b->u_min, 
-											b->v_max - b->v_min, 
-											b->u_samples, 
-											b->v_samples );
-	terrainRenderable* r = b->renderable;
-	for ( int i = 0; i < b->u_samples; i++ ) {
-		for ( int j = 0; j < b->v_samples; j++ ) {
-			int index = canyonTerrainBlock_renderIndexFromUV( b, i, j );
-			h->verts[i + j * b->u_samples] = r->vertex_buffer[index].position;
-		}
-	}
-	heightField_calculateAABB( h );
+	// Collision shares the block's heights rather than copying them
+	heightField* h = heightField_create( b->u_max - b->u_min, b->v_max - b->v_min, b->heights );
 	shape* s = shape_heightField_create( h );
 	b->collision = body_create( s, transform_create());
 	b->collision->layers |= kCollisionLayerTerrain;
@@ -39,17 +39,152 @@ void terrainBlock_calculateCollision( canyonTerrainBlock* b ) {
 }
 
 void terrainBlock_calculateAABB( terrainRenderable* r ) {
-	r->bb.min = r->vertex_buffer[0].position;
-	r->bb.max = r->vertex_buffer[0].position;
-	int vertex_count = canyonTerrainBlock_renderVertCount( r->block );
-	for ( int i = 1; i < vertex_count; ++i ) {
-		vector vert = r->vertex_buffer[i].position;
-		r->bb.min.coord.x = fminf( r->bb.min.coord.x, vert.coord.x );
-		r->bb.min.coord.y = fminf( r->bb.min.coord.y, vert.coord.y );
-		r->bb.min.coord.z = fminf( r->bb.min.coord.z, vert.coord.z );
-
-		r->bb.max.coord.x = fmaxf( r->bb.max.coord.x, vert.coord.x );
-		r->bb.max.coord.y = fmaxf( r->bb.max.coord.y, vert.coord.y );
-		r->bb.max.coord.z = fmaxf( r->bb.max.coord.z, vert.coord.z );
+	r->bb = r->block->heights->bounds;
+}
+
+#if UNIT_TEST
+#define kCollisionTestQueries 4096
+#define kCollisionBenchQueries 65536
+#define kCollisionBenchBruteQueries 512
+#define kCollisionBenchBlocks 4
+
+typedef struct collisionQuery_s {
+	vector point;	// Also the sphere centre, and the ray origin
+	vector dir;
+	float radius;
+} collisionQuery;
+
+// A LOD 0 block built headless, along the canyon; beyond the terrain's bounds, so handing it over deletes it
+static canyonTerrainBlock* collisionTestBlock( canyonTerrain* t, engine* e, int index ) {
+	const absolute u = { index % 3 - 1 };
+	const absolute v = { t->bounds[1][1] + 1 + index };
+	canyonTerrainBlock* b = newBlock( t, u, v, e );
+	canyonTerrainBlock_setLayout( b, t, u, v, 0 );
+	terrainBlock_generateNow( b );
+	return b;
+}
+
+static void collisionTestRelease( canyonTerrainBlock* b ) {
+	render_bufferDiscardRequests();
+	future_complete_( b->ready );
+	futures_tick( 0.f );
+}
+
+/* Points and spheres in a slab around the surface, over the field and a little beyond it; rays mostly from above
+   heading down at a slant, some climbing, some starting off the field */
+static void collisionTest_queries( heightField* h, collisionQuery* queries, int n, long int seed ) {
+	randSeq r;
+	deterministic_seedRandSeq( seed, &r );
+	const aabb2d& bb = h->aabb;
+	const float xMargin = ( bb.x_max - bb.x_min ) * 0.1f, zMargin = ( bb.z_max - bb.z_min ) * 0.1f;
+	const float yMin = h->grid->bounds.min.coord.y, yMax = h->grid->bounds.max.coord.y;
+	for ( int i = 0; i < n; ++i ) {
+		collisionQuery* q = &queries[i];
+		q->point = Vector( deterministic_frand( &r, bb.x_min - xMargin, bb.x_max + xMargin ),
+							deterministic_frand( &r, yMin - 10.f, yMax + 10.f ),
+							deterministic_frand( &r, bb.z_min - zMargin, bb.z_max + zMargin ), 1.f );
+		q->dir = Vector( deterministic_frand( &r, -1.f, 1.f ), deterministic_frand( &r, -1.f, 0.25f ), deterministic_frand( &r, -1.f, 1.f ), 0.f );
+		q->radius = deterministic_frand( &r, 0.5f, 8.f );
+	}
+}
+
+#define kCollisionRayLength 200.f
+
+void test_terrainCollision() {
+	printf( "--- Beginning Unit Test: Terrain Collision Queries ---\n" );
+	noise_staticInit();
+	if ( !scratch_hasArena() )
+		scratch_threadInit( kScratchArenaSize );
+	canyonTerrain* t = testTerrain_create();
+	engine* e = engine_create();
+	collisionQuery* queries = (collisionQuery*)mem_alloc( sizeof( collisionQuery ) * kCollisionTestQueries );
+
+	int pointMismatches = 0, sphereMismatches = 0, rayMismatches = 0, pointHits = 0, rayHits = 0;
+	for ( int block = 0; block < 2; ++block ) {
+		canyonTerrainBlock* b = collisionTestBlock( t, e, block );
+		heightField* h = heightField_create( b->u_max - b->u_min, b->v_max - b->v_min, b->heights );
+		collisionTest_queries( h, queries, kCollisionTestQueries, 0x5eed + block );
+		for ( int i = 0; i < kCollisionTestQueries; ++i ) {
+			const collisionQuery* q = &queries[i];
+			const bool point = heightField_collides( h, q->point );
+			pointHits += point;
+			pointMismatches += point != heightField_collidesBrute( h, q->point );
+			sphereMismatches += heightField_sphereCollides( h, q->point, q->radius ) != heightField_sphereCollidesBrute( h, q->point, q->radius );
+			float hit = 0.f, bruteHit = 0.f;
+			const bool ray = heightField_raycast( h, q->point, q->dir, kCollisionRayLength, &hit );
+			const bool bruteRay = heightField_raycastBrute( h, q->point, q->dir, kCollisionRayLength, &bruteHit );
+			rayHits += ray;
+			rayMismatches += ray != bruteRay || ( ray && fabsf( hit - bruteHit ) > 0.0001f );
+		}
+		heightField_delete( h );
+		collisionTestRelease( b );
+	}
+	printf( "Collision queries: %d point hits, %d ray hits of %d; mismatches: %d point, %d sphere, %d ray\n",
+			pointHits, rayHits, 2 * kCollisionTestQueries, pointMismatches, sphereMismatches, rayMismatches );
+	test( pointHits > 0 && pointMismatches == 0, "Point queries match brute force", "Point queries differ from brute force" );
+	test( sphereMismatches == 0, "Sphere queries match brute force", "Sphere queries differ from brute force" );
+	test( rayHits > 0 && rayMismatches == 0, "Raycasts match brute force", "Raycasts differ from brute force" );
+	mem_free( queries );
+	testTerrain_delete( t );
+}
+
+void bench_terrainCollision() {
+	noise_staticInit();
+	if ( !scratch_hasArena() )
+		scratch_threadInit( kScratchArenaSize );
+	canyonTerrain* t = testTerrain_create();
+	engine* e = engine_create();
+	collisionQuery* queries = (collisionQuery*)mem_alloc( sizeof( collisionQuery ) * kCollisionBenchQueries );
+
+	// Each query is against a single block's field, so these are queries per second per block
+	double seconds[6] = { 0.0 };
+	int hits = 0;
+	for ( int block = 0; block < kCollisionBenchBlocks; ++block ) {
+		canyonTerrainBlock* b = collisionTestBlock( t, e, block );
+		heightField* h = heightField_create( b->u_max - b->u_min, b->v_max - b->v_min, b->heights );
+		collisionTest_queries( h, queries, kCollisionBenchQueries, 0xbe7c + block );
+		float hit;
+
+		double start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchQueries; ++i )
+			hits += heightField_collides( h, queries[i].point );
+		seconds[0] += bench_seconds() - start;
+		start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchBruteQueries; ++i )
+			hits += heightField_collidesBrute( h, queries[i].point );
+		seconds[1] += bench_seconds() - start;
+
+		start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchQueries; ++i )
+			hits += heightField_sphereCollides( h, queries[i].point, queries[i].radius );
+		seconds[2] += bench_seconds() - start;
+		start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchBruteQueries; ++i )
+			hits += heightField_sphereCollidesBrute( h, queries[i].point, queries[i].radius );
+		seconds[3] += bench_seconds() - start;
+
+		start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchQueries; ++i )
+			hits += heightField_raycast( h, queries[i].point, queries[i].dir, kCollisionRayLength, &hit );
+		seconds[4] += bench_seconds() - start;
+		start = bench_seconds();
+		for ( int i = 0; i < kCollisionBenchBruteQueries; ++i )
+			hits += heightField_raycastBrute( h, queries[i].point, queries[i].dir, kCollisionRayLength, &hit );
+		seconds[5] += bench_seconds() - start;
+
+		heightField_delete( h );
+		collisionTestRelease( b );
 	}
+	const long long fast = (long long)kCollisionBenchQueries * kCollisionBenchBlocks;
+	const long long brute = (long long)kCollisionBenchBruteQueries * kCollisionBenchBlocks;
+	bench_report( "heightfield point queries (cell lookup)", fast, seconds[0] );
+	bench_report( "heightfield point queries (brute force)", brute, seconds[1] );
+	bench_report( "heightfield sphere queries (cell lookup)", fast, seconds[2] );
+	bench_report( "heightfield sphere queries (brute force)", brute, seconds[3] );
+	bench_report( "heightfield raycasts (cell walk)", fast, seconds[4] );
+	bench_report( "heightfield raycasts (brute force)", brute, seconds[5] );
+	printf( "(%d hits)\n", hits );
+	mem_free( queries );
+	testTerrain_delete( t );
 }
+#endif // UNIT_TEST
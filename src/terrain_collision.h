@@ -1,7 +1,13 @@
 // terrain_collision.h
+#pragma once
 #include "canyon_terrain.h"
 
 void terrainBlock_removeCollision( canyonTerrainBlock* b );
 void terrainBlock_calculateCollision( canyonTerrainBlock* b );
 //void terrainBlock_calculateAABB( canyonTerrainBlock* b );
 void terrainBlock_calculateAABB( terrainRenderable* b );
+
+#if UNIT_TEST
+void test_terrainCollision();
+void bench_terrainCollision();
+#endif // UNIT_TEST
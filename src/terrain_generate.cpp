@@ -8,7 +8,32 @@
 #include "base/pair.h"
 #include "terrain_render.h"
 #include "terrain_collision.h"
+#include "mem/scratch.h"
 #include "terrain/cache.h"
+#include "terrain/heightGrid.h"
+#include "terrain/morph.h"
+#include <atomic>
+#include <time.h>
+
+const char* terrainStageNames[kTerrainStageCount] = { "cache_build", "cache_sample", "lod", "normals", "vertices", "collision" };
+std::atomic<long long> terrainStageNanoseconds[kTerrainStageCount];
+
+long long terrainStage_begin() {
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void terrainStage_end( int stage, long long begin ) {
+	terrainStageNanoseconds[stage].fetch_add( terrainStage_begin() - begin, std::memory_order_relaxed );
+}
+
+double terrainStage_seconds( int stage ) { return (double)terrainStageNanoseconds[stage].load() * 0.000000001; }
+
+void terrainStages_reset() {
+	for ( int i = 0; i < kTerrainStageCount; ++i )
+		terrainStageNanoseconds[i] = 0;
+}
 
 int vertCount( canyonTerrainBlock* b ) { return ( b->u_samples + 2 ) * ( b->v_samples + 2); }
 
@@ -38,7 +63,7 @@ vector terrainPointCached( canyon* c, canyonTerrainBlock* b, cacheBlocklist* cac
 	cacheBlock* cache = terrainCachedFromList( caches, uMin, vMin );
 	if ( !cache ) printf( "Missing cache block %d %d.\n", uMin, vMin );
 	vAssert( cache && cache->lod <= b->lod_level );
-	return cache->positions[uOffset][vOffset];
+	return cacheBlock_position( cache, uOffset, vOffset );
 }
 
 // if it's in p, return the cached version
@@ -47,9 +72,14 @@ vector pointForUV( vertPositions* p, int u, int v ) {
 	return p->positions[u - p->uMin + (v - p->vMin) * p->uCount];
 }
 
-void vertPositions_delete( vertPositions* vs ) {
-	mem_free( vs->positions );
-	mem_free( vs );
+vertPositions* vertPositions_create( canyonTerrainBlock* b ) {
+	vertPositions* vs = scratchArray( vertPositions, 1 );
+	vs->uMin = -1;
+	vs->vMin = -1;
+	vs->uCount = b->u_samples + 2;
+	vs->vCount = b->v_samples + 2;
+	vs->positions = scratchArray( vector, vertCount( b ));
+	return vs;
 }
 
 // Hopefully this should just be hitting the cache we were given
@@ -133,21 +163,48 @@ void generateNormals( canyonTerrainBlock* block, int vert_count, vector* verts,
 // When given an array of vert positions, use them to build a renderable terrainBlock
 // (This will be sent from the canyon that has already calculated positions)
 void terrainBlock_build( canyonTerrainBlock* b, vertPositions* vertSources ) {
-	vector* verts = (vector*)stackArray( vector, vertCount( b ));
-	vector* normals = (vector*)stackArray( vector, vertCount( b ));
+	vector* verts = scratchArray( vector, vertCount( b ));
+	vector* normals = scratchArray( vector, vertCount( b ));
 
+	long long stage = terrainStage_begin();
 	generatePoints( b, vertSources, verts );
+	terrainStage_end( kTerrainStageCacheSample, stage );
+
+	stage = terrainStage_begin();
 	lodVectors( b, verts );
+	terrainStage_end( kTerrainStageLod, stage );
 
+	stage = terrainStage_begin();
 	generateNormals( b, vertCount( b ), verts, normals );
-	lodVectors( b, normals );
+	terrainStage_end( kTerrainStageNormals, stage );
 
-	canyonTerrainBlock_generateVertices( b, verts, normals );
+	stage = terrainStage_begin();
+	lodVectors( b, normals );
+	terrainStage_end( kTerrainStageLod, stage );
+
+	stage = terrainStage_begin();
+	// The generic vertices only live until they're packed; the block keeps the packed ones and its morph targets
+	terrainRenderable* r = b->renderable;
+	const int renderVerts = canyonTerrainBlock_renderVertCount( b );
+	vertex* vertices = scratchArray( vertex, renderVerts );
+	canyonTerrainBlock_generateVertices( b, verts, normals, vertices );
+	terrainMorph_fillTargets( b, verts, r->morph_targets );
+	terrainVertex_frameFor( &r->packed_frame_alt, vertices, renderVerts );
+	terrainVertex_pack( &r->packed_frame_alt, vertices, r->packed_vertices, renderVerts );
+	terrainStage_end( kTerrainStageVertices, stage );
+
+	stage = terrainStage_begin();
+	if ( b->heights )
+		terrainHeightGrid_release( b->heights );
+	b->heights = terrainHeightGrid_create( &verts[indexFromUV( b, 0, 0 )], b->u_samples, b->v_samples, b->u_samples + 2 );
+	terrainStage_end( kTerrainStageCollision, stage );
 }
 
 void* setBlock( const void* data, void* args ) {
 	(void)data;
 	canyonTerrainBlock* b = (canyonTerrainBlock*)args;
+	terrainLatency_stamp( b, kBlockLive );
+	terrainLatency_record( b );
 	terrain_setBlock( b->terrain, b->u, b->v, b );
 	return NULL;
 }
@@ -156,16 +213,14 @@ void canyonTerrainBlock_generate( vertPositions* vs, canyonTerrainBlock* b ) {
 	canyonTerrainBlock_createBuffers( b );
 
 	terrainBlock_build( b, vs );
+	terrainLatency_stamp( b, kBlockVertsGenerated );
+	const long long stage = terrainStage_begin();
 	terrainBlock_calculateCollision( b );
 	terrainBlock_calculateAABB( b->renderable );
+	terrainStage_end( kTerrainStageCollision, stage );
+	terrainLatency_stamp( b, kBlockCollisionBuilt );
 
-	future_onComplete( terrainBlock_initVBO( b ), setBlock, b );
-}
-
-void* canyonTerrain_workerGenerateBlock( void* args ) {
-	vertPositions* verts = (vertPositions*)_1(args);
-	canyonTerrainBlock_generate( verts, (canyonTerrainBlock*)_2(args) );
-	vertPositions_delete( verts );
-	mem_free( args );
-	return NULL;
+	future* live = terrainBlock_initVBO( b );
+	terrainLatency_stamp( b, kBlockUploadQueued );
+	future_onComplete( live, setBlock, b );
 }
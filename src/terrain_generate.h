@@ -10,14 +10,36 @@ struct vertPositions_s {
 	vector* positions; // (uCount * vCount) in size
 };
 
+// Positions for B, including the 1-vert margin, in scratch
+vertPositions* vertPositions_create( canyonTerrainBlock* b );
+
 void terrainBlock_build( canyonTerrainBlock* b, vertPositions* vertSources );
 vector terrainPointCached( canyon* c, canyonTerrainBlock* b, cacheBlocklist* caches, int uRelative, int vRelative );
 
 // Total number of real (not rendered) verts in this block
 int vertCount( canyonTerrainBlock* b );
 
-// Worker Task to generate this block
-void* canyonTerrain_workerGenerateBlock( void* args );
+// Build B's geometry and collision from VS, then hand it to the terrain once its buffers are up
+void canyonTerrainBlock_generate( vertPositions* vs, canyonTerrainBlock* b );
 
 // Turn local u,v pair into a vert-array index
 int indexFromUV( canyonTerrainBlock* b, int u, int v );
+
+/* Time spent in each stage of building blocks, summed across workers. Cheap enough to leave on; read by the
+   terrain generation benchmark */
+enum terrainStage {
+	kTerrainStageCacheBuild,	// Sampling the canyon into cache blocks
+	kTerrainStageCacheSample,	// Reading a block's positions from the cache
+	kTerrainStageLod,
+	kTerrainStageNormals,
+	kTerrainStageVertices,
+	kTerrainStageCollision,
+	kTerrainStageCount
+};
+
+extern const char* terrainStageNames[kTerrainStageCount];
+
+long long terrainStage_begin();
+void terrainStage_end( int stage, long long begin );
+double terrainStage_seconds( int stage );
+void terrainStages_reset();
@@ -2,9 +2,12 @@
 #include "common.h"
 #include "terrain_render.h"
 //-----------------------
+#include "bench.h"
 #include "canyon.h"
 #include "camera.h"
 #include "future.h"
+#include "noise.h"
+#include "test.h"
 #include "terrain_generate.h"
 #include "maths/geometry.h"
 #include "maths/vector.h"
@@ -12,6 +15,7 @@
 #include "render/shader.h"
 #include "render/graphicsbuffer.h"
 #include "render/texture.h"
+#include "terrain/morph.h"
 
 const float texture_scale = 0.0325f;
 const float texture_repeat = 10.f;
@@ -70,9 +74,12 @@ int canyonTerrainBlock_renderVertCount( canyonTerrainBlock* b ) {
 #endif // CANYON_TERRAIN_INDEXED
 }
 
-void canyonTerrain_renderInit() {
+void canyonTerrain_renderInitPools() {
 	static_renderable_pool = pool_terrainRenderable_create( PoolMaxBlocks );
 	initialiseDefaultElementBuffer();
+}
+
+void canyonTerrain_renderLoadTextures() {
 	//if ( !terrain_texture ) 		{ terrain_texture		= texture_load( "dat/img/terrain/grass.tga" ); }
 	if ( !terrain_texture ) 		{ terrain_texture		= texture_load( "dat/img/terrain/cliff_normal.tga" ); }
 	if ( !terrain_texture_cliff )	{ terrain_texture_cliff = texture_load( "dat/img/terrain/cliff_grass.tga" ); }
@@ -156,26 +163,41 @@ void canyonTerrainBlock_fillTrianglesForVertex( canyonTerrainBlock* b, vector* p
 }
 #endif
 
-vertex* canyonTerrain_allocVertexBuffer( canyonTerrain* t ) {
+int canyonTerrain_maxVertCount( canyonTerrain* t ) {
 #if CANYON_TERRAIN_INDEXED
-	int max_vert_count = ( t->uSamplesPerBlock + 1 ) * ( t->vSamplesPerBlock + 1 );
-	return (vertex*)mem_alloc( sizeof( vertex ) * max_vert_count );
+	return ( t->uSamplesPerBlock + 1 ) * ( t->vSamplesPerBlock + 1 );
 #else
-	int max_element_count = t->uSamplesPerBlock * t->vSamplesPerBlock * 6;
-	return (vertex*)mem_alloc( sizeof( vertex ) * max_element_count );
+	return t->uSamplesPerBlock * t->vSamplesPerBlock * 6;
 #endif // CANYON_TERRAIN_INDEX
 }
 
+// Each vertex buffer has its morph targets straight after it, so they're recycled together
+terrainVertex* canyonTerrain_allocVertexBuffer( canyonTerrain* t ) {
+	const int max_vert_count = canyonTerrain_maxVertCount( t );
+	return (terrainVertex*)mem_alloc(( sizeof( terrainVertex ) + sizeof( float[3] )) * max_vert_count );
+}
+
+float* canyonTerrain_morphTargetsFor( canyonTerrain* t, terrainVertex* buffer ) { return (float*)( buffer + canyonTerrain_maxVertCount( t )); }
+
 void canyonTerrain_initVertexBuffers( canyonTerrain* t ) {
 	// Init w*h*2 buffers that we can use for vertex_buffers
 	vAssert( t->vertex_buffers == 0 );
 	const int count = t->u_block_count * t->v_block_count * 2;
-	t->vertex_buffers = (vertex**)mem_alloc( count * sizeof( vertex* ));
+	t->vertex_buffers = (terrainVertex**)mem_alloc( count * sizeof( terrainVertex* ));
 	for ( int i = 0; i < count; i++ ) {
 		t->vertex_buffers[i] = canyonTerrain_allocVertexBuffer( t );
 	}
 }
-void canyonTerrain_freeVertexBuffer( canyonTerrain* t, vertex* buffer ) {
+// Every block must have given its buffer back
+void canyonTerrain_deleteVertexBuffers( canyonTerrain* t ) {
+	vAssert( t->vertex_buffer_count == 0 );
+	const int count = t->u_block_count * t->v_block_count * 2;
+	for ( int i = 0; i < count; i++ )
+		mem_free( t->vertex_buffers[i] );
+	mem_free( t->vertex_buffers );
+	t->vertex_buffers = NULL;
+}
+void canyonTerrain_freeVertexBuffer( canyonTerrain* t, terrainVertex* buffer ) {
 	// Find the buffer in the list
 	// Switch it with the last
 	int count = t->vertex_buffer_count;
@@ -184,62 +206,93 @@ void canyonTerrain_freeVertexBuffer( canyonTerrain* t, vertex* buffer ) {
 	t->vertex_buffers[count-1] = buffer;
 	--t->vertex_buffer_count;
 }
-vertex* canyonTerrain_nextVertexBuffer( canyonTerrain* t ) {
+terrainVertex* canyonTerrain_nextVertexBuffer( canyonTerrain* t ) {
 	vAssert( t->vertex_buffer_count < ( t->u_block_count * t->v_block_count * 3 ));
-	void* buffer = t->vertex_buffers[t->vertex_buffer_count++];
-	return (vertex*)buffer;
+	return t->vertex_buffers[t->vertex_buffer_count++];
 }
 
-unsigned short* canyonTerrain_allocElementBuffer( canyonTerrain* t ) {
-	int max_element_count = t->uSamplesPerBlock * t->vSamplesPerBlock * 6;
-	return (unsigned short*)mem_alloc( sizeof( unsigned short ) * max_element_count );
+// Fill ELEMENTS with the triangle grid for a block of U_SAMPLES x V_SAMPLES vertices; returns the element count
+int terrainElements_fill( unsigned short* elements, int u_samples, int v_samples ) {
+	vAssert( u_samples * v_samples <= 0x10000 );
+	int i = 0;
+	for ( int v = 0; v + 1 < v_samples; ++v ) {
+		for ( int u = 0; u + 1 < u_samples; ++u ) {
+			const int corner = u + v * u_samples;
+			elements[i++] = corner;
+			elements[i++] = corner + 1;
+			elements[i++] = corner + u_samples;
+			elements[i++] = corner + 1;
+			elements[i++] = corner + u_samples + 1;
+			elements[i++] = corner + u_samples;
+		}
+	}
+	return i;
 }
-void canyonTerrain_initElementBuffers( canyonTerrain* t ) {
-	// Init w*h*2 buffers that we can use for element_buffers
-	vAssert( t->element_buffers == 0 );
-	int count = t->u_block_count * t->v_block_count * 3;
-	t->element_buffers = (unsigned short**)mem_alloc( count * sizeof( unsigned short* ));
-	for ( int i = 0; i < count; i++ ) {
-		t->element_buffers[i] = canyonTerrain_allocElementBuffer( t );
+
+void canyonTerrain_initLodElements( canyonTerrain* t ) {
+	for ( int lod = 0; lod <= LowestLod; ++lod ) {
+		terrainElements* e = &t->lod_elements[lod];
+		vAssert( e->elements == NULL );
+		e->u_samples = canyonTerrain_lodSamples( t->uSamplesPerBlock, lod );
+		e->v_samples = canyonTerrain_lodSamples( t->vSamplesPerBlock, lod );
+		e->elements = (unsigned short*)mem_alloc( sizeof( unsigned short ) * ( e->u_samples - 1 ) * ( e->v_samples - 1 ) * 6 );
+		e->count = terrainElements_fill( e->elements, e->u_samples, e->v_samples );
+		vAssert( e->count <= kMaxTerrainBlockElements );
+		e->VBO = render_requestBuffer( GL_ELEMENT_ARRAY_BUFFER, e->elements, sizeof( unsigned short ) * e->count );
 	}
 }
-void canyonTerrain_freeElementBuffer( canyonTerrain* t, unsigned short* buffer ) {
-	// Find the buffer in the list
-	// Switch it with the last
-	int count = t->element_buffer_count;
-	int i = array_find( (void**)t->element_buffers, count, buffer );
-	t->element_buffers[i] = t->element_buffers[count-1];
-	t->element_buffers[count-1] = buffer;
-	--t->element_buffer_count;
+
+void canyonTerrain_deleteLodElements( canyonTerrain* t ) {
+	for ( int lod = 0; lod <= LowestLod; ++lod ) {
+		terrainElements* e = &t->lod_elements[lod];
+		render_freeBuffer( e->VBO );
+		mem_free( e->elements );
+		memset( e, 0, sizeof( terrainElements ));
+	}
 }
-short unsigned int* canyonTerrain_nextElementBuffer( canyonTerrain* t ) {
-	//printf( "Allocate\n" );
-	vAssert( t->element_buffer_count < ( t->u_block_count * t->v_block_count * 3 ));
-	void* buffer = t->element_buffers[t->element_buffer_count++];
-	return (short unsigned int*)buffer;
+
+const terrainElements* canyonTerrain_elementsFor( canyonTerrain* t, canyonTerrainBlock* b ) {
+	vAssert( b->lod_level >= 0 && b->lod_level <= LowestLod );
+	const terrainElements* e = &t->lod_elements[b->lod_level];
+	vAssert( e->u_samples == b->u_samples && e->v_samples == b->v_samples );
+	return e;
 }
+
 // Create GPU vertex buffer objects to hold our data and save transferring to the GPU each frame
 // If we've already allocated a buffer at some point, just re-use it
 future* terrainBlock_initVBO( canyonTerrainBlock* b ) {
 	int vert_count = canyonTerrainBlock_renderVertCount( b );
 	terrainRenderable* r = b->renderable;
-	r->vertex_VBO_alt	= render_requestBuffer( GL_ARRAY_BUFFER,			r->vertex_buffer,	sizeof( vertex )	* vert_count );
-	r->element_VBO_alt	= render_requestBuffer( GL_ELEMENT_ARRAY_BUFFER, 	r->element_buffer,	sizeof( GLushort ) 	* r->element_count );
+	r->vertex_VBO_alt	= render_requestBuffer( GL_ARRAY_BUFFER,			r->packed_vertices,	sizeof( terrainVertex )	* vert_count );
+	r->morph_VBO_alt	= render_requestBuffer( GL_ARRAY_BUFFER,			r->morph_targets,	sizeof( float[3] )	* vert_count );
+	// The element buffer is shared per LOD, and already requested
+	r->element_VBO_alt	= canyonTerrain_elementsFor( b->terrain, b )->VBO;
 	return b->ready;
 }
 
+// The block's VBO holds packed terrainVertex; the draw decodes them with FRAME
+static void terrainDraw_packed( drawCall* draw, const terrainVertexFrame* frame ) {
+	draw->packed_vertices = true;
+	draw->vertex_origin = frame->origin;
+	draw->vertex_scale = frame->scale;
+	draw->vertex_uv_origin = Vector( frame->uv_origin.x, frame->uv_origin.y, frame->texture_v_origin, 0.f );
+}
+
 bool canyonTerrainBlock_render( canyonTerrainBlock* b, scene* s ) {
 	terrainRenderable* r = b->renderable;
 	// If we have new render buffers, free the old ones and switch to the new
-	if (( r->vertex_VBO_alt && *r->vertex_VBO_alt ) && ( r->element_VBO_alt && *r->element_VBO_alt )) {
+	if (( r->vertex_VBO_alt && *r->vertex_VBO_alt ) && ( r->element_VBO_alt && *r->element_VBO_alt ) && ( r->morph_VBO_alt && *r->morph_VBO_alt )) {
 		render_freeBuffer( r->vertex_VBO );
-		render_freeBuffer( r->element_VBO );
+		render_freeBuffer( r->morph_VBO );
 
 		r->vertex_VBO = r->vertex_VBO_alt;
 		r->element_VBO = r->element_VBO_alt;
+		r->morph_VBO = r->morph_VBO_alt;
+		r->packed_frame = r->packed_frame_alt;
 		r->element_count_render = r->element_count;
 		r->vertex_VBO_alt = NULL;
 		r->element_VBO_alt = NULL;
+		r->morph_VBO_alt = NULL;
 	}
 
 	if ( frustum_cull( &r->bb, s->cam->frustum ) )
@@ -250,7 +303,7 @@ bool canyonTerrainBlock_render( canyonTerrainBlock* b, scene* s ) {
 	int second = ( zone + 1 - (zone % 2)) % b->_canyon->zone_count;
 	if ( r->vertex_VBO && *r->vertex_VBO && terrain_texture && terrain_texture_cliff ) {
 		// TODO - use a cached drawcall
-		drawCall* draw = drawCall::create( &renderPass_main, *r->terrainShader, r->element_count_render, r->element_buffer, r->vertex_buffer, b->_canyon->zones[first].texture_ground->gl_tex, modelview );
+		drawCall* draw = drawCall::create( &renderPass_main, *r->terrainShader, r->element_count_render, r->element_buffer, NULL, b->_canyon->zones[first].texture_ground->gl_tex, modelview );
 		draw->texture_b = b->_canyon->zones[first].texture_cliff->gl_tex;
 		draw->texture_c = b->_canyon->zones[second].texture_ground->gl_tex;
 		draw->texture_d = b->_canyon->zones[second].texture_cliff->gl_tex;
@@ -258,10 +311,16 @@ bool canyonTerrainBlock_render( canyonTerrainBlock* b, scene* s ) {
 		draw->texture_b_normal = terrain_texture->gl_tex;
 		draw->vertex_VBO = *r->vertex_VBO;
 		draw->element_VBO = *r->element_VBO;
+		draw->morph_VBO = *r->morph_VBO;
+		draw->morph = terrainMorph_factor( b->terrain, b, b->terrain->sample_uv[0], b->terrain->sample_uv[1] );
+		terrainDraw_packed( draw, &r->packed_frame );
 
-		drawCall* drawDepth = drawCall::create( &renderPass_depth, *Shader::depth(), r->element_count_render, r->element_buffer, r->vertex_buffer, b->_canyon->zones[first].texture_ground->gl_tex, modelview );
+		drawCall* drawDepth = drawCall::create( &renderPass_depth, *r->depthShader, r->element_count_render, r->element_buffer, NULL, b->_canyon->zones[first].texture_ground->gl_tex, modelview );
 		drawDepth->vertex_VBO = *r->vertex_VBO;
 		drawDepth->element_VBO = *r->element_VBO;
+		drawDepth->morph_VBO = draw->morph_VBO;
+		drawDepth->morph = draw->morph;
+		terrainDraw_packed( drawDepth, &r->packed_frame );
 	}
 	return true;
 }
@@ -280,8 +339,7 @@ void canyonTerrain_render( void* data, scene* s ) {
 	//printf( "Rendering %d out of %d blocks.\n", count, t->total_block_count );
 }
 
-void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts, vector* normals ) {
-	terrainRenderable* r = b->renderable;
+void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts, vector* normals, vertex* vertices ) {
 #if CANYON_TERRAIN_INDEXED
 	for ( int v_index = 0; v_index < b->v_samples; ++v_index ) {
 		for ( int u_index = 0; u_index < b->u_samples; ++u_index ) {
@@ -292,31 +350,15 @@ void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts,
 				int buffer_index = canyonTerrainBlock_renderIndexFromUV( b, u_index, v_index );
 				vAssert( buffer_index < canyonTerrainBlock_renderVertCount( b ));
 				vAssert( buffer_index >= 0 );
-				r->vertex_buffer[buffer_index].position = verts[i];
+				vertices[buffer_index].position = verts[i];
 				vector uv = calcUV( b, &verts[i], v );
-				r->vertex_buffer[buffer_index].uv = Vec2( uv.coord.x, uv.coord.y );
-				r->vertex_buffer[buffer_index].color = intFromVector(Vector( canyonZone_terrainBlend( v ), 0.f, 0.f, 1.f ));
-				r->vertex_buffer[buffer_index].normal = normals[i];
-				r->vertex_buffer[buffer_index].normal.coord.w = uv.coord.z;
+				vertices[buffer_index].uv = Vec2( uv.coord.x, uv.coord.y );
+				vertices[buffer_index].color = intFromVector(Vector( canyonZone_terrainBlend( v ), 0.f, 0.f, 1.f ));
+				vertices[buffer_index].normal = normals[i];
+				vertices[buffer_index].normal.coord.w = uv.coord.z;
 			}
 		}
 	}
-	int triangleCount = canyonTerrainBlock_triangleCount( b );
-	int i = 0;
-	for ( int v = 0; v + 1 < b->v_samples; ++v ) {
-		for ( int u = 0; u + 1 < b->u_samples; ++u ) {
-			vAssert( i * 3 + 5 < r->element_count );
-			vAssert( canyonTerrainBlock_renderIndexFromUV( b, u + 1, v + 1 ) < canyonTerrainBlock_renderVertCount( b ) );
-			r->element_buffer[ i * 3 + 0 ] = canyonTerrainBlock_renderIndexFromUV( b, u, v );
-			r->element_buffer[ i * 3 + 1 ] = canyonTerrainBlock_renderIndexFromUV( b, u + 1, v );
-			r->element_buffer[ i * 3 + 2 ] = canyonTerrainBlock_renderIndexFromUV( b, u, v + 1 );
-			r->element_buffer[ i * 3 + 3 ] = canyonTerrainBlock_renderIndexFromUV( b, u + 1, v );
-			r->element_buffer[ i * 3 + 4 ] = canyonTerrainBlock_renderIndexFromUV( b, u + 1, v + 1 );
-			r->element_buffer[ i * 3 + 5 ] = canyonTerrainBlock_renderIndexFromUV( b, u, v + 1 );
-			i+=2;
-		}
-	}
-	vAssert( i == triangleCount );
 #else
 	for ( int v = 0; v < b->v_samples; v ++ ) {
 		for ( int u = 0; u < b->u_samples; u ++  ) {
@@ -328,7 +370,7 @@ void canyonTerrainBlock_generateVertices( canyonTerrainBlock* b, vector* verts,
 			float u_pos, v_pos;
 			canyonTerrainBlock_positionsFromUV( b, u, v, &u_pos, &v_pos );
 			vert.uv = calcUV( b, &vert.position, v_pos );
-			canyonTerrainBlock_fillTrianglesForVertex( b, verts, b->vertex_buffer, u, v, &vert );
+			canyonTerrainBlock_fillTrianglesForVertex( b, verts, vertices, u, v, &vert );
 		}
 	}
 #endif // CANYON_TERRAIN_INDEXED
@@ -341,23 +383,123 @@ void canyonTerrainBlock_createBuffers( canyonTerrainBlock* b ) {
 	vAssert( r->element_count <= kMaxTerrainBlockElements );
 
 #if CANYON_TERRAIN_INDEXED
-	if ( !r->element_buffer ) r->element_buffer = canyonTerrain_nextElementBuffer( b->terrain );
+	const terrainElements* e = canyonTerrain_elementsFor( b->terrain, b );
+	vAssert( e->count == r->element_count );
+	r->element_buffer = e->elements;
 #else
 	r->element_buffer = elementBuffer;
 #endif // CANYON_TERRAIN_INDEXED
-	if ( !r->vertex_buffer ) r->vertex_buffer = canyonTerrain_nextVertexBuffer( b->terrain );
+	if ( !r->packed_vertices ) r->packed_vertices = canyonTerrain_nextVertexBuffer( b->terrain );
+	r->morph_targets = canyonTerrain_morphTargetsFor( b->terrain, r->packed_vertices );
 }
 
 terrainRenderable* terrainRenderable_create( canyonTerrainBlock* b ) {
 	terrainRenderable* r = pool_terrainRenderable_allocate( static_renderable_pool ); 
 	memset( r, 0, sizeof( terrainRenderable ));
 	r->terrainShader = Shader::byName("dat/shaders/terrain.s");
+	r->depthShader = Shader::byName("dat/shaders/terrain_depth.s");
 	r->block = b;
 	return r;
 }
 
 void terrainRenderable_delete( terrainRenderable* r ) {
-	canyonTerrain_freeElementBuffer( r->block->terrain, r->element_buffer );
-	canyonTerrain_freeVertexBuffer( r->block->terrain, (vertex*)r->vertex_buffer );
+	// A block deleted before it was ever generated has no buffer to give back
+	if ( r->packed_vertices )
+		canyonTerrain_freeVertexBuffer( r->block->terrain, r->packed_vertices );
 	pool_terrainRenderable_free( static_renderable_pool, r );
 }
+
+#if UNIT_TEST
+void test_terrainElements() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	bool sized = true, inRange = true, quads = true, allUsed = true;
+	for ( int lod = 0; lod <= LowestLod; ++lod ) {
+		const terrainElements* e = &t->lod_elements[lod];
+		const int vert_count = e->u_samples * e->v_samples;
+		sized = sized && e->count == ( e->u_samples - 1 ) * ( e->v_samples - 1 ) * 6 && e->VBO != NULL;
+		bool* used = (bool*)mem_alloc( sizeof( bool ) * vert_count );
+		memset( used, 0, sizeof( bool ) * vert_count );
+		for ( int i = 0; i < e->count; ++i ) {
+			inRange = inRange && e->elements[i] < vert_count;
+			if ( e->elements[i] < vert_count )
+				used[e->elements[i]] = true;
+		}
+		for ( int i = 0; i < vert_count; ++i )
+			allUsed = allUsed && used[i];
+		mem_free( used );
+		// Each quad is two triangles over its four corners, wound as blocks have always been
+		int i = 0;
+		for ( int v = 0; v + 1 < e->v_samples; ++v ) {
+			for ( int u = 0; u + 1 < e->u_samples; ++u ) {
+				const int a = u + v * e->u_samples, b = a + 1, d = a + e->u_samples, f = d + 1;
+				const unsigned short* q = &e->elements[i];
+				quads = quads && q[0] == a && q[1] == b && q[2] == d && q[3] == b && q[4] == f && q[5] == d;
+				i += 6;
+			}
+		}
+	}
+	test( sized, "Shared LOD element buffers sized for their grids", "Shared LOD element buffers missized" );
+	test( inRange, "Shared LOD elements within the vertex grid", "Shared LOD elements index past the vertex grid" );
+	test( quads, "Shared LOD elements triangulate every quad", "Shared LOD elements don't match the grid" );
+	test( allUsed, "Shared LOD elements use every unique vertex", "Shared LOD elements leave vertices unused" );
+	testTerrain_delete( t );
+}
+
+// Compares a block's vertex data when unrolled per triangle, when indexed with its own element buffer (as
+// terrain blocks were) and when indexed with the shared per-LOD buffer
+void bench_terrainElements() {
+	noise_staticInit();
+	canyonTerrain* t = testTerrain_create();
+	const int blocks = 2000;
+	vertex* grid = (vertex*)mem_alloc( sizeof( vertex ) * kMaxTerrainBlockWidth * kMaxTerrainBlockWidth );
+	vertex* out = (vertex*)mem_alloc( sizeof( vertex ) * kMaxTerrainBlockElements );
+	unsigned short* elements = (unsigned short*)mem_alloc( sizeof( unsigned short ) * kMaxTerrainBlockElements );
+	for ( int i = 0; i < kMaxTerrainBlockWidth * kMaxTerrainBlockWidth; ++i ) {
+		grid[i].position = Vector( (float)i, 0.f, 0.f, 1.f );
+		grid[i].normal = y_axis;
+		grid[i].uv = Vec2( 0.f, 0.f );
+		grid[i].color = 0;
+	}
+
+	for ( int lod = 0; lod <= LowestLod; ++lod ) {
+		const terrainElements* e = &t->lod_elements[lod];
+		const int unique = e->u_samples * e->v_samples;
+		char name[96];
+
+		double start = bench_seconds();
+		for ( int b = 0; b < blocks; ++b )
+			for ( int i = 0; i < e->count; ++i )
+				out[i] = grid[e->elements[i]];
+		const double unrolledSeconds = bench_seconds() - start;
+
+		start = bench_seconds();
+		for ( int b = 0; b < blocks; ++b ) {
+			memcpy( out, grid, sizeof( vertex ) * unique );
+			terrainElements_fill( elements, e->u_samples, e->v_samples );
+		}
+		const double perBlockSeconds = bench_seconds() - start;
+
+		start = bench_seconds();
+		for ( int b = 0; b < blocks; ++b )
+			memcpy( out, grid, sizeof( vertex ) * unique );
+		const double sharedSeconds = bench_seconds() - start;
+
+		snprintf( name, sizeof( name ), "LOD %d blocks (unrolled vertices)", lod );
+		bench_report( name, blocks, unrolledSeconds );
+		snprintf( name, sizeof( name ), "LOD %d blocks (per-block elements)", lod );
+		bench_report( name, blocks, perBlockSeconds );
+		snprintf( name, sizeof( name ), "LOD %d blocks (shared elements)", lod );
+		bench_report( name, blocks, sharedSeconds );
+		printf( "LOD %d block (%dx%d): %d vertices unrolled, %d unique; upload %d bytes unrolled, %d per-block elements, %d shared\n",
+				lod, e->u_samples, e->v_samples, e->count, unique,
+				(int)sizeof( vertex ) * e->count,
+				(int)sizeof( vertex ) * unique + (int)sizeof( unsigned short ) * e->count,
+				(int)sizeof( vertex ) * unique );
+	}
+	mem_free( grid );
+	mem_free( out );
+	mem_free( elements );
+	testTerrain_delete( t );
+}
+#endif // UNIT_TEST
@@ -1,15 +1,21 @@
 // terrain_render.h
+#pragma once
 #include "canyon_terrain.h"
 
 // *** Static init
-void canyonTerrain_renderInit();
+// Pools need nothing else up, so are enough to build blocks headless; textures need the file system
+void canyonTerrain_renderInitPools();
+void canyonTerrain_renderLoadTextures();
 
 // *** Buffers
 void	canyonTerrainBlock_fillTrianglesForVertex( canyonTerrainBlock* b, vector* positions, vertex* vertices, int u_index, int v_index, vertex* vert );
 void	canyonTerrain_initVertexBuffers( canyonTerrain* t );
-vertex* canyonTerrain_nextVertexBuffer( canyonTerrain* t );
-void	canyonTerrain_initElementBuffers( canyonTerrain* t );
-short unsigned int* canyonTerrain_nextElementBuffer( canyonTerrain* t );
+void	canyonTerrain_deleteVertexBuffers( canyonTerrain* t );
+terrainVertex* canyonTerrain_nextVertexBuffer( canyonTerrain* t );
+int		terrainElements_fill( unsigned short* elements, int u_samples, int v_samples );
+void	canyonTerrain_initLodElements( canyonTerrain* t );
+void	canyonTerrain_deleteLodElements( canyonTerrain* t );
+const terrainElements* canyonTerrain_elementsFor( canyonTerrain* t, canyonTerrainBlock* b );
 future* terrainBlock_initVBO( canyonTerrainBlock* b );
 
 void canyonTerrainBlock_createBuffers( canyonTerrainBlock* b );
@@ -18,3 +24,8 @@ int canyonTerrainBlock_renderVertCount( canyonTerrainBlock* b );
 // *** Terrain Renderable
 terrainRenderable*	terrainRenderable_create( canyonTerrainBlock* b );
 void				terrainRenderable_delete( terrainRenderable* r );
+
+#if UNIT_TEST
+void test_terrainElements();
+void bench_terrainElements();
+#endif // UNIT_TEST
@@ -3,18 +3,22 @@
 #include "worker.h"
 //-----------------------
 #include "mem/allocator.h"
+#include "mem/scratch.h"
 #include "system/thread.h"
 #include <unistd.h>
 
 #define kMaxWorkerTasks 2048
 int worker_task_count = 0;
 int worker_immediate_task_count = 0;
+int worker_background_task_count = 0;
 vmutex worker_task_mutex = kMutexInitialiser;
 worker_task worker_tasks[kMaxWorkerTasks];
 worker_task worker_immediate_tasks[kMaxWorkerTasks];
+worker_task worker_background_tasks[kMaxWorkerTasks];
 
 // TODO worker task adding/removing should be lock free
 void worker_addTask( worker_task t ) {
+	vAssert( !scratch_contains( t.args )); // Scratch memory doesn't outlive the task that took it
 	vmutex_lock( &worker_task_mutex ); {
 		vAssert( worker_task_count < kMaxWorkerTasks );
 		worker_tasks[worker_task_count++] = t;
@@ -43,6 +47,7 @@ worker_task worker_nextTask() {
 
 // Immediate tasks
 void worker_addImmediateTask( worker_task t ) {
+	vAssert( !scratch_contains( t.args ));
 	vmutex_lock( &worker_task_mutex );
 	{
 		vAssert( worker_immediate_task_count < kMaxWorkerTasks );
@@ -71,14 +76,59 @@ worker_task worker_nextImmediateTask() {
 	return task;
 }
 
+// Background tasks
+bool worker_addBackgroundTask( worker_task t ) {
+	vAssert( !scratch_contains( t.args ));
+	bool added = false;
+	vmutex_lock( &worker_task_mutex );
+	{
+		if ( worker_background_task_count < kMaxWorkerTasks ) {
+			worker_background_tasks[worker_background_task_count++] = t;
+			vthread_broadcastCondition( work_exists );
+			added = true;
+		}
+	}
+	vmutex_unlock( &worker_task_mutex );
+	return added;
+}
+worker_task worker_nextBackgroundTask() {
+	worker_task task = { NULL, NULL, NULL };
+	vmutex_lock( &worker_task_mutex );
+	{
+		if ( worker_background_task_count > 0 ) {
+			task = worker_background_tasks[0];
+			memmove( &worker_background_tasks[0], &worker_background_tasks[1], sizeof( worker_task ) * ( worker_background_task_count - 1 ));
+			--worker_background_task_count;
+		}
+	}
+	vmutex_unlock( &worker_task_mutex );
+	return task;
+}
+
+int worker_runBackgroundTasks( int max ) {
+	int ran = 0;
+	for ( ; ran < max; ++ran ) {
+		worker_task task = worker_nextBackgroundTask();
+		if ( !task.func )
+			break;
+		task.func( task.args );
+		scratch_reset();
+		if ( task.onComplete )
+			worker_addBackgroundTask( *task.onComplete );
+	}
+	return ran;
+}
+
 void* worker_threadFunc( void* args ) {
 	(void)args;
+	scratch_threadInit( kScratchArenaSize );
 	while ( true ) {
 		if ( worker_immediate_task_count > 0 ) {
 			// Grab the first task
 			worker_task task = worker_nextImmediateTask();
 			if ( task.func )
 				task.func( task.args );
+			scratch_reset();
 			if ( task.onComplete )
 				worker_addImmediateTask( *task.onComplete );
 		}
@@ -87,14 +137,17 @@ void* worker_threadFunc( void* args ) {
 			worker_task task = worker_nextTask();
 			if ( task.func )
 				task.func( task.args );
+			scratch_reset();
 			if ( task.onComplete )
 				worker_addTask( *task.onComplete );
 		}
+		else
+			worker_runBackgroundTasks( 1 ); // Takes the lock to find out whether there's any
 
 		bool workWaiting = false;
 		vmutex_lock( &worker_task_mutex );
 		{
-			workWaiting = (worker_immediate_task_count == 0 && worker_task_count == 0 );
+			workWaiting = (worker_immediate_task_count == 0 && worker_task_count == 0 && worker_background_task_count == 0 );
 		}
 		vmutex_unlock( &worker_task_mutex );
 		if ( workWaiting ) {
@@ -14,6 +14,11 @@ void* worker_threadFunc( void* args );
 void worker_addTask( worker_task t );
 void worker_addImmediateTask( worker_task t );
 
+// Low priority work, only run when no other task is waiting; returns false (dropping T) if the queue is full
+bool worker_addBackgroundTask( worker_task t );
+// Run up to MAX waiting background tasks on this thread, returning how many ran; for running headless
+int worker_runBackgroundTasks( int max );
+
 worker_task onComplete( worker_task first, worker_task andThen );
 
 // Create an actor task message